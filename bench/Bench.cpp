@@ -0,0 +1,199 @@
+#include "Bench.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+
+#include <boost/program_options.hpp>
+
+using namespace std::chrono;
+
+//////////////////////////////
+// Allocation counting
+//////////////////////////////
+
+static std::atomic<uint64_t> g_allocations(0);
+
+void* operator new(size_t size)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	void* p = malloc(size ? size : 1);
+	if( !p ) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	free(p);
+}
+
+namespace bench {
+
+uint64_t allocationCount()
+{
+	return g_allocations.load(std::memory_order_relaxed);
+}
+
+//////////////////////////////
+// Timer
+//////////////////////////////
+
+Timer::Timer() :
+m_running(false),
+m_startAllocations(0),
+m_elapsedNs(0),
+m_allocations(0),
+m_ops(0)
+{
+	resume();
+}
+
+void Timer::pause()
+{
+	if( m_running ) {
+		m_elapsedNs += duration<double, std::nano>(steady_clock::now() - m_start).count();
+		m_allocations += allocationCount() - m_startAllocations;
+		m_running = false;
+	}
+}
+
+void Timer::resume()
+{
+	if( !m_running ) {
+		m_running = true;
+		m_startAllocations = allocationCount();
+		m_start = steady_clock::now();
+	}
+}
+
+//////////////////////////////
+// Suite
+//////////////////////////////
+
+void Suite::add(const std::string& name, const Params& params, Body body)
+{
+	Benchmark benchmark = {name, params, body};
+	m_benchmarks.push_back(benchmark);
+}
+
+static std::string paramString(const Params& params)
+{
+	std::stringstream output;
+	for( size_t i = 0; i < params.size(); ++i ) {
+		output << (i ? ";" : "") << params[i].first << "=" << params[i].second;
+	}
+	return output.str();
+}
+
+int Suite::run(int argc, char** argv)
+{
+	namespace po = boost::program_options;
+	po::options_description desc("REACH microbenchmarks");
+	desc.add_options()
+		("help", "Print help messages")
+		("list", "List benchmarks without running them")
+		("filter", po::value<std::string>()->default_value(""), "Run benchmarks whose name contains this string")
+		("format", po::value<std::string>()->default_value("json"), "Output format: json or csv")
+		("min-time", po::value<double>()->default_value(0.2), "Minimum measured seconds per benchmark");
+
+	po::variables_map vm;
+	try
+	{
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		po::notify(vm);
+	}
+	catch(po::error& e)
+	{
+		std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
+		std::cerr << desc << std::endl;
+		return 1;
+	}
+
+	if( vm.count("help") ) {
+		std::cout << desc << std::endl;
+		return 0;
+	}
+
+	const std::string filter = vm["filter"].as<std::string>();
+	const bool csv = vm["format"].as<std::string>() == "csv";
+	const double minTimeNs = vm["min-time"].as<double>() * 1e9;
+
+	if( csv && !vm.count("list") ) {
+		std::cout << "benchmark,params,ns_per_op,min_ns_per_op,allocs_per_op,ops,calls" << std::endl;
+	}
+
+	for( Benchmark& benchmark : m_benchmarks ) {
+		if( benchmark.name.find(filter) == std::string::npos ) {
+			continue;
+		}
+
+		if( vm.count("list") ) {
+			std::cout << benchmark.name << " " << paramString(benchmark.params) << std::endl;
+			continue;
+		}
+
+		// Warm up caches and lazily allocated state
+		{
+			Timer warmup;
+			benchmark.body(warmup);
+		}
+
+		std::vector<double> nsPerOp;
+		double totalNs = 0;
+		uint64_t totalOps = 0;
+		uint64_t totalAllocations = 0;
+
+		while( totalNs < minTimeNs || nsPerOp.size() < 3 ) {
+			Timer timer;
+			benchmark.body(timer);
+			timer.pause();
+
+			uint64_t ops = std::max<uint64_t>(timer.ops(), 1);
+			nsPerOp.push_back(timer.elapsedNs() / ops);
+			totalNs += timer.elapsedNs();
+			totalOps += ops;
+			totalAllocations += timer.allocations();
+		}
+
+		std::sort(nsPerOp.begin(), nsPerOp.end());
+		double median = nsPerOp[nsPerOp.size() / 2];
+		double allocsPerOp = static_cast<double>(totalAllocations) / totalOps;
+
+		std::cout << std::fixed << std::setprecision(2);
+		if( csv ) {
+			std::cout << benchmark.name << "," << paramString(benchmark.params) << ","
+				<< median << "," << nsPerOp.front() << "," << allocsPerOp << ","
+				<< totalOps << "," << nsPerOp.size() << std::endl;
+		} else {
+			std::cout << "{\"benchmark\":\"" << benchmark.name << "\"";
+			for( auto& param : benchmark.params ) {
+				std::cout << ",\"" << param.first << "\":\"" << param.second << "\"";
+			}
+			std::cout << ",\"ns_per_op\":" << median
+				<< ",\"min_ns_per_op\":" << nsPerOp.front()
+				<< ",\"allocs_per_op\":" << allocsPerOp
+				<< ",\"ops\":" << totalOps
+				<< ",\"calls\":" << nsPerOp.size() << "}" << std::endl;
+		}
+	}
+
+	return 0;
+}
+
+}
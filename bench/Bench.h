@@ -0,0 +1,87 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+//////////////////////////////
+// Minimal microbenchmark harness for reach_bench. A benchmark body is
+// called repeatedly until the minimum time is reached, the Timer excludes
+// setup work from the measurement. Every run reports ns/op and heap
+// allocations/op (counted via the global operator new) as JSON lines or
+// CSV so results of two branches can be diffed.
+//////////////////////////////
+
+namespace bench {
+
+typedef std::vector< std::pair<std::string, std::string> > Params;
+
+// Heap allocations since program start
+uint64_t allocationCount();
+
+// Keeps the compiler from dropping the computation of value
+template<typename T>
+inline void doNotOptimize(const T& value)
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+class Timer {
+public:
+	Timer();
+
+	// Exclude setup from the measurement
+	void pause();
+	void resume();
+
+	// Operations performed by this call of the body
+	void addOps(uint64_t ops) { m_ops += ops; }
+
+	double elapsedNs() const { return m_elapsedNs; }
+	uint64_t allocations() const { return m_allocations; }
+	uint64_t ops() const { return m_ops; }
+
+private:
+	bool m_running;
+	std::chrono::steady_clock::time_point m_start;
+	uint64_t m_startAllocations;
+	double m_elapsedNs;
+	uint64_t m_allocations;
+	uint64_t m_ops;
+};
+
+class Suite {
+public:
+	typedef std::function<void(Timer&)> Body;
+
+	void add(const std::string& name, const Params& params, Body body);
+
+	// Parses the command line, runs the selected benchmarks and prints the results
+	int run(int argc, char** argv);
+
+private:
+	struct Benchmark {
+		std::string name;
+		Params params;
+		Body body;
+	};
+
+	std::vector<Benchmark> m_benchmarks;
+};
+
+// Packet ids lost in one pass over packetCount packets. The pattern is
+// "random" (uniform), "burst" (Gilbert-Elliott) or "tail" (tail drop).
+std::vector<uint64_t> lostPackets(const std::string& pattern, uint64_t packetCount, double rate, uint64_t seed);
+
+// Benchmark registration, one function per bench_*.cpp
+void registerRangeBenchmarks(Suite& suite);
+void registerMessageBenchmarks(Suite& suite);
+void registerTraceBenchmarks(Suite& suite);
+void registerClientEngineBenchmarks(Suite& suite);
+void registerZeroCopyBenchmarks(Suite& suite);
+void registerCoroutineBenchmarks(Suite& suite);
+void registerTimingWheelBenchmarks(Suite& suite);
+
+}
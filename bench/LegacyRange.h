@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <cstdint>
+
+//////////////////////////////
+// The deque-of-intervals Range as it was before the chunked bitmap
+// implementation. Kept for benchmarking only.
+//////////////////////////////
+
+class LegacyRange
+{
+public:
+	typedef std::pair<uint64_t, uint64_t> Interval;
+
+public:
+	LegacyRange() {};
+	LegacyRange(int64_t start, int64_t end) { add(start, end); }
+
+	void add(int64_t start, int64_t end)
+	{
+		if( end > start ) {
+			Interval addition(start, end);
+			m_intervals.insert( std::upper_bound( m_intervals.begin(), m_intervals.end(), addition), addition );
+			mergeIntervals();
+		}
+	}
+
+	void add(const LegacyRange &other)
+	{
+		for( Interval addition : other.m_intervals ) {
+			m_intervals.insert( std::upper_bound( m_intervals.begin(), m_intervals.end(), addition), addition );
+		}
+
+		mergeIntervals();
+	}
+
+	void subtract(int64_t start, int64_t end)
+	{
+		if( end <= start ) return;
+
+		for( auto it = m_intervals.begin(); it < m_intervals.end(); ) {
+			if( it->first <= end && start < it->second ) {
+				if( start <= it->first && it->second <= end ) {
+					it = m_intervals.erase(it);
+				} else if (  start <= it->first && end < it->second) {
+					it->first = end;
+					it++;
+				} else if ( start > it->first && it->second < end ) {
+					it->second = start;
+					it++;
+				} else {
+					Interval split(it->first, start);
+					it->first = end;
+					it = m_intervals.insert(it, split);
+					it += 2;
+				}
+			} else {
+				it++;
+			}
+		}
+	}
+
+	void subtract(const LegacyRange &other)
+	{
+		for( Interval sub: other.m_intervals) {
+			subtract(sub.first, sub.second);
+		}
+	}
+
+	size_t intervalCount() const { return m_intervals.size(); }
+
+	size_t elementCount() const
+	{
+		size_t elements = 0;
+		for( const Interval& v : m_intervals) {
+			elements += v.second - v.first;
+		}
+
+		return elements;
+	}
+
+	LegacyRange firstN(int64_t elements) const
+	{
+		LegacyRange result;
+
+		for( const Interval& v : m_intervals) {
+			int64_t deltaElements = v.second - v.first;
+			result.add(v.first, v.first + std::min<int64_t>(elements - result.elementCount(), deltaElements));
+		}
+
+		return result;
+	}
+
+	LegacyRange removeFirstN(int64_t elements)
+	{
+		LegacyRange r = firstN(elements);
+		subtract(r);
+		return r;
+	}
+
+	bool contains(uint64_t x) const
+	{
+		for( Interval i : m_intervals ) {
+			if( i.first <= x && x < i.second )
+				return true;
+		}
+
+		return false;
+	}
+
+private:
+	void mergeIntervals()
+	{
+		if( m_intervals.size() > 1 ) {
+			auto it = m_intervals.begin() + 1;
+			while( it != m_intervals.end() )
+			{
+				if( (it-1)->first <= it->second && (it-1)->second >= it->first ) {
+					(it-1)->second = std::max((it-1)->second, it->second);
+					it = m_intervals.erase(it);
+				} else {
+					it++;
+				}
+			}
+		}
+	}
+
+	std::deque< Interval > m_intervals;
+};
@@ -0,0 +1,148 @@
+#include "Bench.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+
+#include <ClientEngine.h>
+
+//////////////////////////////
+// Concurrent transfers of one ClientEngine against an in-process server on
+// the loopback interface. Client and server share one io_service and thus
+// one core, ns/op is the cost of a complete small transfer while the given
+// number of transfers run at the same time.
+//
+// A single large transfer compares receiving from the socket with the
+// PacketRing, ns/op is per packet. The ring needs CAP_NET_RAW and is left
+// out without it.
+//////////////////////////////
+
+namespace bench {
+
+using boost::asio::ip::udp;
+
+class LoopbackServer {
+public:
+	LoopbackServer(boost::asio::io_service& io_service, uint64_t packetSize)
+	: m_socket(io_service, udp::endpoint(boost::asio::ip::address_v4::loopback(), 0)),
+	  m_payload(packetSize, 0x5a)
+	{
+		m_socket.set_option(boost::asio::socket_base::receive_buffer_size(4 * 1024 * 1024));
+		receive();
+	}
+
+	udp::endpoint endpoint() const { return m_socket.local_endpoint(); }
+
+private:
+	void receive()
+	{
+		m_socket.async_receive_from(boost::asio::buffer(m_buffer), m_client,
+			[this](const boost::system::error_code& error, std::size_t size) {
+				if( !error ) {
+					handle(*Message::fromBuffer(m_buffer.data(), size));
+					receive();
+				}
+			});
+	}
+
+	void handle(const Message& message)
+	{
+		// The path is the decimal file size
+		if( message.type() == Message::REQ_FILE ) {
+			m_fileSize[message.ufid()] = std::stoull(message.path());
+			m_socket.send_to(Message::createFileInfo(message.ufid(), m_fileSize[message.ufid()], m_payload.size())->asBuffer(), m_client);
+		} else if( message.type() == Message::REQ_FILE_PACKETS ) {
+			uint64_t fileSize = m_fileSize[message.ufid()];
+			for( uint64_t packetId : message.packets() ) {
+				uint64_t offset = packetId * m_payload.size();
+				size_t size = std::min<uint64_t>(m_payload.size(), fileSize - offset);
+				m_socket.send_to(Message::createFilePacket(message.ufid(), packetId, m_payload.data(), size)->asBuffer(), m_client);
+			}
+		}
+	}
+
+	udp::socket m_socket;
+	udp::endpoint m_client;
+	boost::array<uint8_t, MAX_MESSAGE_SIZE> m_buffer;
+	std::vector<uint8_t> m_payload;
+	std::map<uint64_t, uint64_t> m_fileSize;
+};
+
+static void addConcurrentTransfers(Suite& suite, int transfers)
+{
+	const uint64_t packetSize = 1024;
+	const uint64_t fileSize = 16 * packetSize;
+	Params params = {{"transfers", std::to_string(transfers)}, {"fileSize", std::to_string(fileSize)}};
+
+	suite.add("clientEngine.concurrentTransfers", params, [=](Timer& timer) {
+		timer.pause();
+		boost::asio::io_service io_service;
+		LoopbackServer server(io_service, packetSize);
+		ClientEngine engine(io_service, server.endpoint());
+		std::shared_ptr<Sink> sink(new NullSink());
+		timer.resume();
+
+		int completed = 0;
+		for( int i = 0; i < transfers; ++i ) {
+			engine.copy(std::to_string(fileSize), sink, [&](const boost::system::error_code&, const CopyFile::Result&) {
+				if( ++completed == transfers ) {
+					io_service.stop();
+				}
+			});
+		}
+		io_service.run();
+
+		doNotOptimize(completed);
+		timer.addOps(transfers);
+	});
+}
+
+static void addReceivePath(Suite& suite, bool packetRing)
+{
+	const uint64_t packetSize = 8192;
+	const uint64_t fileSize = 4096 * packetSize;
+	Params params = {{"receive", packetRing ? "ring" : "socket"}, {"fileSize", std::to_string(fileSize)}};
+
+	suite.add("clientEngine.receivePath", params, [=](Timer& timer) {
+		timer.pause();
+		boost::asio::io_service io_service;
+		LoopbackServer server(io_service, packetSize);
+		ClientEngine::Options options;
+		options.packetRing = packetRing;
+		ClientEngine engine(io_service, server.endpoint(), options);
+		std::shared_ptr<Sink> sink(new NullSink());
+		timer.resume();
+
+		engine.copy(std::to_string(fileSize), sink, [&](const boost::system::error_code&, const CopyFile::Result&) {
+			io_service.stop();
+		});
+		io_service.run();
+
+		timer.addOps(fileSize / packetSize);
+	});
+}
+
+static bool packetRingAvailable()
+{
+	boost::asio::io_service io_service;
+	udp::socket socket(io_service, udp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+	PacketRing ring(io_service);
+	return ring.open(socket, [](const uint8_t*, size_t, const udp::endpoint&) {});
+}
+
+void registerClientEngineBenchmarks(Suite& suite)
+{
+	for( int transfers : {1, 64, 1024, 4096} ) {
+		addConcurrentTransfers(suite, transfers);
+	}
+
+	addReceivePath(suite, false);
+	if( packetRingAvailable() ) {
+		addReceivePath(suite, true);
+	}
+}
+
+}
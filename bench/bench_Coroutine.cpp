@@ -0,0 +1,102 @@
+#include "Bench.h"
+
+#include <chrono>
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <FramePool.h>
+
+//////////////////////////////
+// Outstanding operations as boost::asio::spawn coroutines against explicit
+// state machines with frames from a FramePool. Every operation waits on its
+// timer a number of times, ns/op is the cost of one resume with the given
+// number of operations outstanding. The timers are expired, so the waits
+// complete on the next pass of the io_service.
+//
+// Coroutine stacks are not allocated with operator new and are missing
+// from allocs/op, every spawn maps its own stack.
+//////////////////////////////
+
+namespace bench {
+
+static const int RESUMES = 16;
+
+static void addSpawn(Suite& suite, int outstanding)
+{
+	Params params = {{"outstanding", std::to_string(outstanding)}, {"resumes", std::to_string(RESUMES)}};
+
+	suite.add("coroutine.spawn", params, [=](Timer& timer) {
+		timer.pause();
+		boost::asio::io_service io_service;
+		timer.resume();
+
+		int completed = 0;
+		for( int i = 0; i < outstanding; ++i ) {
+			boost::asio::spawn(io_service, [&](boost::asio::yield_context yield) {
+				boost::asio::steady_timer wait(io_service);
+				boost::system::error_code error;
+				for( int resume = 0; resume < RESUMES; ++resume ) {
+					wait.expires_at(std::chrono::steady_clock::time_point());
+					wait.async_wait(yield[error]);
+				}
+				completed++;
+			});
+		}
+		io_service.run();
+
+		doNotOptimize(completed);
+		timer.addOps(outstanding * RESUMES);
+	});
+}
+
+struct WaitFrame {
+	explicit WaitFrame(boost::asio::io_service& io_service) : timer(io_service), resumes(0) {}
+
+	boost::asio::steady_timer timer;
+	int resumes;
+};
+
+static void addFramePool(Suite& suite, int outstanding)
+{
+	Params params = {{"outstanding", std::to_string(outstanding)}, {"resumes", std::to_string(RESUMES)}};
+
+	suite.add("coroutine.framePool", params, [=](Timer& timer) {
+		timer.pause();
+		boost::asio::io_service io_service;
+		FramePool<WaitFrame> pool([&]() { return new WaitFrame(io_service); }, outstanding);
+		timer.resume();
+
+		int completed = 0;
+		std::function<void(WaitFrame*)> step = [&](WaitFrame* frame) {
+			if( frame->resumes++ == RESUMES ) {
+				completed++;
+				pool.release(frame);
+				return;
+			}
+			frame->timer.expires_at(std::chrono::steady_clock::time_point());
+			frame->timer.async_wait([&step, frame](const boost::system::error_code&) { step(frame); });
+		};
+		for( int i = 0; i < outstanding; ++i ) {
+			WaitFrame* frame = pool.acquire();
+			frame->resumes = 0;
+			step(frame);
+		}
+		io_service.run();
+
+		doNotOptimize(completed);
+		timer.addOps(outstanding * RESUMES);
+	});
+}
+
+void registerCoroutineBenchmarks(Suite& suite)
+{
+	for( int outstanding : {1000, 10000} ) {
+		addSpawn(suite, outstanding);
+		addFramePool(suite, outstanding);
+	}
+}
+
+}
@@ -0,0 +1,113 @@
+#include "Bench.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include <Message.h>
+#include <SendRing.h>
+
+//////////////////////////////
+// Encoding and parsing of the messages on the data path: FILE_PACKET for
+// every payload and REQ_FILE_PACKETS for every (re)request.
+//////////////////////////////
+
+namespace bench {
+
+static void addFilePacketBenchmarks(Suite& suite, size_t payloadSize)
+{
+	Params params = {{"payload", std::to_string(payloadSize)}};
+	std::shared_ptr<std::vector<uint8_t> > payload(new std::vector<uint8_t>(payloadSize, 0x5a));
+
+	suite.add("message.filePacket.asBuffer", params, [=](Timer& timer) {
+		size_t bytes = 0;
+		for( uint64_t packetId = 0; packetId < 1000; ++packetId ) {
+			auto message = Message::createFilePacket(1, packetId, payload->data(), payload->size());
+			bytes += boost::asio::buffer_size(message->asBuffer());
+		}
+		doNotOptimize(bytes);
+		timer.addOps(1000);
+	});
+
+	suite.add("message.filePacket.sendRing", params, [=](Timer& timer) {
+		timer.pause();
+		SendRing ring(SEND_RING_SIZE);
+		timer.resume();
+
+		size_t bytes = 0;
+		for( uint64_t packetId = 0; packetId < 1000; ++packetId ) {
+			SendRing::Slot* slot = ring.acquire(1, packetId, payload->data(), payload->size());
+			bytes += boost::asio::buffer_size(slot->buffers());
+			ring.release(slot);
+		}
+		doNotOptimize(bytes);
+		timer.addOps(1000);
+	});
+
+	std::shared_ptr<std::vector<uint8_t> > datagram(new std::vector<uint8_t>());
+	{
+		auto message = Message::createFilePacket(1, 42, payload->data(), payload->size());
+		auto buffer = message->asBuffer();
+		datagram->resize(boost::asio::buffer_size(buffer));
+		boost::asio::buffer_copy(boost::asio::buffer(*datagram), buffer);
+	}
+
+	suite.add("message.filePacket.fromBuffer", params, [=](Timer& timer) {
+		uint64_t sum = 0;
+		for( int i = 0; i < 1000; ++i ) {
+			auto message = Message::fromBuffer(datagram->data(), datagram->size());
+			sum += message->packetId() + message->payloadSize();
+		}
+		doNotOptimize(sum);
+		timer.addOps(1000);
+	});
+}
+
+static void addRequestBenchmarks(Suite& suite, const std::string& pattern, double rate)
+{
+	const uint64_t packetCount = 256 * 1024;
+	Params params = {{"loss", pattern}, {"rate", std::to_string(rate)}};
+
+	std::shared_ptr<Range> missing(new Range());
+	for( uint64_t packetId : lostPackets(pattern, packetCount, rate, 1) ) {
+		missing->add(packetId);
+	}
+	params.push_back(std::make_pair("intervals", std::to_string(missing->intervalCount())));
+
+	suite.add("message.reqFilePackets.asBuffer", params, [=](Timer& timer) {
+		auto message = Message::createRequestFilePackets(1, *missing);
+		doNotOptimize(boost::asio::buffer_size(message->asBuffer()));
+		timer.addOps(1);
+	});
+
+	std::shared_ptr<std::vector<uint8_t> > datagram(new std::vector<uint8_t>());
+	{
+		auto message = Message::createRequestFilePackets(1, *missing);
+		auto buffer = message->asBuffer();
+		datagram->resize(boost::asio::buffer_size(buffer));
+		boost::asio::buffer_copy(boost::asio::buffer(*datagram), buffer);
+	}
+	params.push_back(std::make_pair("bytes", std::to_string(datagram->size())));
+
+	suite.add("message.reqFilePackets.fromBuffer", params, [=](Timer& timer) {
+		auto message = Message::fromBuffer(datagram->data(), datagram->size());
+		doNotOptimize(message->packets().elementCount());
+		timer.addOps(1);
+	});
+}
+
+void registerMessageBenchmarks(Suite& suite)
+{
+	for( size_t payloadSize : {512, 1400, 8192, 32768} ) {
+		addFilePacketBenchmarks(suite, payloadSize);
+	}
+
+	for( const char* pattern : {"random", "burst"} ) {
+		for( double rate : {0.001, 0.01, 0.1} ) {
+			addRequestBenchmarks(suite, pattern, rate);
+		}
+	}
+}
+
+}
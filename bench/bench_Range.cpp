@@ -0,0 +1,199 @@
+#include "Bench.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <Range.h>
+#include "LegacyRange.h"
+
+//////////////////////////////
+// Range operations as the client performs them while a transfer
+// fragments under different loss patterns. The deque based LegacyRange
+// runs on the smaller configurations for comparison.
+//////////////////////////////
+
+namespace bench {
+
+static const uint64_t PACKET_COUNT = 256 * 1024;
+static const uint64_t LEGACY_PACKET_COUNT = 64 * 1024;
+
+std::vector<uint64_t> lostPackets(const std::string& pattern, uint64_t packetCount, double rate, uint64_t seed)
+{
+	std::mt19937_64 random(seed);
+	std::uniform_real_distribution<double> uniform;
+	std::vector<uint64_t> lost;
+
+	if( pattern == "random" ) {
+		for( uint64_t i = 0; i < packetCount; ++i ) {
+			if( uniform(random) < rate ) {
+				lost.push_back(i);
+			}
+		}
+	} else if( pattern == "burst" ) {
+		// Gilbert-Elliott with a mean burst length of 16 packets
+		const double meanBurst = 16;
+		const double enterBad = rate / (meanBurst * (1 - rate));
+		bool bad = false;
+		for( uint64_t i = 0; i < packetCount; ++i ) {
+			bad = bad ? uniform(random) >= 1 / meanBurst : uniform(random) < enterBad;
+			if( bad ) {
+				lost.push_back(i);
+			}
+		}
+	} else {
+		// Tail drop: the connection stalls towards the end of the transfer
+		for( uint64_t i = packetCount - static_cast<uint64_t>(packetCount * rate); i < packetCount; ++i ) {
+			lost.push_back(i);
+		}
+	}
+
+	return lost;
+}
+
+template<typename RangeT>
+static RangeT rangeOf(const std::vector<uint64_t>& packets)
+{
+	RangeT range;
+	for( uint64_t packetId : packets ) {
+		range.add(static_cast<int64_t>(packetId), static_cast<int64_t>(packetId + 1));
+	}
+	return range;
+}
+
+template<typename RangeT>
+static void addRangeBenchmarks(Suite& suite, const std::string& impl, const std::string& pattern, double rate, uint64_t packetCount)
+{
+	Params params = {
+		{"impl", impl},
+		{"loss", pattern},
+		{"rate", std::to_string(rate)},
+		{"packets", std::to_string(packetCount)}};
+
+	std::shared_ptr<std::vector<uint64_t> > lost(new std::vector<uint64_t>(lostPackets(pattern, packetCount, rate, 1)));
+	std::shared_ptr<std::vector<uint64_t> > received(new std::vector<uint64_t>());
+	for( uint64_t i = 0, j = 0; i < packetCount; ++i ) {
+		if( j < lost->size() && (*lost)[j] == i ) {
+			j++;
+		} else {
+			received->push_back(i);
+		}
+	}
+
+	std::shared_ptr<RangeT> outstanding(new RangeT(rangeOf<RangeT>(*lost)));
+	std::shared_ptr<RangeT> other(new RangeT(rangeOf<RangeT>(lostPackets(pattern, packetCount, rate, 2))));
+
+	// Every received packet is removed from the outstanding set
+	suite.add("range.markReceived", params, [=](Timer& timer) {
+		timer.pause();
+		RangeT range(0, packetCount);
+		timer.resume();
+
+		for( uint64_t packetId : *received ) {
+			range.subtract(static_cast<int64_t>(packetId), static_cast<int64_t>(packetId + 1));
+		}
+		doNotOptimize(range.elementCount());
+		timer.addOps(received->size());
+	});
+
+	// Timed out packets are added back to the outstanding set
+	suite.add("range.markLost", params, [=](Timer& timer) {
+		RangeT range;
+		for( uint64_t packetId : *lost ) {
+			range.add(static_cast<int64_t>(packetId), static_cast<int64_t>(packetId + 1));
+		}
+		doNotOptimize(range.elementCount());
+		timer.addOps(lost->size());
+	});
+
+	suite.add("range.contains", params, [=](Timer& timer) {
+		std::mt19937_64 random(3);
+		uint64_t found = 0;
+		for( int i = 0; i < 10000; ++i ) {
+			found += outstanding->contains(random() % packetCount);
+		}
+		doNotOptimize(found);
+		timer.addOps(10000);
+	});
+
+	suite.add("range.firstN", params, [=](Timer& timer) {
+		for( int i = 0; i < 100; ++i ) {
+			doNotOptimize(outstanding->firstN(256).elementCount());
+		}
+		timer.addOps(100);
+	});
+
+	// Draining the outstanding set in request sized pieces
+	suite.add("range.removeFirstN", params, [=](Timer& timer) {
+		timer.pause();
+		RangeT range = *outstanding;
+		timer.resume();
+
+		uint64_t ops = 0;
+		while( range.elementCount() > 0 ) {
+			doNotOptimize(range.removeFirstN(32).elementCount());
+			ops++;
+		}
+		timer.addOps(ops);
+	});
+
+	suite.add("range.union", params, [=](Timer& timer) {
+		timer.pause();
+		RangeT range = *outstanding;
+		timer.resume();
+
+		range.add(*other);
+		doNotOptimize(range.elementCount());
+		timer.addOps(1);
+	});
+
+	suite.add("range.difference", params, [=](Timer& timer) {
+		timer.pause();
+		RangeT range = *outstanding;
+		timer.resume();
+
+		range.subtract(*other);
+		doNotOptimize(range.elementCount());
+		timer.addOps(1);
+	});
+}
+
+static void addIterateBenchmark(Suite& suite, const std::string& pattern, double rate)
+{
+	Params params = {
+		{"impl", "range"},
+		{"loss", pattern},
+		{"rate", std::to_string(rate)},
+		{"packets", std::to_string(PACKET_COUNT)}};
+
+	std::shared_ptr<Range> outstanding(new Range(rangeOf<Range>(lostPackets(pattern, PACKET_COUNT, rate, 1))));
+
+	suite.add("range.iterate", params, [=](Timer& timer) {
+		uint64_t sum = 0;
+		for( uint64_t packetId : *outstanding ) {
+			sum += packetId;
+		}
+		doNotOptimize(sum);
+		timer.addOps(std::max<size_t>(outstanding->elementCount(), 1));
+	});
+}
+
+void registerRangeBenchmarks(Suite& suite)
+{
+	for( const char* pattern : {"random", "burst"} ) {
+		for( double rate : {0.001, 0.01, 0.1, 0.5} ) {
+			addRangeBenchmarks<Range>(suite, "range", pattern, rate, PACKET_COUNT);
+			addIterateBenchmark(suite, pattern, rate);
+		}
+	}
+	addRangeBenchmarks<Range>(suite, "range", "tail", 0.1, PACKET_COUNT);
+	addIterateBenchmark(suite, "tail", 0.1);
+
+	// The legacy class is quadratic in the fragmentation, keep it small
+	for( const char* pattern : {"random", "burst"} ) {
+		addRangeBenchmarks<Range>(suite, "range", pattern, 0.01, LEGACY_PACKET_COUNT);
+		addRangeBenchmarks<LegacyRange>(suite, "legacy", pattern, 0.01, LEGACY_PACKET_COUNT);
+	}
+}
+
+}
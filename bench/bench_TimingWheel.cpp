@@ -0,0 +1,88 @@
+#include "Bench.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <TimingWheel.h>
+
+//////////////////////////////
+// Re-arming request deadlines with a given number of them armed, as a
+// transfer does on every request. ns/op is one re-arm of a steady_timer,
+// which cancels its wait in Asio's timer heap and queues a new one, or of
+// a TimingWheel::Timer. The deadlines lie in the future and never fire.
+//////////////////////////////
+
+namespace bench {
+
+static const int REARMS = 16;
+
+static void addSteadyTimer(Suite& suite, int armed)
+{
+	Params params = {{"timer", "steady_timer"}, {"armed", std::to_string(armed)}};
+
+	suite.add("timers.rearm", params, [=](Timer& timer) {
+		timer.pause();
+		boost::asio::io_service io_service;
+		std::vector<std::unique_ptr<boost::asio::steady_timer> > timers;
+		for( int i = 0; i < armed; ++i ) {
+			timers.emplace_back(new boost::asio::steady_timer(io_service));
+		}
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		timer.resume();
+
+		for( int rearm = 0; rearm < REARMS; ++rearm ) {
+			for( int i = 0; i < armed; ++i ) {
+				timers[i]->expires_at(now + std::chrono::milliseconds(200 + (i + rearm) % 100));
+				timers[i]->async_wait([](const boost::system::error_code&) {});
+			}
+		}
+
+		timer.pause();
+		timers.clear();
+		timer.resume();
+		timer.addOps(armed * REARMS);
+	});
+}
+
+static void addTimingWheel(Suite& suite, int armed)
+{
+	Params params = {{"timer", "wheel"}, {"armed", std::to_string(armed)}};
+
+	suite.add("timers.rearm", params, [=](Timer& timer) {
+		timer.pause();
+		boost::asio::io_service io_service;
+		TimingWheel wheel(io_service);
+		std::vector<std::unique_ptr<TimingWheel::Timer> > timers;
+		for( int i = 0; i < armed; ++i ) {
+			timers.emplace_back(new TimingWheel::Timer(wheel));
+		}
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		timer.resume();
+
+		for( int rearm = 0; rearm < REARMS; ++rearm ) {
+			for( int i = 0; i < armed; ++i ) {
+				timers[i]->expiresAt(now + std::chrono::milliseconds(200 + (i + rearm) % 100), []() {});
+			}
+		}
+
+		timer.pause();
+		timers.clear();
+		timer.resume();
+		timer.addOps(armed * REARMS);
+	});
+}
+
+void registerTimingWheelBenchmarks(Suite& suite)
+{
+	for( int armed : {1000, 10000, 100000} ) {
+		addSteadyTimer(suite, armed);
+		addTimingWheel(suite, armed);
+	}
+}
+
+}
@@ -0,0 +1,31 @@
+#include "Bench.h"
+
+#include <Trace.h>
+
+//////////////////////////////
+// Cost of one recorded trace event. Trace::record is called directly, so
+// the numbers are independent of REACH_ENABLE_TRACE.
+//////////////////////////////
+
+namespace bench {
+
+void registerTraceBenchmarks(Suite& suite)
+{
+	suite.add("trace.record", Params(), [](Timer& timer) {
+		for( uint64_t packetId = 0; packetId < 1000; ++packetId ) {
+			Trace::record(Trace::PACKET_SENT, 1, packetId);
+		}
+		timer.addOps(1000);
+	});
+
+	suite.add("trace.timestamp", Params(), [](Timer& timer) {
+		uint64_t sum = 0;
+		for( int i = 0; i < 1000; ++i ) {
+			sum += Trace::timestamp();
+		}
+		doNotOptimize(sum);
+		timer.addOps(1000);
+	});
+}
+
+}
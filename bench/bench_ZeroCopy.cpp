@@ -0,0 +1,70 @@
+#include "Bench.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include <SendRing.h>
+#include <ZeroCopy.h>
+
+//////////////////////////////
+// Cost of sending FILE_PACKETs from a SendRing, with the copying
+// async_send_to and with MSG_ZEROCOPY. The receiver never reads, so the
+// numbers are the sender side only. On loopback the kernel copies the
+// zerocopy sends after all; only a real NIC shows the saved copy.
+//////////////////////////////
+
+namespace bench {
+
+using boost::asio::ip::udp;
+
+static void addSendBenchmarks(Suite& suite, bool zeroCopy)
+{
+	const size_t packets = 1000;
+	Params params = {{"payload", "8192"}, {"zerocopy", zeroCopy ? "1" : "0"}};
+	std::shared_ptr<std::vector<uint8_t> > payload(new std::vector<uint8_t>(8192, 0x5a));
+
+	suite.add("sendRing.send", params, [=](Timer& timer) {
+		timer.pause();
+		boost::asio::io_service io_service;
+		udp::socket receiver(io_service, udp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+		udp::socket sender(io_service, udp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+		SendRing ring(SEND_RING_SIZE);
+		std::unique_ptr<ZeroCopySender> zeroCopySender;
+		if( zeroCopy && ZeroCopySender::enable(sender) ) {
+			zeroCopySender.reset(new ZeroCopySender(sender, ring));
+		}
+		timer.resume();
+
+		for( uint64_t packetId = 0; packetId < packets; ++packetId ) {
+			SendRing::Slot* slot;
+			while( !(slot = ring.acquire(1, packetId, payload->data(), payload->size(), payload)) ) {
+				io_service.run_one();
+			}
+			if( zeroCopySender ) {
+				zeroCopySender->send(slot, receiver.local_endpoint());
+			} else {
+				sender.async_send_to(slot->buffers(), receiver.local_endpoint(), [&ring, slot](const boost::system::error_code&, std::size_t) {
+					ring.release(slot);
+				});
+			}
+			io_service.poll();
+			io_service.reset();
+		}
+		while( ring.inFlight() > 0 ) {
+			io_service.run_one();
+		}
+
+		timer.addOps(packets);
+	});
+}
+
+void registerZeroCopyBenchmarks(Suite& suite)
+{
+	addSendBenchmarks(suite, false);
+	addSendBenchmarks(suite, true);
+}
+
+}
@@ -0,0 +1,14 @@
+#include "Bench.h"
+
+int main(int argc, char** argv)
+{
+	bench::Suite suite;
+	bench::registerRangeBenchmarks(suite);
+	bench::registerMessageBenchmarks(suite);
+	bench::registerTraceBenchmarks(suite);
+	bench::registerClientEngineBenchmarks(suite);
+	bench::registerZeroCopyBenchmarks(suite);
+	bench::registerCoroutineBenchmarks(suite);
+	bench::registerTimingWheelBenchmarks(suite);
+	return suite.run(argc, argv);
+}
@@ -1,241 +1,28 @@
+#include <algorithm>
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <string>
-#include <deque>
-#include <chrono>
+#include <vector>
+#include <unistd.h>
 
-#include <boost/date_time/posix_time/posix_time.hpp>
-#include <boost/array.hpp>
 #include <boost/asio.hpp>
-#include <boost/asio/spawn.hpp>
-#include <boost/asio/async_result.hpp>
-#include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/program_options.hpp>
 
 #include <Config.h>
-#include <Message.h>
+#include <ClientEngine.h>
+#include <BusyPoll.h>
+#include <Trace.h>
 
 #define BOOST_LOG_DYN_LINK 1
 #include <boost/log/trivial.hpp>
-#include <map>
+#include <boost/log/core.hpp>
+#include <boost/log/sinks/sync_frontend.hpp>
+#include <boost/log/sinks/text_ostream_backend.hpp>
+#include <boost/core/null_deleter.hpp>
+#include <boost/make_shared.hpp>
 
 using boost::asio::ip::udp;
-using namespace boost::asio;
-using namespace std::chrono;
-
-class ReachClient
-{
-public:
-  ReachClient(boost::asio::io_service& io_service, boost::asio::ip::address_v4 address)
-    : m_socket(new udp::socket(io_service)),
-      m_receiverEndpoint(address, REACH_PORT),
-      m_nextUfid(1),
-      m_shutdown(false)
-  {
-    m_socket->open(udp::v4());
-  }
-
-  void receiveMessage(boost::asio::yield_context yield) {
-    boost::array<uint8_t, MAX_MESSAGE_SIZE> buffer;
-
-    while(!m_shutdown) {
-      boost::system::error_code ec;
-
-      size_t messageSize = m_socket->async_receive_from(
-        boost::asio::buffer(buffer),
-        m_receiverEndpoint, yield[ec]);
-
-      if( ec == boost::system::errc::success ) {
-        std::shared_ptr<Message> receivedMessage = Message::Message::fromBuffer(
-          buffer.data(), messageSize);
-
-  //      BOOST_LOG_TRIVIAL(info) << "Received message for ID:" << receivedMessage->ufid();
-
-        auto callbackIt = m_receiveCallback.find(receivedMessage->ufid());
-        if( callbackIt != m_receiveCallback.end() ) {
-          (callbackIt->second)(receivedMessage);
-        }
-      }
-    }
-  }
-
-  void fetchFile(const char* path, boost::asio::yield_context yield) {
-
-    boost::system::error_code ec;
-    uint64_t ufid = m_nextUfid++;
-    auto fileRequestMessage = Message::createReqFile(ufid, path);
-
-    boost::asio::deadline_timer timer(m_socket->get_io_service());
-
-    std::shared_ptr<Message> fileInfoMessage;
-
-    m_receiveCallback[ufid] = [&](std::shared_ptr<Message> receivedMessage)
-    {
-      if( receivedMessage->type() == Message::FILE_INFO ) {
-        // Store the fileInfoMessage when it is received
-        fileInfoMessage = receivedMessage;
-
-        // Cancel timeout timer -> unblock async_wait
-        timer.cancel();
-      }
-    };
-
-    for( int i = 0; i < SEND_RETRY && !fileInfoMessage; ++i) {
-
-      BOOST_LOG_TRIVIAL(info) << "Sending fileRequest: " << path;
-      m_socket->async_send_to(fileRequestMessage->asBuffer(), m_receiverEndpoint, yield[ec]);
-
-      timer.expires_from_now(boost::posix_time::milliseconds(RECEIVE_TIMEOUT));
-
-      timer.async_wait(yield[ec]);
-    }
-
-    if( !fileInfoMessage ) {
-      BOOST_LOG_TRIVIAL(error) << "No response from server";
-      return;
-    }
-
-    BOOST_LOG_TRIVIAL(info) << "Received fileInfo: " << fileInfoMessage->fileSize();
-
-    boost::iostreams::mapped_file_params fileParams;
-    fileParams.path = std::string("client_received.bin");
-    fileParams.new_file_size = fileInfoMessage->fileSize();
-
-    boost::iostreams::mapped_file_sink fileSink(fileParams);
-
-    size_t packetSize = fileInfoMessage->packetSize();
-    size_t packetCount = (fileInfoMessage->fileSize() + packetSize - 1) / packetSize;
-    Range outstandingPackets = Range(0, packetCount);
-
-    typedef std::pair<uint32_t, Range> TimedRange;
-    std::deque<TimedRange> inflightPackets;
-
-    uint64_t requestSize = 10;
-    uint64_t timeoutCount = requestSize / 2;
-    uint64_t throttleCount = 32 * requestSize;
-    uint64_t totalUnexpectedPackages = 0;
-
-    std::vector<uint64_t> lostSize(requestSize+1, 0);
-
-    m_receiveCallback[ufid] = [&](std::shared_ptr<Message> receivedMessage)
-    {
-      if( receivedMessage->type() == Message::FILE_PACKET ) {
-        char* dest = fileSink.data() + receivedMessage->packetId() * packetSize;
-        memcpy(dest, receivedMessage->payloadData(), receivedMessage->payloadSize());
-
-        bool cancelTimer = false;
-        bool expectedPackage = false;
-
-        for( TimedRange &timedRange: inflightPackets ) {
-          if( timedRange.second.contains(receivedMessage->packetId())) {
-            expectedPackage = true;
-            timedRange.second.subtract(receivedMessage->packetId());
-            if( timedRange.second.elementCount() == 0  ) {
-              cancelTimer = true;
-            } else {
-              timedRange.first = 0;
-            }
-
-            break;
-          } else {
-            if( timedRange.first++ > timeoutCount ) {
-              cancelTimer = true;
-            }
-          }
-        }
-
-        if( !expectedPackage ) {
-          totalUnexpectedPackages++;
-        }
-
-        if( cancelTimer ) {
-          timer.cancel();
-        }
-      }
-    };
-
-    high_resolution_clock::time_point t1 = high_resolution_clock::now();
-    uint64_t totalRequested = 0;
-    boost::asio::deadline_timer m_throttleTimer(m_socket->get_io_service());
-    m_throttleTimer.expires_from_now(boost::posix_time::microseconds(0));
-
-    for(;;)
-    {
-      int64_t totalInflightPackets = 0;
-      for( auto it = inflightPackets.begin(); it != inflightPackets.end(); ) {
-        int64_t currentPackets = it->second.elementCount();
-        totalInflightPackets += currentPackets;
-
-        if( currentPackets == 0 ) {
-          // All received
-          it = inflightPackets.erase(it);
-        } else if( it->first > timeoutCount ) {
-          // Detected dropped packets -> request again
-          lostSize[it->second.elementCount()]++;
-          outstandingPackets.add(it->second);
-          it = inflightPackets.erase(it);
-        } else {
-          ++it;
-        }
-      }
-      // BOOST_LOG_TRIVIAL(debug) << "outstandingPackets: " << outstandingPackets.elementCount();
-
-      if( totalInflightPackets == 0 && outstandingPackets.elementCount() == 0 ) {
-        m_receiveCallback.erase(ufid);
-        break;
-      }
-
-      if( totalInflightPackets < throttleCount && outstandingPackets.elementCount() > 0 ) {
-        Range requestRange = outstandingPackets.removeFirstN(requestSize);
-        // BOOST_LOG_TRIVIAL(info) << "Sending packetRequest Message: " << requestRange.elementCount();
-        totalRequested += requestRange.elementCount();
-
-        inflightPackets.push_back(TimedRange(0, requestRange));
-        auto reqFilePacketsMessage = Message::createRequestFilePackets(ufid, requestRange);
-        m_throttleTimer.async_wait(yield[ec]);
-        m_socket->async_send_to(reqFilePacketsMessage->asBuffer(), m_receiverEndpoint, yield[ec]);
-        m_throttleTimer.expires_from_now(boost::posix_time::microseconds(1000));
-      }
-
-      if( totalInflightPackets > requestSize || outstandingPackets.elementCount() < requestSize ) {
-        timer.expires_from_now(boost::posix_time::milliseconds(100));
-        timer.async_wait(yield[ec]);
-
-        if( ec == boost::system::errc::success ) {
-          BOOST_LOG_TRIVIAL(debug) << "Timeout: " << static_cast<float>(outstandingPackets.elementCount()) / packetCount;
-          BOOST_LOG_TRIVIAL(debug) << "inflightPackets: " << totalInflightPackets;
-          for( int i=0; i < requestSize+1; ++i) {
-            BOOST_LOG_TRIVIAL(info) << "Lost Statistics " << i << ": " << lostSize[i];
-          }
-
-          for( TimedRange &timedRange: inflightPackets) {
-            timedRange.first += timeoutCount / inflightPackets.size();
-          }
-        }
-      }
-    }
-    high_resolution_clock::time_point t2 = high_resolution_clock::now();
-    auto duration = duration_cast<microseconds>( t2 - t1 ).count();
-
-    BOOST_LOG_TRIVIAL(info) << "Transfer Complete: " << packetCount;
-    BOOST_LOG_TRIVIAL(info) << "Total Requested: " << totalRequested;
-    BOOST_LOG_TRIVIAL(info) << "Total Unexpected Packages: " << totalUnexpectedPackages;
-    BOOST_LOG_TRIVIAL(info) << "Duration: " << duration;
-    BOOST_LOG_TRIVIAL(info) << "Throughput: " << fileInfoMessage->fileSize() / duration;
-
-
-    m_shutdown = true;
-    m_socket->cancel();
-  }
-
-private:
-  std::shared_ptr<udp::socket> m_socket;
-  udp::endpoint m_receiverEndpoint;
-
-  std::atomic<uint64_t> m_nextUfid;
-  std::map<uint64_t, std::function<void(std::shared_ptr<Message>)> > m_receiveCallback;
-
-  bool m_shutdown;
-};
 
 int main(int argc, char** argv)
 {
@@ -244,7 +31,25 @@ int main(int argc, char** argv)
     desc.add_options()
       ("help", "Print help messages")
       ("file", po::value<std::string>()->required(), "File on server to be copied")
-      ("address", po::value<std::string>(), "Address of the client");
+      ("address", po::value<std::string>(), "Address of the server, or a comma separated list of replicas as address[:port]")
+      ("port", po::value<unsigned short>()->default_value(REACH_PORT), "Port of servers given without one")
+      ("output", po::value<std::string>()->default_value("client_received.bin"), "Local file to write, - streams the file in order to stdout")
+      ("stream-window", po::value<uint64_t>()->default_value(STREAM_WINDOW / (1024 * 1024)), "Reorder window in MB when streaming to stdout")
+      ("offset", po::value<uint64_t>()->default_value(0), "First byte of the file to read, with --length")
+      ("length", po::value<uint64_t>(), "Read only this many bytes starting at --offset")
+      ("direct", "Write the output with O_DIRECT through bounded buffers instead of a memory mapping")
+      ("cache-dir", po::value<std::string>(), "Keep received packets in this directory for later runs")
+      ("cache-size", po::value<uint64_t>()->default_value(10240), "Disk budget of the cache in MB")
+      ("no-multicast", "Request every packet instead of joining the multicast group of the server")
+      ("multicast-interface", po::value<std::string>(), "Address of the interface to receive multicast on")
+      ("no-peers", "Only fetch from the servers, even if a tracker sends peers")
+      ("busy-poll", po::value<int>()->default_value(0), "Spin on the socket instead of waiting, block after this many us without work (0 disables)")
+      ("cpu", po::value<int>(), "Pin the client to this CPU, use with --busy-poll")
+      ("packet-ring", "Receive packets from an AF_PACKET ring instead of the socket (needs CAP_NET_RAW)")
+      ("seed", po::value<int>()->default_value(0), "Keep serving the file to peers for this many seconds after the transfer, needs --cache-dir")
+      ("priority", po::value<int>()->default_value(0), "Priority class 0-255 of the transfer, servers send higher classes first")
+      ("metrics", po::value<std::string>(), "Write JSON metrics of the transfer to this file")
+      ("trace", po::value<std::string>(), "Write Chrome trace JSON of the transfer to this file (needs REACH_ENABLE_TRACE)");
 
     po::positional_options_description positionalOptions;
     positionalOptions.add("file", 1);
@@ -270,31 +75,145 @@ int main(int argc, char** argv)
       std::cerr << desc << std::endl;
       return 1;
     }
+  int exitCode = 0;
+
+  // The default log sink writes to stdout, which carries the file when streaming
+  if( vm["output"].as<std::string>() == "-" ) {
+    namespace sinks = boost::log::sinks;
+    auto backend = boost::make_shared<sinks::text_ostream_backend>();
+    backend->add_stream(boost::shared_ptr<std::ostream>(&std::clog, boost::null_deleter()));
+    boost::log::core::get()->add_sink(boost::make_shared<sinks::synchronous_sink<sinks::text_ostream_backend> >(backend));
+  }
   try
   {
     boost::asio::io_service io_service;
-    std::string address("127.0.0.1");
+    std::string addresses("127.0.0.1");
     if( vm.count("address") ) {
-      address = vm["address"].as<std::string>();
+      addresses = vm["address"].as<std::string>();
     }
-    boost::asio::ip::address_v4 targetIP = boost::asio::ip::address_v4::from_string(address);
 
-    ReachClient client(io_service, targetIP);
-    boost::asio::spawn(io_service, [&](yield_context yield)
-    {
-      client.fetchFile(vm["file"].as<std::string>().c_str() , yield);
-    });
-    boost::asio::spawn(io_service, [&](yield_context yield) {
-      client.receiveMessage(yield);
+    std::vector<udp::endpoint> servers;
+    std::stringstream addressList(addresses);
+    std::string address;
+    while( std::getline(addressList, address, ',') ) {
+      unsigned short port = vm["port"].as<unsigned short>();
+      size_t colon = address.find(':');
+      if( colon != std::string::npos ) {
+        port = static_cast<unsigned short>(std::stoul(address.substr(colon + 1)));
+        address.resize(colon);
+      }
+      servers.push_back(udp::endpoint(boost::asio::ip::address_v4::from_string(address), port));
+    }
+
+    ClientEngine::Options options;
+    if( vm.count("cache-dir") ) {
+      options.cacheDirectory = vm["cache-dir"].as<std::string>();
+      options.cacheBytes = vm["cache-size"].as<uint64_t>() * 1024 * 1024;
+    }
+    options.multicast = !vm.count("no-multicast");
+    if( vm.count("multicast-interface") ) {
+      options.multicastInterface = vm["multicast-interface"].as<std::string>();
+    }
+    options.peers = !vm.count("no-peers");
+    options.packetRing = vm.count("packet-ring") > 0;
+    options.busyPollUs = vm["busy-poll"].as<int>();
+    options.priority = static_cast<uint8_t>(std::min(std::max(vm["priority"].as<int>(), 0), 255));
+    ClientEngine engine(io_service, servers, options);
+
+    std::string path = vm["file"].as<std::string>();
+    std::shared_ptr<Sink> sink(new MappedFileSink(vm["output"].as<std::string>()));
+    if( vm.count("direct") ) {
+      sink.reset(new DirectFileSink(vm["output"].as<std::string>()));
+    }
+    if( vm["output"].as<std::string>() == "-" ) {
+      sink.reset(new StreamSink(io_service, STDOUT_FILENO, vm["stream-window"].as<uint64_t>() * 1024 * 1024));
+    }
+
+    // A byte range is read into memory and written out as it is
+    std::vector<uint8_t> rangeData;
+    if( vm.count("length") ) {
+      rangeData.resize(vm["length"].as<uint64_t>());
+      ScatterSink::Buffer buffer = {vm["offset"].as<uint64_t>(), rangeData.size(), rangeData.data()};
+      sink.reset(new ScatterSink(std::vector<ScatterSink::Buffer>(1, buffer)));
+    }
+
+    boost::asio::deadline_timer seedTimer(io_service);
+
+    BOOST_LOG_TRIVIAL(info) << "Sending fileRequest: " << path;
+    engine.copy(path, sink, [&](const boost::system::error_code& error, const CopyFile::Result& result) {
+      if( error ) {
+        BOOST_LOG_TRIVIAL(error) << "Transfer failed: " << error.message();
+        exitCode = 1;
+      } else {
+        BOOST_LOG_TRIVIAL(info) << "Transfer Complete: " << result.packets;
+        BOOST_LOG_TRIVIAL(info) << "Total Requested: " << result.requestedPackets;
+        BOOST_LOG_TRIVIAL(info) << "From Cache: " << result.cachedPackets;
+        BOOST_LOG_TRIVIAL(info) << "Resumed: " << result.resumedPackets;
+        BOOST_LOG_TRIVIAL(info) << "From Multicast: " << result.multicastPackets;
+        BOOST_LOG_TRIVIAL(info) << "From Peers: " << result.peerPackets;
+        BOOST_LOG_TRIVIAL(info) << "Timeouts: " << result.timeouts;
+        if( servers.size() > 1 ) {
+          for( size_t server = 0; server < servers.size(); ++server ) {
+            BOOST_LOG_TRIVIAL(info) << "From " << servers[server] << ": " << result.serverPackets[server];
+          }
+        }
+        BOOST_LOG_TRIVIAL(info) << "Duration: " << result.seconds;
+        BOOST_LOG_TRIVIAL(info) << "Throughput: " << result.bytes / result.seconds / 1e6 << " MB/s";
+
+        if( !rangeData.empty() ) {
+          uint64_t offset = vm["offset"].as<uint64_t>();
+          uint64_t end = std::min<uint64_t>(offset + rangeData.size(), result.fileSize);
+          if( vm["output"].as<std::string>() == "-" ) {
+            std::cout.write(reinterpret_cast<const char*>(rangeData.data()), end > offset ? end - offset : 0);
+          } else {
+            std::ofstream output(vm["output"].as<std::string>(), std::ios::binary);
+            output.write(reinterpret_cast<const char*>(rangeData.data()), end > offset ? end - offset : 0);
+          }
+        }
+
+        if( vm["seed"].as<int>() > 0 ) {
+          BOOST_LOG_TRIVIAL(info) << "Seeding for " << vm["seed"].as<int>() << " s";
+          seedTimer.expires_from_now(boost::posix_time::seconds(vm["seed"].as<int>()));
+          seedTimer.async_wait([&](const boost::system::error_code&) {
+            io_service.stop();
+          });
+          return;
+        }
+      }
+      io_service.stop();
     });
 
-    io_service.run();
+    if( vm.count("cpu") && !BusyPoll::pinThread(vm["cpu"].as<int>()) ) {
+      BOOST_LOG_TRIVIAL(warning) << "Pinning to CPU " << vm["cpu"].as<int>() << " failed";
+    }
+    if( vm["busy-poll"].as<int>() > 0 ) {
+      BusyPoll busyPoll(io_service, std::chrono::microseconds(vm["busy-poll"].as<int>()));
+      busyPoll.run();
+    } else {
+      io_service.run();
+    }
+
+    if( vm.count("metrics") ) {
+      std::ofstream metricsFile(vm["metrics"].as<std::string>());
+      engine.metrics().writeJson(metricsFile);
+      metricsFile << std::endl;
+    } else {
+      std::stringstream json;
+      engine.metrics().writeJson(json);
+      BOOST_LOG_TRIVIAL(info) << "Metrics: " << json.str();
+    }
+
+    if( vm.count("trace") ) {
+      std::ofstream traceFile(vm["trace"].as<std::string>());
+      Trace::writeChromeJson(traceFile);
+    }
   }
   catch (std::exception& e)
   {
     std::cerr << e.what() << std::endl;
+    return 1;
   }
 
-  return 0;
+  return exitCode;
 }
 
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <Config.h>
+#include <Range.h>
+
+//////////////////////////////
+// Persistent client side cache of received packets. Every cached file
+// has a sparse data file and a bitmap of the packets it holds, both memory
+// mapped. An index with a fixed number of slots records the key, version,
+// size and last use of every file. It is memory mapped as well, so startup
+// only maps the index.
+//
+// Files are keyed by server and path. The version, file size and packet
+// size come from FILE_INFO, and a mismatch drops the cached packets, so one
+// REQ_FILE round trip revalidates the whole file. Files are evicted least
+// recently used first once the cached bytes exceed the budget; files
+// with an open Entry are kept.
+//
+// One process owns a cache directory at a time. A cache that was not
+// closed cleanly is emptied when it is opened again. Create the cache with
+// std::make_shared, the entries share its ownership.
+//////////////////////////////
+
+class BlockCache : public std::enable_shared_from_this<BlockCache> {
+//////////////////////////////
+// Types
+//////////////////////////////
+private:
+	struct IndexHeader {
+		uint64_t magic;
+		uint64_t slotCount;
+		uint64_t clock;
+		uint64_t clean;
+	};
+
+	struct IndexSlot {
+		// 0 for a free slot
+		uint64_t key;
+		uint64_t version;
+		uint64_t fileSize;
+		uint64_t packetSize;
+		uint64_t cachedPackets;
+		uint64_t lastUsed;
+	};
+
+public:
+	// One version of a cached file, keeps the cache alive
+	class Entry {
+	public:
+		~Entry();
+
+		// The part of packets that is in the cache
+		Range cached(const Range& packets) const;
+		uint64_t cachedPackets() const;
+
+		// Points into the mapped data file, a packet at the end of the file
+		// is shorter than the packet size
+		const uint8_t* data(uint64_t packetId) const;
+		size_t size(uint64_t packetId) const;
+
+		// Stores a received packet unless the budget is used by open files
+		void write(uint64_t packetId, const uint8_t* data, size_t size);
+
+		uint64_t fileSize() const { return m_fileSize; }
+		uint64_t packetSize() const { return m_packetSize; }
+		uint64_t version() const { return m_version; }
+		uint64_t packetCount() const { return (m_fileSize + m_packetSize - 1) / m_packetSize; }
+
+	private:
+		friend class BlockCache;
+		Entry(std::shared_ptr<BlockCache> cache, size_t slot);
+
+		std::shared_ptr<BlockCache> m_cache;
+		size_t m_slot;
+		uint64_t m_fileSize;
+		uint64_t m_packetSize;
+		uint64_t m_version;
+		boost::iostreams::mapped_file m_data;
+		boost::iostreams::mapped_file m_bitmap;
+	};
+
+//////////////////////////////
+// Methods
+//////////////////////////////
+public:
+	BlockCache(const std::string& directory, uint64_t budgetBytes, size_t slotCount = CACHE_SLOTS);
+	~BlockCache();
+
+	// False if the directory can not be used or another process owns it
+	bool isOpen() const { return m_lockFd >= 0; }
+
+	// Returns nullptr for unversioned and empty files and if every slot is in use
+	std::shared_ptr<Entry> open(const std::string& server, const std::string& path,
+		uint64_t fileSize, uint64_t packetSize, uint64_t version);
+
+	// The cached version of the file, nullptr if there is none
+	std::shared_ptr<Entry> find(const std::string& server, const std::string& path);
+
+	uint64_t cachedBytes() const { return m_cachedBytes; }
+	uint64_t budgetBytes() const { return m_budgetBytes; }
+
+private:
+	IndexHeader& header();
+	IndexSlot& slot(size_t index);
+	std::string slotPath(size_t index, const char* suffix) const;
+
+	void resetIndex(size_t slotCount);
+	void dropSlot(size_t index);
+
+	// Evicts unused files until size more bytes fit, false if they do not
+	bool reserve(uint64_t size);
+	bool evictLeastRecentlyUsed();
+
+//////////////////////////////
+// Variables
+//////////////////////////////
+private:
+	std::string m_directory;
+	uint64_t m_budgetBytes;
+	int m_lockFd;
+
+	boost::iostreams::mapped_file m_index;
+	std::unordered_map<uint64_t, size_t> m_slots;
+	std::vector<int> m_users;
+	size_t m_usedSlots;
+	uint64_t m_cachedBytes;
+};
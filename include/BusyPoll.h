@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <boost/asio.hpp>
+
+#include <Config.h>
+
+//////////////////////////////
+// Runs an io_service for low latency. Instead of parking in epoll_wait
+// until the kernel wakes the thread, it polls for ready handlers in a loop:
+// every poll checks the sockets without blocking. After the given idle time
+// without a handler it blocks in run_one() like run() would, so an idle
+// process does not burn its core forever.
+//
+// Spinning only pays off on a core of its own, pin the thread with
+// pinThread(). SO_BUSY_POLL additionally lets the receive calls poll the
+// NIC queue instead of waiting for its interrupt.
+//////////////////////////////
+
+class BusyPoll {
+//////////////////////////////
+// Methods
+//////////////////////////////
+public:
+	BusyPoll(boost::asio::io_service& io_service, std::chrono::microseconds idle);
+
+	// Returns once the io_service is stopped or out of work
+	void run();
+
+	// Polls that found no handler and waits in run_one()
+	uint64_t emptyPolls() const { return m_emptyPolls; }
+	uint64_t blockingWaits() const { return m_blockingWaits; }
+
+	// False if the CPU does not exist or is not allowed
+	static bool pinThread(int cpu);
+
+	// Sets SO_BUSY_POLL in us, raising it needs CAP_NET_ADMIN
+	static bool enableSocket(int fd, int busyPollUs = BUSY_POLL_US);
+
+//////////////////////////////
+// Variables
+//////////////////////////////
+private:
+	boost::asio::io_service& m_ioService;
+	std::chrono::microseconds m_idle;
+
+	uint64_t m_emptyPolls;
+	uint64_t m_blockingWaits;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <Range.h>
+
+//////////////////////////////
+// Sidecar of an interrupted transfer: the identity of the file from
+// FILE_INFO and the packets still missing from the output. The payload of
+// all other packets is in the page cache of the mapped output when the
+// checkpoint is written, so a restarted client can trust it after the
+// client was killed, but not after the machine crashed.
+//////////////////////////////
+
+struct Checkpoint {
+	Checkpoint();
+
+	// Same server file, size, packet grid and version
+	bool sameFile(const Checkpoint& other) const;
+
+	// False if the file is missing or not a complete checkpoint
+	bool load(const std::string& file);
+
+	// Written to a temporary file and renamed, so a crash keeps the old one
+	bool save(const std::string& file) const;
+
+	std::string path;
+	uint64_t fileSize;
+	uint64_t packetSize;
+	uint64_t fileVersion;
+	Range missing;
+};
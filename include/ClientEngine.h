@@ -0,0 +1,240 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <BlockCache.h>
+#include <Config.h>
+#include <CopyFile.h>
+#include <Histogram.h>
+#include <Message.h>
+#include <PacketRing.h>
+#include <RequestScheduler.h>
+#include <SendRing.h>
+#include <Sink.h>
+#include <TimingWheel.h>
+
+//////////////////////////////
+// Embeddable client side of the protocol. The engine owns one UDP socket
+// and a dispatch table from ufid to the running CopyFile transfers, so any
+// number of transfers share the socket and the caller's io_service.
+// copy() may be called from any thread; the transfers and all completion
+// callbacks run on the io_service.
+//
+// With several servers every one of them must serve the same files; each
+// transfer stripes its packets across the servers that answer.
+//
+// A server may announce a multicast group in FILE_INFO. The engine then
+// joins it with one socket per group, shared by all transfers.
+//
+// A server acting as tracker sends the other clients of a file. Transfers
+// use them like servers for the packets they hold, and the engine answers
+// their requests from the block cache, paced like the server.
+//////////////////////////////
+
+class ClientEngine {
+//////////////////////////////
+// Types
+//////////////////////////////
+public:
+	struct Options {
+		Options();
+
+		// Packets per REQ_FILE_PACKETS request
+		uint64_t requestSize;
+
+		// Packets requested but not yet received per transfer and for all
+		// transfers of the engine together
+		uint64_t window;
+		uint64_t engineWindow;
+
+		// SO_RCVBUF of the socket, bursts of all transfers land in it
+		int receiveBufferSize;
+
+		// Wait for FILE_INFO before the request is repeated, SEND_RETRY times
+		uint64_t fileInfoTimeoutMs;
+
+		// Silence after which the packets in flight are requested again, doubled
+		// on every repeat until a packet arrives
+		uint64_t requestTimeoutMs;
+
+		// Silence after which a transfer fails
+		uint64_t stallTimeoutMs;
+
+		// Interval for the checkpoints of sinks that can resume, 0 disables
+		uint64_t checkpointIntervalMs;
+
+		// Persistent packet cache, disabled if the directory is empty
+		std::string cacheDirectory;
+		uint64_t cacheBytes;
+
+		// Join multicast groups announced by the server, on the interface
+		// with this address or the one the kernel picks if it is empty
+		bool multicast;
+		std::string multicastInterface;
+
+		// Fetch from and serve to the peers of the tracker, serving needs the
+		// cache. Peers and their packets are refreshed every interval.
+		bool peers;
+		uint64_t peerIntervalMs;
+
+		// Priority class of the transfers, the servers send the packets of
+		// higher classes first
+		uint8_t priority;
+
+		// Receive FILE_PACKETs from a PacketRing, the socket is used if the
+		// ring can not be set up
+		bool packetRing;
+
+		// SO_BUSY_POLL of the socket in us, 0 disables. Pays off when the
+		// io_service is run by a BusyPoll.
+		int busyPollUs;
+	};
+
+	// Histograms the transfers record into, looked up once
+	struct Histograms {
+		explicit Histograms(Metrics& metrics);
+
+		Histogram& firstPacket;
+		Histogram& requestCompletion;
+		Histogram& retransmitsPerPacket;
+		Histogram& lossBurst;
+	};
+
+private:
+	struct MulticastGroup {
+		MulticastGroup(boost::asio::io_service& io_service) : socket(io_service), users(0) {}
+
+		boost::asio::ip::udp::socket socket;
+		boost::asio::ip::udp::endpoint sender;
+		boost::array<uint8_t, MAX_MESSAGE_SIZE> buffer;
+		size_t users;
+	};
+
+	typedef std::pair<boost::asio::ip::udp::endpoint, uint64_t> PeerTransfer;
+
+	struct ServedFile {
+		ServedFile() : availableVersion(0), availableCount(UINT64_MAX) {}
+
+		std::shared_ptr<BlockCache::Entry> entry;
+		std::chrono::steady_clock::time_point lastUsed;
+
+		// Cached packets as last announced, until the entry changes
+		Range available;
+		uint64_t availableVersion;
+		uint64_t availableCount;
+	};
+
+//////////////////////////////
+// Methods
+//////////////////////////////
+public:
+	ClientEngine(boost::asio::io_service& io_service, const boost::asio::ip::udp::endpoint& server,
+		const Options& options = Options());
+	ClientEngine(boost::asio::io_service& io_service, const std::vector<boost::asio::ip::udp::endpoint>& servers,
+		const Options& options = Options());
+	~ClientEngine();
+
+	// Starts a transfer and returns its id. The completion is called exactly
+	// once, with operation_aborted if the transfer was cancelled and
+	// timed_out if the server stopped answering.
+	uint64_t copy(const std::string& path, std::shared_ptr<Sink> sink, CopyFile::Completion completion);
+
+	// The future throws boost::system::system_error on failure. Do not wait
+	// on it from the thread that runs the io_service.
+	std::future<CopyFile::Result> copy(const std::string& path, std::shared_ptr<Sink> sink);
+
+	// Reads byte ranges of the file into the caller's buffers, which must
+	// stay valid until the completion. All ranges share one transfer and
+	// only the packets covering them are requested. Bytes past the end of
+	// the file stay untouched, Result::fileSize tells where it ends.
+	uint64_t read(const std::string& path, const std::vector<ScatterSink::Buffer>& buffers, CopyFile::Completion completion);
+	std::future<CopyFile::Result> read(const std::string& path, uint64_t offset, uint64_t length, uint8_t* data);
+
+	void cancel(uint64_t id);
+
+	size_t activeTransfers() const { return m_transfers.size(); }
+	const Options& options() const { return m_options; }
+	Metrics& metrics() { return m_metrics; }
+	Histograms& histograms() { return m_histograms; }
+	boost::asio::io_service& ioService() { return m_ioService; }
+	// Request and retransmit deadlines of all transfers
+	TimingWheel& timers() { return m_timers; }
+	const std::vector<boost::asio::ip::udp::endpoint>& servers() const { return m_servers; }
+	// nullptr if the packets come from the socket
+	PacketRing* packetRing() { return m_packetRing.get(); }
+
+	// Used by the transfers
+	void send(std::shared_ptr<Message> message, const boost::asio::ip::udp::endpoint& destination);
+	void finished(uint64_t id);
+
+	// FILE_PACKETs of the session go to the transfer's receiveMulticast()
+	// until it leaves, false if the group can not be joined
+	bool joinGroup(const boost::asio::ip::udp::endpoint& group, uint64_t session, std::shared_ptr<CopyFile> transfer);
+	void leaveGroup(const boost::asio::ip::udp::endpoint& group, uint64_t session, const CopyFile* transfer);
+
+	// nullptr without a cache or if the file can not be cached
+	std::shared_ptr<BlockCache::Entry> openCacheEntry(size_t server, const std::string& path,
+		uint64_t fileSize, uint64_t packetSize, uint64_t fileVersion);
+
+	// Takes up to count packets from the engine window, a transfer that got
+	// nothing waits and is resumed once packets are released
+	uint64_t acquirePackets(uint64_t count);
+	void releasePackets(uint64_t count);
+	void waitForPackets(std::shared_ptr<CopyFile> transfer);
+
+private:
+	void start();
+	void receiveMessage();
+	void receiveMessageComplete(const boost::system::error_code& error, std::size_t messageSize);
+	void dispatch(const uint8_t* data, size_t size, const boost::asio::ip::udp::endpoint& sender);
+	void receiveGroupMessage(std::shared_ptr<MulticastGroup> group);
+	void servePeer(const Message& message, const boost::asio::ip::udp::endpoint& peer);
+	// Sends the next packet the peers asked for every SEND_INTERVAL_US
+	void sendPeerPackets();
+	std::string serverName(size_t server) const;
+
+//////////////////////////////
+// Variables
+//////////////////////////////
+private:
+	boost::asio::io_service& m_ioService;
+	boost::asio::ip::udp::socket m_socket;
+	std::vector<boost::asio::ip::udp::endpoint> m_servers;
+	boost::asio::ip::udp::endpoint m_senderEndpoint;
+	boost::array<uint8_t, MAX_MESSAGE_SIZE> m_receiveBuffer;
+	Options m_options;
+	TimingWheel m_timers;
+	std::unique_ptr<PacketRing> m_packetRing;
+
+	std::shared_ptr<BlockCache> m_cache;
+
+	std::atomic<uint64_t> m_nextUfid;
+	std::unordered_map<uint64_t, std::shared_ptr<CopyFile> > m_transfers;
+
+	std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<MulticastGroup> > m_groups;
+	std::unordered_multimap<uint64_t, std::weak_ptr<CopyFile> > m_sessions;
+
+	std::map<PeerTransfer, ServedFile> m_servedFiles;
+	RequestScheduler m_peerScheduler;
+	// Shared with the send handlers, which may outlive the engine
+	std::shared_ptr<SendRing> m_peerRing;
+	boost::asio::steady_timer m_peerTimer;
+	bool m_peerSending;
+
+	uint64_t m_packetsInFlight;
+	std::deque<std::weak_ptr<CopyFile> > m_waiting;
+
+	Metrics m_metrics;
+	Histograms m_histograms;
+};
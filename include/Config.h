@@ -1,6 +1,6 @@
 #pragma once
 
-#define REACH_VERSION 1
+#define REACH_VERSION 5
 #define REACH_PORT 52123
 #define MAX_MESSAGE_SIZE (128 * 1024)
 #define PING_INTERVAL 5
@@ -8,4 +8,22 @@
 #define SEND_RETRY 3
 #define RECEIVE_TIMEOUT 2000
 #define REQUEST_SIZE 32
-#define REQUEST_PREFETCH 1024
\ No newline at end of file
+#define REQUEST_PREFETCH 1024
+#define SEND_RING_SIZE 64
+#define TRACE_BUFFER_EVENTS (64 * 1024)
+#define FILE_IDLE_TIMEOUT 60
+#define CACHE_SLOTS 4096
+#define MULTICAST_RATE (64 * 1024 * 1024)
+#define PEER_LIMIT 8
+#define DIRECT_EXTENT_SIZE (1024 * 1024)
+#define DIRECT_DIRTY_LIMIT (64 * 1024 * 1024)
+#define STREAM_WINDOW (16 * 1024 * 1024)
+#define ZEROCOPY_MIN_PAYLOAD 4096
+#define DRR_QUANTUM (64 * 1024)
+#define HOT_SET_FILES 1024
+#define PACKET_RING_BLOCK_SIZE (256 * 1024)
+#define PACKET_RING_BLOCKS 64
+#define BUSY_POLL_US 50
+#define TIMING_WHEEL_TICK_US 1000
+#define MAX_PACKET_ID (1ULL << 30)
+#define SEND_INTERVAL_US 50
\ No newline at end of file
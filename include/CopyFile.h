@@ -1,47 +1,227 @@
 #pragma once
 
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include <boost/asio.hpp>
-#include <boost/array.hpp>
 
+#include <BlockCache.h>
+#include <Checkpoint.h>
 #include <Message.h>
+#include <Sink.h>
+#include <TimingWheel.h>
 
-using boost::asio::ip::udp;
+class ClientEngine;
 
-class CopyFile {
+//////////////////////////////
+// State machine of a single file transfer inside the ClientEngine. It asks
+// for the file info, keeps a window of REQ_FILE_PACKETS requests in flight
+// and requests lost packets again until every packet reached the sink.
+// The engine owns the socket and hands every message with our ufid to
+// receive().
+//
+// With several servers the REQ_FILE goes to all of them and the first
+// FILE_INFO starts the transfer. Each request goes to one server; a server's
+// share of the window follows its measured delivery rate. The requests of a
+// silent server go to the others, and a server silent for the stall timeout
+// gets no more requests.
+//
+// If the server announces a multicast group the transfer joins it and only
+// requests the packets the group lost. It falls back to requests once the
+// group goes silent.
+//
+// Peers sent by a tracker become replicas as well once they answer the
+// REQ_FILE with the same version. They only get requests for the packets
+// their AVAILABILITY lists. With peers the packets fewest peers hold are
+// requested first, from a random start per transfer, so that clients
+// starting together fetch different packets and can trade them.
+//////////////////////////////
+
+class CopyFile : public std::enable_shared_from_this<CopyFile> {
+//////////////////////////////
+// Types
+//////////////////////////////
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Result {
+		Result();
+
+		uint64_t fileSize;
+		uint64_t packetSize;
+
+		// Packets the sink asked for and payload bytes written to it
+		uint64_t packets;
+		uint64_t bytes;
+
+		// Packets the block cache provided and packets an earlier, interrupted
+		// run had written to the sink already
+		uint64_t cachedPackets;
+		uint64_t resumedPackets;
+
+		uint64_t requests;
+		uint64_t requestedPackets;
+		uint64_t receivedPackets;
+		uint64_t multicastPackets;
+		uint64_t timeouts;
+		double seconds;
+
+		// Packets received from each server of the engine and from all
+		// peers, without the multicast packets
+		std::vector<uint64_t> serverPackets;
+		uint64_t peerPackets;
+	};
+
+	typedef std::function<void(const boost::system::error_code&, const Result&)> Completion;
+
+private:
+	struct InflightRequest {
+		// Packets of later requests received since the last packet of this one
+		uint32_t missed;
+		Range packets;
+		Clock::time_point sent;
+		bool answered;
+		size_t server;
+	};
+
+	// A server of the engine or a peer as seen by this transfer
+	struct Replica {
+		Replica();
+
+		boost::asio::ip::udp::endpoint endpoint;
+		bool peer;
+		// Packets a peer announced, servers have all
+		Range available;
+
+		// Answered FILE_INFO for the same file, a failed replica gets no requests
+		bool ready;
+		bool failed;
+		uint32_t fileInfoRequests;
+		Clock::time_point lastFileInfoRequest;
+
+		uint64_t packetsInFlight;
+		Clock::time_point lastDelivery;
+		Clock::time_point lastRequeue;
+		uint64_t requestTimeoutMs;
+
+		// Packets received since the last rate update and their smoothed
+		// rate in packets per second
+		uint64_t delivered;
+		double rate;
+	};
+
+//////////////////////////////
+// Methods
+//////////////////////////////
 public:
-	CopyFile(const char* path, 
-		std::shared_ptr<udp::socket> socket,
-		udp::endpoint& receiverEndpoint);
+	CopyFile(ClientEngine& engine, uint64_t ufid, const std::string& path,
+		std::shared_ptr<Sink> sink, Completion completion);
+
+	void start();
+	void cancel();
+	void receive(const Message& message, const boost::asio::ip::udp::endpoint& sender);
+	void receiveMulticast(const Message& message);
+
+	// Called by the engine when packets of its window became available
+	void resume();
+
+	uint64_t ufid() const { return m_ufid; }
+	const std::string& path() const { return m_path; }
 
 private:
 	void sendRequestFile();
-	void sendRequestFileComplete(  
-  		const boost::system::error_code& error,
-  		std::size_t messageSize);
+	void requestFileInfo(size_t server);
+	void receiveFileInfo(const Message& message, size_t server);
+	void acceptReplica(const Message& message, size_t server);
+	void readCache(size_t server, uint64_t fileVersion);
+	void readCachedPackets();
+	void resumeCheckpoint(uint64_t fileVersion);
+	void saveCheckpoint();
+	void receiveFileInfoTimeOut();
+
+	void joinMulticast(const Message& message);
+	void leaveMulticast();
 
-	void receiveFileInfo( const boost::system::error_code& error,
-  		std::size_t messageSize);
-	void receiveFileInfoTimeOut(const boost::system::error_code& error);
+	size_t findReplica(const boost::asio::ip::udp::endpoint& endpoint) const;
+	void addPeers(const Message& message, size_t tracker);
+	void refreshPeers(Clock::time_point now);
 
 	void sendRequestFilePackets();
-	void sendRequestFilePacketsComplete(  
-  		const boost::system::error_code& error,
-  		std::size_t messageSize);
-	void sendRequestFilePacketsTimeOut(const boost::system::error_code& error);
+	size_t pickReplica() const;
+	Range selectPackets(size_t server, uint64_t count);
+	uint64_t packetCount() const { return (m_fileSize + m_packetSize - 1) / m_packetSize; }
+	uint64_t windowLimit() const;
+	void receiveFilePacket(const Message& message, size_t server);
+	// Whether the payload is exactly the packet of the file it claims to be
+	bool validPacket(const Message& message) const;
+	void writePacket(const Message& message, Clock::time_point now);
+	bool receivedAll() const;
+	void sendRequestFilePacketsTimeOut();
+	void updateRates(Clock::time_point now);
+	uint64_t requeue(std::deque<InflightRequest>::iterator request);
+	uint64_t requeueReplica(size_t server);
 
-	void receiveFilePacket(const boost::system::error_code& error,
-  		std::size_t messageSize);
+	void complete(const boost::system::error_code& error);
 
+//////////////////////////////
+// Variables
+//////////////////////////////
 private:
-	std::shared_ptr<boost::asio::ip::udp::socket> m_socket;
-	boost::asio::ip::udp::endpoint m_receiverEndpoint;
-	uint64_t m_errorCount;
-	boost::asio::deadline_timer m_receiveTimer;
+	ClientEngine& m_engine;
+	uint64_t m_ufid;
+	std::string m_path;
+	std::shared_ptr<Sink> m_sink;
+	std::shared_ptr<BlockCache::Entry> m_cacheEntry;
+	// Packets below were looked up in the cache
+	uint64_t m_cacheLimit;
+	Completion m_completion;
+	bool m_done;
+	bool m_waiting;
 
-	boost::array<uint8_t, MAX_MESSAGE_SIZE> m_receiveBuffer;
+	// On the engine's wheel, destroying the transfer cancels it
+	TimingWheel::Timer m_receiveTimer;
+	Clock::time_point m_lastProgress;
+	uint64_t m_errorCount;
 	std::shared_ptr<Message> m_reqFileMessage;
-	std::shared_ptr<Message> m_fileInfoMessage;
 
+	uint64_t m_fileSize;
+	uint64_t m_packetSize;
 	Range m_outstandingPackets;
+	std::deque<InflightRequest> m_inflight;
 	uint64_t m_packetsInFlight;
-};
\ No newline at end of file
+	// Times a packet was requeued, only for packets that were
+	std::unordered_map<uint64_t, uint16_t> m_requeueCount;
+
+	// The servers of the engine in its order, followed by the peers
+	std::vector<Replica> m_replicas;
+	Clock::time_point m_lastRateUpdate;
+	uint64_t m_fileVersion;
+	// Replicas without a packet to request in the current round
+	std::vector<bool> m_exhausted;
+
+	// The replica that sent peers, SIZE_MAX without one
+	size_t m_tracker;
+	size_t m_peerCount;
+	uint64_t m_selectionStart;
+	Clock::time_point m_lastPeerRefresh;
+
+	// Packets still expected from the multicast group, the session is 0
+	// without one. The cursor is the last packet the group sent.
+	boost::asio::ip::udp::endpoint m_multicastGroup;
+	uint64_t m_multicastSession;
+	Range m_multicastPackets;
+	uint64_t m_multicastCursor;
+	Clock::time_point m_lastMulticast;
+
+	// Without a version the file can not be identified and is not resumed
+	std::string m_checkpointPath;
+	Checkpoint m_checkpoint;
+	Clock::time_point m_lastCheckpoint;
+
+	Clock::time_point m_start;
+	Result m_result;
+};
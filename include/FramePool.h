@@ -0,0 +1,72 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+//////////////////////////////
+// Recycles the frames of explicit state machines. A frame holds the state
+// an operation keeps between two asynchronous steps (its timer, buffers and
+// position) and its completion handlers only capture the frame pointer.
+// Released frames keep their members, e.g. the timer and the capacity of
+// their vectors, so a busy server stops allocating once the pool has
+// grown to the peak number of outstanding operations.
+//
+// Frames are owned by the pool, a released frame must not have an
+// operation in flight. The caller resets the frame after acquire().
+//////////////////////////////
+
+template<typename Frame>
+class FramePool {
+//////////////////////////////
+// Types
+//////////////////////////////
+public:
+	typedef std::function<Frame*()> Factory;
+
+//////////////////////////////
+// Methods
+//////////////////////////////
+public:
+	// Creates reserve frames up front
+	explicit FramePool(Factory factory, size_t reserve = 0) :
+	m_factory(factory)
+	{
+		for( size_t i = 0; i < reserve; ++i ) {
+			m_frames.emplace_back(m_factory());
+			m_free.push_back(m_frames.back().get());
+		}
+	}
+
+	// A recycled frame, a new one if all are in use
+	Frame* acquire()
+	{
+		if( m_free.empty() ) {
+			m_frames.emplace_back(m_factory());
+			// release() does not allocate
+			m_free.reserve(m_frames.size());
+			return m_frames.back().get();
+		}
+		Frame* frame = m_free.back();
+		m_free.pop_back();
+		return frame;
+	}
+
+	void release(Frame* frame)
+	{
+		m_free.push_back(frame);
+	}
+
+	size_t size() const { return m_frames.size(); }
+	size_t inUse() const { return m_frames.size() - m_free.size(); }
+
+//////////////////////////////
+// Variables
+//////////////////////////////
+private:
+	Factory m_factory;
+	std::vector< std::unique_ptr<Frame> > m_frames;
+
+	// Most recently released first, its memory is likely still cached
+	std::vector<Frame*> m_free;
+};
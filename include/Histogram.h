@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+//////////////////////////////
+// HDR-style histogram of unsigned integer values. Every power of two is
+// split into 2^precisionBits linear buckets, so a recorded value is off by
+// less than 2^-precisionBits relative to its bucket. Recording is a shift
+// and an increment, the bucket array only grows to the largest value seen.
+//////////////////////////////
+
+class Histogram {
+//////////////////////////////
+// Methods
+//////////////////////////////
+public:
+	explicit Histogram(int precisionBits = 7);
+
+	void record(uint64_t value, uint64_t count = 1);
+	void merge(const Histogram& other);
+	void reset();
+
+	uint64_t count() const { return m_count; }
+	uint64_t sum() const { return m_sum; }
+	uint64_t min() const { return m_count > 0 ? m_min : 0; }
+	uint64_t max() const { return m_max; }
+	double mean() const { return m_count > 0 ? static_cast<double>(m_sum) / m_count : 0; }
+
+	// Highest value equivalent to the given percentile (0 - 100)
+	uint64_t percentile(double percent) const;
+
+	// {"count":..,"min":..,"max":..,"mean":..,"p50":..,..,"buckets":[[value,count],..]}
+	void writeJson(std::ostream& output) const;
+
+	// Prometheus text format summary with quantiles, _sum and _count
+	void writePrometheus(std::ostream& output, const std::string& name, const std::string& help) const;
+
+private:
+	size_t bucketIndex(uint64_t value) const;
+	uint64_t bucketValue(size_t index) const;
+
+//////////////////////////////
+// Variables
+//////////////////////////////
+private:
+	int m_precisionBits;
+	std::vector<uint64_t> m_buckets;
+	uint64_t m_count;
+	uint64_t m_sum;
+	uint64_t m_min;
+	uint64_t m_max;
+};
+
+//////////////////////////////
+// Named set of histograms that are exported together, e.g. at the end of a
+// transfer as JSON or periodically by the server as a Prometheus textfile.
+//////////////////////////////
+
+class Metrics {
+//////////////////////////////
+// Methods
+//////////////////////////////
+public:
+	// Returns the histogram with the given name, creates it on first use
+	Histogram& histogram(const std::string& name, const std::string& help = std::string());
+
+	void reset();
+
+	void writeJson(std::ostream& output) const;
+	void writePrometheus(std::ostream& output) const;
+
+	// Writes to a temporary file and renames it, so scrapers never see a
+	// partially written file
+	bool writePrometheusFile(const std::string& path) const;
+
+//////////////////////////////
+// Variables
+//////////////////////////////
+private:
+	struct Entry {
+		std::string help;
+		Histogram histogram;
+	};
+
+	std::map<std::string, Entry> m_entries;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <Config.h>
+
+//////////////////////////////
+// The files a server is expected to serve right after a start. The manifest
+// is a text file with one path per line, the most important first; empty
+// lines and lines starting with # are ignored. It can be written by hand or
+// recorded: the files served are counted and save() writes them, the most
+// requested first, followed by the files of the loaded manifest that were
+// not requested.
+//
+// warm() prefaults the mappings of the hot set with several threads, so the
+// first clients do not pay for page faults, and locks them in memory within
+// a budget.
+//////////////////////////////
+
+class HotSet {
+//////////////////////////////
+// Types
+//////////////////////////////
+public:
+	struct Region {
+		const void* data;
+		size_t size;
+	};
+
+	struct WarmOptions {
+		WarmOptions();
+
+		unsigned threads;
+		// Ask for transparent huge pages, the kernel may not support them
+		// for file mappings
+		bool hugePages;
+		// Regions are locked in order as long as they fit
+		uint64_t lockBytes;
+	};
+
+	struct WarmResult {
+		uint64_t faultedBytes;
+		uint64_t lockedBytes;
+	};
+
+//////////////////////////////
+// Methods
+//////////////////////////////
+public:
+	explicit HotSet(size_t limit = HOT_SET_FILES);
+
+	// False if the manifest can not be read, a missing manifest is empty
+	bool load(const std::string& manifest);
+	const std::vector<std::string>& paths() const { return m_paths; }
+
+	void record(const std::string& path);
+	// Drops a file that is gone from the hot set
+	void forget(const std::string& path);
+
+	// Replaces the manifest with the hot set of at most limit files
+	bool save(const std::string& manifest) const;
+
+	static WarmResult warm(const std::vector<Region>& regions, const WarmOptions& options);
+
+//////////////////////////////
+// Variables
+//////////////////////////////
+private:
+	size_t m_limit;
+	std::vector<std::string> m_paths;
+	std::map<std::string, uint64_t> m_requests;
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+//////////////////////////////
+// The impairment class models one direction of a WAN link for reach_netem.
+// For every datagram it decides whether it is lost (random and bursty
+// Gilbert-Elliott loss), duplicated or reordered and when it leaves the
+// link (delay with jitter behind a bandwidth limited queue).
+//////////////////////////////
+
+class Impairment {
+//////////////////////////////
+// Types
+//////////////////////////////
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Config {
+		Config();
+
+		// Independent random loss probability
+		double loss;
+
+		// Gilbert-Elliott: P(good -> bad), P(bad -> good) and the loss
+		// probability in each state. Disabled while burstEnter is 0.
+		double burstEnter;
+		double burstExit;
+		double burstLossGood;
+		double burstLossBad;
+
+		// Probability to duplicate a datagram
+		double duplicate;
+
+		// Probability that a datagram skips the delay and overtakes others
+		double reorder;
+
+		// One way delay and uniform jitter in microseconds
+		uint64_t delayUs;
+		uint64_t jitterUs;
+
+		// Bandwidth cap in bits per second (0 = unlimited) and the maximum
+		// queueing delay before datagrams are tail dropped
+		uint64_t rateBps;
+		uint64_t queueLimitUs;
+	};
+
+	struct Statistics {
+		Statistics() : packets(0), bytes(0), lost(0), queueDropped(0), duplicated(0), reordered(0) {}
+
+		uint64_t packets;
+		uint64_t bytes;
+		uint64_t lost;
+		uint64_t queueDropped;
+		uint64_t duplicated;
+		uint64_t reordered;
+	};
+
+//////////////////////////////
+// Methods
+//////////////////////////////
+public:
+	Impairment(const Config& config, uint64_t seed);
+
+	// Appends the departure times of a datagram of the given size that enters
+	// the link at now. Appends nothing if it is dropped, two times if it is
+	// duplicated.
+	void schedule(Clock::time_point now, size_t size, std::vector<Clock::time_point>& departures);
+
+	const Config& config() const { return m_config; }
+	const Statistics& statistics() const { return m_statistics; }
+
+private:
+	bool chance(double probability);
+	Clock::time_point transmit(Clock::time_point now, size_t size, bool& dropped);
+
+//////////////////////////////
+// Variables
+//////////////////////////////
+private:
+	Config m_config;
+	Statistics m_statistics;
+	std::mt19937_64 m_random;
+	bool m_burstState;
+	Clock::time_point m_linkFree;
+};
@@ -17,7 +17,13 @@ class Message {
 // Types
 //////////////////////////////
 public:
-	enum TYPE : uint8_t {PING, ALIVE, REQ_FILE, FILE_INFO, REQ_FILE_PACKETS, FILE_PACKET};
+	// REQ_PEERS asks the tracker for other clients of the file, which answers
+	// with PEERS. A client answers a peer's REQ_FILE with FILE_INFO and the
+	// AVAILABILITY of the packets it holds.
+	enum TYPE : uint8_t {PING, ALIVE, REQ_FILE, FILE_INFO, REQ_FILE_PACKETS, FILE_PACKET, REQ_PEERS, PEERS, AVAILABILITY};
+
+	// Wire size of a FILE_PACKET without its payload (type, ufid, packetId)
+	static const size_t FILE_PACKET_HEADER_SIZE = sizeof(TYPE) + 2 * sizeof(uint64_t);
 
 
 //////////////////////////////
@@ -27,25 +33,46 @@ public:
 	// Message Specific Create
 	static std::shared_ptr<Message> createPing();
 	static std::shared_ptr<Message> createAlive();	
-	static std::shared_ptr<Message> createReqFile(uint64_t ufid, const char* path);
-	static std::shared_ptr<Message> createFileInfo(uint64_t ufid, uint64_t packetCount, uint64_t packetSize);
+	// Servers schedule the packets of a higher priority transfer first
+	static std::shared_ptr<Message> createReqFile(uint64_t ufid, const char* path, uint8_t priority = 0);
+	// The file version changes whenever the content may have changed, 0 if
+	// the server can not tell
+	static std::shared_ptr<Message> createFileInfo(uint64_t ufid, uint64_t packetCount, uint64_t packetSize, uint64_t fileVersion = 0);
+	// Announces that the file is sent to a multicast group, its FILE_PACKETs
+	// carry the session instead of the ufid
+	static std::shared_ptr<Message> createFileInfo(uint64_t ufid, uint64_t packetCount, uint64_t packetSize, uint64_t fileVersion,
+		uint64_t multicastSession, const boost::asio::ip::udp::endpoint& multicastGroup);
 	static std::shared_ptr<Message> createRequestFilePackets(uint64_t ufid, Range packets);
 	static std::shared_ptr<Message> createFilePacket(uint64_t ufid, uint64_t packetId, const uint8_t* payloadData, size_t payloadSize);
 	static std::shared_ptr<Message> createFilePacket(uint64_t ufid, uint64_t packetId, const char* payloadData, size_t payloadSize);
+	static std::shared_ptr<Message> createReqPeers(uint64_t ufid);
+	static std::shared_ptr<Message> createPeers(uint64_t ufid, const std::vector<boost::asio::ip::udp::endpoint>& peers);
+	static std::shared_ptr<Message> createAvailability(uint64_t ufid, Range packets);
 
-	// Message from Buffer
-	static std::shared_ptr<Message> fromBuffer(const uint8_t* data, size_t length);
+	// Message from Buffer, nullptr if a fixed field is cut off or its
+	// packets reach packetLimit
+	static std::shared_ptr<Message> fromBuffer(const uint8_t* data, size_t length, uint64_t packetLimit = MAX_PACKET_ID);
 
 	// Message to Buffer
 	std::vector<boost::asio::const_buffer> asBuffer() const;
 
+	// Pre-encoded FILE_PACKET headers for the allocation free send path.
+	// The header has to provide FILE_PACKET_HEADER_SIZE bytes.
+	static void encodeFilePacketHeader(uint8_t* header, uint64_t ufid, uint64_t packetId);
+	static void stampPacketId(uint8_t* header, uint64_t packetId);
+
 	// Meta
 	TYPE type() const { return m_type; }
 	const char* path() const { return m_path; }
+	uint8_t priority() const { return m_priority; }
 	uint64_t ufid() const { return m_ufid; }
 	uint64_t fileSize() const { return m_fileSize; }
 	uint64_t packetSize() const { return m_packetSize; }
-	Range packets() const { return m_packets; }
+	uint64_t fileVersion() const { return m_fileVersion; }
+	uint64_t multicastSession() const { return m_multicastSession; }
+	boost::asio::ip::udp::endpoint multicastGroup() const;
+	const Range& packets() const { return m_packets; }
+	const std::vector<boost::asio::ip::udp::endpoint>& peers() const { return m_peers; }
 
 	uint64_t packetId() const { return m_packetId; }
 	const uint8_t* payloadData() const { return m_payloadData; }
@@ -61,10 +88,18 @@ private:
 	TYPE m_type;
 	uint64_t m_version;
 	char m_path[PATH_LENGTH];
+	uint8_t m_priority;
 	uint64_t m_ufid;
 	uint64_t m_fileSize;
 	uint64_t m_packetSize;
+	uint64_t m_fileVersion;
+	uint64_t m_multicastSession;
+	uint32_t m_multicastAddress;
+	uint16_t m_multicastPort;
 	Range m_packets;
+	std::vector<boost::asio::ip::udp::endpoint> m_peers;
+	// Wire form of the peers, uint32 count and count x (uint32 address, uint16 port)
+	std::vector<uint8_t> m_peerBuffer;
 	uint64_t m_packetId;
 	const uint8_t* m_payloadData;
 	size_t m_payloadSize;
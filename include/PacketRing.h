@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <boost/asio.hpp>
+
+#include <Config.h>
+
+//////////////////////////////
+// Receives the FILE_PACKETs for a UDP socket from an AF_PACKET TPACKET_V3
+// ring shared with the kernel, instead of one receive call and copy per
+// datagram. A BPF filter passes IPv4 UDP datagrams to the port of the
+// socket that carry a FILE_PACKET; fragmented datagrams are reassembled by
+// the kernel (PACKET_FANOUT_FLAG_DEFRAG). The socket gets a filter that
+// drops FILE_PACKETs, so every packet arrives once, and keeps receiving the
+// other messages.
+//
+// The kernel hands over a block when it is full or after 1 ms. Handlers get
+// the UDP payload in place in the ring, it is valid during the call. UDP
+// checksums the NIC did not verify are checked here, the socket path would
+// have done that in the kernel.
+//
+// Needs CAP_NET_RAW, open() returns false without it.
+//////////////////////////////
+
+class PacketRing {
+//////////////////////////////
+// Types
+//////////////////////////////
+public:
+	typedef std::function<void(const uint8_t* data, size_t size, const boost::asio::ip::udp::endpoint& sender)> Handler;
+
+//////////////////////////////
+// Methods
+//////////////////////////////
+public:
+	explicit PacketRing(boost::asio::io_service& io_service,
+		size_t blockSize = PACKET_RING_BLOCK_SIZE, size_t blockCount = PACKET_RING_BLOCKS);
+	~PacketRing();
+
+	// The socket has to be bound. Calls the handler for the FILE_PACKETs to
+	// its port until the ring is destroyed.
+	bool open(boost::asio::ip::udp::socket& socket, Handler handler);
+
+	uint64_t packets() const { return m_packets; }
+	// Packets the ring had no room for and packets with a bad checksum
+	uint64_t drops();
+	uint64_t checksumErrors() const { return m_checksumErrors; }
+
+private:
+	void close();
+	void receive();
+	void readBlocks();
+	void readFrame(const uint8_t* frame);
+
+//////////////////////////////
+// Variables
+//////////////////////////////
+private:
+	boost::asio::posix::stream_descriptor m_descriptor;
+	size_t m_blockSize;
+	size_t m_blockCount;
+	uint8_t* m_ring;
+	size_t m_nextBlock;
+	Handler m_handler;
+
+	uint64_t m_packets;
+	uint64_t m_drops;
+	uint64_t m_checksumErrors;
+};
@@ -1,13 +1,37 @@
 #pragma once
 
-#include <deque>
+#include <vector>
 #include <boost/asio.hpp>
 
+#include <Config.h>
+
+//////////////////////////////
+// A Range is a set of packet ids. Internally the ids are split into chunks
+// of CHUNK_SIZE ids (roaring bitmap style). A chunk stores its ids either as
+// sorted runs or, once it fragments into more than MAX_RUNS runs, as a
+// bitmap. Marking a single id in a bitmap chunk is O(1), counting and
+// iteration use popcount / count trailing zeros and set union / difference
+// between bitmaps run word parallel.
+//
+// On the wire a Range starts with its Encoding followed by either
+//   INTERVALS: uint32 count, count x (uint64 start, uint64 end)
+//   BITMAP:    uint64 base, uint32 byteCount, bit i set <=> base + i in range
+//   RUNS:      uint32 count, count x (varint gap to previous end, varint length)
+// asBuffer() picks the smallest of them.
+//////////////////////////////
+
 class Range
 {
 public:
 	typedef std::pair<uint64_t, uint64_t> Interval;
 
+	enum Encoding : uint8_t {INTERVALS, BITMAP, RUNS};
+
+	static const uint32_t CHUNK_BITS = 16;
+	static const uint32_t CHUNK_SIZE = 1u << CHUNK_BITS;
+	static const uint32_t CHUNK_WORDS = CHUNK_SIZE / 64;
+	static const size_t MAX_RUNS = 512;
+
 public:
 	Range() {};
 	Range(int64_t number);
@@ -21,22 +45,69 @@ public:
 	void subtract(int64_t start, int64_t end);
 	void subtract(const Range &other);
 
-	uint8_t intervalCount() { return m_intervalCount = static_cast<uint8_t>(m_intervals.size()); }
+	size_t intervalCount() const;
 	size_t elementCount() const;
+	bool empty() const { return m_chunks.empty(); }
 
-	Range firstN(int64_t elements);
+	Range firstN(int64_t elements) const;
 	Range removeFirstN(int64_t elements);
 
-	bool contains(uint64_t x);
+	bool contains(uint64_t x) const;
+
+	// Smallest id and the interval starting with it without building all
+	// intervals, the range must not be empty
+	uint64_t first() const;
+	Interval firstInterval() const;
 
+	// Sorted, non adjacent intervals covering the range
+	std::vector<Interval> intervals() const;
 
-	// Range from Buffer
-	static std::shared_ptr<Range> fromBuffer(const uint8_t* data);
+	// Range from Buffer, nullptr if the buffer is truncated or malformed or
+	// holds ids at or past limit, which bounds the chunks a single datagram
+	// can make us build.
+	static std::shared_ptr<Range> fromBuffer(const uint8_t* data, size_t length, uint64_t limit = MAX_PACKET_ID);
 
-	// Range to Buffer
+	// Range to Buffer, in the smallest or in the given encoding
 	std::vector<boost::asio::const_buffer> asBuffer() const;
+	std::vector<boost::asio::const_buffer> asBuffer(Encoding encoding) const;
+	size_t encodedSize() const;
+	size_t encodedSize(Encoding encoding) const;
+	Encoding smallestEncoding() const;
     std::string toString() const;
 
+private:
+	// Chunk relative run [first, second)
+	typedef std::pair<uint32_t, uint32_t> Run;
+
+	struct Chunk {
+		uint64_t key;
+		uint32_t cardinality;
+		std::vector<Run> runs;
+		std::vector<uint64_t> bitmap;
+
+		explicit Chunk(uint64_t _key) : key(_key), cardinality(0) {}
+
+		bool isBitmap() const { return !bitmap.empty(); }
+		bool contains(uint32_t x) const;
+		bool next(uint32_t from, uint32_t& result) const;
+
+		void add(uint32_t start, uint32_t end);
+		void subtract(uint32_t start, uint32_t end);
+		void unite(const Chunk& other);
+		void difference(const Chunk& other);
+		Chunk firstN(uint32_t elements) const;
+
+		size_t runCount() const;
+		template<typename F> void forEachRun(F f) const;
+
+		void toBitmap();
+		void toRuns();
+		void optimize();
+	};
+
+	std::vector<Chunk>::iterator findChunk(uint64_t key);
+	std::vector<Chunk>::const_iterator findChunk(uint64_t key) const;
+	Chunk& chunk(uint64_t key);
 
 public:
     // member typedefs provided through inheriting from std::iterator
@@ -48,27 +119,39 @@ public:
                         uint64_t                       // reference
                         >
     {
-    	uint64_t num;
-    	std::deque<Interval>::iterator subIt;
-    	std::deque<Interval>::iterator subEnd;
+    	const Range* range;
+    	size_t chunkIndex;
+    	uint32_t local;
     public:
-        explicit iterator(std::deque<Interval>::iterator _subIt, std::deque<Interval>::iterator _subEnd) : subIt(_subIt), subEnd(_subEnd), num(_subIt->first) {}
-        explicit iterator(uint64_t _num) : num(_num) {}
-
-        iterator& operator++() {num = num + 1; if (num == subIt->second) { subIt++; num = subIt != subEnd ? subIt->first : num; }; return *this;}
+        explicit iterator(const Range* _range, size_t _chunkIndex) : range(_range), chunkIndex(_chunkIndex), local(0) {
+        	if( chunkIndex < range->m_chunks.size() ) {
+        		range->m_chunks[chunkIndex].next(0, local);
+        	}
+        }
+
+        iterator& operator++() {
+        	const std::vector<Chunk>& chunks = range->m_chunks;
+        	if( local + 1 < CHUNK_SIZE && chunks[chunkIndex].next(local + 1, local) ) {
+        		return *this;
+        	}
+        	local = 0;
+        	if( ++chunkIndex < chunks.size() ) {
+        		chunks[chunkIndex].next(0, local);
+        	}
+        	return *this;
+        }
         iterator operator++(int) {iterator retval = *this; ++(*this); return retval;}
-        bool operator==(iterator other) const {return num == other.num;}
+        bool operator==(iterator other) const {return chunkIndex == other.chunkIndex && local == other.local;}
         bool operator!=(iterator other) const {return !(*this == other);}
-        reference operator*() const {return num;}
+        reference operator*() const {return (range->m_chunks[chunkIndex].key << CHUNK_BITS) | local;}
     };
-    iterator begin() {return m_intervals.size() > 0 ? iterator(m_intervals.begin(), m_intervals.end()) : iterator(0);}
-    iterator end() {return m_intervals.size() > 0 ? iterator(m_intervals.back().second) : iterator(0);}
+    iterator begin() const {return iterator(this, 0);}
+    iterator end() const {return iterator(this, m_chunks.size());}
 
 private:
-	void mergeIntervals();
-
-	// Vector of sorted intervals
-	std::deque< Interval > m_intervals;
+	// Sorted by key, chunks are never empty
+	std::vector<Chunk> m_chunks;
 
-	uint8_t m_intervalCount;
-};
\ No newline at end of file
+	// Encoded wire representation, see asBuffer()
+	mutable std::vector<uint8_t> m_wireBuffer;
+};
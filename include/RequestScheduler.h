@@ -0,0 +1,116 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include <Config.h>
+#include <Range.h>
+
+//////////////////////////////
+// Orders the packets of the queued requests of all clients. Every client
+// has a queue per priority class; a higher class is served as long as one
+// of its clients can send. Within a class the queues take turns by deficit
+// round robin over bytes: a queue gets the quantum on its turn and sends
+// while its deficit covers the next packet, so a client asking for a few
+// packets does not wait behind another client's large ranges.
+//
+// An optional cap limits the bytes per second of every client with a token
+// bucket. A capped client is skipped, the others may use the bandwidth.
+//
+// Requests for the same content, e.g. one version of a file, can be
+// coalesced: once a packet is picked, coalesce() takes it from the other
+// queues waiting for it as well, so it is read once for all of them. Those
+// queues pay for it with their deficit and their bucket.
+//////////////////////////////
+
+class RequestScheduler {
+//////////////////////////////
+// Types
+//////////////////////////////
+public:
+	typedef std::chrono::steady_clock Clock;
+	typedef boost::asio::ip::udp::endpoint Client;
+
+	struct Packet {
+		Client client;
+		uint64_t ufid;
+		uint64_t packetId;
+		uint64_t content;
+		// Set on the last packet of a request, with the time it was queued
+		bool last;
+		Clock::time_point queued;
+	};
+
+private:
+	struct Request {
+		uint64_t ufid;
+		uint64_t content;
+		Range packets;
+		uint64_t packetBytes;
+		Clock::time_point queued;
+	};
+
+	struct Queue {
+		Queue() : deficit(0), turn(false) {}
+
+		std::deque<Request> requests;
+		// Coalesced packets may leave it negative
+		int64_t deficit;
+		// The queue got its quantum and is at the front of its class
+		bool turn;
+	};
+
+	struct Bucket {
+		double tokens;
+		Clock::time_point refilled;
+	};
+
+	typedef std::pair<Client, uint8_t> QueueKey;
+
+//////////////////////////////
+// Methods
+//////////////////////////////
+public:
+	// A rate cap of 0 does not limit the clients
+	explicit RequestScheduler(uint64_t quantum = DRR_QUANTUM, uint64_t rateCap = 0);
+
+	// Packets of the same transfer that are queued already are not queued
+	// again. Requests of content 0 are never coalesced.
+	void enqueue(const Client& client, uint8_t priority, uint64_t ufid, const Range& packets,
+		uint64_t packetBytes, Clock::time_point now, uint64_t content = 0);
+
+	// False if nothing is queued or every client with packets is capped
+	bool next(Clock::time_point now, Packet& packet);
+
+	// Adds the packet of other transfers of the same content to packets,
+	// at most limit of them, capped clients keep theirs
+	void coalesce(const Packet& packet, Clock::time_point now, size_t limit, std::vector<Packet>& packets);
+
+	bool empty() const { return m_queuedPackets == 0; }
+	uint64_t queuedPackets() const { return m_queuedPackets; }
+
+private:
+	bool capped(const Client& client, uint64_t bytes, Clock::time_point now);
+	void charge(const Client& client, uint64_t bytes);
+	void removeRequest(const QueueKey& key, std::deque<Request>::iterator request);
+	void pruneBuckets(Clock::time_point now);
+
+//////////////////////////////
+// Variables
+//////////////////////////////
+private:
+	uint64_t m_quantum;
+	double m_rateCap;
+
+	std::map<QueueKey, Queue> m_queues;
+	// Queues with packets in turn order, highest priority first
+	std::map<uint8_t, std::deque<QueueKey>, std::greater<uint8_t> > m_active;
+	std::map<Client, Bucket> m_buckets;
+	// Requests per queue for every content that is waited for
+	std::map<uint64_t, std::map<QueueKey, size_t> > m_content;
+	uint64_t m_queuedPackets;
+};
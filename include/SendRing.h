@@ -0,0 +1,65 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+#include <Message.h>
+
+//////////////////////////////
+// The send ring holds a fixed number of pre-encoded FILE_PACKET headers.
+// A slot is taken for every outgoing packet, only the packetId (and on a
+// new request the ufid) is stamped into the header and the slot hands out
+// a fixed scatter-gather array of header and payload. The slot has to be
+// released once the send operation completed.
+//////////////////////////////
+
+class SendRing {
+//////////////////////////////
+// Types
+//////////////////////////////
+public:
+	class Slot {
+	public:
+		typedef boost::array<boost::asio::const_buffer, 2> Buffers;
+
+		const Buffers& buffers() const { return m_buffers; }
+		uint64_t packetId() const { return m_packetId; }
+
+	private:
+		friend class SendRing;
+
+		uint8_t m_header[Message::FILE_PACKET_HEADER_SIZE];
+		Buffers m_buffers;
+		uint64_t m_ufid;
+		uint64_t m_packetId;
+		bool m_inUse;
+
+		// Keeps the payload alive while the send is in flight
+		std::shared_ptr<const void> m_payloadOwner;
+	};
+
+//////////////////////////////
+// Methods
+//////////////////////////////
+public:
+	explicit SendRing(size_t slotCount);
+
+	// Returns nullptr if all slots are in flight
+	Slot* acquire(uint64_t ufid, uint64_t packetId,
+		const uint8_t* payloadData, size_t payloadSize,
+		std::shared_ptr<const void> payloadOwner = std::shared_ptr<const void>());
+
+	void release(Slot* slot);
+
+	size_t slotCount() const { return m_slots.size(); }
+	size_t inFlight() const { return m_inFlight; }
+
+//////////////////////////////
+// Variables
+//////////////////////////////
+private:
+	std::vector<Slot> m_slots;
+	size_t m_next;
+	size_t m_inFlight;
+};
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <Config.h>
+#include <Range.h>
+
+//////////////////////////////
+// Destination of a transfer. The engine opens the sink once the file size
+// is known and then writes every received payload at its file offset, in
+// whatever order the packets arrive.
+//////////////////////////////
+
+class Sink {
+public:
+	virtual ~Sink() {}
+
+	// Returns false if the sink can not hold a file of the given size
+	virtual bool open(uint64_t fileSize) = 0;
+	virtual void write(uint64_t offset, const uint8_t* data, size_t size) = 0;
+
+	// Packets the transfer requests, all packets of the file by default
+	virtual Range packets(uint64_t fileSize, uint64_t packetSize) const;
+
+	// Sidecar that lets an interrupted transfer resume, empty if the sink
+	// does not keep data across runs
+	virtual std::string checkpointPath() const { return std::string(); }
+
+	// Whether open kept an existing file, a checkpoint of a new file does
+	// not describe its content
+	virtual bool keptFile() const { return false; }
+
+	// Puts everything written so far into the file, before a checkpoint
+	// records it as written
+	virtual void flush() {}
+
+	// End of the bytes the sink takes now. A streaming sink only takes the
+	// bytes of its window and calls the listener once the window moved
+	// without a write.
+	virtual uint64_t windowEnd() const { return UINT64_MAX; }
+	virtual void setWindowListener(std::function<void()>) {}
+
+	// Called once after the last packet was written
+	virtual void close() {}
+};
+
+// Writes into a memory mapped file. An existing file of the right size is
+// kept, so an interrupted transfer can resume into it.
+class MappedFileSink : public Sink {
+public:
+	explicit MappedFileSink(const std::string& path);
+
+	bool open(uint64_t fileSize) override;
+	void write(uint64_t offset, const uint8_t* data, size_t size) override;
+	void close() override;
+	std::string checkpointPath() const override { return m_path + ".reach"; }
+	bool keptFile() const override { return m_kept; }
+
+private:
+	std::string m_path;
+	boost::iostreams::mapped_file_sink m_file;
+	bool m_kept;
+};
+
+// Writes through aligned in-memory extents with O_DIRECT, bypassing the
+// page cache. An extent is written once every byte of it arrived; if the
+// extents in memory reach the dirty limit, the fullest one is merged with
+// the file and written early. The file is preallocated at open. Falls back
+// to buffered writes on file systems without O_DIRECT. Writes are
+// synchronous, an extent costs one pwrite on the calling thread.
+class DirectFileSink : public Sink {
+public:
+	explicit DirectFileSink(const std::string& path, uint64_t dirtyLimit = DIRECT_DIRTY_LIMIT);
+	~DirectFileSink();
+
+	bool open(uint64_t fileSize) override;
+	void write(uint64_t offset, const uint8_t* data, size_t size) override;
+	void flush() override;
+	void close() override;
+	std::string checkpointPath() const override { return m_path + ".reach"; }
+	bool keptFile() const override { return m_kept; }
+
+	uint64_t dirtyBytes() const { return m_extents.size() * DIRECT_EXTENT_SIZE; }
+	bool direct() const { return m_direct; }
+
+private:
+	struct Extent {
+		uint8_t* data;
+		// Bytes of the extent that were written, relative to its start
+		Range filled;
+	};
+
+	uint64_t extentLength(uint64_t extent) const;
+	Extent& extent(uint64_t extent);
+	void writeExtent(uint64_t extent);
+
+	std::string m_path;
+	uint64_t m_dirtyLimit;
+	int m_fd;
+	bool m_direct;
+	bool m_kept;
+	uint64_t m_fileSize;
+	std::unordered_map<uint64_t, Extent> m_extents;
+	// Buffers of written extents for reuse
+	std::vector<uint8_t*> m_free;
+};
+
+// Writes the file in order to a pipe or any other descriptor, the
+// descriptor is not closed. Packets are reordered in a ring of the window
+// size, at least one packet, and the contiguous prefix is written as soon as it is complete.
+// Writes do not block; while the consumer lags the window stays put, so
+// the transfer does not request past it. close() blocks until the rest is
+// written.
+class StreamSink : public Sink {
+public:
+	StreamSink(boost::asio::io_service& io_service, int fd, uint64_t window = STREAM_WINDOW);
+	~StreamSink();
+
+	bool open(uint64_t fileSize) override;
+	void write(uint64_t offset, const uint8_t* data, size_t size) override;
+	void close() override;
+	uint64_t windowEnd() const override { return m_emitted + m_ring.size(); }
+	void setWindowListener(std::function<void()> listener) override { m_listener = listener; }
+
+	uint64_t emittedBytes() const { return m_emitted; }
+
+private:
+	// Writes the complete prefix until the descriptor is full
+	void emit();
+	void waitWritable();
+
+	boost::asio::posix::stream_descriptor m_descriptor;
+	std::vector<uint8_t> m_ring;
+	uint64_t m_fileSize;
+	uint64_t m_emitted;
+	// Bytes in the ring, at their file offsets
+	Range m_filled;
+	bool m_waiting;
+	bool m_failed;
+	std::function<void()> m_listener;
+};
+
+// Collects the file in memory
+class MemorySink : public Sink {
+public:
+	bool open(uint64_t fileSize) override;
+	void write(uint64_t offset, const uint8_t* data, size_t size) override;
+
+	const std::vector<uint8_t>& data() const { return m_data; }
+
+private:
+	std::vector<uint8_t> m_data;
+};
+
+// Reads byte ranges of the file into caller buffers. Only the packets that
+// overlap a range are requested, so a 4 KB read moves one or two packets.
+// Ranges may overlap; the part of a range past the end of the file is left
+// untouched.
+class ScatterSink : public Sink {
+public:
+	struct Buffer {
+		uint64_t offset;
+		uint64_t length;
+		uint8_t* data;
+	};
+
+	explicit ScatterSink(const std::vector<Buffer>& buffers);
+
+	bool open(uint64_t fileSize) override;
+	void write(uint64_t offset, const uint8_t* data, size_t size) override;
+	Range packets(uint64_t fileSize, uint64_t packetSize) const override;
+
+private:
+	// Sorted by offset
+	std::vector<Buffer> m_buffers;
+	uint64_t m_maxLength;
+};
+
+// Drops the payload, for benchmarks
+class NullSink : public Sink {
+public:
+	bool open(uint64_t) override { return true; }
+	void write(uint64_t, const uint8_t*, size_t) override {}
+};
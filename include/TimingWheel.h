@@ -0,0 +1,128 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <Config.h>
+
+//////////////////////////////
+// Hashed hierarchical timing wheel for coarse deadlines like request
+// timeouts. LEVELS wheels of SLOTS slots hold the armed timers in
+// intrusive lists, a slot of level n spans SLOTS^n ticks. Arming and
+// cancelling a timer links or unlinks it in O(1) without allocating, the
+// timers of a higher level move down once the level below wrapped around.
+//
+// One steady_timer drives the wheel while timers are armed. It wakes up
+// for the next occupied slot of the lowest level, or for the next
+// cascade if only later timers are armed, and expires every slot up to
+// the current time in one batch. A timer fires at most one tick late and
+// never early. Timers with a deadline beyond the top level go around it.
+//
+// Not thread safe, timers are armed and fire on the io_service thread.
+//////////////////////////////
+
+class TimingWheel {
+//////////////////////////////
+// Types
+//////////////////////////////
+public:
+	typedef std::chrono::steady_clock Clock;
+	typedef std::function<void()> Handler;
+
+	static const int LEVELS = 4;
+	static const int SLOT_BITS = 6;
+	static const uint64_t SLOTS = 1 << SLOT_BITS;
+
+private:
+	struct Node {
+		Node() : prev(this), next(this) {}
+		Node(const Node&) = delete;
+		Node& operator=(const Node&) = delete;
+
+		bool linked() const { return next != this; }
+		void unlink();
+
+		Node* prev;
+		Node* next;
+	};
+
+public:
+	// Embedded in its owner, the destructor cancels it
+	class Timer : private Node {
+	public:
+		explicit Timer(TimingWheel& wheel);
+		~Timer();
+
+		// Replaces the deadline and handler of an armed timer
+		void expiresAt(Clock::time_point deadline, Handler handler);
+		void expiresAfter(Clock::duration delay, Handler handler);
+
+		// The handler is not called
+		void cancel();
+		bool armed() const { return linked(); }
+
+	private:
+		friend class TimingWheel;
+
+		TimingWheel* m_wheel;
+		uint64_t m_expiry;
+		int m_level;
+		Handler m_handler;
+	};
+
+//////////////////////////////
+// Methods
+//////////////////////////////
+public:
+	explicit TimingWheel(boost::asio::io_service& io_service,
+		std::chrono::microseconds tick = std::chrono::microseconds(TIMING_WHEEL_TICK_US));
+	~TimingWheel();
+
+	size_t armed() const { return m_armed; }
+
+	// Times the steady_timer woke the wheel and timers it expired
+	uint64_t wakeups() const { return m_wakeups; }
+	uint64_t expired() const { return m_expired; }
+
+private:
+	// The first tick at or after the time point and the tick we are in
+	uint64_t tickOf(Clock::time_point time) const;
+	uint64_t currentTick() const;
+
+	void link(Timer& timer);
+	void unlink(Timer& timer);
+	// Puts the timer into the slot of its expiry relative to m_now
+	void place(Timer& timer);
+
+	void advance(uint64_t now);
+	void cascade(int level);
+	void expireSlot(size_t slot);
+
+	// The next tick that expires timers or cascades, m_armed must not be 0
+	uint64_t nextWake() const;
+	void wakeAt(uint64_t tick);
+	void onTick(const boost::system::error_code& error);
+
+//////////////////////////////
+// Variables
+//////////////////////////////
+private:
+	boost::asio::steady_timer m_tickTimer;
+	Clock::duration m_tick;
+	Clock::time_point m_origin;
+
+	// Every tick up to m_now was processed
+	uint64_t m_now;
+	Node m_slots[LEVELS][SLOTS];
+	size_t m_levelCount[LEVELS];
+	size_t m_armed;
+
+	// The tick the steady_timer waits for, 0 if it does not wait
+	uint64_t m_wakeTick;
+
+	uint64_t m_wakeups;
+	uint64_t m_expired;
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//////////////////////////////
+// Event tracer for stalled transfers. Every thread records fixed size
+// events into its own ring buffer, so recording is a TSC read and four
+// stores without locks or allocation. The newest TRACE_BUFFER_EVENTS events
+// per thread are kept and can be written as Chrome / Perfetto trace JSON.
+//
+// The REACH_TRACE hook compiles to nothing unless the tree is configured
+// with -DREACH_ENABLE_TRACE=ON.
+//////////////////////////////
+
+#ifdef REACH_TRACE_ENABLED
+#define REACH_TRACE(type, ufid, value) Trace::record(Trace::type, (ufid), (value))
+#else
+#define REACH_TRACE(type, ufid, value) ((void)0)
+#endif
+
+class Trace {
+//////////////////////////////
+// Types
+//////////////////////////////
+public:
+	enum Type : uint8_t {
+		REQUEST_SENT,
+		REQUEST_RECEIVED,
+		PACKET_SENT,
+		PACKET_RECEIVED,
+		TIMEOUT,
+		RETRANSMIT
+	};
+
+	struct Event {
+		uint64_t timestamp;
+		uint64_t ufid;
+		uint64_t value;
+		Type type;
+	};
+
+//////////////////////////////
+// Methods
+//////////////////////////////
+public:
+	static inline void record(Type type, uint64_t ufid, uint64_t value)
+	{
+		Buffer* buffer = s_threadBuffer;
+		if( !buffer ) {
+			buffer = registerThread();
+		}
+
+		// Only the owning thread writes, the release store publishes the event
+		uint64_t head = buffer->head.load(std::memory_order_relaxed);
+		Event& event = buffer->events[head & (buffer->events.size() - 1)];
+		event.timestamp = timestamp();
+		event.ufid = ufid;
+		event.value = value;
+		event.type = type;
+		buffer->head.store(head + 1, std::memory_order_release);
+	}
+
+	static inline uint64_t timestamp()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+	}
+
+	// Copies the recorded events of all threads, oldest first per thread.
+	// Events written while the snapshot is taken may be torn, so dump when
+	// the traced threads are idle or stopped.
+	static std::vector<std::vector<Event> > snapshot();
+
+	// {"traceEvents":[...]} with one instant event per recorded event
+	static void writeChromeJson(std::ostream& output);
+
+	// Discards all recorded events
+	static void clear();
+
+	static const char* name(Type type);
+
+private:
+	struct Buffer {
+		std::atomic<uint64_t> head;
+		std::vector<Event> events;
+	};
+
+	static Buffer* registerThread();
+
+//////////////////////////////
+// Variables
+//////////////////////////////
+private:
+	static thread_local Buffer* s_threadBuffer;
+
+	// Buffers outlive their threads so events can be dumped after a worker
+	// has exited, they are never freed
+	static std::vector<Buffer*> s_buffers;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <boost/asio.hpp>
+#include <SendRing.h>
+
+//////////////////////////////
+// Sends SendRing slots with MSG_ZEROCOPY. The kernel references the header
+// and the mapped payload pages instead of copying them, so a slot stays in
+// use, and keeps its payload owner alive, until the completion for its send
+// arrived on the error queue of the socket. Every zerocopy send of a socket
+// gets the next 32 bit sequence number; completions report ranges of them.
+//
+// Sends the kernel refuses with EAGAIN or ENOBUFS, and payloads below
+// ZEROCOPY_MIN_PAYLOAD, take the copying async_send_to path instead.
+//////////////////////////////
+
+class ZeroCopySender {
+//////////////////////////////
+// Methods
+//////////////////////////////
+public:
+	// Sets SO_ZEROCOPY on the socket, false if the kernel does not support it
+	static bool enable(boost::asio::ip::udp::socket& socket);
+
+	ZeroCopySender(boost::asio::ip::udp::socket& socket, SendRing& ring);
+
+	// Releases the slot once the kernel no longer needs its buffers
+	void send(SendRing::Slot* slot, const boost::asio::ip::udp::endpoint& destination);
+
+	size_t pending() const { return m_pending.size(); }
+	uint64_t zeroCopySends() const { return m_zeroCopySends; }
+	// Completions for which the kernel copied after all, always the case
+	// on loopback
+	uint64_t copiedSends() const { return m_copiedSends; }
+
+private:
+	void sendCopy(SendRing::Slot* slot, const boost::asio::ip::udp::endpoint& destination);
+	void waitForCompletions();
+	void readCompletions();
+	void complete(uint32_t first, uint32_t last);
+
+//////////////////////////////
+// Variables
+//////////////////////////////
+private:
+	boost::asio::ip::udp::socket& m_socket;
+	SendRing& m_ring;
+
+	// Slots by sequence number from m_firstSequence on, nullptr once done
+	std::deque<SendRing::Slot*> m_pending;
+	uint32_t m_firstSequence;
+	bool m_waiting;
+
+	uint64_t m_zeroCopySends;
+	uint64_t m_copiedSends;
+};
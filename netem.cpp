@@ -0,0 +1,295 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <map>
+#include <queue>
+#include <csignal>
+
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/program_options.hpp>
+
+#include <Config.h>
+#include <Impairment.h>
+
+#define BOOST_LOG_DYN_LINK 1
+#include <boost/log/trivial.hpp>
+
+using boost::asio::ip::udp;
+using namespace boost::asio;
+
+//////////////////////////////
+// UDP relay between reach clients and a reach server that impairs the
+// traffic in both directions. Every client endpoint gets its own upstream
+// socket so the server's responses can be routed back.
+//////////////////////////////
+
+class ReachNetem
+{
+public:
+  ReachNetem(boost::asio::io_service& io_service, unsigned short port, udp::endpoint serverEndpoint,
+      const Impairment::Config& up, const Impairment::Config& down, uint64_t seed)
+    : m_ioService(io_service),
+      m_socket(io_service, udp::endpoint(udp::v4(), port)),
+      m_serverEndpoint(serverEndpoint),
+      m_up(up, seed),
+      m_down(down, seed + 1),
+      m_timer(io_service),
+      m_nextSequence(0)
+  {
+    boost::asio::spawn(io_service, [this](yield_context yield) {
+      receiveDownstream(yield);
+    });
+    boost::asio::spawn(io_service, [this](yield_context yield) {
+      deliver(yield);
+    });
+  }
+
+  void writeStatistics(std::ostream& output) const {
+    output << "{\"up\":";
+    writeStatistics(output, m_up.statistics());
+    output << ",\"down\":";
+    writeStatistics(output, m_down.statistics());
+    output << ",\"sessions\":" << m_sessions.size() << "}" << std::endl;
+  }
+
+private:
+  struct Session {
+    Session(boost::asio::io_service& io_service, const udp::endpoint& _client)
+      : client(_client), upstream(io_service, udp::endpoint(udp::v4(), 0)) {}
+
+    udp::endpoint client;
+    udp::socket upstream;
+  };
+
+  struct Pending {
+    Impairment::Clock::time_point departure;
+    uint64_t sequence;
+    udp::socket* socket;
+    udp::endpoint destination;
+    std::shared_ptr<std::vector<uint8_t> > data;
+
+    bool operator>(const Pending& other) const {
+      return departure != other.departure ? departure > other.departure : sequence > other.sequence;
+    }
+  };
+
+  static void writeStatistics(std::ostream& output, const Impairment::Statistics& s) {
+    output << "{\"packets\":" << s.packets << ",\"bytes\":" << s.bytes
+      << ",\"lost\":" << s.lost << ",\"queue_dropped\":" << s.queueDropped
+      << ",\"duplicated\":" << s.duplicated << ",\"reordered\":" << s.reordered << "}";
+  }
+
+  // Client -> relay -> server
+  void receiveDownstream(boost::asio::yield_context yield) {
+    boost::array<uint8_t, MAX_MESSAGE_SIZE> buffer;
+
+    for(;;) {
+      boost::system::error_code ec;
+      udp::endpoint client;
+      size_t messageSize = m_socket.async_receive_from(boost::asio::buffer(buffer), client, yield[ec]);
+
+      if( ec == boost::asio::error::operation_aborted ) {
+        return;
+      } else if( ec ) {
+        continue;
+      }
+
+      auto sessionIt = m_sessions.find(client);
+      if( sessionIt == m_sessions.end() ) {
+        BOOST_LOG_TRIVIAL(info) << "New session: " << client;
+        std::shared_ptr<Session> session(new Session(m_ioService, client));
+        sessionIt = m_sessions.insert(std::make_pair(client, session)).first;
+        boost::asio::spawn(m_ioService, [this, session](yield_context yield) {
+          receiveUpstream(session, yield);
+        });
+      }
+
+      enqueue(m_up, &sessionIt->second->upstream, m_serverEndpoint, buffer.data(), messageSize);
+    }
+  }
+
+  // Server -> relay -> client
+  void receiveUpstream(std::shared_ptr<Session> session, boost::asio::yield_context yield) {
+    boost::array<uint8_t, MAX_MESSAGE_SIZE> buffer;
+
+    for(;;) {
+      boost::system::error_code ec;
+      udp::endpoint sender;
+      size_t messageSize = session->upstream.async_receive_from(boost::asio::buffer(buffer), sender, yield[ec]);
+
+      if( ec == boost::asio::error::operation_aborted ) {
+        return;
+      } else if( ec ) {
+        continue;
+      }
+
+      enqueue(m_down, &m_socket, session->client, buffer.data(), messageSize);
+    }
+  }
+
+  void enqueue(Impairment& impairment, udp::socket* socket, const udp::endpoint& destination,
+      const uint8_t* data, size_t size) {
+    m_departures.clear();
+    impairment.schedule(Impairment::Clock::now(), size, m_departures);
+    if( m_departures.empty() ) {
+      return;
+    }
+
+    std::shared_ptr<std::vector<uint8_t> > copy(new std::vector<uint8_t>(data, data + size));
+    bool wakeUp = false;
+    for( Impairment::Clock::time_point departure : m_departures ) {
+      wakeUp |= m_pending.empty() || departure < m_pending.top().departure;
+      Pending pending = {departure, m_nextSequence++, socket, destination, copy};
+      m_pending.push(pending);
+    }
+
+    // The delivery loop sleeps until the earliest departure
+    if( wakeUp ) {
+      m_timer.cancel();
+    }
+  }
+
+  void deliver(boost::asio::yield_context yield) {
+    for(;;) {
+      boost::system::error_code ec;
+      if( m_pending.empty() ) {
+        m_timer.expires_from_now(std::chrono::hours(24));
+      } else {
+        m_timer.expires_at(m_pending.top().departure);
+      }
+      m_timer.async_wait(yield[ec]);
+
+      Impairment::Clock::time_point now = Impairment::Clock::now();
+      while( !m_pending.empty() && m_pending.top().departure <= now ) {
+        const Pending& pending = m_pending.top();
+        pending.socket->send_to(boost::asio::buffer(*pending.data), pending.destination, 0, ec);
+        m_pending.pop();
+      }
+    }
+  }
+
+private:
+  boost::asio::io_service& m_ioService;
+  udp::socket m_socket;
+  udp::endpoint m_serverEndpoint;
+
+  Impairment m_up;
+  Impairment m_down;
+  std::vector<Impairment::Clock::time_point> m_departures;
+
+  std::map<udp::endpoint, std::shared_ptr<Session> > m_sessions;
+
+  boost::asio::steady_timer m_timer;
+  std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending> > m_pending;
+  uint64_t m_nextSequence;
+};
+
+int main(int argc, char** argv)
+{
+    namespace po = boost::program_options;
+    po::options_description desc("Impair REACH UDP traffic between client and server");
+    desc.add_options()
+      ("help", "Print help messages")
+      ("port", po::value<unsigned short>()->default_value(REACH_PORT), "Port the clients connect to")
+      ("server", po::value<std::string>()->default_value("127.0.0.1"), "Address of the server")
+      ("server-port", po::value<unsigned short>()->default_value(REACH_PORT + 1), "Port of the server")
+      ("direction", po::value<std::string>()->default_value("both"), "Impaired direction: both, up (to server) or down (to client)")
+      ("loss", po::value<double>()->default_value(0), "Random loss probability")
+      ("burst-enter", po::value<double>()->default_value(0), "Gilbert-Elliott probability good -> bad")
+      ("burst-exit", po::value<double>()->default_value(1), "Gilbert-Elliott probability bad -> good")
+      ("burst-loss-good", po::value<double>()->default_value(0), "Loss probability in the good state")
+      ("burst-loss-bad", po::value<double>()->default_value(1), "Loss probability in the bad state")
+      ("duplicate", po::value<double>()->default_value(0), "Duplication probability")
+      ("reorder", po::value<double>()->default_value(0), "Probability that a datagram skips the delay")
+      ("delay", po::value<double>()->default_value(0), "One way delay in ms")
+      ("jitter", po::value<double>()->default_value(0), "Uniform jitter in ms")
+      ("rate", po::value<double>()->default_value(0), "Bandwidth cap in Mbit/s (0 = unlimited)")
+      ("queue-limit", po::value<double>()->default_value(100), "Maximum queueing delay in ms before tail drop")
+      ("seed", po::value<uint64_t>()->default_value(1), "Random seed")
+      ("duration", po::value<double>(), "Exit after the given number of seconds")
+      ("stats", po::value<std::string>(), "Write JSON statistics to this file on exit instead of stdout");
+
+    po::variables_map vm;
+    try
+    {
+      po::store(po::parse_command_line(argc, argv, desc), vm);
+
+      if ( vm.count("help")  )
+      {
+        std::cout << desc << std::endl;
+        return 0;
+      }
+
+      po::notify(vm); // throws on error, so do after help in case
+                      // there are any problems
+    }
+    catch(po::error& e)
+    {
+      std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
+      std::cerr << desc << std::endl;
+      return 1;
+    }
+
+  try
+  {
+    Impairment::Config config;
+    config.loss = vm["loss"].as<double>();
+    config.burstEnter = vm["burst-enter"].as<double>();
+    config.burstExit = vm["burst-exit"].as<double>();
+    config.burstLossGood = vm["burst-loss-good"].as<double>();
+    config.burstLossBad = vm["burst-loss-bad"].as<double>();
+    config.duplicate = vm["duplicate"].as<double>();
+    config.reorder = vm["reorder"].as<double>();
+    config.delayUs = static_cast<uint64_t>(vm["delay"].as<double>() * 1000);
+    config.jitterUs = static_cast<uint64_t>(vm["jitter"].as<double>() * 1000);
+    config.rateBps = static_cast<uint64_t>(vm["rate"].as<double>() * 1000000);
+    config.queueLimitUs = static_cast<uint64_t>(vm["queue-limit"].as<double>() * 1000);
+
+    std::string direction = vm["direction"].as<std::string>();
+    Impairment::Config up = direction == "down" ? Impairment::Config() : config;
+    Impairment::Config down = direction == "up" ? Impairment::Config() : config;
+
+    boost::asio::io_service io_service;
+    udp::endpoint serverEndpoint(
+      boost::asio::ip::address_v4::from_string(vm["server"].as<std::string>()),
+      vm["server-port"].as<unsigned short>());
+
+    ReachNetem netem(io_service, vm["port"].as<unsigned short>(), serverEndpoint,
+      up, down, vm["seed"].as<uint64_t>());
+
+    boost::asio::signal_set signals(io_service, SIGINT, SIGTERM);
+    signals.async_wait([&](const boost::system::error_code&, int) {
+      io_service.stop();
+    });
+
+    boost::asio::steady_timer durationTimer(io_service);
+    if( vm.count("duration") ) {
+      durationTimer.expires_from_now(std::chrono::milliseconds(
+        static_cast<int64_t>(vm["duration"].as<double>() * 1000)));
+      durationTimer.async_wait([&](const boost::system::error_code& ec) {
+        if( !ec ) {
+          io_service.stop();
+        }
+      });
+    }
+
+    io_service.run();
+
+    if( vm.count("stats") ) {
+      std::ofstream statsFile(vm["stats"].as<std::string>());
+      netem.writeStatistics(statsFile);
+    } else {
+      netem.writeStatistics(std::cout);
+    }
+  }
+  catch (std::exception& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,57 @@
+#!/bin/bash
+#
+# Runs reach_client through reach_netem against a local reach_server for a
+# set of WAN scenarios and prints one CSV line per run:
+#   scenario,seconds,bytes,mbit_per_s,verified,netem_stats_json
+#
+# Usage: scripts/netem_run.sh <build dir> <file> [scenario...]
+# Scenarios: clean lossy bursty wan reorder (default: all)
+
+set -u
+
+BUILD=${1:?build directory}
+FILE=$(readlink -f "${2:?file to transfer}")
+shift 2
+SCENARIOS=${*:-clean lossy bursty wan reorder}
+
+PORT=${REACH_PORT:-52123}
+SERVER_PORT=$((PORT + 1))
+TIMEOUT=${REACH_TIMEOUT:-300}
+WORKDIR=$(mktemp -d)
+trap 'kill $SERVER_PID 2>/dev/null; rm -rf "$WORKDIR"' EXIT
+
+scenario_options() {
+  case "$1" in
+    clean)   echo "" ;;
+    lossy)   echo "--loss 0.01" ;;
+    bursty)  echo "--burst-enter 0.002 --burst-exit 0.1" ;;
+    wan)     echo "--delay 25 --jitter 5 --rate 100 --loss 0.005" ;;
+    reorder) echo "--delay 5 --jitter 2 --reorder 0.05 --duplicate 0.01" ;;
+    *)       echo "unknown scenario $1" >&2; exit 1 ;;
+  esac
+}
+
+"$BUILD/reach_server" --port $SERVER_PORT > "$WORKDIR/server.log" 2>&1 &
+SERVER_PID=$!
+
+echo "scenario,seconds,bytes,mbit_per_s,verified,netem"
+for scenario in $SCENARIOS; do
+  "$BUILD/reach_netem" --port $PORT --server-port $SERVER_PORT \
+    --stats "$WORKDIR/$scenario.json" $(scenario_options $scenario) > "$WORKDIR/netem.log" 2>&1 &
+  NETEM_PID=$!
+  sleep 0.2
+
+  rm -f "$WORKDIR/client_received.bin" "$WORKDIR"/*.reach
+  start=$(date +%s.%N)
+  (cd "$WORKDIR" && timeout $TIMEOUT "$BUILD/reach_client" --port $PORT "$FILE" > client.log 2>&1)
+  end=$(date +%s.%N)
+
+  kill -INT $NETEM_PID
+  wait $NETEM_PID 2>/dev/null
+
+  bytes=$(stat -c %s "$FILE")
+  verified=false
+  cmp -s "$FILE" "$WORKDIR/client_received.bin" && verified=true
+  awk -v s=$scenario -v a=$start -v b=$end -v n=$bytes -v v=$verified -v j="$(cat $WORKDIR/$scenario.json)" \
+    'BEGIN { t = b - a; printf "%s,%.3f,%d,%.1f,%s,%s\n", s, t, n, n * 8 / t / 1e6, v, j }'
+done
@@ -3,15 +3,35 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 #include <iostream>
+#include <fstream>
 #include <string>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <csignal>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <boost/array.hpp>
 #include <boost/asio.hpp>
 #include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/asio/spawn.hpp>
 #include <boost/asio/async_result.hpp>
+#include <boost/program_options.hpp>
 
 #include <Config.h>
 #include <Message.h>
+#include <SendRing.h>
+#include <ZeroCopy.h>
+#include <RequestScheduler.h>
+#include <HotSet.h>
+#include <BusyPoll.h>
+#include <Histogram.h>
+#include <Trace.h>
 
 #define BOOST_LOG_DYN_LINK 1
 #include <boost/log/trivial.hpp>
@@ -24,11 +44,120 @@ using namespace boost::asio;
 class ReachServer
 {
 public:
-    ReachServer(boost::asio::io_service& io_service)
-    : socket_(io_service, udp::endpoint(udp::v4(), REACH_PORT))
+    ReachServer(boost::asio::io_service& io_service, unsigned short port)
+    : io_service_(io_service),
+      socket_(io_service, udp::endpoint(udp::v4(), port)),
+      m_sendRing(SEND_RING_SIZE),
+      m_requestService(m_metrics.histogram("reach_server_request_service_us", "Time to send all packets of a request in us")),
+      m_requestPackets(m_metrics.histogram("reach_server_request_packets", "Packets per request")),
+      m_retransmitBursts(m_metrics.histogram("reach_server_retransmit_burst_packets", "Length of runs of packets requested again")),
+      m_packetFanout(m_metrics.histogram("reach_server_packet_fanout", "Clients a packet was read and sent for at once")),
+      m_metricsTimer(io_service),
+      m_multicastRate(0),
+      m_multicastTimer(io_service),
+      m_random(std::random_device()()),
+      m_tracker(false),
+      m_scheduleTimer(io_service)
     {
     }
 
+    // Files are sent to the group at the given rate in bytes per second and
+    // the clients only request the packets the group lost
+    void enableMulticast(const udp::endpoint& group, const boost::asio::ip::address_v4& interface, uint64_t rate)
+    {
+        if( !interface.is_unspecified() ) {
+            socket_.set_option(boost::asio::ip::multicast::outbound_interface(interface));
+        }
+        m_multicastGroup = group;
+        m_multicastRate = rate;
+    }
+
+    // Payloads are sent from the mapped pages with MSG_ZEROCOPY, a slot and
+    // its mapping are kept until the kernel reported the send complete
+    bool enableZeroCopy()
+    {
+        if( !ZeroCopySender::enable(socket_) ) {
+            return false;
+        }
+        m_zeroCopy.reset(new ZeroCopySender(socket_, m_sendRing));
+        return true;
+    }
+
+    // Clients of the same file version learn about each other and fetch
+    // packets from their peers
+    void enableTracker()
+    {
+        m_tracker = true;
+    }
+
+    // Receives poll the NIC queue instead of waiting for its interrupt
+    bool enableBusyPoll()
+    {
+        return BusyPoll::enableSocket(socket_.native_handle());
+    }
+
+    // Every client gets at most the given bytes per second, the bandwidth
+    // it leaves goes to the other clients
+    void limitClientRate(uint64_t rate)
+    {
+        m_scheduler = RequestScheduler(DRR_QUANTUM, rate);
+    }
+
+    // Maps and prefaults the files of the manifest before the server is
+    // ready, they stay mapped while they are current. The files served are
+    // recorded to the manifest for the next start.
+    void enableHotSet(const std::string& manifest, const HotSet::WarmOptions& options)
+    {
+        m_hotSet.reset(new HotSet());
+        m_hotSetManifest = manifest;
+        if( !m_hotSet->load(manifest) ) {
+            BOOST_LOG_TRIVIAL(error) << "Reading hot set " << manifest << " failed";
+            return;
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::vector<HotSet::Region> regions;
+        std::vector<std::string> paths = m_hotSet->paths();
+        for( const std::string& path : paths ) {
+            uint64_t version = 0;
+            std::shared_ptr<boost::iostreams::mapped_file_source> source = openSource(path, version);
+            if( source ) {
+                m_hotSources[path] = source;
+                HotSet::Region region = {source->data(), source->size()};
+                regions.push_back(region);
+            } else {
+                m_hotSet->forget(path);
+            }
+        }
+
+        HotSet::WarmResult result = HotSet::warm(regions, options);
+        BOOST_LOG_TRIVIAL(info) << "Warmed " << regions.size() << " files, " << result.faultedBytes / (1024 * 1024) << " MB ("
+            << result.lockedBytes / (1024 * 1024) << " MB locked) in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << " ms";
+    }
+
+    void saveHotSet()
+    {
+        if( m_hotSet && !m_hotSet->save(m_hotSetManifest) ) {
+            BOOST_LOG_TRIVIAL(error) << "Writing hot set " << m_hotSetManifest << " failed";
+        }
+    }
+
+    // Periodically replaces the file with the metrics in Prometheus text format
+    void exportMetrics(const std::string& path, int intervalSeconds, boost::asio::yield_context yield)
+    {
+        for(;;)
+        {
+            boost::system::error_code error;
+            m_metricsTimer.expires_from_now(boost::posix_time::seconds(intervalSeconds));
+            m_metricsTimer.async_wait(yield[error]);
+
+            if( !m_metrics.writePrometheusFile(path) ) {
+                BOOST_LOG_TRIVIAL(error) << "Writing metrics to " << path << " failed";
+            }
+        }
+    }
+
     void receiveMessage(boost::asio::yield_context yield)
     {
         for(;;)
@@ -40,30 +169,78 @@ public:
             if (!error || error == boost::asio::error::message_size)
             {
               auto message = Message::fromBuffer(recv_buffer_.data(), messageSize);
+              if( !message ) {
+                  continue;
+              }
               size_t packetSize = 8 * 1024;
 
               switch( message->type() ) {
                 case Message::REQ_FILE: {
                     BOOST_LOG_TRIVIAL(info) << "Opening File: " << message->path();
-                    m_fileSource.reset(new boost::iostreams::mapped_file_source(message->path()));
+                    uint64_t fileVersion = 0;
+                    std::shared_ptr<boost::iostreams::mapped_file_source> source = openSource(message->path(), fileVersion);
+                    if( !source ) {
+                        break;
+                    }
+
+                    // Every transfer of a client has its own ufid
+                    OpenFile& file = m_openFiles[TransferKey(remote_endpoint_, message->ufid())];
+                    file.source = source;
+                    file.lastUsed = std::chrono::steady_clock::now();
+                    file.swarm = SwarmKey(message->path(), fileVersion);
+                    file.priority = message->priority();
+                    if( m_hotSet ) {
+                        m_hotSet->record(message->path());
+                    }
+
+                    auto response = Message::createFileInfo(message->ufid(), source->size(), packetSize, fileVersion);
+                    if( m_multicastRate > 0 && source->size() > 0 ) {
+                        const MulticastSession& session = joinSession(message->path(), source, fileVersion, packetSize);
+                        response = Message::createFileInfo(message->ufid(), source->size(), packetSize, fileVersion, session.id, m_multicastGroup);
+                    }
+                    socket_.async_send_to(response->asBuffer(), remote_endpoint_, yield[error]);
+                    if( m_tracker && fileVersion != 0 ) {
+                        socket_.async_send_to(swarmPeers(file, message->ufid())->asBuffer(), remote_endpoint_, yield[error]);
+                    }
+                    break;
+                }
 
-                    auto response = Message::createFileInfo(message->ufid(), m_fileSource->size(), packetSize);
-                    socket_.async_send_to(response->asBuffer(), remote_endpoint_, yield);
+                case Message::REQ_PEERS: {
+                    auto fileIt = m_openFiles.find(TransferKey(remote_endpoint_, message->ufid()));
+                    if( !m_tracker || fileIt == m_openFiles.end() ) {
+                        break;
+                    }
+                    fileIt->second.lastUsed = std::chrono::steady_clock::now();
+                    socket_.async_send_to(swarmPeers(fileIt->second, message->ufid())->asBuffer(), remote_endpoint_, yield[error]);
                     break;
                 }
 
                 case Message::REQ_FILE_PACKETS: {
-                    boost::asio::deadline_timer throttle_timer(socket_.get_io_service());
+                    auto fileIt = m_openFiles.find(TransferKey(remote_endpoint_, message->ufid()));
+                    if( fileIt == m_openFiles.end() ) {
+                        break;
+                    }
 
-                    for( int64_t packetId : message->packets() ) {
-                        throttle_timer.expires_from_now(boost::posix_time::microseconds(50));
-                        const char* payloadData = m_fileSource->data() + (packetId * packetSize);
-                        size_t payloadSize = std::min(packetSize, static_cast<size_t>(m_fileSource->size() - (packetId * packetSize)));
+                    std::chrono::steady_clock::time_point received = std::chrono::steady_clock::now();
+                    REACH_TRACE(REQUEST_RECEIVED, message->ufid(), message->packets().elementCount());
 
-                        auto response = Message::createFilePacket(message->ufid(), packetId, payloadData, payloadSize);
-                        socket_.async_send_to(response->asBuffer(), remote_endpoint_, yield);
-                        throttle_timer.async_wait(yield);
+                    fileIt->second.lastUsed = received;
+
+                    // Packets past the end of the file are not sent
+                    Range packets(message->packets());
+                    packets.subtract(static_cast<int64_t>((fileIt->second.source->size() + packetSize - 1) / packetSize), INT64_MAX);
+                    recordRetransmits(fileIt->second, message->ufid(), packets);
+                    if( packets.elementCount() == 0 ) {
+                        break;
+                    }
+
+                    if( m_scheduler.empty() ) {
+                        m_scheduleTimer.cancel();
                     }
+                    // Transfers of one file version share the mapping, its address
+                    // identifies the content for coalescing
+                    m_scheduler.enqueue(remote_endpoint_, fileIt->second.priority, message->ufid(), packets, packetSize, received,
+                        reinterpret_cast<uintptr_t>(fileIt->second.source.get()));
                     break;
                 }
                 }
@@ -71,25 +248,517 @@ public:
         }
     }
 
+    // Sends the packets of the queued requests in the order of the
+    // scheduler, so one client's large request does not hold back the others
+    void sendScheduled(boost::asio::yield_context yield)
+    {
+        const size_t packetSize = 8 * 1024;
+        boost::asio::deadline_timer throttle_timer(io_service_);
+        for(;;)
+        {
+            boost::system::error_code error;
+            if( m_scheduler.empty() ) {
+                m_scheduleTimer.expires_at(boost::posix_time::pos_infin);
+                m_scheduleTimer.async_wait(yield[error]);
+                continue;
+            }
+
+            // Every client with queued packets used up its rate
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            RequestScheduler::Packet packet;
+            if( !m_scheduler.next(now, packet) ) {
+                throttle_timer.expires_from_now(boost::posix_time::milliseconds(1));
+                throttle_timer.async_wait(yield[error]);
+                continue;
+            }
+
+            // Clients waiting for the same packet of the same mapping get it
+            // now as well, it is read once and sent with one system call
+            m_batch.assign(1, packet);
+            m_scheduler.coalesce(packet, now, SEND_RING_SIZE / 2, m_batch);
+            m_packetFanout.record(m_batch.size());
+
+            throttle_timer.expires_from_now(boost::posix_time::microseconds(SEND_INTERVAL_US));
+            m_sends.clear();
+            for( const RequestScheduler::Packet& destination : m_batch ) {
+                // The idle sweep may have closed the file since the request was
+                // queued, or the transfer reopened another version
+                auto fileIt = m_openFiles.find(TransferKey(destination.client, destination.ufid));
+                if( fileIt == m_openFiles.end() || reinterpret_cast<uintptr_t>(fileIt->second.source.get()) != destination.content ) {
+                    continue;
+                }
+                std::shared_ptr<boost::iostreams::mapped_file_source> source = fileIt->second.source;
+
+                const uint8_t* payloadData = reinterpret_cast<const uint8_t*>(source->data()) + (destination.packetId * packetSize);
+                size_t payloadSize = std::min(packetSize, static_cast<size_t>(source->size() - (destination.packetId * packetSize)));
+
+                // Wait for in flight sends to complete if all slots are taken,
+                // the batch so far holds slots as well
+                SendRing::Slot* slot;
+                while( !(slot = m_sendRing.acquire(destination.ufid, destination.packetId, payloadData, payloadSize, source)) ) {
+                    sendSlots(m_sends);
+                    m_sends.clear();
+                    throttle_timer.async_wait(yield[error]);
+                    throttle_timer.expires_from_now(boost::posix_time::microseconds(SEND_INTERVAL_US));
+                }
+
+                REACH_TRACE(PACKET_SENT, destination.ufid, destination.packetId);
+                m_sends.push_back(std::make_pair(slot, destination.client));
+
+                if( destination.last ) {
+                    m_requestService.record(
+                        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - destination.queued).count());
+                }
+            }
+            sendSlots(m_sends);
+            throttle_timer.async_wait(yield[error]);
+        }
+    }
+
+    // Sends one packet of every session in turn, paced to the multicast rate
+    void sendMulticast(boost::asio::yield_context yield)
+    {
+        boost::asio::deadline_timer throttle_timer(io_service_);
+        std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+        for(;;)
+        {
+            boost::system::error_code error;
+            if( m_sessions.empty() ) {
+                m_multicastTimer.expires_at(boost::posix_time::pos_infin);
+                m_multicastTimer.async_wait(yield[error]);
+                next = std::chrono::steady_clock::now();
+                continue;
+            }
+
+            // Only this coroutine erases sessions, the iterator survives the yields
+            for( auto sessionIt = m_sessions.begin(); sessionIt != m_sessions.end(); ) {
+                MulticastSession& session = sessionIt->second;
+                std::shared_ptr<boost::iostreams::mapped_file_source> source = session.source;
+                uint64_t sessionId = session.id;
+                uint64_t packetId = session.nextPacket;
+                uint64_t packetSize = session.packetSize;
+                session.nextPacket = (packetId + 1) * packetSize < source->size() ? packetId + 1 : 0;
+                session.remaining--;
+
+                const uint8_t* payloadData = reinterpret_cast<const uint8_t*>(source->data()) + (packetId * packetSize);
+                size_t payloadSize = std::min<uint64_t>(packetSize, source->size() - (packetId * packetSize));
+
+                SendRing::Slot* slot;
+                while( !(slot = m_sendRing.acquire(sessionId, packetId, payloadData, payloadSize, source)) ) {
+                    throttle_timer.expires_from_now(boost::posix_time::microseconds(SEND_INTERVAL_US));
+                    throttle_timer.async_wait(yield[error]);
+                }
+
+                REACH_TRACE(PACKET_SENT, sessionId, packetId);
+                sendSlot(slot, m_multicastGroup);
+
+                // A receiver joining while we waited reset the count
+                if( sessionIt->second.remaining == 0 ) {
+                    BOOST_LOG_TRIVIAL(info) << "Multicast of " << sessionIt->first << " finished";
+                    sessionIt = m_sessions.erase(sessionIt);
+                } else {
+                    ++sessionIt;
+                }
+
+                // Pacing restarts after a stall instead of catching up in a burst
+                std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                next = std::max(next, now - std::chrono::milliseconds(1)) +
+                    std::chrono::nanoseconds(payloadSize * 1000000000 / m_multicastRate);
+                if( next > now ) {
+                    throttle_timer.expires_from_now(boost::posix_time::microseconds(
+                        std::chrono::duration_cast<std::chrono::microseconds>(next - now).count()));
+                    throttle_timer.async_wait(yield[error]);
+                }
+            }
+        }
+    }
+
+    // Closes the files of transfers that were idle for FILE_IDLE_TIMEOUT
+    void closeIdleFiles(boost::asio::yield_context yield)
+    {
+        boost::asio::deadline_timer timer(io_service_);
+        for(;;)
+        {
+            boost::system::error_code error;
+            timer.expires_from_now(boost::posix_time::seconds(FILE_IDLE_TIMEOUT));
+            timer.async_wait(yield[error]);
+
+            std::chrono::steady_clock::time_point idle = std::chrono::steady_clock::now() - std::chrono::seconds(FILE_IDLE_TIMEOUT);
+            for( auto it = m_openFiles.begin(); it != m_openFiles.end(); ) {
+                if( it->second.lastUsed < idle ) {
+                    it = m_openFiles.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            // A hot file that changed since it was warmed is no longer kept
+            for( auto it = m_hotSources.begin(); it != m_hotSources.end(); ) {
+                auto sourceIt = m_sources.find(it->first);
+                if( sourceIt == m_sources.end() || sourceIt->second.source.lock() != it->second ) {
+                    it = m_hotSources.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            for( auto it = m_sources.begin(); it != m_sources.end(); ) {
+                if( it->second.source.expired() ) {
+                    it = m_sources.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            for( auto swarmIt = m_swarms.begin(); swarmIt != m_swarms.end(); ) {
+                for( auto it = swarmIt->second.begin(); it != swarmIt->second.end(); ) {
+                    if( it->second < idle ) {
+                        it = swarmIt->second.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+                swarmIt = swarmIt->second.empty() ? m_swarms.erase(swarmIt) : std::next(swarmIt);
+            }
+            saveHotSet();
+        }
+    }
+
 private:
+    // One sendmmsg for all slots, the kernel copies the payload for every
+    // destination. What it does not take at once is sent asynchronously.
+    void sendSlots(const std::vector<std::pair<SendRing::Slot*, udp::endpoint> >& sends)
+    {
+        if( m_zeroCopy || sends.size() < 2 ) {
+            for( const auto& send : sends ) {
+                sendSlot(send.first, send.second);
+            }
+            return;
+        }
+
+        // The buffers grow to the largest batch and are reused
+        m_messages.resize(sends.size());
+        m_iovecs.resize(2 * sends.size());
+        for( size_t i = 0; i < sends.size(); ++i ) {
+            const SendRing::Slot::Buffers& buffers = sends[i].first->buffers();
+            for( size_t j = 0; j < buffers.size(); ++j ) {
+                m_iovecs[2 * i + j].iov_base = const_cast<void*>(buffers[j].data());
+                m_iovecs[2 * i + j].iov_len = buffers[j].size();
+            }
+
+            memset(&m_messages[i], 0, sizeof(mmsghdr));
+            m_messages[i].msg_hdr.msg_name = const_cast<sockaddr*>(sends[i].second.data());
+            m_messages[i].msg_hdr.msg_namelen = sends[i].second.size();
+            m_messages[i].msg_hdr.msg_iov = &m_iovecs[2 * i];
+            m_messages[i].msg_hdr.msg_iovlen = buffers.size();
+        }
+
+        int sent = std::max(sendmmsg(socket_.native_handle(), m_messages.data(), m_messages.size(), MSG_DONTWAIT), 0);
+        for( size_t i = 0; i < sends.size(); ++i ) {
+            if( i < static_cast<size_t>(sent) ) {
+                m_sendRing.release(sends[i].first);
+            } else {
+                sendSlot(sends[i].first, sends[i].second);
+            }
+        }
+    }
+
+    // The slot is released once the send completed
+    void sendSlot(SendRing::Slot* slot, const udp::endpoint& destination)
+    {
+        if( m_zeroCopy ) {
+            m_zeroCopy->send(slot, destination);
+            return;
+        }
+
+        socket_.async_send_to(slot->buffers(), destination,
+            [this, slot, destination](const boost::system::error_code& error, std::size_t) {
+                if( error ) {
+                    BOOST_LOG_TRIVIAL(error) << "Sending packet " << slot->packetId() << " to " << destination << " failed: " << error.message();
+                }
+                m_sendRing.release(slot);
+            });
+    }
+
+    typedef std::pair<udp::endpoint, uint64_t> TransferKey;
+    // Path and version of a file, the clients of one are peers
+    typedef std::pair<std::string, uint64_t> SwarmKey;
+
+    struct OpenFile {
+        std::shared_ptr<boost::iostreams::mapped_file_source> source;
+        Range sentPackets;
+        std::chrono::steady_clock::time_point lastUsed;
+        SwarmKey swarm;
+        uint8_t priority;
+    };
+
+    struct SharedSource {
+        std::weak_ptr<boost::iostreams::mapped_file_source> source;
+        uint64_t version;
+    };
+
+    // The packets of a file version go to the multicast group in a loop.
+    // Every receiver that joins restarts the count of packets left, so it
+    // sees each packet once. It joins a round trip after its REQ_FILE, the
+    // count covers 10 ms more than the file for the packets sent meanwhile.
+    struct MulticastSession {
+        uint64_t id;
+        uint64_t version;
+        uint64_t packetSize;
+        std::shared_ptr<boost::iostreams::mapped_file_source> source;
+        uint64_t nextPacket;
+        uint64_t remaining;
+    };
+
+    const MulticastSession& joinSession(const std::string& path, std::shared_ptr<boost::iostreams::mapped_file_source> source,
+        uint64_t version, uint64_t packetSize)
+    {
+        if( m_sessions.empty() ) {
+            m_multicastTimer.cancel();
+        }
+
+        MulticastSession& session = m_sessions[path];
+        if( !session.source || session.version != version || session.packetSize != packetSize ) {
+            // Random ids, so a restarted server does not feed old sessions
+            session.id = m_random() | 1;
+            session.version = version;
+            session.packetSize = packetSize;
+            session.source = source;
+            session.nextPacket = 0;
+            BOOST_LOG_TRIVIAL(info) << "Multicast of " << path << " started";
+        }
+        session.remaining = (source->size() + packetSize - 1) / packetSize +
+            std::max<uint64_t>(SEND_RING_SIZE, m_multicastRate / 100 / packetSize);
+        return session;
+    }
+
+    // Transfers of the same file version share one mapping. The version is
+    // the modification time in ns, clients cache packets under it.
+    std::shared_ptr<boost::iostreams::mapped_file_source> openSource(const std::string& path, uint64_t& version)
+    {
+        std::shared_ptr<boost::iostreams::mapped_file_source> source;
+        struct stat status;
+        if( stat(path.c_str(), &status) != 0 ) {
+            BOOST_LOG_TRIVIAL(error) << "Opening " << path << " failed: " << strerror(errno);
+            return source;
+        }
+        version = static_cast<uint64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+
+        SharedSource& shared = m_sources[path];
+        source = shared.source.lock();
+        if( source && shared.version == version ) {
+            return source;
+        }
+
+        try {
+            source.reset(new boost::iostreams::mapped_file_source(path));
+        } catch( std::exception& e ) {
+            BOOST_LOG_TRIVIAL(error) << "Opening " << path << " failed: " << e.what();
+            m_sources.erase(path);
+            return std::shared_ptr<boost::iostreams::mapped_file_source>();
+        }
+
+        shared.source = source;
+        shared.version = version;
+        return source;
+    }
+
+    // Registers the client and lists the peers that were seen last, the
+    // client itself is not one of them
+    std::shared_ptr<Message> swarmPeers(const OpenFile& file, uint64_t ufid)
+    {
+        std::map<udp::endpoint, std::chrono::steady_clock::time_point>& swarm = m_swarms[file.swarm];
+        swarm[remote_endpoint_] = file.lastUsed;
+
+        std::vector<std::pair<std::chrono::steady_clock::time_point, udp::endpoint> > recent;
+        for( const auto& peer : swarm ) {
+            if( peer.first != remote_endpoint_ ) {
+                recent.push_back(std::make_pair(peer.second, peer.first));
+            }
+        }
+        std::sort(recent.begin(), recent.end(), std::greater<std::pair<std::chrono::steady_clock::time_point, udp::endpoint> >());
+
+        std::vector<udp::endpoint> peers;
+        for( size_t i = 0; i < recent.size() && i < PEER_LIMIT; ++i ) {
+            peers.push_back(recent[i].second);
+        }
+        return Message::createPeers(ufid, peers);
+    }
+
+    // Packets that were already sent for the transfer are retransmissions,
+    // every contiguous run of them is one loss burst on the client side
+    void recordRetransmits(OpenFile& file, uint64_t ufid, const Range& requested)
+    {
+        m_requestPackets.record(requested.elementCount());
+
+        Range fresh(requested);
+        fresh.subtract(file.sentPackets);
+        Range repeated(requested);
+        repeated.subtract(fresh);
+
+        for( const Range::Interval& interval : repeated.intervals() ) {
+            m_retransmitBursts.record(interval.second - interval.first);
+            REACH_TRACE(RETRANSMIT, ufid, interval.first);
+        }
+
+        file.sentPackets.add(fresh);
+    }
+
+private:
+    boost::asio::io_service& io_service_;
     udp::socket socket_;
     udp::endpoint remote_endpoint_;
     boost::array<uint8_t, 1024000> recv_buffer_;
-    std::shared_ptr<boost::iostreams::mapped_file_source> m_fileSource;
+    SendRing m_sendRing;
+    std::unique_ptr<ZeroCopySender> m_zeroCopy;
+
+    std::map<TransferKey, OpenFile> m_openFiles;
+    std::map<std::string, SharedSource> m_sources;
+
+    Metrics m_metrics;
+    Histogram& m_requestService;
+    Histogram& m_requestPackets;
+    Histogram& m_retransmitBursts;
+    Histogram& m_packetFanout;
+    boost::asio::deadline_timer m_metricsTimer;
+
+    udp::endpoint m_multicastGroup;
+    uint64_t m_multicastRate;
+    boost::asio::deadline_timer m_multicastTimer;
+    std::map<std::string, MulticastSession> m_sessions;
+    std::mt19937_64 m_random;
 
+    bool m_tracker;
+    std::map<SwarmKey, std::map<udp::endpoint, std::chrono::steady_clock::time_point> > m_swarms;
+
+    std::unique_ptr<HotSet> m_hotSet;
+    std::string m_hotSetManifest;
+    std::map<std::string, std::shared_ptr<boost::iostreams::mapped_file_source> > m_hotSources;
+
+    RequestScheduler m_scheduler;
+    boost::asio::deadline_timer m_scheduleTimer;
+
+    // Reused by sendScheduled and sendSlots for every packet
+    std::vector<RequestScheduler::Packet> m_batch;
+    std::vector<std::pair<SendRing::Slot*, udp::endpoint> > m_sends;
+    std::vector<mmsghdr> m_messages;
+    std::vector<iovec> m_iovecs;
 };
 
-int main()
+int main(int argc, char** argv)
 {
+    namespace po = boost::program_options;
+    po::options_description desc("Serve Files via REACH UDP");
+    desc.add_options()
+      ("help", "Print help messages")
+      ("port", po::value<unsigned short>()->default_value(REACH_PORT), "Port to listen on")
+      ("multicast-group", po::value<std::string>(), "Send files to this group as address:port, clients only request lost packets")
+      ("multicast-interface", po::value<std::string>(), "Address of the interface for the multicast group")
+      ("multicast-rate", po::value<uint64_t>()->default_value(MULTICAST_RATE / (1024 * 1024)), "Multicast send rate in MB/s")
+      ("zerocopy", "Send payloads straight from the mapped file with MSG_ZEROCOPY")
+      ("client-rate", po::value<uint64_t>()->default_value(0), "Send at most this many MB/s to every client, 0 for no limit")
+      ("busy-poll", po::value<int>()->default_value(0), "Spin on the socket instead of waiting, block after this many us without work (0 disables)")
+      ("cpu", po::value<int>(), "Pin the server to this CPU, use with --busy-poll")
+      ("tracker", "Tell the clients of a file about each other, so they fetch packets from their peers")
+      ("hot-set", po::value<std::string>(), "Prefault the files listed in this manifest before serving, and record the files served to it")
+      ("hot-set-lock", po::value<uint64_t>()->default_value(0), "Lock up to this many MB of the hot set in memory")
+      ("huge-pages", "Ask for transparent huge pages for the hot set")
+      ("metrics", po::value<std::string>(), "Write Prometheus text format metrics to this file")
+      ("metrics-interval", po::value<int>()->default_value(10), "Seconds between metrics updates")
+      ("trace", po::value<std::string>(), "Write Chrome trace JSON to this file on exit (needs REACH_ENABLE_TRACE)");
+
+    po::variables_map vm;
+    try
+    {
+      po::store(po::parse_command_line(argc, argv, desc), vm);
+
+      if ( vm.count("help")  )
+      {
+        std::cout << desc << std::endl;
+        return 0;
+      }
+
+      po::notify(vm);
+    }
+    catch(po::error& e)
+    {
+      std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
+      std::cerr << desc << std::endl;
+      return 1;
+    }
   try
   {
     boost::asio::io_service io_service;
-    ReachServer server(io_service);
+    ReachServer server(io_service, vm["port"].as<unsigned short>());
+
+    // Requests arriving meanwhile wait in the socket buffer
+    if( vm.count("hot-set") ) {
+      HotSet::WarmOptions warmOptions;
+      warmOptions.hugePages = vm.count("huge-pages") > 0;
+      warmOptions.lockBytes = vm["hot-set-lock"].as<uint64_t>() * 1024 * 1024;
+      server.enableHotSet(vm["hot-set"].as<std::string>(), warmOptions);
+    }
     boost::asio::spawn(io_service, [&](yield_context yield) {
       server.receiveMessage(yield);
     });
+    boost::asio::spawn(io_service, [&](yield_context yield) {
+      server.sendScheduled(yield);
+    });
+    boost::asio::spawn(io_service, [&](yield_context yield) {
+      server.closeIdleFiles(yield);
+    });
+    if( vm.count("multicast-group") ) {
+      std::string group = vm["multicast-group"].as<std::string>();
+      size_t colon = group.find(':');
+      unsigned short port = colon == std::string::npos ? REACH_PORT + 1 : static_cast<unsigned short>(std::stoul(group.substr(colon + 1)));
+      boost::asio::ip::address_v4 interface;
+      if( vm.count("multicast-interface") ) {
+        interface = boost::asio::ip::address_v4::from_string(vm["multicast-interface"].as<std::string>());
+      }
 
-    io_service.run();
+      server.enableMulticast(udp::endpoint(boost::asio::ip::address_v4::from_string(group.substr(0, colon)), port),
+        interface, vm["multicast-rate"].as<uint64_t>() * 1024 * 1024);
+      boost::asio::spawn(io_service, [&](yield_context yield) {
+        server.sendMulticast(yield);
+      });
+    }
+    if( vm.count("zerocopy") && !server.enableZeroCopy() ) {
+      BOOST_LOG_TRIVIAL(warning) << "MSG_ZEROCOPY is not supported, sending copies";
+    }
+    if( vm.count("tracker") ) {
+      server.enableTracker();
+    }
+    if( vm["client-rate"].as<uint64_t>() > 0 ) {
+      server.limitClientRate(vm["client-rate"].as<uint64_t>() * 1024 * 1024);
+    }
+    if( vm.count("metrics") ) {
+      boost::asio::spawn(io_service, [&](yield_context yield) {
+        server.exportMetrics(vm["metrics"].as<std::string>(), vm["metrics-interval"].as<int>(), yield);
+      });
+    }
+
+    boost::asio::signal_set signals(io_service, SIGINT, SIGTERM);
+    signals.async_wait([&](const boost::system::error_code&, int) {
+      io_service.stop();
+    });
+
+    if( vm.count("cpu") && !BusyPoll::pinThread(vm["cpu"].as<int>()) ) {
+      BOOST_LOG_TRIVIAL(warning) << "Pinning to CPU " << vm["cpu"].as<int>() << " failed";
+    }
+
+    BOOST_LOG_TRIVIAL(info) << "Ready on port " << vm["port"].as<unsigned short>();
+    if( vm["busy-poll"].as<int>() > 0 ) {
+      if( !server.enableBusyPoll() ) {
+        BOOST_LOG_TRIVIAL(warning) << "SO_BUSY_POLL is not available, spinning in user space only";
+      }
+      BusyPoll busyPoll(io_service, std::chrono::microseconds(vm["busy-poll"].as<int>()));
+      busyPoll.run();
+    } else {
+      io_service.run();
+    }
+    server.saveHotSet();
+
+    if( vm.count("trace") ) {
+      std::ofstream traceFile(vm["trace"].as<std::string>());
+      Trace::writeChromeJson(traceFile);
+    }
 }
 catch (std::exception& e)
 {
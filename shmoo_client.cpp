@@ -1,248 +1,235 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <string>
-#include <deque>
 #include <chrono>
 
-#include <boost/date_time/posix_time/posix_time.hpp>
-#include <boost/array.hpp>
 #include <boost/asio.hpp>
-#include <boost/asio/spawn.hpp>
-#include <boost/asio/async_result.hpp>
-#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/program_options.hpp>
 
 #include <Config.h>
-#include <Message.h>
+#include <ClientEngine.h>
+#include <BusyPoll.h>
 
 #define BOOST_LOG_DYN_LINK 1
 #include <boost/log/trivial.hpp>
-#include <map>
 
 using boost::asio::ip::udp;
-using namespace boost::asio;
-using namespace std::chrono;
 
-class ReachClient
-{
-public:
-  ReachClient(boost::asio::io_service& io_service, boost::asio::ip::address_v4 address)
-    : m_socket(new udp::socket(io_service)),
-      m_receiverEndpoint(address, REACH_PORT),
-      m_nextUfid(1),
-      m_nextReqid(1),
-      m_shutdown(0)
-  {
-    m_socket->open(udp::v4());
-    boost::asio::spawn(io_service, [&](yield_context yield) {
-      receiveMessage(yield);
-    });
-  }
-
-  void shutdown() {
-    m_shutdown++;
-    BOOST_LOG_TRIVIAL(info) << "===================================================";
-    BOOST_LOG_TRIVIAL(info) << "Shutdown: " << m_shutdown;
-    if( m_shutdown >= 10 ) {
-      double fileSize = m_fileSink->size();
-      double throughput = fileSize / duration_cast<microseconds>( high_resolution_clock::now() - m_t1 ).count();
-      BOOST_LOG_TRIVIAL(info) << "Throughput (MB/s): " << throughput;
-      
-      m_socket->cancel();
-    }
-  }
+//////////////////////////////
+// Parameter sweep against reach_shmoo_server. Every point of the grid
+// (concurrency x request size x packet size x pacing) is transferred
+// --repeat times and reported with throughput, loss and latency
+// percentiles as CSV and/or JSON.
+//
+// --latency-reads instead reads single packet files one after the other,
+// once with io_service::run() and once with a BusyPoll, and reports the
+// latency percentiles of both.
+//////////////////////////////
+
+struct SweepPoint {
+  uint64_t concurrency;
+  uint64_t requestSize;
+  uint64_t packetSize;
+  uint64_t paceUs;
+};
 
+struct SweepResult {
+  SweepPoint point;
+  int repetition;
+  bool complete;
+  double seconds;
+  double throughput;
+  uint64_t requests;
+  uint64_t timeouts;
+  uint64_t requestedPackets;
+  uint64_t receivedPackets;
+  double loss;
+  double firstPacketUs[3];
+  double completionUs[3];
+};
 
-  void fetchFileAsync(const char* path) {
-    m_t1 = high_resolution_clock::now();
+static const double PERCENTILES[3] = {50, 90, 99};
 
-    std::shared_ptr<std::vector<size_t> > ranges(new std::vector<size_t>());
-    for( size_t i = 0; i < REQUEST_PREFETCH; i += REQUEST_SIZE) {
-      ranges->push_back(i);
+// Runs one transfer of the grid point on its own engine and socket
+static SweepResult runPoint(const udp::endpoint& receiverEndpoint, const SweepPoint& point, int repetition,
+    uint64_t fileSize, uint64_t timeoutMs, double maxSeconds, std::shared_ptr<Sink> sink)
+{
+  boost::asio::io_service io_service;
+
+  // Concurrent requests of the old worker model map onto the engine's window
+  ClientEngine::Options options;
+  options.requestSize = point.requestSize;
+  options.window = point.concurrency * point.requestSize;
+  options.requestTimeoutMs = timeoutMs;
+  ClientEngine engine(io_service, receiverEndpoint, options);
+
+  std::stringstream path;
+  path << "shmoo?size=" << fileSize << "&packet=" << point.packetSize << "&pace=" << point.paceUs;
+
+  SweepResult result;
+  result.point = point;
+  result.repetition = repetition;
+
+  boost::asio::steady_timer deadline(io_service);
+  uint64_t id = engine.copy(path.str(), sink, [&](const boost::system::error_code& error, const CopyFile::Result& transfer) {
+    result.complete = !error;
+    result.seconds = transfer.seconds;
+    result.throughput = result.complete ? transfer.fileSize / transfer.seconds / 1e6 : 0;
+    result.requests = transfer.requests;
+    result.timeouts = transfer.timeouts;
+    result.requestedPackets = transfer.requestedPackets;
+    result.receivedPackets = transfer.receivedPackets;
+    result.loss = transfer.requestedPackets > 0 ? 1.0 - static_cast<double>(transfer.receivedPackets) / transfer.requestedPackets : 0;
+    io_service.stop();
+  });
+
+  // Stop runs that do not converge, e.g. because the pacing is too aggressive
+  deadline.expires_from_now(std::chrono::milliseconds(static_cast<int64_t>(maxSeconds * 1000)));
+  deadline.async_wait([&](const boost::system::error_code& error) {
+    if( !error ) {
+      engine.cancel(id);
     }
+  });
 
+  io_service.run();
 
+  for( int i = 0; i < 3; ++i ) {
+    result.firstPacketUs[i] = engine.metrics().histogram("reach_client_first_packet_us").percentile(PERCENTILES[i]);
+    result.completionUs[i] = engine.metrics().histogram("reach_client_request_completion_us").percentile(PERCENTILES[i]);
+  }
+  return result;
+}
 
-    boost::asio::spawn(m_socket->get_io_service(), [ranges, this, path](yield_context yield)
-    {
-      uint64_t ufid = m_nextUfid++;
-
-      boost::system::error_code ec;
-      auto fileRequestMessage = Message::createReqFile(ufid, path);
-
-      boost::asio::deadline_timer timer(m_socket->get_io_service());
-
-      std::shared_ptr<Message> fileInfoMessage;
-
-      m_receiveCallback[ufid] = [&](std::shared_ptr<Message> receivedMessage)
-      {
-        if( receivedMessage->type() == Message::FILE_INFO ) {
-          // Store the fileInfoMessage when it is received
-          fileInfoMessage = receivedMessage;
-
-          // Cancel timeout timer -> unblock async_wait
-          timer.cancel();
-        }
-      };
-
-      for( int i = 0; i < SEND_RETRY && !fileInfoMessage; ++i) {
-
-        BOOST_LOG_TRIVIAL(info) << "Sending fileRequest: " << path;
-        m_socket->async_send_to(fileRequestMessage->asBuffer(), m_receiverEndpoint, yield[ec]);
-
-        timer.expires_from_now(boost::posix_time::milliseconds(RECEIVE_TIMEOUT));
-
-        timer.async_wait(yield[ec]);
-      }
-      
-
-      m_receiveCallback.erase(ufid);
-
-      if( !fileInfoMessage ) {
-        BOOST_LOG_TRIVIAL(error) << "No response from server";
-        return;
-      } 
-
-      size_t fileSize = fileInfoMessage->fileSize();
-      boost::iostreams::mapped_file_params fileParams;
-      fileParams.path = std::string("client_received.bin");
-      fileParams.new_file_size = fileSize;
-      m_fileSink.reset(new boost::iostreams::mapped_file_sink(fileParams));
-
-      size_t totalPackets = (fileSize + fileInfoMessage->packetSize() - 1) / fileInfoMessage->packetSize();
-      BOOST_LOG_TRIVIAL(info) << "Total Packet Count : " << totalPackets;
+struct LatencyResult {
+  std::string mode;
+  uint64_t reads;
+  uint64_t failed;
+  double latencyUs[3];
+};
 
-      for( size_t i = REQUEST_PREFETCH; i < totalPackets; i += REQUEST_SIZE) {
-        ranges->push_back(i);
+// The latency of a read is the time from copy() to its completion, two
+// round trips for REQ_FILE and REQ_FILE_PACKETS
+static LatencyResult measureReads(const udp::endpoint& receiverEndpoint, uint64_t reads, uint64_t packetSize,
+    uint64_t timeoutMs, int busyPollUs)
+{
+  boost::asio::io_service io_service;
+  ClientEngine::Options options;
+  options.requestTimeoutMs = timeoutMs;
+  options.busyPollUs = busyPollUs;
+  ClientEngine engine(io_service, receiverEndpoint, options);
+
+  std::stringstream path;
+  path << "shmoo?size=" << packetSize << "&packet=" << packetSize << "&pace=0";
+
+  LatencyResult result;
+  result.mode = busyPollUs > 0 ? "busy_poll" : "run";
+  result.reads = reads;
+  result.failed = 0;
+
+  Histogram latency;
+  for( uint64_t read = 0; read < reads; ++read ) {
+    std::shared_ptr<Sink> sink(new MemorySink());
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    engine.copy(path.str(), sink, [&](const boost::system::error_code& error, const CopyFile::Result&) {
+      if( error ) {
+        result.failed++;
+      } else {
+        latency.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
       }
-
+      io_service.stop();
     });
 
-
-    for( size_t i = 0; i < 10; i++) {
-      boost::asio::spawn(m_socket->get_io_service(), [this, ranges](yield_context yield)
-      {
-        while( !ranges->empty() ) {
-          size_t startOffset = ranges->back();
-          ranges->pop_back();
-          size_t remainingPackets = packetRequest(Range(startOffset, startOffset + REQUEST_SIZE), yield);
-          if( remainingPackets > 0 ) {
-            ranges->push_back(startOffset);
-          }
-        }
-        shutdown();
-      });
+    if( busyPollUs > 0 ) {
+      BusyPoll busyPoll(io_service, std::chrono::microseconds(busyPollUs));
+      busyPoll.run();
+    } else {
+      io_service.run();
     }
-
+    io_service.reset();
   }
 
-private:
-  size_t packetRequest(Range requestRange, boost::asio::yield_context yield) {
-    uint64_t ufid = m_nextUfid++;
-
-    boost::system::error_code ec;
-
-    // Request parameters
-    // double received = .0;
-    // std::vector<high_resolution_clock::time_point> receiveTime;
-    boost::asio::deadline_timer timer(m_socket->get_io_service());
-    // BOOST_LOG_TRIVIAL(info) << "===================================================";
-    // BOOST_LOG_TRIVIAL(info) << "Sending PacketRequest: " << requestRange.elementCount() << " - " << ufid;
-
-    // Receive Logic
-    m_receiveCallback[ufid] = [&](std::shared_ptr<Message> receivedMessage)
-    {
-      if( receivedMessage->type() == Message::FILE_PACKET ) {
-        char* dest = m_fileSink->data() + receivedMessage->packetId() * 8 * 1024;
-        memcpy(dest, receivedMessage->payloadData(), receivedMessage->payloadSize());
-
-        // receiveTime.push_back(high_resolution_clock::now());
-        requestRange.subtract(receivedMessage->packetId());
-        // received += 1.0;
-        if( requestRange.elementCount() == 0) {
-          timer.cancel();
-        }
-      }
-    };
-
-    // Send packet request and wait for max 10 seconds
-    auto reqFilePacketsMessage = Message::createRequestFilePackets(ufid, requestRange);
-    high_resolution_clock::time_point t1 = high_resolution_clock::now();
-    m_socket->async_send_to(reqFilePacketsMessage->asBuffer(), m_receiverEndpoint, yield[ec]);
-    timer.expires_from_now(boost::posix_time::milliseconds(200));
-    timer.async_wait(yield[ec]);
-    
-    m_receiveCallback.erase(ufid);
-
-    size_t remainingPackets = requestRange.elementCount();
-    // Plot Results
-
-    // BOOST_LOG_TRIVIAL(info) << "Remaining Packets: " << remainingPackets;
-    // if( receiveTime.size() > 0 ) {
-    //   BOOST_LOG_TRIVIAL(info) << "Remaining Details:" << requestRange.toString();
-    //   BOOST_LOG_TRIVIAL(info) << "Latency For First:" << duration_cast<microseconds>( receiveTime.front() - t1 ).count();
-    //   BOOST_LOG_TRIVIAL(info) << "Latency Till Last:" << duration_cast<microseconds>( receiveTime.back() - t1 ).count();
-    //   BOOST_LOG_TRIVIAL(info) << "Net Throughput Till Last:" << (8 * 1024 * received) / duration_cast<microseconds>( receiveTime.back() - receiveTime.front() ).count();
-    // }
-
-    return remainingPackets;
+  for( int i = 0; i < 3; ++i ) {
+    result.latencyUs[i] = latency.percentile(PERCENTILES[i]);
   }
+  return result;
+}
 
-  void receiveMessage(boost::asio::yield_context yield) {
-    boost::array<uint8_t, MAX_MESSAGE_SIZE> buffer;
-
-    while(m_shutdown < 10) {
-      boost::system::error_code ec;
-
-      size_t messageSize = m_socket->async_receive_from(
-        boost::asio::buffer(buffer),
-        m_receiverEndpoint, yield[ec]);
-
-      if( ec == boost::system::errc::success ) {
-        std::shared_ptr<Message> receivedMessage = Message::Message::fromBuffer(
-          buffer.data(), messageSize);
-
-
-        auto callbackIt = m_receiveCallback.find(receivedMessage->ufid());
-        if( callbackIt != m_receiveCallback.end() ) {
-          (callbackIt->second)(receivedMessage);
-        }
-      }
-    }
+static std::vector<uint64_t> parseList(const std::string& list)
+{
+  std::vector<uint64_t> values;
+  std::stringstream input(list);
+  std::string value;
+  while( std::getline(input, value, ',') ) {
+    values.push_back(std::stoull(value));
   }
+  return values;
+}
 
+static void writeCsv(std::ostream& output, const std::vector<SweepResult>& results)
+{
+  output << "concurrency,request_size,packet_size,pace_us,repetition,complete,seconds,throughput_mb_s,"
+    << "requests,timeouts,requested_packets,received_packets,loss,"
+    << "first_packet_p50_us,first_packet_p90_us,first_packet_p99_us,"
+    << "completion_p50_us,completion_p90_us,completion_p99_us" << std::endl;
+
+  for( const SweepResult& r : results ) {
+    output << r.point.concurrency << "," << r.point.requestSize << "," << r.point.packetSize << "," << r.point.paceUs << ","
+      << r.repetition << "," << r.complete << "," << r.seconds << "," << r.throughput << ","
+      << r.requests << "," << r.timeouts << "," << r.requestedPackets << "," << r.receivedPackets << ","
+      << r.loss;
+    for( double v : r.firstPacketUs ) output << "," << v;
+    for( double v : r.completionUs ) output << "," << v;
+    output << std::endl;
+  }
+}
 
-private:
-  std::shared_ptr<udp::socket> m_socket;
-  udp::endpoint m_receiverEndpoint;
-
-  std::atomic<uint64_t> m_nextUfid;
-  std::atomic<uint64_t> m_nextReqid;
-  std::map<uint64_t, std::function<void(std::shared_ptr<Message>)> > m_receiveCallback;
-  std::shared_ptr<boost::iostreams::mapped_file_sink> m_fileSink;
-
-  high_resolution_clock::time_point m_t1;
-
-
-  size_t m_shutdown;
-};
+static void writeJson(std::ostream& output, const std::vector<SweepResult>& results)
+{
+  output << "[" << std::endl;
+  for( size_t i = 0; i < results.size(); ++i ) {
+    const SweepResult& r = results[i];
+    output << "  {\"concurrency\":" << r.point.concurrency << ",\"request_size\":" << r.point.requestSize
+      << ",\"packet_size\":" << r.point.packetSize << ",\"pace_us\":" << r.point.paceUs
+      << ",\"repetition\":" << r.repetition << ",\"complete\":" << (r.complete ? "true" : "false")
+      << ",\"seconds\":" << r.seconds << ",\"throughput_mb_s\":" << r.throughput
+      << ",\"requests\":" << r.requests << ",\"timeouts\":" << r.timeouts
+      << ",\"requested_packets\":" << r.requestedPackets << ",\"received_packets\":" << r.receivedPackets
+      << ",\"loss\":" << r.loss
+      << ",\"first_packet_us\":{\"p50\":" << r.firstPacketUs[0] << ",\"p90\":" << r.firstPacketUs[1] << ",\"p99\":" << r.firstPacketUs[2] << "}"
+      << ",\"completion_us\":{\"p50\":" << r.completionUs[0] << ",\"p90\":" << r.completionUs[1] << ",\"p99\":" << r.completionUs[2] << "}"
+      << "}" << (i + 1 < results.size() ? "," : "") << std::endl;
+  }
+  output << "]" << std::endl;
+}
 
 int main(int argc, char** argv)
 {
     namespace po = boost::program_options;
-    po::options_description desc("Copy Files via REACH UDP");
+    po::options_description desc("Sweep REACH transfer parameters against reach_shmoo_server");
     desc.add_options()
       ("help", "Print help messages")
-      ("file", po::value<std::string>()->required(), "File on server to be copied")
-      ("address", po::value<std::string>(), "Address of the client");
-
-    po::positional_options_description positionalOptions;
-    positionalOptions.add("file", 1);
+      ("address", po::value<std::string>()->default_value("127.0.0.1"), "Address of the server")
+      ("port", po::value<unsigned short>()->default_value(REACH_PORT), "Port of the server")
+      ("file-size", po::value<uint64_t>()->default_value(64 * 1024 * 1024), "Bytes transferred per run")
+      ("concurrency", po::value<std::string>()->default_value("10"), "Comma separated concurrent requests")
+      ("request-size", po::value<std::string>()->default_value(std::to_string(REQUEST_SIZE)), "Comma separated packets per request")
+      ("packet-size", po::value<std::string>()->default_value("8192"), "Comma separated payload bytes per packet")
+      ("pacing", po::value<std::string>()->default_value("50"), "Comma separated server pacing in us per packet")
+      ("repeat", po::value<int>()->default_value(3), "Runs per grid point")
+      ("timeout", po::value<uint64_t>()->default_value(200), "Request timeout in ms")
+      ("max-seconds", po::value<double>()->default_value(60), "Abort a run after this many seconds")
+      ("latency-reads", po::value<uint64_t>(), "Measure this many single packet reads with and without busy polling instead of the sweep")
+      ("busy-poll", po::value<int>()->default_value(1000), "Idle us before a busy polling read blocks, for --latency-reads")
+      ("cpu", po::value<int>(), "Pin the client to this CPU")
+      ("csv", po::value<std::string>(), "Write results as CSV to this file")
+      ("json", po::value<std::string>(), "Write results as JSON to this file");
 
     po::variables_map vm;
     try
     {
-      po::store(po::command_line_parser(argc, argv).options(desc).positional(positionalOptions).run(),
-                vm);
+      po::store(po::parse_command_line(argc, argv, desc), vm);
 
       if ( vm.count("help")  )
       {
@@ -261,23 +248,70 @@ int main(int argc, char** argv)
     }
   try
   {
-    boost::asio::io_service io_service;
-    std::string address("127.0.0.1");
-    if( vm.count("address") ) {
-      address = vm["address"].as<std::string>();
+    udp::endpoint receiverEndpoint(
+      boost::asio::ip::address_v4::from_string(vm["address"].as<std::string>()),
+      vm["port"].as<unsigned short>());
+
+    if( vm.count("cpu") && !BusyPoll::pinThread(vm["cpu"].as<int>()) ) {
+      BOOST_LOG_TRIVIAL(warning) << "Pinning to CPU " << vm["cpu"].as<int>() << " failed";
     }
-    boost::asio::ip::address_v4 targetIP = boost::asio::ip::address_v4::from_string(address);
 
-    ReachClient client(io_service, targetIP);
-    client.fetchFileAsync(vm["file"].as<std::string>().c_str());
+    if( vm.count("latency-reads") ) {
+      uint64_t packetSize = parseList(vm["packet-size"].as<std::string>()).front();
+      std::cout << "mode,reads,failed,latency_p50_us,latency_p90_us,latency_p99_us" << std::endl;
+      for( int busyPollUs : {0, vm["busy-poll"].as<int>()} ) {
+        LatencyResult r = measureReads(receiverEndpoint, vm["latency-reads"].as<uint64_t>(), packetSize,
+          vm["timeout"].as<uint64_t>(), busyPollUs);
+        std::cout << r.mode << "," << r.reads << "," << r.failed;
+        for( double v : r.latencyUs ) std::cout << "," << v;
+        std::cout << std::endl;
+      }
+      return 0;
+    }
 
-    io_service.run();
+    uint64_t fileSize = vm["file-size"].as<uint64_t>();
+    std::shared_ptr<Sink> sink(new MemorySink());
+    std::vector<SweepResult> results;
+
+    for( uint64_t concurrency : parseList(vm["concurrency"].as<std::string>()) ) {
+      for( uint64_t requestSize : parseList(vm["request-size"].as<std::string>()) ) {
+        for( uint64_t packetSize : parseList(vm["packet-size"].as<std::string>()) ) {
+          for( uint64_t paceUs : parseList(vm["pacing"].as<std::string>()) ) {
+            SweepPoint point = {concurrency, requestSize, packetSize, paceUs};
+
+            for( int repetition = 0; repetition < vm["repeat"].as<int>(); ++repetition ) {
+              SweepResult result = runPoint(receiverEndpoint, point, repetition, fileSize,
+                vm["timeout"].as<uint64_t>(), vm["max-seconds"].as<double>(), sink);
+              results.push_back(result);
+
+              BOOST_LOG_TRIVIAL(info) << "concurrency=" << concurrency << " request=" << requestSize
+                << " packet=" << packetSize << " pace=" << paceUs << " run=" << repetition
+                << ": " << result.throughput << " MB/s, loss " << result.loss
+                << ", completion p99 " << result.completionUs[2] << " us"
+                << (result.complete ? "" : " (incomplete)");
+            }
+          }
+        }
+      }
+    }
+
+    if( vm.count("csv") ) {
+      std::ofstream csvFile(vm["csv"].as<std::string>());
+      writeCsv(csvFile, results);
+    }
+    if( vm.count("json") ) {
+      std::ofstream jsonFile(vm["json"].as<std::string>());
+      writeJson(jsonFile, results);
+    }
+    if( !vm.count("csv") && !vm.count("json") ) {
+      writeCsv(std::cout, results);
+    }
   }
   catch (std::exception& e)
   {
     std::cerr << e.what() << std::endl;
+    return 1;
   }
 
   return 0;
 }
-
@@ -4,13 +4,21 @@
 
 #include <iostream>
 #include <string>
+#include <map>
+#include <random>
+#include <sstream>
 #include <boost/array.hpp>
 #include <boost/asio.hpp>
 #include <boost/asio/spawn.hpp>
 #include <boost/asio/async_result.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/program_options.hpp>
 
 #include <Config.h>
 #include <Message.h>
+#include <SendRing.h>
+#include <BusyPoll.h>
+#include <FramePool.h>
 
 #define BOOST_LOG_DYN_LINK 1
 #include <boost/log/trivial.hpp>
@@ -19,13 +27,37 @@
 using boost::asio::ip::udp;
 using namespace boost::asio;
 
+// Payload plus header has to fit into a single UDP datagram
+static const uint64_t MAX_PACKET_SIZE = 65507 - Message::FILE_PACKET_HEADER_SIZE;
+
+//////////////////////////////
+// Synthetic server for reach_shmoo_client. A REQ_FILE path of the form
+//   shmoo?size=<bytes>&packet=<bytes>&pace=<us per packet>
+// opens a virtual file with the given parameters for the requesting
+// transfer. Packets are served from a pregenerated random payload pool.
+//////////////////////////////
 
 class ReachServer
 {
 public:
-    ReachServer(boost::asio::io_service& io_service)
-    : socket_(io_service, udp::endpoint(udp::v4(), REACH_PORT))
+    ReachServer(boost::asio::io_service& io_service, unsigned short port, size_t poolSize)
+    : io_service_(io_service),
+      socket_(io_service, udp::endpoint(udp::v4(), port)),
+      m_payloadPool(poolSize),
+      m_sendRing(SEND_RING_SIZE),
+      m_sendPool([this]() { return new PacedSend(io_service_); })
     {
+        std::mt19937_64 random(1);
+        for( size_t i = 0; i + sizeof(uint64_t) <= m_payloadPool.size(); i += sizeof(uint64_t) ) {
+            uint64_t value = random();
+            memcpy(&m_payloadPool[i], &value, sizeof(value));
+        }
+    }
+
+    // Receives poll the NIC queue instead of waiting for its interrupt
+    bool enableBusyPoll()
+    {
+        return BusyPoll::enableSocket(socket_.native_handle());
     }
 
     void receiveMessage(boost::asio::yield_context yield)
@@ -36,33 +68,52 @@ public:
             size_t messageSize = socket_.async_receive_from(
                 boost::asio::buffer(recv_buffer_), remote_endpoint_, yield[error]);
 
-            BOOST_LOG_TRIVIAL(info) << "Received Message";
-
             if (!error || error == boost::asio::error::message_size)
             {
               auto message = Message::fromBuffer(recv_buffer_.data(), messageSize);
-              size_t packetSize = 8 * 1024;
+              if( !message ) {
+                  continue;
+              }
 
               switch( message->type() ) {
-                case Message::REQ_FILE_PACKETS: {
-                    boost::asio::deadline_timer throttle_timer(socket_.get_io_service());
+                case Message::REQ_FILE: {
+                    VirtualFile file = parseVirtualFile(message->path());
+                    m_files[TransferKey(remote_endpoint_, message->ufid())] = file;
 
-                    BOOST_LOG_TRIVIAL(info) << "Got Packet Request: " << message->packets().elementCount();
-                    uint8_t payloadData[packetSize];
+                    BOOST_LOG_TRIVIAL(info) << "Virtual File: " << file.size << " bytes, "
+                        << file.packetSize << " bytes/packet, " << file.paceUs << " us/packet";
 
-                    for( int64_t packetId : message->packets() ) {
-                        throttle_timer.expires_from_now(boost::posix_time::microseconds(50));
-
-                        for( int32_t i = 0; i < packetSize; ++i) {
-                            payloadData[i] = rand() % 255;
-                        }
+                    auto response = Message::createFileInfo(message->ufid(), file.size, file.packetSize);
+                    socket_.async_send_to(response->asBuffer(), remote_endpoint_, yield[error]);
+                    break;
+                }
 
-                        size_t payloadSize = packetSize;
+                case Message::REQ_FILE_PACKETS: {
+                    TransferKey key(remote_endpoint_, message->ufid());
+                    auto fileIt = m_files.find(key);
+                    if( fileIt == m_files.end() ) {
+                        break;
+                    }
 
-                        auto response = Message::createFilePacket(message->ufid(), packetId, payloadData, payloadSize);
-                        socket_.async_send_to(response->asBuffer(), remote_endpoint_, yield);
-                        throttle_timer.async_wait(yield);
+                    // A transfer has one paced send, further requests queue
+                    // behind it so the pace holds per transfer
+                    auto sendIt = m_sending.find(key);
+                    if( sendIt != m_sending.end() ) {
+                        PacedSend* send = sendIt->second;
+                        send->packets.erase(send->packets.begin(), send->packets.begin() + send->next);
+                        send->next = 0;
+                        send->packets.insert(send->packets.end(), message->packets().begin(), message->packets().end());
+                        break;
                     }
+
+                    PacedSend* send = m_sendPool.acquire();
+                    send->key = key;
+                    send->file = fileIt->second;
+                    send->packets.assign(message->packets().begin(), message->packets().end());
+                    send->next = 0;
+                    send->due = std::chrono::steady_clock::now();
+                    m_sending[key] = send;
+                    sendPaced(send);
                     break;
                 }
                 }
@@ -71,23 +122,172 @@ public:
     }
 
 private:
+    typedef std::pair<udp::endpoint, uint64_t> TransferKey;
+
+    struct VirtualFile {
+        VirtualFile() : size(64 * 1024 * 1024), packetSize(8 * 1024), paceUs(50) {}
+
+        uint64_t size;
+        uint64_t packetSize;
+        uint64_t paceUs;
+    };
+
+    // Frame of the paced send of one transfer, recycled by m_sendPool
+    struct PacedSend {
+        explicit PacedSend(boost::asio::io_service& io_service) : timer(io_service), next(0) {}
+
+        boost::asio::steady_timer timer;
+        TransferKey key;
+        VirtualFile file;
+        std::vector<uint64_t> packets;
+        size_t next;
+        std::chrono::steady_clock::time_point due;
+    };
+
+    // Sends the next queued packet and continues from its completion once
+    // the pace elapsed, the frame goes back to the pool when the queue is
+    // empty. Transfers are paced independently of each other.
+    void sendPaced(PacedSend* send)
+    {
+        const VirtualFile& file = send->file;
+        while( send->next < send->packets.size() && send->packets[send->next] * file.packetSize >= file.size ) {
+            send->next++;
+        }
+        if( send->next == send->packets.size() ) {
+            m_sending.erase(send->key);
+            m_sendPool.release(send);
+            return;
+        }
+
+        uint64_t packetId = send->packets[send->next];
+        uint64_t offset = packetId * file.packetSize;
+        size_t payloadSize = std::min<uint64_t>(file.packetSize, file.size - offset);
+        const uint8_t* payloadData = &m_payloadPool[offset % (m_payloadPool.size() - file.packetSize)];
+
+        // Other transfers hold every slot
+        SendRing::Slot* slot = m_sendRing.acquire(send->key.second, packetId, payloadData, payloadSize);
+        if( !slot ) {
+            send->timer.expires_from_now(std::chrono::microseconds(50));
+            send->timer.async_wait([this, send](const boost::system::error_code&) { sendPaced(send); });
+            return;
+        }
+
+        socket_.async_send_to(slot->buffers(), send->key.first, [this, send, slot](const boost::system::error_code&, size_t) {
+            m_sendRing.release(slot);
+            send->next++;
+
+            // Absolute schedule so the rate does not drift with the send latency
+            if( send->file.paceUs > 0 ) {
+                send->due += std::chrono::microseconds(send->file.paceUs);
+                send->timer.expires_at(send->due);
+                send->timer.async_wait([this, send](const boost::system::error_code&) { sendPaced(send); });
+            } else {
+                sendPaced(send);
+            }
+        });
+    }
+
+    VirtualFile parseVirtualFile(const std::string& path)
+    {
+        VirtualFile file;
+
+        std::stringstream parameters(path.substr(path.find('?') + 1));
+        std::string parameter;
+        while( std::getline(parameters, parameter, '&') ) {
+            size_t separator = parameter.find('=');
+            if( separator == std::string::npos ) {
+                continue;
+            }
+
+            std::string key = parameter.substr(0, separator);
+            uint64_t value = strtoull(parameter.c_str() + separator + 1, nullptr, 10);
+            if( key == "size" ) {
+                file.size = value;
+            } else if( key == "packet" ) {
+                file.packetSize = value;
+            } else if( key == "pace" ) {
+                file.paceUs = value;
+            }
+        }
+
+        // Covers the default as well, sendPaced reads packets at offsets
+        // below pool size minus packet size, which has to stay positive
+        uint64_t maxPacketSize = std::min<uint64_t>(MAX_PACKET_SIZE, m_payloadPool.size() / 2);
+        file.packetSize = std::max<uint64_t>(1, std::min<uint64_t>(file.packetSize, maxPacketSize));
+
+        return file;
+    }
+
+private:
+    boost::asio::io_service& io_service_;
     udp::socket socket_;
     udp::endpoint remote_endpoint_;
     boost::array<uint8_t, 1024000> recv_buffer_;
 
+    std::vector<uint8_t> m_payloadPool;
+    SendRing m_sendRing;
+    std::map<TransferKey, VirtualFile> m_files;
+
+    FramePool<PacedSend> m_sendPool;
+    std::map<TransferKey, PacedSend*> m_sending;
 };
 
-int main()
+int main(int argc, char** argv)
 {
+    namespace po = boost::program_options;
+    po::options_description desc("Synthetic REACH server for parameter sweeps");
+    desc.add_options()
+      ("help", "Print help messages")
+      ("port", po::value<unsigned short>()->default_value(REACH_PORT), "Port to listen on")
+      ("pool-size", po::value<size_t>()->default_value(16 * 1024 * 1024), "Size of the pregenerated payload pool in bytes")
+      ("busy-poll", po::value<int>()->default_value(0), "Spin on the socket instead of waiting, block after this many us without work (0 disables)")
+      ("cpu", po::value<int>(), "Pin the server to this CPU, use with --busy-poll");
+
+    po::variables_map vm;
+    try
+    {
+      po::store(po::parse_command_line(argc, argv, desc), vm);
+
+      if ( vm.count("help")  )
+      {
+        std::cout << desc << std::endl;
+        return 0;
+      }
+
+      po::notify(vm);
+    }
+    catch(po::error& e)
+    {
+      std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
+      std::cerr << desc << std::endl;
+      return 1;
+    }
+
+    if( vm["pool-size"].as<size_t>() < 2 * MAX_PACKET_SIZE ) {
+      std::cerr << "ERROR: --pool-size has to be at least " << 2 * MAX_PACKET_SIZE << " bytes" << std::endl;
+      return 1;
+    }
+
   try
   {
     boost::asio::io_service io_service;
-    ReachServer server(io_service);
+    ReachServer server(io_service, vm["port"].as<unsigned short>(), vm["pool-size"].as<size_t>());
     boost::asio::spawn(io_service, [&](yield_context yield) {
       server.receiveMessage(yield);
     });
 
-    io_service.run();
+    if( vm.count("cpu") && !BusyPoll::pinThread(vm["cpu"].as<int>()) ) {
+      BOOST_LOG_TRIVIAL(warning) << "Pinning to CPU " << vm["cpu"].as<int>() << " failed";
+    }
+    if( vm["busy-poll"].as<int>() > 0 ) {
+      if( !server.enableBusyPoll() ) {
+        BOOST_LOG_TRIVIAL(warning) << "SO_BUSY_POLL is not available, spinning in user space only";
+      }
+      BusyPoll busyPoll(io_service, std::chrono::microseconds(vm["busy-poll"].as<int>()));
+      busyPoll.run();
+    } else {
+      io_service.run();
+    }
 }
 catch (std::exception& e)
 {
@@ -0,0 +1,337 @@
+#include <BlockCache.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BOOST_LOG_DYN_LINK 1
+#include <boost/log/trivial.hpp>
+
+// "REACHBC1"
+static const uint64_t INDEX_MAGIC = 0x3143424843414552ULL;
+
+// FNV-1a, unlike std::hash it is stable across builds
+static uint64_t cacheKey(const std::string& server, const std::string& path)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for( const std::string& text : {server, std::string(1, '\0'), path} ) {
+		for( unsigned char c : text ) {
+			hash ^= c;
+			hash *= 1099511628211ULL;
+		}
+	}
+	return hash == 0 ? 1 : hash;
+}
+
+static bool endsWith(const std::string& text, const std::string& suffix)
+{
+	return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Maps the file and creates it with the given size unless it has it
+// already, returns true if it was created
+static bool mapFile(boost::iostreams::mapped_file& file, const std::string& path, uint64_t size)
+{
+	boost::iostreams::mapped_file_params params;
+	params.path = path;
+	params.flags = boost::iostreams::mapped_file::readwrite;
+
+	struct stat status;
+	if( stat(path.c_str(), &status) != 0 || static_cast<uint64_t>(status.st_size) != size ) {
+		params.new_file_size = size;
+	}
+	file.open(params);
+	return params.new_file_size != 0;
+}
+
+//////////////////////////////
+// Entry
+//////////////////////////////
+
+BlockCache::Entry::Entry(std::shared_ptr<BlockCache> cache, size_t slot) :
+m_cache(cache),
+m_slot(slot),
+m_fileSize(cache->slot(slot).fileSize),
+m_packetSize(cache->slot(slot).packetSize),
+m_version(cache->slot(slot).version)
+{
+	uint64_t packets = packetCount();
+	bool createdData = mapFile(m_data, m_cache->slotPath(slot, ".data"), m_fileSize);
+	bool createdBitmap = mapFile(m_bitmap, m_cache->slotPath(slot, ".bitmap"), (packets + 7) / 8);
+
+	// A lost data or bitmap file loses all packets
+	IndexSlot& entry = m_cache->slot(slot);
+	if( createdData || createdBitmap ) {
+		memset(m_bitmap.data(), 0, m_bitmap.size());
+		m_cache->m_cachedBytes -= entry.cachedPackets * entry.packetSize;
+		entry.cachedPackets = 0;
+	}
+
+	if( m_cache->m_users[m_slot]++ == 0 ) {
+		m_cache->m_usedSlots++;
+	}
+}
+
+BlockCache::Entry::~Entry()
+{
+	if( --m_cache->m_users[m_slot] == 0 ) {
+		m_cache->m_usedSlots--;
+	}
+}
+
+Range BlockCache::Entry::cached(const Range& packets) const
+{
+	const uint8_t* bitmap = reinterpret_cast<const uint8_t*>(m_bitmap.const_data());
+	Range result;
+	for( const Range::Interval& interval : packets.intervals() ) {
+		uint64_t end = std::min(interval.second, packetCount());
+		uint64_t runStart = end;
+		for( uint64_t packetId = interval.first; packetId < end; ++packetId ) {
+			bool present = bitmap[packetId / 8] & (1 << (packetId % 8));
+			if( present && runStart == end ) {
+				runStart = packetId;
+			} else if( !present && runStart != end ) {
+				result.add(runStart, packetId);
+				runStart = end;
+			}
+		}
+		if( runStart != end ) {
+			result.add(runStart, end);
+		}
+	}
+	return result;
+}
+
+uint64_t BlockCache::Entry::cachedPackets() const
+{
+	return m_cache->slot(m_slot).cachedPackets;
+}
+
+const uint8_t* BlockCache::Entry::data(uint64_t packetId) const
+{
+	return reinterpret_cast<const uint8_t*>(m_data.const_data()) + packetId * m_packetSize;
+}
+
+size_t BlockCache::Entry::size(uint64_t packetId) const
+{
+	uint64_t offset = packetId * m_packetSize;
+	return offset < m_fileSize ? std::min(m_packetSize, m_fileSize - offset) : 0;
+}
+
+void BlockCache::Entry::write(uint64_t packetId, const uint8_t* data, size_t size)
+{
+	uint8_t* bitmap = reinterpret_cast<uint8_t*>(m_bitmap.data());
+	uint8_t mask = 1 << (packetId % 8);
+	if( this->size(packetId) == 0 || (bitmap[packetId / 8] & mask) || !m_cache->reserve(m_packetSize) ) {
+		return;
+	}
+
+	// The bit is only set once the payload is in place
+	memcpy(m_data.data() + packetId * m_packetSize, data, std::min(size, this->size(packetId)));
+	bitmap[packetId / 8] |= mask;
+
+	m_cache->slot(m_slot).cachedPackets++;
+	m_cache->m_cachedBytes += m_packetSize;
+}
+
+//////////////////////////////
+// BlockCache
+//////////////////////////////
+
+BlockCache::BlockCache(const std::string& directory, uint64_t budgetBytes, size_t slotCount) :
+m_directory(directory),
+m_budgetBytes(budgetBytes),
+m_lockFd(-1),
+m_usedSlots(0),
+m_cachedBytes(0)
+{
+	mkdir(m_directory.c_str(), 0755);
+
+	int lockFd = ::open((m_directory + "/lock").c_str(), O_RDWR | O_CREAT, 0644);
+	if( lockFd < 0 || flock(lockFd, LOCK_EX | LOCK_NB) != 0 ) {
+		BOOST_LOG_TRIVIAL(warning) << "BlockCache: " << m_directory << " is not usable: " << strerror(errno);
+		if( lockFd >= 0 ) {
+			close(lockFd);
+		}
+		return;
+	}
+
+	try {
+		mapFile(m_index, m_directory + "/index", sizeof(IndexHeader) + slotCount * sizeof(IndexSlot));
+	} catch( std::exception& e ) {
+		BOOST_LOG_TRIVIAL(warning) << "BlockCache: " << m_directory << " is not usable: " << e.what();
+		close(lockFd);
+		return;
+	}
+	m_lockFd = lockFd;
+
+	if( header().magic != INDEX_MAGIC || header().slotCount != slotCount || !header().clean ) {
+		resetIndex(slotCount);
+	}
+
+	for( size_t index = 0; index < slotCount; ++index ) {
+		const IndexSlot& entry = slot(index);
+		if( entry.key != 0 ) {
+			m_slots[entry.key] = index;
+			m_cachedBytes += entry.cachedPackets * entry.packetSize;
+		}
+	}
+	m_users.assign(slotCount, 0);
+
+	// Cleared until the destructor ran, a crash empties the cache
+	header().clean = 0;
+}
+
+BlockCache::~BlockCache()
+{
+	if( isOpen() ) {
+		header().clean = 1;
+		m_index.close();
+		close(m_lockFd);
+	}
+}
+
+std::shared_ptr<BlockCache::Entry> BlockCache::open(const std::string& server, const std::string& path,
+	uint64_t fileSize, uint64_t packetSize, uint64_t version)
+{
+	if( !isOpen() || version == 0 || fileSize == 0 || packetSize == 0 ) {
+		return std::shared_ptr<Entry>();
+	}
+
+	uint64_t key = cacheKey(server, path);
+	auto slotIt = m_slots.find(key);
+	if( slotIt != m_slots.end() ) {
+		const IndexSlot& entry = slot(slotIt->second);
+		if( entry.version != version || entry.fileSize != fileSize || entry.packetSize != packetSize ) {
+			// Transfers still reading the old version keep it
+			if( m_users[slotIt->second] > 0 ) {
+				return std::shared_ptr<Entry>();
+			}
+			dropSlot(slotIt->second);
+			slotIt = m_slots.end();
+		}
+	}
+
+	size_t index = 0;
+	if( slotIt != m_slots.end() ) {
+		index = slotIt->second;
+	} else {
+		if( m_slots.size() == header().slotCount && !evictLeastRecentlyUsed() ) {
+			return std::shared_ptr<Entry>();
+		}
+		while( slot(index).key != 0 ) {
+			index++;
+		}
+
+		IndexSlot& entry = slot(index);
+		entry.key = key;
+		entry.version = version;
+		entry.fileSize = fileSize;
+		entry.packetSize = packetSize;
+		entry.cachedPackets = 0;
+		m_slots[key] = index;
+	}
+	slot(index).lastUsed = ++header().clock;
+
+	try {
+		return std::shared_ptr<Entry>(new Entry(shared_from_this(), index));
+	} catch( std::exception& e ) {
+		BOOST_LOG_TRIVIAL(warning) << "BlockCache: Caching " << path << " failed: " << e.what();
+		dropSlot(index);
+		return std::shared_ptr<Entry>();
+	}
+}
+
+std::shared_ptr<BlockCache::Entry> BlockCache::find(const std::string& server, const std::string& path)
+{
+	auto slotIt = isOpen() ? m_slots.find(cacheKey(server, path)) : m_slots.end();
+	if( slotIt == m_slots.end() ) {
+		return std::shared_ptr<Entry>();
+	}
+
+	const IndexSlot& entry = slot(slotIt->second);
+	return open(server, path, entry.fileSize, entry.packetSize, entry.version);
+}
+
+BlockCache::IndexHeader& BlockCache::header()
+{
+	return *reinterpret_cast<IndexHeader*>(m_index.data());
+}
+
+BlockCache::IndexSlot& BlockCache::slot(size_t index)
+{
+	return reinterpret_cast<IndexSlot*>(m_index.data() + sizeof(IndexHeader))[index];
+}
+
+std::string BlockCache::slotPath(size_t index, const char* suffix) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx", static_cast<unsigned long long>(
+		reinterpret_cast<const IndexSlot*>(m_index.const_data() + sizeof(IndexHeader))[index].key));
+	return m_directory + name + suffix;
+}
+
+void BlockCache::resetIndex(size_t slotCount)
+{
+	// Without a valid index every file of the directory is an orphan
+	DIR* directory = opendir(m_directory.c_str());
+	if( directory ) {
+		while( dirent* file = readdir(directory) ) {
+			std::string name(file->d_name);
+			if( endsWith(name, ".data") || endsWith(name, ".bitmap") ) {
+				unlink((m_directory + "/" + name).c_str());
+			}
+		}
+		closedir(directory);
+	}
+
+	memset(m_index.data(), 0, m_index.size());
+	header().magic = INDEX_MAGIC;
+	header().slotCount = slotCount;
+}
+
+void BlockCache::dropSlot(size_t index)
+{
+	IndexSlot& entry = slot(index);
+	unlink(slotPath(index, ".data").c_str());
+	unlink(slotPath(index, ".bitmap").c_str());
+
+	m_cachedBytes -= entry.cachedPackets * entry.packetSize;
+	m_slots.erase(entry.key);
+	memset(&entry, 0, sizeof(entry));
+}
+
+bool BlockCache::reserve(uint64_t size)
+{
+	while( m_cachedBytes + size > m_budgetBytes ) {
+		if( !evictLeastRecentlyUsed() ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool BlockCache::evictLeastRecentlyUsed()
+{
+	// Files with an open entry can not be evicted
+	if( m_slots.size() <= m_usedSlots ) {
+		return false;
+	}
+
+	size_t victim = 0;
+	uint64_t oldest = UINT64_MAX;
+	for( const auto& cached : m_slots ) {
+		if( m_users[cached.second] == 0 && slot(cached.second).lastUsed < oldest ) {
+			victim = cached.second;
+			oldest = slot(cached.second).lastUsed;
+		}
+	}
+
+	dropSlot(victim);
+	return true;
+}
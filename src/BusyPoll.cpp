@@ -0,0 +1,55 @@
+#include <BusyPoll.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+
+BusyPoll::BusyPoll(boost::asio::io_service& io_service, std::chrono::microseconds idle) :
+m_ioService(io_service),
+m_idle(idle),
+m_emptyPolls(0),
+m_blockingWaits(0)
+{
+}
+
+void BusyPoll::run()
+{
+	std::chrono::steady_clock::time_point lastHandler = std::chrono::steady_clock::now();
+	while( !m_ioService.stopped() ) {
+		if( m_ioService.poll() > 0 ) {
+			lastHandler = std::chrono::steady_clock::now();
+			continue;
+		}
+
+		if( std::chrono::steady_clock::now() - lastHandler < m_idle ) {
+			m_emptyPolls++;
+			continue;
+		}
+
+		// Idle long enough, wait for the kernel like run() does
+		m_blockingWaits++;
+		m_ioService.run_one();
+		lastHandler = std::chrono::steady_clock::now();
+	}
+}
+
+bool BusyPoll::pinThread(int cpu)
+{
+	if( cpu < 0 || cpu >= CPU_SETSIZE ) {
+		return false;
+	}
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+}
+
+bool BusyPoll::enableSocket(int fd, int busyPollUs)
+{
+#ifdef SO_BUSY_POLL
+	return setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busyPollUs, sizeof(busyPollUs)) == 0;
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,99 @@
+#include <Checkpoint.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+// "REACHCP1"
+static const uint64_t CHECKPOINT_MAGIC = 0x3150434843414552ULL;
+
+template<typename T>
+static bool readValue(const uint8_t*& data, const uint8_t* end, T& value)
+{
+	if( static_cast<size_t>(end - data) < sizeof(T) ) {
+		return false;
+	}
+	memcpy(&value, data, sizeof(T));
+	data += sizeof(T);
+	return true;
+}
+
+template<typename T>
+static void writeValue(std::ofstream& file, const T& value)
+{
+	file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+Checkpoint::Checkpoint() :
+fileSize(0),
+packetSize(0),
+fileVersion(0)
+{
+}
+
+bool Checkpoint::sameFile(const Checkpoint& other) const
+{
+	return path == other.path && fileSize == other.fileSize &&
+		packetSize == other.packetSize && fileVersion == other.fileVersion;
+}
+
+// magic, fileSize, packetSize, fileVersion, uint64 pathLength, path,
+// uint64 rangeLength, missing in wire encoding
+bool Checkpoint::load(const std::string& file)
+{
+	std::ifstream input(file, std::ios::binary);
+	std::vector<uint8_t> buffer((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+	const uint8_t* data = buffer.data();
+	const uint8_t* end = data + buffer.size();
+
+	uint64_t magic = 0;
+	uint64_t pathLength = 0;
+	if( !readValue(data, end, magic) || magic != CHECKPOINT_MAGIC ||
+		!readValue(data, end, fileSize) || !readValue(data, end, packetSize) ||
+		!readValue(data, end, fileVersion) || !readValue(data, end, pathLength) ||
+		static_cast<uint64_t>(end - data) < pathLength ) {
+		return false;
+	}
+	path.assign(reinterpret_cast<const char*>(data), pathLength);
+	data += pathLength;
+
+	uint64_t rangeLength = 0;
+	if( !readValue(data, end, rangeLength) || static_cast<uint64_t>(end - data) != rangeLength ) {
+		return false;
+	}
+	// Packets past the end of the file mean a corrupt checkpoint
+	std::shared_ptr<Range> packets = Range::fromBuffer(data, rangeLength,
+		packetSize == 0 ? 0 : (fileSize + packetSize - 1) / packetSize);
+	if( !packets ) {
+		return false;
+	}
+	missing = *packets;
+	return true;
+}
+
+bool Checkpoint::save(const std::string& file) const
+{
+	std::string temporaryFile = file + ".tmp";
+	{
+		std::ofstream output(temporaryFile, std::ios::binary);
+		writeValue(output, CHECKPOINT_MAGIC);
+		writeValue(output, fileSize);
+		writeValue(output, packetSize);
+		writeValue(output, fileVersion);
+		writeValue(output, static_cast<uint64_t>(path.size()));
+		output.write(path.data(), path.size());
+
+		std::vector<boost::asio::const_buffer> range = missing.asBuffer();
+		writeValue(output, static_cast<uint64_t>(boost::asio::buffer_size(range)));
+		for( const boost::asio::const_buffer& buffer : range ) {
+			output.write(boost::asio::buffer_cast<const char*>(buffer), boost::asio::buffer_size(buffer));
+		}
+		if( !output ) {
+			return false;
+		}
+	}
+
+	return std::rename(temporaryFile.c_str(), file.c_str()) == 0;
+}
@@ -0,0 +1,440 @@
+#include <ClientEngine.h>
+#include <BusyPoll.h>
+#include <sstream>
+#include <boost/bind.hpp>
+
+#define BOOST_LOG_DYN_LINK 1
+#include <boost/log/trivial.hpp>
+
+using boost::asio::ip::udp;
+
+ClientEngine::Options::Options() :
+requestSize(REQUEST_SIZE),
+window(8 * REQUEST_SIZE),
+engineWindow(REQUEST_PREFETCH),
+receiveBufferSize(4 * 1024 * 1024),
+fileInfoTimeoutMs(RECEIVE_TIMEOUT),
+requestTimeoutMs(100),
+stallTimeoutMs(SEND_RETRY * RECEIVE_TIMEOUT),
+checkpointIntervalMs(1000),
+cacheBytes(10ULL * 1024 * 1024 * 1024),
+multicast(true),
+peers(true),
+peerIntervalMs(1000),
+priority(0),
+packetRing(false),
+busyPollUs(0)
+{
+}
+
+ClientEngine::Histograms::Histograms(Metrics& metrics) :
+firstPacket(metrics.histogram("reach_client_first_packet_us", "Time from sending a request to its first packet in us")),
+requestCompletion(metrics.histogram("reach_client_request_completion_us", "Time from sending a request to its last packet in us")),
+retransmitsPerPacket(metrics.histogram("reach_client_retransmits_per_packet", "Number of times a packet was requested again")),
+lossBurst(metrics.histogram("reach_client_loss_burst_packets", "Length of runs of packets missing from a request"))
+{
+}
+
+ClientEngine::ClientEngine(boost::asio::io_service& io_service, const udp::endpoint& server,
+	const Options& options) :
+m_ioService(io_service),
+m_socket(io_service),
+m_servers(1, server),
+m_options(options),
+m_timers(io_service),
+m_nextUfid(1),
+m_peerRing(std::make_shared<SendRing>(SEND_RING_SIZE)),
+m_peerTimer(io_service),
+m_peerSending(false),
+m_packetsInFlight(0),
+m_histograms(m_metrics)
+{
+	start();
+}
+
+ClientEngine::ClientEngine(boost::asio::io_service& io_service, const std::vector<udp::endpoint>& servers,
+	const Options& options) :
+m_ioService(io_service),
+m_socket(io_service),
+m_servers(servers),
+m_options(options),
+m_timers(io_service),
+m_nextUfid(1),
+m_peerRing(std::make_shared<SendRing>(SEND_RING_SIZE)),
+m_peerTimer(io_service),
+m_peerSending(false),
+m_packetsInFlight(0),
+m_histograms(m_metrics)
+{
+	start();
+}
+
+void ClientEngine::start()
+{
+	m_socket.open(udp::v4());
+
+	boost::system::error_code error;
+	m_socket.set_option(boost::asio::socket_base::receive_buffer_size(m_options.receiveBufferSize), error);
+	if( m_options.busyPollUs > 0 && !BusyPoll::enableSocket(m_socket.native_handle(), m_options.busyPollUs) ) {
+		BOOST_LOG_TRIVIAL(warning) << "ClientEngine: SO_BUSY_POLL is not available";
+	}
+
+	// The ring filters on the port, the socket needs it before the first send
+	if( m_options.packetRing ) {
+		m_socket.bind(udp::endpoint(udp::v4(), 0));
+		m_packetRing.reset(new PacketRing(m_ioService));
+		bool opened = m_packetRing->open(m_socket, [this](const uint8_t* data, size_t size, const udp::endpoint& sender) {
+			dispatch(data, size, sender);
+		});
+		if( !opened ) {
+			BOOST_LOG_TRIVIAL(warning) << "ClientEngine: Receiving from the socket, the packet ring is not available";
+			m_packetRing.reset();
+		}
+	}
+	receiveMessage();
+
+	if( !m_options.cacheDirectory.empty() ) {
+		m_cache = std::make_shared<BlockCache>(m_options.cacheDirectory, m_options.cacheBytes);
+	}
+}
+
+ClientEngine::~ClientEngine()
+{
+	m_packetRing.reset();
+
+	boost::system::error_code error;
+	m_socket.close(error);
+	for( const auto& group : m_groups ) {
+		group.second->socket.close(error);
+	}
+}
+
+uint64_t ClientEngine::copy(const std::string& path, std::shared_ptr<Sink> sink, CopyFile::Completion completion)
+{
+	uint64_t ufid = m_nextUfid++;
+
+	m_ioService.post([this, ufid, path, sink, completion]() {
+		std::shared_ptr<CopyFile> transfer(new CopyFile(*this, ufid, path, sink, completion));
+		m_transfers[ufid] = transfer;
+		transfer->start();
+	});
+
+	return ufid;
+}
+
+std::future<CopyFile::Result> ClientEngine::copy(const std::string& path, std::shared_ptr<Sink> sink)
+{
+	std::shared_ptr<std::promise<CopyFile::Result> > promise(new std::promise<CopyFile::Result>());
+
+	copy(path, sink, [promise](const boost::system::error_code& error, const CopyFile::Result& result) {
+		if( error ) {
+			promise->set_exception(std::make_exception_ptr(boost::system::system_error(error)));
+		} else {
+			promise->set_value(result);
+		}
+	});
+
+	return promise->get_future();
+}
+
+uint64_t ClientEngine::read(const std::string& path, const std::vector<ScatterSink::Buffer>& buffers, CopyFile::Completion completion)
+{
+	return copy(path, std::make_shared<ScatterSink>(buffers), completion);
+}
+
+std::future<CopyFile::Result> ClientEngine::read(const std::string& path, uint64_t offset, uint64_t length, uint8_t* data)
+{
+	ScatterSink::Buffer buffer = {offset, length, data};
+	return copy(path, std::make_shared<ScatterSink>(std::vector<ScatterSink::Buffer>(1, buffer)));
+}
+
+void ClientEngine::cancel(uint64_t id)
+{
+	m_ioService.post([this, id]() {
+		auto transferIt = m_transfers.find(id);
+		if( transferIt != m_transfers.end() ) {
+			transferIt->second->cancel();
+		}
+	});
+}
+
+void ClientEngine::send(std::shared_ptr<Message> message, const udp::endpoint& destination)
+{
+	// The message owns the buffers until the send completed
+	m_socket.async_send_to(message->asBuffer(), destination,
+		[message](const boost::system::error_code& error, std::size_t) {
+			if( error ) {
+				BOOST_LOG_TRIVIAL(error) << "ClientEngine::send: " << error.message();
+			}
+		});
+}
+
+void ClientEngine::finished(uint64_t id)
+{
+	m_transfers.erase(id);
+}
+
+std::shared_ptr<BlockCache::Entry> ClientEngine::openCacheEntry(size_t server, const std::string& path,
+	uint64_t fileSize, uint64_t packetSize, uint64_t fileVersion)
+{
+	if( !m_cache ) {
+		return std::shared_ptr<BlockCache::Entry>();
+	}
+
+	// The version is only comparable between files of the same server
+	return m_cache->open(serverName(server), path, fileSize, packetSize, fileVersion);
+}
+
+std::string ClientEngine::serverName(size_t server) const
+{
+	std::stringstream name;
+	name << m_servers[server];
+	return name.str();
+}
+
+bool ClientEngine::joinGroup(const udp::endpoint& group, uint64_t session, std::shared_ptr<CopyFile> transfer)
+{
+	std::shared_ptr<MulticastGroup>& joined = m_groups[group];
+	if( !joined ) {
+		std::shared_ptr<MulticastGroup> created = std::make_shared<MulticastGroup>(m_ioService);
+		try {
+			boost::asio::ip::address_v4 interface = m_options.multicastInterface.empty() ?
+				boost::asio::ip::address_v4::any() : boost::asio::ip::address_v4::from_string(m_options.multicastInterface);
+
+			// Every receiver on the host binds the group port
+			created->socket.open(udp::v4());
+			created->socket.set_option(udp::socket::reuse_address(true));
+			created->socket.bind(group);
+			created->socket.set_option(boost::asio::ip::multicast::join_group(group.address().to_v4(), interface));
+
+			boost::system::error_code error;
+			created->socket.set_option(boost::asio::socket_base::receive_buffer_size(m_options.receiveBufferSize), error);
+		} catch( std::exception& e ) {
+			BOOST_LOG_TRIVIAL(warning) << "ClientEngine::joinGroup: " << group << " " << e.what();
+			m_groups.erase(group);
+			return false;
+		}
+
+		joined = created;
+		receiveGroupMessage(joined);
+	}
+
+	joined->users++;
+	m_sessions.insert(std::make_pair(session, std::weak_ptr<CopyFile>(transfer)));
+	return true;
+}
+
+void ClientEngine::leaveGroup(const udp::endpoint& group, uint64_t session, const CopyFile* transfer)
+{
+	auto range = m_sessions.equal_range(session);
+	for( auto sessionIt = range.first; sessionIt != range.second; ++sessionIt ) {
+		std::shared_ptr<CopyFile> member = sessionIt->second.lock();
+		if( !member || member.get() == transfer ) {
+			m_sessions.erase(sessionIt);
+			break;
+		}
+	}
+
+	auto groupIt = m_groups.find(group);
+	if( groupIt != m_groups.end() && --groupIt->second->users == 0 ) {
+		// The pending receive keeps the group alive until it is aborted
+		boost::system::error_code error;
+		groupIt->second->socket.close(error);
+		m_groups.erase(groupIt);
+	}
+}
+
+uint64_t ClientEngine::acquirePackets(uint64_t count)
+{
+	count = std::min(count, m_options.engineWindow - std::min(m_packetsInFlight, m_options.engineWindow));
+	m_packetsInFlight += count;
+	return count;
+}
+
+void ClientEngine::releasePackets(uint64_t count)
+{
+	m_packetsInFlight -= std::min(count, m_packetsInFlight);
+
+	// Waiting transfers are served in order, a transfer that gets nothing
+	// queues itself again and ends the loop
+	while( m_packetsInFlight < m_options.engineWindow && !m_waiting.empty() ) {
+		std::shared_ptr<CopyFile> transfer = m_waiting.front().lock();
+		m_waiting.pop_front();
+		if( transfer ) {
+			transfer->resume();
+		}
+	}
+}
+
+void ClientEngine::waitForPackets(std::shared_ptr<CopyFile> transfer)
+{
+	m_waiting.push_back(transfer);
+}
+
+void ClientEngine::receiveMessage()
+{
+	m_socket.async_receive_from(boost::asio::buffer(m_receiveBuffer), m_senderEndpoint,
+		boost::bind(&ClientEngine::receiveMessageComplete, this,
+			boost::asio::placeholders::error,
+			boost::asio::placeholders::bytes_transferred));
+}
+
+void ClientEngine::receiveMessageComplete(const boost::system::error_code& error, std::size_t messageSize)
+{
+	if( error == boost::asio::error::operation_aborted ) {
+		return;
+	}
+
+	if( !error ) {
+		dispatch(m_receiveBuffer.data(), messageSize, m_senderEndpoint);
+	}
+
+	receiveMessage();
+}
+
+void ClientEngine::dispatch(const uint8_t* data, size_t size, const udp::endpoint& sender)
+{
+	if( size < sizeof(Message::TYPE) + sizeof(uint64_t) ) {
+		return;
+	}
+	std::shared_ptr<Message> message = Message::fromBuffer(data, size);
+	if( !message ) {
+		return;
+	}
+
+	auto transferIt = m_transfers.find(message->ufid());
+	if( message->type() == Message::REQ_FILE || message->type() == Message::REQ_FILE_PACKETS ) {
+		servePeer(*message, sender);
+	} else if( transferIt != m_transfers.end() ) {
+		// The transfer may finish and remove itself from the table
+		std::shared_ptr<CopyFile> transfer = transferIt->second;
+		transfer->receive(*message, sender);
+	}
+}
+
+void ClientEngine::receiveGroupMessage(std::shared_ptr<MulticastGroup> group)
+{
+	group->socket.async_receive_from(boost::asio::buffer(group->buffer), group->sender,
+		[this, group](const boost::system::error_code& error, std::size_t messageSize) {
+			if( error == boost::asio::error::operation_aborted || !group->socket.is_open() ) {
+				return;
+			}
+
+			if( !error && messageSize >= Message::FILE_PACKET_HEADER_SIZE && group->buffer[0] == Message::FILE_PACKET ) {
+				std::shared_ptr<Message> message = Message::fromBuffer(group->buffer.data(), messageSize);
+
+				// Transfers may finish and leave while the packet is handed out
+				std::vector<std::shared_ptr<CopyFile> > members;
+				auto range = m_sessions.equal_range(message->ufid());
+				for( auto sessionIt = range.first; sessionIt != range.second; ++sessionIt ) {
+					if( std::shared_ptr<CopyFile> member = sessionIt->second.lock() ) {
+						members.push_back(member);
+					}
+				}
+				for( const std::shared_ptr<CopyFile>& member : members ) {
+					member->receiveMulticast(*message);
+				}
+			}
+
+			receiveGroupMessage(group);
+		});
+}
+
+// Peers ask like clients of a server and get the packets of the cached
+// version the engine holds
+void ClientEngine::servePeer(const Message& message, const udp::endpoint& peer)
+{
+	if( !m_cache || !m_options.peers ) {
+		return;
+	}
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if( message.type() == Message::REQ_FILE ) {
+		std::shared_ptr<BlockCache::Entry> entry;
+		for( size_t server = 0; server < m_servers.size() && !entry; ++server ) {
+			entry = m_cache->find(serverName(server), message.path());
+		}
+		if( !entry ) {
+			return;
+		}
+
+		// Served files keep their cache slot, idle ones let it go
+		for( auto servedIt = m_servedFiles.begin(); servedIt != m_servedFiles.end(); ) {
+			if( now - servedIt->second.lastUsed > std::chrono::seconds(FILE_IDLE_TIMEOUT) ) {
+				servedIt = m_servedFiles.erase(servedIt);
+			} else {
+				++servedIt;
+			}
+		}
+		ServedFile& served = m_servedFiles[PeerTransfer(peer, message.ufid())];
+		served.entry = entry;
+		served.lastUsed = now;
+
+		// The bitmap is only scanned again once the entry cached more. A list
+		// too long for one datagram is cut, the peer just asks less of us.
+		if( served.availableVersion != entry->version() || served.availableCount != entry->cachedPackets() ) {
+			served.available = entry->cached(Range(0, entry->packetCount()));
+			while( served.available.encodedSize() > MAX_MESSAGE_SIZE / 4 ) {
+				served.available = served.available.firstN(served.available.elementCount() / 2);
+			}
+			served.availableVersion = entry->version();
+			served.availableCount = entry->cachedPackets();
+		}
+		send(Message::createFileInfo(message.ufid(), entry->fileSize(), entry->packetSize(), entry->version()), peer);
+		send(Message::createAvailability(message.ufid(), served.available), peer);
+		return;
+	}
+
+	auto servedIt = m_servedFiles.find(PeerTransfer(peer, message.ufid()));
+	if( servedIt == m_servedFiles.end() ) {
+		return;
+	}
+	servedIt->second.lastUsed = now;
+
+	// Like a request to the server at most requestSize packets, queued with
+	// those of the other peers
+	std::shared_ptr<BlockCache::Entry> entry = servedIt->second.entry;
+	Range packets = entry->cached(message.packets().firstN(m_options.requestSize));
+	m_peerScheduler.enqueue(peer, 0, message.ufid(), packets, entry->packetSize(), now);
+	if( !m_peerSending ) {
+		sendPeerPackets();
+	}
+}
+
+void ClientEngine::sendPeerPackets()
+{
+	m_peerSending = false;
+
+	// Every slot is in flight, the sends complete before the next interval
+	RequestScheduler::Packet packet;
+	while( m_peerRing->inFlight() < m_peerRing->slotCount() && m_peerScheduler.next(std::chrono::steady_clock::now(), packet) ) {
+		// The peer may have been idle too long and forgotten
+		auto servedIt = m_servedFiles.find(PeerTransfer(packet.client, packet.ufid));
+		if( servedIt == m_servedFiles.end() ) {
+			continue;
+		}
+
+		std::shared_ptr<BlockCache::Entry> entry = servedIt->second.entry;
+		std::shared_ptr<SendRing> ring = m_peerRing;
+		SendRing::Slot* slot = ring->acquire(packet.ufid, packet.packetId, entry->data(packet.packetId), entry->size(packet.packetId), entry);
+		m_socket.async_send_to(slot->buffers(), packet.client,
+			[ring, slot](const boost::system::error_code& error, std::size_t) {
+				ring->release(slot);
+				if( error && error != boost::asio::error::operation_aborted ) {
+					BOOST_LOG_TRIVIAL(error) << "ClientEngine::sendPeerPackets: " << error.message();
+				}
+			});
+		break;
+	}
+
+	if( m_peerScheduler.empty() ) {
+		return;
+	}
+	m_peerSending = true;
+	m_peerTimer.expires_from_now(std::chrono::microseconds(SEND_INTERVAL_US));
+	m_peerTimer.async_wait([this](const boost::system::error_code& error) {
+		if( !error ) {
+			sendPeerPackets();
+		}
+	});
+}
@@ -1,183 +1,933 @@
 #include <CopyFile.h>
-#include <boost/bind.hpp>
+#include <ClientEngine.h>
+#include <algorithm>
+#include <cstdio>
+#include <random>
 #include <Config.h>
+#include <Trace.h>
 
 #define BOOST_LOG_DYN_LINK 1
 #include <boost/log/trivial.hpp>
 
-using boost::asio::ip::udp;
+using namespace std::chrono;
+
+CopyFile::Result::Result() :
+fileSize(0),
+packetSize(0),
+packets(0),
+bytes(0),
+cachedPackets(0),
+resumedPackets(0),
+requests(0),
+requestedPackets(0),
+receivedPackets(0),
+multicastPackets(0),
+timeouts(0),
+seconds(0),
+peerPackets(0)
+{
+}
+
+CopyFile::Replica::Replica() :
+peer(false),
+ready(false),
+failed(false),
+fileInfoRequests(0),
+packetsInFlight(0),
+requestTimeoutMs(0),
+delivered(0),
+rate(0)
+{
+}
 
-CopyFile::CopyFile(const char* path, 
-	std::shared_ptr<udp::socket> socket,
-	udp::endpoint& receiverEndpoint) : 
-m_socket(socket),
-m_receiverEndpoint(receiverEndpoint),
+CopyFile::CopyFile(ClientEngine& engine, uint64_t ufid, const std::string& path,
+	std::shared_ptr<Sink> sink, Completion completion) :
+m_engine(engine),
+m_ufid(ufid),
+m_path(path),
+m_sink(sink),
+m_cacheLimit(0),
+m_completion(completion),
+m_done(false),
+m_waiting(false),
+m_receiveTimer(engine.timers()),
 m_errorCount(0),
-m_receiveTimer(socket->get_io_service())
+m_fileSize(0),
+m_packetSize(0),
+m_packetsInFlight(0),
+m_replicas(engine.servers().size()),
+m_fileVersion(0),
+m_tracker(SIZE_MAX),
+m_peerCount(0),
+m_selectionStart(0),
+m_multicastSession(0),
+m_multicastCursor(UINT64_MAX)
 {
-	m_reqFileMessage = Message::createReqFile(path);  
-	sendRequestFile();
+	m_reqFileMessage = Message::createReqFile(ufid, path.c_str(), engine.options().priority);
+	m_result.serverPackets.assign(m_replicas.size(), 0);
+	for( size_t server = 0; server < m_replicas.size(); ++server ) {
+		m_replicas[server].endpoint = engine.servers()[server];
+		m_replicas[server].requestTimeoutMs = engine.options().requestTimeoutMs;
+	}
+}
+
+void CopyFile::start()
+{
+	m_start = Clock::now();
+	resume();
+}
+
+void CopyFile::cancel()
+{
+	complete(boost::asio::error::operation_aborted);
+}
+
+void CopyFile::resume()
+{
+	m_waiting = false;
+	if( m_done ) {
+		return;
+	}
+
+	if( m_packetSize > 0 ) {
+		sendRequestFilePackets();
+	} else if( m_engine.acquirePackets(1) == 1 ) {
+		// The outstanding REQ_FILE takes one packet of the engine window, so
+		// thousands of transfers do not start with a burst of REQ_FILEs
+		m_packetsInFlight = 1;
+		sendRequestFile();
+	} else {
+		m_waiting = true;
+		m_engine.waitForPackets(shared_from_this());
+	}
+}
+
+void CopyFile::receive(const Message& message, const boost::asio::ip::udp::endpoint& sender)
+{
+	// A single server may answer from another address of a multihomed host
+	size_t server = findReplica(sender);
+	if( server == m_replicas.size() && m_engine.servers().size() == 1 ) {
+		server = 0;
+	}
+	if( m_done || server == m_replicas.size() ) {
+		return;
+	}
+
+	if( message.type() == Message::FILE_INFO && m_packetSize == 0 ) {
+		receiveFileInfo(message, server);
+	} else if( message.type() == Message::FILE_INFO ) {
+		acceptReplica(message, server);
+	} else if( message.type() == Message::FILE_PACKET && m_packetSize > 0 ) {
+		receiveFilePacket(message, server);
+	} else if( message.type() == Message::PEERS && m_packetSize > 0 && !m_replicas[server].peer ) {
+		addPeers(message, server);
+	} else if( message.type() == Message::AVAILABILITY && m_replicas[server].peer ) {
+		m_replicas[server].available = message.packets();
+		sendRequestFilePackets();
+	}
 }
 
 void CopyFile::sendRequestFile()
 {
-	BOOST_LOG_TRIVIAL(info) << "CopyFile::sendRequestFile: " << m_reqFileMessage->path();
+	BOOST_LOG_TRIVIAL(debug) << "CopyFile::sendRequestFile: " << m_path;
 
-    m_socket->async_send_to(m_reqFileMessage->asBuffer(), m_receiverEndpoint,
-        boost::bind(&CopyFile::sendRequestFileComplete, this, 
-          	boost::asio::placeholders::error,
-          	boost::asio::placeholders::bytes_transferred));
+	for( size_t server = 0; server < m_replicas.size(); ++server ) {
+		requestFileInfo(server);
+	}
 
-    m_socket->async_receive_from(boost::asio::buffer(m_receiveBuffer), 
-    		m_receiverEndpoint,
-        	boost::bind(&CopyFile::receiveFileInfo, this, 
-          	boost::asio::placeholders::error,
-          	boost::asio::placeholders::bytes_transferred));    	
+	m_receiveTimer.expiresAfter(milliseconds(m_engine.options().fileInfoTimeoutMs), [this]() {
+		receiveFileInfoTimeOut();
+	});
 }
 
-void CopyFile::sendRequestFileComplete (
-  const boost::system::error_code& error,
-  std::size_t messageSize)
+void CopyFile::requestFileInfo(size_t server)
 {
-	if( error ) {
-		m_errorCount++;
-		BOOST_LOG_TRIVIAL(error) << "CopyFile::sendRequestFile (" << m_errorCount << "):" << error;
+	Replica& replica = m_replicas[server];
+	replica.fileInfoRequests++;
+	replica.lastFileInfoRequest = Clock::now();
+	m_engine.send(m_reqFileMessage, replica.endpoint);
+}
 
-		if(m_errorCount < SEND_RETRY) {
-			sendRequestFile();
+void CopyFile::receiveFileInfo(const Message& message, size_t server)
+{
+	BOOST_LOG_TRIVIAL(debug) << "CopyFile::receiveFileInfo: " << message.fileSize();
+
+	// Cancel timeout timer
+	m_receiveTimer.cancel();
+
+	if( message.packetSize() == 0 || !m_sink->open(message.fileSize()) ) {
+		complete(boost::system::errc::make_error_code(boost::system::errc::io_error));
+		return;
+	}
+
+	m_packetsInFlight = 0;
+	m_engine.releasePackets(1);
+
+	// A streaming sink moves its window once the consumer caught up
+	std::weak_ptr<CopyFile> weak = shared_from_this();
+	m_sink->setWindowListener([weak]() {
+		std::shared_ptr<CopyFile> self = weak.lock();
+		if( self && !self->m_done ) {
+			self->sendRequestFilePackets();
 		}
-	} else {
-		BOOST_LOG_TRIVIAL(info) << "CopyFile::sendRequestFile: " << messageSize;
+	});
+
+	m_fileSize = message.fileSize();
+	m_packetSize = message.packetSize();
+	m_fileVersion = message.fileVersion();
+	m_result.fileSize = m_fileSize;
+	m_result.packetSize = m_packetSize;
+	m_outstandingPackets = m_sink->packets(m_fileSize, m_packetSize);
+	m_result.packets = m_outstandingPackets.elementCount();
+	m_errorCount = 0;
+	resumeCheckpoint(message.fileVersion());
+	readCache(server, message.fileVersion());
+
+	if( m_outstandingPackets.elementCount() == 0 ) {
+		complete(boost::system::error_code());
+		return;
+	}
 
-		m_receiveTimer.expires_from_now(boost::posix_time::milliseconds(RECEIVE_TIMEOUT));
-		m_receiveTimer.async_wait(
-	        boost::bind(&CopyFile::receiveFileInfoTimeOut, this, 
-	          	boost::asio::placeholders::error));
+	if( message.multicastSession() != 0 ) {
+		joinMulticast(message);
 	}
+
+	m_lastProgress = Clock::now();
+	m_lastRateUpdate = m_lastProgress;
+	m_replicas[server].ready = true;
+	m_replicas[server].lastDelivery = m_lastProgress;
+	sendRequestFilePackets();
+
+	m_receiveTimer.expiresAfter(milliseconds(m_engine.options().requestTimeoutMs), [this]() {
+		sendRequestFilePacketsTimeOut();
+	});
 }
 
-void CopyFile::receiveFileInfo( const boost::system::error_code& error,
-		std::size_t messageSize)
+// A later FILE_INFO adds its server to the transfer if it has the same file.
+// A peer has to have the same version of the file, which only a file from
+// the same server has.
+void CopyFile::acceptReplica(const Message& message, size_t server)
 {
-	BOOST_LOG_TRIVIAL(info) << "CopyFile::receiveFileInfo: " << messageSize;
-	
-    if (!error || error == boost::asio::error::message_size)
-    {
-    	// Cancel timeout timer
-    	m_receiveTimer.cancel();
+	Replica& replica = m_replicas[server];
+	if( replica.ready || replica.failed ) {
+		return;
+	}
+
+	bool sameFile = message.fileSize() == m_fileSize && message.packetSize() == m_packetSize;
+	if( replica.peer ) {
+		sameFile = sameFile && m_fileVersion != 0 && message.fileVersion() == m_fileVersion;
+	}
+	if( !sameFile ) {
+		BOOST_LOG_TRIVIAL(warning) << "CopyFile::acceptReplica: " << replica.endpoint << " has another " << m_path;
+		replica.failed = true;
+		return;
+	}
 
-      	m_fileInfoMessage = Message::fromBuffer(m_receiveBuffer.data(), messageSize);
-  		m_outstandingPackets = Range(0, m_fileInfoMessage->packetCount());
+	replica.ready = true;
+	replica.lastDelivery = Clock::now();
+	sendRequestFilePackets();
+}
 
-  		sendRequestFilePackets();
-  	} 
+// Packets in the block cache go straight to the sink and are not requested.
+// The version comes from the server that answered first, so the cache
+// entry is that server's.
+void CopyFile::readCache(size_t server, uint64_t fileVersion)
+{
+	m_cacheEntry = m_engine.openCacheEntry(server, m_path, m_fileSize, m_packetSize, fileVersion);
+	readCachedPackets();
 }
 
+// A streaming sink only takes the cached packets of its window, the others
+// are read once the window got to them
+void CopyFile::readCachedPackets()
+{
+	uint64_t limit = windowLimit();
+	if( !m_cacheEntry || limit <= m_cacheLimit ) {
+		return;
+	}
+
+	Range window(m_outstandingPackets);
+	window.subtract(limit, packetCount());
+	if( m_cacheLimit > 0 ) {
+		window.subtract(0, m_cacheLimit);
+	}
+	m_cacheLimit = limit;
+
+	Range cached = m_cacheEntry->cached(window);
+	for( const Range::Interval& interval : cached.intervals() ) {
+		uint64_t offset = interval.first * m_packetSize;
+		uint64_t size = std::min(interval.second * m_packetSize, m_fileSize) - offset;
+		m_sink->write(offset, m_cacheEntry->data(interval.first), size);
+		m_result.bytes += size;
+	}
+	m_result.cachedPackets += cached.elementCount();
+	m_outstandingPackets.subtract(cached);
+}
 
-void CopyFile::receiveFileInfoTimeOut( const boost::system::error_code& error )
+// Packets an interrupted run wrote to the sink are not requested again
+void CopyFile::resumeCheckpoint(uint64_t fileVersion)
 {
-	if( !error ) {
-		m_errorCount++;
-		BOOST_LOG_TRIVIAL(error) << "CopyFile::receiveFileInfo: (" << m_errorCount << "):" << " Timeout";
+	if( m_engine.options().checkpointIntervalMs == 0 || fileVersion == 0 || m_sink->checkpointPath().empty() ) {
+		return;
+	}
 
-		// Cancel the receive operation
-		m_socket->cancel();
+	m_checkpointPath = m_sink->checkpointPath();
+	m_checkpoint.path = m_path;
+	m_checkpoint.fileSize = m_fileSize;
+	m_checkpoint.packetSize = m_packetSize;
+	m_checkpoint.fileVersion = fileVersion;
+	m_lastCheckpoint = Clock::now();
+
+	// The sink replaced a missing or truncated file, whatever the sidecar
+	// recorded as written is gone
+	if( !m_sink->keptFile() ) {
+		std::remove(m_checkpointPath.c_str());
+		return;
+	}
+
+	Checkpoint saved;
+	if( saved.load(m_checkpointPath) && saved.sameFile(m_checkpoint) ) {
+		Range written(m_outstandingPackets);
+		written.subtract(saved.missing);
+		m_outstandingPackets.subtract(written);
+		m_result.resumedPackets = written.elementCount();
+		BOOST_LOG_TRIVIAL(info) << "CopyFile::resumeCheckpoint: " << m_path << " " << m_result.resumedPackets << " packets written before";
+	}
+}
+
+void CopyFile::saveCheckpoint()
+{
+	// Everything else was written, the sink may still buffer it
+	m_sink->flush();
+	m_checkpoint.missing = m_outstandingPackets;
+	m_checkpoint.missing.add(m_multicastPackets);
+	for( const InflightRequest& request : m_inflight ) {
+		m_checkpoint.missing.add(request.packets);
+	}
+
+	if( !m_checkpoint.save(m_checkpointPath) ) {
+		BOOST_LOG_TRIVIAL(warning) << "CopyFile::saveCheckpoint: Writing " << m_checkpointPath << " failed";
+	}
+	m_lastCheckpoint = Clock::now();
+}
+
+void CopyFile::receiveFileInfoTimeOut()
+{
+	if( !m_done && m_packetSize == 0 ) {
+		m_errorCount++;
+		BOOST_LOG_TRIVIAL(debug) << "CopyFile::receiveFileInfo: (" << m_errorCount << "):" << " Timeout";
+		REACH_TRACE(TIMEOUT, m_ufid, m_errorCount);
 
 		// Retry up to SEND_RETRY times
-		if(m_errorCount < SEND_RETRY) {
+		if( m_errorCount < SEND_RETRY ) {
 			sendRequestFile();
-		}		
-	} 
+		} else {
+			complete(boost::asio::error::timed_out);
+		}
+	}
+}
+
+// The outstanding packets are expected from the group, only the packets it
+// lost are requested
+void CopyFile::joinMulticast(const Message& message)
+{
+	// The group sends in its own order, past the window of a streaming sink
+	if( !m_engine.options().multicast || windowLimit() < packetCount() ||
+		!m_engine.joinGroup(message.multicastGroup(), message.multicastSession(), shared_from_this()) ) {
+		return;
+	}
+
+	m_multicastGroup = message.multicastGroup();
+	m_multicastSession = message.multicastSession();
+	m_multicastPackets = m_outstandingPackets;
+	m_outstandingPackets = Range();
+	m_lastMulticast = Clock::now();
+}
+
+void CopyFile::leaveMulticast()
+{
+	if( m_multicastSession == 0 ) {
+		return;
+	}
+
+	m_engine.leaveGroup(m_multicastGroup, m_multicastSession, this);
+	m_multicastSession = 0;
+	m_outstandingPackets.add(m_multicastPackets);
+	m_multicastPackets = Range();
+}
+
+size_t CopyFile::findReplica(const boost::asio::ip::udp::endpoint& endpoint) const
+{
+	size_t server = 0;
+	while( server < m_replicas.size() && m_replicas[server].endpoint != endpoint ) {
+		server++;
+	}
+	return server;
+}
+
+// New peers are asked for the file like servers, they stay for the rest of
+// the transfer
+void CopyFile::addPeers(const Message& message, size_t tracker)
+{
+	if( !m_engine.options().peers ) {
+		return;
+	}
+
+	if( m_tracker == SIZE_MAX ) {
+		std::random_device random;
+		uint64_t packetCount = (m_fileSize + m_packetSize - 1) / m_packetSize;
+		m_selectionStart = std::uniform_int_distribution<uint64_t>(0, packetCount - 1)(random);
+		m_lastPeerRefresh = Clock::now();
+	}
+	m_tracker = tracker;
+
+	for( const boost::asio::ip::udp::endpoint& endpoint : message.peers() ) {
+		if( m_peerCount >= PEER_LIMIT || findReplica(endpoint) != m_replicas.size() ) {
+			continue;
+		}
+
+		Replica peer;
+		peer.endpoint = endpoint;
+		peer.peer = true;
+		peer.requestTimeoutMs = m_engine.options().requestTimeoutMs;
+		m_replicas.push_back(peer);
+		m_peerCount++;
+		requestFileInfo(m_replicas.size() - 1);
+	}
+}
+
+// The tracker sends the peers that came since, a peer answers the REQ_FILE
+// with the packets it received since
+void CopyFile::refreshPeers(Clock::time_point now)
+{
+	m_lastPeerRefresh = now;
+	m_engine.send(Message::createReqPeers(m_ufid), m_replicas[m_tracker].endpoint);
+	for( const Replica& replica : m_replicas ) {
+		if( replica.peer && replica.ready && !replica.failed ) {
+			m_engine.send(m_reqFileMessage, replica.endpoint);
+		}
+	}
+}
+
+void CopyFile::receiveMulticast(const Message& message)
+{
+	uint64_t packetId = message.packetId();
+	uint64_t packetCount = (m_fileSize + m_packetSize - 1) / m_packetSize;
+	if( m_done || m_multicastSession == 0 || !validPacket(message) ) {
+		return;
+	}
+
+	Clock::time_point now = Clock::now();
+	m_lastMulticast = now;
+	REACH_TRACE(PACKET_RECEIVED, m_ufid, packetId);
+
+	// The group sends the packets in order and starts over after the last
+	// one, packets it skipped since the cursor were lost. A packet shortly
+	// before the cursor was reordered.
+	bool reordered = m_multicastCursor != UINT64_MAX && packetId <= m_multicastCursor &&
+		m_multicastCursor - packetId <= m_engine.options().requestSize;
+	bool next = m_multicastCursor != UINT64_MAX && packetId == (m_multicastCursor + 1) % packetCount;
+	if( m_multicastCursor != UINT64_MAX && !reordered && !next ) {
+		Range skipped;
+		if( packetId > m_multicastCursor ) {
+			skipped.add(m_multicastCursor + 1, packetId);
+		} else {
+			skipped.add(m_multicastCursor + 1, packetCount);
+			skipped.add(0, packetId);
+		}
+
+		// The skipped packets we still expected are lost
+		Range unexpected(skipped);
+		unexpected.subtract(m_multicastPackets);
+		Range lost(skipped);
+		lost.subtract(unexpected);
+		m_multicastPackets.subtract(lost);
+		m_outstandingPackets.add(lost);
+	}
+	if( !reordered ) {
+		m_multicastCursor = packetId;
+	}
+
+	bool expected = m_multicastPackets.contains(packetId);
+	if( expected ) {
+		m_multicastPackets.subtract(packetId);
+	} else if( m_outstandingPackets.contains(packetId) ) {
+		m_outstandingPackets.subtract(packetId);
+		expected = true;
+	}
+
+	if( expected ) {
+		writePacket(message, now);
+		m_result.multicastPackets++;
+	}
+
+	if( receivedAll() ) {
+		complete(boost::system::error_code());
+	} else {
+		sendRequestFilePackets();
+	}
 }
 
 void CopyFile::sendRequestFilePackets()
 {
-	BOOST_LOG_TRIVIAL(info) << "CopyFile::sendRequestFilePackets PacketCount: " << m_outstandingPackets.elementCount();
+	const ClientEngine::Options& options = m_engine.options();
+
+	if( m_cacheLimit < windowLimit() ) {
+		readCachedPackets();
+		if( receivedAll() ) {
+			complete(boost::system::error_code());
+			return;
+		}
+	}
 
-	auto reqPacketsMessage = Message::createRequestFilePackets(
-		m_fileInfoMessage->ufid(),
-		m_outstandingPackets.firstN(256));
+	m_exhausted.assign(m_replicas.size(), false);
+	while( m_packetsInFlight < options.window && !m_outstandingPackets.empty() && !m_waiting ) {
+		size_t server = pickReplica();
+		if( server == m_replicas.size() ) {
+			break;
+		}
 
-    m_socket->async_send_to(reqPacketsMessage->asBuffer(), m_receiverEndpoint,
-        boost::bind(&CopyFile::sendRequestFilePacketsComplete, this, 
-          	boost::asio::placeholders::error,
-          	boost::asio::placeholders::bytes_transferred));
+		uint64_t count = m_engine.acquirePackets(options.requestSize);
+		if( count == 0 ) {
+			m_waiting = true;
+			m_engine.waitForPackets(shared_from_this());
+			break;
+		}
 
-    m_socket->async_receive_from(boost::asio::buffer(m_receiveBuffer), 
-    		m_receiverEndpoint,
-        	boost::bind(&CopyFile::receiveFilePacket, this, 
-          	boost::asio::placeholders::error,
-          	boost::asio::placeholders::bytes_transferred));    	
+		Range requestRange = selectPackets(server, count);
+		m_engine.releasePackets(count - requestRange.elementCount());
+		if( requestRange.elementCount() == 0 ) {
+			m_exhausted[server] = true;
+			continue;
+		}
 
+		InflightRequest request = {0, requestRange, Clock::now(), false, server};
+		m_inflight.push_back(request);
+		m_packetsInFlight += requestRange.elementCount();
+		m_replicas[server].packetsInFlight += requestRange.elementCount();
+		m_result.requests++;
+		m_result.requestedPackets += requestRange.elementCount();
+
+		REACH_TRACE(REQUEST_SENT, m_ufid, requestRange.elementCount());
+		m_engine.send(Message::createRequestFilePackets(m_ufid, requestRange), m_replicas[server].endpoint);
+	}
 }
 
+// The replica furthest below its share of the window. The share follows the
+// delivery rate plus one request, so a replica with spare capacity can
+// show it and a new one gets measured. A replica that timed out since its
+// last packet only gets the requests no other replica takes.
+size_t CopyFile::pickReplica() const
+{
+	const ClientEngine::Options& options = m_engine.options();
+
+	double totalRate = 0;
+	size_t usable = 0;
+	for( const Replica& replica : m_replicas ) {
+		if( replica.ready && !replica.failed ) {
+			totalRate += replica.rate;
+			usable++;
+		}
+	}
+
+	size_t best = m_replicas.size();
+	double bestLoad = 2;
+	for( size_t server = 0; server < m_replicas.size(); ++server ) {
+		const Replica& replica = m_replicas[server];
+		if( !replica.ready || replica.failed || m_exhausted[server] ) {
+			continue;
+		}
 
-void CopyFile::sendRequestFilePacketsComplete(  
-		const boost::system::error_code& error,
-		std::size_t messageSize)
+		double share = totalRate > 0 ? replica.rate / totalRate : 1.0 / usable;
+		double limit = share * options.window + options.requestSize;
+		if( replica.packetsInFlight >= limit ) {
+			continue;
+		}
+
+		double load = replica.packetsInFlight / limit + (replica.lastRequeue > replica.lastDelivery ? 1 : 0);
+		if( load < bestLoad ) {
+			best = server;
+			bestLoad = load;
+		}
+	}
+	return best;
+}
+
+// Packets past the window of the sink are not requested yet
+uint64_t CopyFile::windowLimit() const
+{
+	uint64_t end = m_sink->windowEnd();
+	return end >= m_fileSize ? packetCount() : end / m_packetSize;
+}
+
+// Takes up to count outstanding packets the replica has. Only a window of
+// candidates from the random start on is ranked by the peers holding them,
+// which bounds the cost of a request.
+Range CopyFile::selectPackets(size_t server, uint64_t count)
 {
-	BOOST_LOG_TRIVIAL(info) << "CopyFile::sendRequestFilePacketsComplete";
+	uint64_t limit = windowLimit();
+	if( m_peerCount == 0 && limit == packetCount() ) {
+		return m_outstandingPackets.removeFirstN(count);
+	}
 
-	if( error ) {
-		m_errorCount++;
-		BOOST_LOG_TRIVIAL(error) << "CopyFile::sendRequestFile (" << m_errorCount << "):" << error;
+	Range candidates(m_outstandingPackets);
+	candidates.subtract(limit, packetCount());
+	if( m_peerCount == 0 ) {
+		Range selected = candidates.firstN(count);
+		m_outstandingPackets.subtract(selected);
+		return selected;
+	}
+
+	if( m_replicas[server].peer ) {
+		Range missing(candidates);
+		missing.subtract(m_replicas[server].available);
+		candidates.subtract(missing);
+	}
 
-		if(m_errorCount < SEND_RETRY) {
-			sendRequestFilePackets();
+	// Candidates from the start on, then wrapped around to the beginning
+	const int64_t windowSize = 8 * count;
+	Range wrapped(candidates);
+	wrapped.subtract(m_selectionStart, (m_fileSize + m_packetSize - 1) / m_packetSize);
+	candidates.subtract(wrapped);
+	candidates = candidates.firstN(windowSize);
+	wrapped = wrapped.firstN(windowSize - candidates.elementCount());
+
+	std::vector<std::pair<size_t, uint64_t> > ranked;
+	for( const Range* part : {&candidates, &wrapped} ) {
+		for( uint64_t packetId : *part ) {
+			size_t holders = 0;
+			for( const Replica& replica : m_replicas ) {
+				if( replica.peer && replica.ready && !replica.failed && replica.available.contains(packetId) ) {
+					holders++;
+				}
+			}
+			ranked.push_back(std::make_pair(holders, packetId));
 		}
+	}
+	std::stable_sort(ranked.begin(), ranked.end(),
+		[](const std::pair<size_t, uint64_t>& a, const std::pair<size_t, uint64_t>& b) { return a.first < b.first; });
+
+	Range selected;
+	for( size_t i = 0; i < ranked.size() && i < count; ++i ) {
+		selected.add(ranked[i].second);
+	}
+	m_outstandingPackets.subtract(selected);
+	return selected;
+}
+
+void CopyFile::receiveFilePacket(const Message& message, size_t server)
+{
+	// Truncated or oversized datagrams leave the transfer untouched
+	if( !validPacket(message) ) {
+		return;
+	}
+
+	uint64_t packetId = message.packetId();
+	REACH_TRACE(PACKET_RECEIVED, m_ufid, packetId);
+
+	// A server answers its requests in order, packets of its later requests
+	// overtaking a request means that its remaining packets were lost
+	size_t index = 0;
+	while( index < m_inflight.size() && !m_inflight[index].packets.contains(packetId) ) {
+		index++;
+	}
+
+	bool expected = index < m_inflight.size();
+	Clock::time_point now = Clock::now();
+	uint64_t released = 0;
+	if( expected ) {
+		// A late packet of a requeued request may come from another server
+		const size_t owner = m_inflight[index].server;
+		const uint32_t lossThreshold = m_engine.options().requestSize / 2;
+		for( size_t i = 0; i < index; ) {
+			if( owner == server && m_inflight[i].server == owner && m_inflight[i].missed++ > lossThreshold ) {
+				released += requeue(m_inflight.begin() + i);
+				index--;
+			} else {
+				i++;
+			}
+		}
+
+		InflightRequest& request = m_inflight[index];
+		if( !request.answered ) {
+			m_engine.histograms().firstPacket.record(
+				duration_cast<microseconds>(now - request.sent).count());
+			request.answered = true;
+		}
+
+		request.packets.subtract(packetId);
+		request.missed = 0;
+		m_packetsInFlight--;
+		m_replicas[owner].packetsInFlight--;
+		released++;
+		if( request.packets.empty() ) {
+			m_engine.histograms().requestCompletion.record(
+				duration_cast<microseconds>(now - request.sent).count());
+			m_inflight.erase(m_inflight.begin() + index);
+		}
+	}
+
+	// Late packets of requests that were already requeued are still welcome
+	if( !expected && m_outstandingPackets.contains(packetId) ) {
+		m_outstandingPackets.subtract(packetId);
+		expected = true;
+	}
+
+	if( !expected ) {
+		m_engine.releasePackets(released);
+		return;
+	}
+
+	writePacket(message, now);
+
+	Replica& replica = m_replicas[server];
+	replica.delivered++;
+	replica.lastDelivery = now;
+	replica.requestTimeoutMs = m_engine.options().requestTimeoutMs;
+	if( replica.peer ) {
+		m_result.peerPackets++;
 	} else {
-		BOOST_LOG_TRIVIAL(info) << "CopyFile::sendRequestFile: " << messageSize;
+		m_result.serverPackets[server]++;
+	}
 
-		m_receiveTimer.expires_from_now(boost::posix_time::milliseconds(RECEIVE_TIMEOUT));
-		m_receiveTimer.async_wait(
-	        boost::bind(&CopyFile::sendRequestFilePacketsTimeOut, this, 
-	          	boost::asio::placeholders::error));
+	// Releasing may resume other transfers and this one, so the deque is
+	// only touched before
+	m_engine.releasePackets(released);
+	if( receivedAll() ) {
+		complete(boost::system::error_code());
+	} else if( !m_done ) {
+		sendRequestFilePackets();
 	}
+}
 
+bool CopyFile::validPacket(const Message& message) const
+{
+	uint64_t packetId = message.packetId();
+	if( packetId >= packetCount() ) {
+		return false;
+	}
+	return message.payloadSize() == std::min<uint64_t>(m_packetSize, m_fileSize - packetId * m_packetSize);
+}
 
+void CopyFile::writePacket(const Message& message, Clock::time_point now)
+{
+	// Never write more than the packet's place in the sink and cache
+	if( !validPacket(message) ) {
+		return;
+	}
+
+	uint64_t packetId = message.packetId();
+	size_t payloadSize = message.payloadSize();
+	m_sink->write(packetId * m_packetSize, message.payloadData(), payloadSize);
+	m_result.receivedPackets++;
+	m_result.bytes += payloadSize;
+	if( m_cacheEntry ) {
+		m_cacheEntry->write(packetId, message.payloadData(), payloadSize);
+	}
+	m_lastProgress = now;
+	m_errorCount = 0;
 }
 
+bool CopyFile::receivedAll() const
+{
+	return m_inflight.empty() && m_outstandingPackets.empty() && m_multicastPackets.empty();
+}
 
-void CopyFile::sendRequestFilePacketsTimeOut( const boost::system::error_code& error )
+// Returns the packets the caller has to release to the engine window
+uint64_t CopyFile::requeue(std::deque<InflightRequest>::iterator request)
 {
-	if( !error ) {
-		BOOST_LOG_TRIVIAL(error) << "CopyFile::receiveFilePacket: (" << m_errorCount << "):" << " Timeout";
+	Histogram& lossBurst = m_engine.histograms().lossBurst;
+	for( const Range::Interval& burst : request->packets.intervals() ) {
+		lossBurst.record(burst.second - burst.first);
+	}
+	REACH_TRACE(RETRANSMIT, m_ufid, request->packets.elementCount());
 
-		// Cancel the receive operation
-		m_socket->cancel();
+	for( uint64_t packetId : request->packets ) {
+		uint16_t& requeueCount = m_requeueCount[packetId];
+		if( requeueCount < UINT16_MAX ) {
+			requeueCount++;
+		}
+	}
 
-		// Retry up to SEND_RETRY times
-		if(m_outstandingPackets.elementCount() > 0 && m_errorCount < SEND_RETRY) {
-			sendRequestFilePackets();
-		}		
-	} 
+	uint64_t count = request->packets.elementCount();
+	m_packetsInFlight -= count;
+	m_replicas[request->server].packetsInFlight -= count;
+	m_outstandingPackets.add(request->packets);
+	m_inflight.erase(request);
+	return count;
+}
+
+uint64_t CopyFile::requeueReplica(size_t server)
+{
+	uint64_t released = 0;
+	for( size_t i = 0; i < m_inflight.size(); ) {
+		if( m_inflight[i].server == server ) {
+			released += requeue(m_inflight.begin() + i);
+		} else {
+			i++;
+		}
+	}
+	return released;
+}
+
+// Rates are measured over at least one request timeout, so a single burst
+// does not decide the split
+void CopyFile::updateRates(Clock::time_point now)
+{
+	double seconds = duration_cast<duration<double> >(now - m_lastRateUpdate).count();
+	if( m_replicas.size() == 1 || seconds * 1000 < m_engine.options().requestTimeoutMs ) {
+		return;
+	}
+
+	for( Replica& replica : m_replicas ) {
+		double rate = replica.delivered / seconds;
+		replica.rate = replica.rate == 0 ? rate : (replica.rate + rate) / 2;
+		replica.delivered = 0;
+	}
+	m_lastRateUpdate = now;
 }
 
-void CopyFile::receiveFilePacket( const boost::system::error_code& error,
-		std::size_t messageSize)
+void CopyFile::sendRequestFilePacketsTimeOut()
 {
-    if (!error || error == boost::asio::error::message_size)
-    {
-    	m_receiveTimer.cancel();
+	if( m_done ) {
+		return;
+	}
+
+	// The timer is only re-armed here instead of on every packet, it fires
+	// at least once per request timeout and checks how long every replica
+	// was silent
+	const ClientEngine::Options& options = m_engine.options();
+	Clock::time_point now = Clock::now();
+	Clock::time_point deadline = now + milliseconds(options.requestTimeoutMs);
+
+	if( !m_checkpointPath.empty() && now - m_lastCheckpoint >= milliseconds(options.checkpointIntervalMs) ) {
+		saveCheckpoint();
+	}
+
+	// Waiting for the consumer of a streaming sink is no stall
+	if( m_inflight.empty() && !m_outstandingPackets.empty() && m_outstandingPackets.first() >= windowLimit() ) {
+		m_lastProgress = now;
+	}
 
-      	auto filePacketMessage = Message::fromBuffer(m_receiveBuffer.data(), messageSize);
-  		m_outstandingPackets.subtract(filePacketMessage->packetId());
+	if( now - m_lastProgress >= milliseconds(options.stallTimeoutMs) ) {
+		BOOST_LOG_TRIVIAL(error) << "CopyFile::receiveFilePacket: " << m_path << " Timeout";
+		complete(boost::asio::error::timed_out);
+		return;
+	}
+
+	// A group silent for a few request timeouts finished its loop or does
+	// not reach us
+	if( m_multicastSession != 0 && now - m_lastMulticast >= milliseconds(SEND_RETRY * options.requestTimeoutMs) ) {
+		BOOST_LOG_TRIVIAL(info) << "CopyFile::receiveMulticast: " << m_path << " " << m_multicastPackets.elementCount() << " packets left to request";
+		leaveMulticast();
+	}
+
+	updateRates(now);
+
+	if( m_tracker != SIZE_MAX ) {
+		if( now - m_lastPeerRefresh >= milliseconds(options.peerIntervalMs) ) {
+			refreshPeers(now);
+		}
+		deadline = std::min(deadline, m_lastPeerRefresh + milliseconds(options.peerIntervalMs));
+	}
+
+	uint64_t released = 0;
+	bool usable = false;
+	for( size_t server = 0; server < m_replicas.size(); ++server ) {
+		Replica& replica = m_replicas[server];
+		if( replica.failed ) {
+			continue;
+		}
+
+		// Servers that did not answer the REQ_FILE yet may still join
+		if( !replica.ready ) {
+			bool retry = now - replica.lastFileInfoRequest >= milliseconds(options.fileInfoTimeoutMs);
+			if( retry && replica.fileInfoRequests >= SEND_RETRY ) {
+				replica.failed = true;
+				continue;
+			}
+			if( retry ) {
+				requestFileInfo(server);
+			}
+			usable = true;
+			deadline = std::min(deadline, replica.lastFileInfoRequest + milliseconds(options.fileInfoTimeoutMs));
+			continue;
+		}
+
+		Clock::time_point replicaDeadline = std::max(replica.lastDelivery, replica.lastRequeue) + milliseconds(replica.requestTimeoutMs);
+		if( replica.packetsInFlight > 0 && now >= replicaDeadline ) {
+			m_result.timeouts++;
+			REACH_TRACE(TIMEOUT, m_ufid, replica.packetsInFlight);
+			released += requeueReplica(server);
+
+			// Back off while the replica is silent, a loaded server answers
+			// late and repeating everything early only adds to its backlog
+			replica.requestTimeoutMs = std::min(2 * replica.requestTimeoutMs, options.stallTimeoutMs);
+			replica.lastRequeue = now;
+			replicaDeadline = now + milliseconds(replica.requestTimeoutMs);
+
+			if( now - replica.lastDelivery >= milliseconds(options.stallTimeoutMs) ) {
+				BOOST_LOG_TRIVIAL(warning) << "CopyFile::receiveFilePacket: " << replica.endpoint << " Timeout";
+				replica.failed = true;
+				continue;
+			}
+		}
+		usable = true;
+		deadline = std::min(deadline, replicaDeadline);
+	}
 
-		BOOST_LOG_TRIVIAL(info) << "CopyFile::receiveFilePacket: " << m_outstandingPackets.elementCount() ;
+	if( !usable ) {
+		BOOST_LOG_TRIVIAL(error) << "CopyFile::receiveFilePacket: " << m_path << " No server left";
+		complete(boost::asio::error::timed_out);
+		return;
+	}
+
+	m_engine.releasePackets(released);
+	sendRequestFilePackets();
+
+	m_receiveTimer.expiresAt(deadline, [this]() {
+		sendRequestFilePacketsTimeOut();
+	});
+}
+
+void CopyFile::complete(const boost::system::error_code& error)
+{
+	if( m_done ) {
+		return;
+	}
+	m_done = true;
+
+	std::shared_ptr<CopyFile> self = shared_from_this();
+	m_receiveTimer.cancel();
+	m_engine.releasePackets(m_packetsInFlight);
+	m_packetsInFlight = 0;
+	m_cacheEntry.reset();
+	m_sink->setWindowListener(std::function<void()>());
+	leaveMulticast();
+
+	// A failed transfer leaves an exact checkpoint for the next run
+	if( !m_checkpointPath.empty() ) {
+		if( error ) {
+			saveCheckpoint();
+		} else {
+			std::remove(m_checkpointPath.c_str());
+		}
+	}
 
-    	// Restart timeout timer
-    	if(m_outstandingPackets.elementCount() > 0) {
-		    m_socket->async_receive_from(boost::asio::buffer(m_receiveBuffer), 
-		    		m_receiverEndpoint,
-		        	boost::bind(&CopyFile::receiveFilePacket, this, 
-		          	boost::asio::placeholders::error,
-		          	boost::asio::placeholders::bytes_transferred));    		
+	if( !error ) {
+		m_sink->close();
 
-	    	m_receiveTimer.expires_from_now(boost::posix_time::milliseconds(RECEIVE_TIMEOUT));
-			m_receiveTimer.async_wait(
-		        boost::bind(&CopyFile::sendRequestFilePacketsTimeOut, this, 
-		          	boost::asio::placeholders::error));	    	
+		Histogram& retransmits = m_engine.histograms().retransmitsPerPacket;
+		retransmits.record(0, m_result.packets - m_requeueCount.size());
+		for( const auto& requeueCount : m_requeueCount ) {
+			retransmits.record(requeueCount.second);
+		}
+	}
+
+	m_result.seconds = duration_cast<duration<double> >(Clock::now() - m_start).count();
+	m_engine.finished(m_ufid);
 
-    	}
-  	} 
+	if( m_completion ) {
+		m_completion(error, m_result);
+	}
 }
@@ -0,0 +1,196 @@
+#include <Histogram.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+
+static const double EXPORTED_PERCENTILES[] = {50, 90, 99, 99.9};
+static const char* EXPORTED_NAMES[] = {"p50", "p90", "p99", "p999"};
+
+Histogram::Histogram(int precisionBits) :
+m_precisionBits(std::min(std::max(precisionBits, 1), 16)),
+m_count(0),
+m_sum(0),
+m_min(std::numeric_limits<uint64_t>::max()),
+m_max(0)
+{
+}
+
+size_t Histogram::bucketIndex(uint64_t value) const
+{
+	const uint64_t subBuckets = 1ULL << m_precisionBits;
+	if( value < subBuckets ) {
+		return value;
+	}
+
+	// Magnitude above the exact range selects the block, the top bits below
+	// the leading one select the linear bucket within it
+	int shift = 63 - __builtin_clzll(value) - m_precisionBits;
+	return (shift + 1) * subBuckets + ((value >> shift) - subBuckets);
+}
+
+uint64_t Histogram::bucketValue(size_t index) const
+{
+	const uint64_t subBuckets = 1ULL << m_precisionBits;
+	if( index < subBuckets ) {
+		return index;
+	}
+
+	int shift = static_cast<int>(index / subBuckets) - 1;
+	uint64_t lowest = (index % subBuckets + subBuckets) << shift;
+	return lowest + ((1ULL << shift) - 1);
+}
+
+void Histogram::record(uint64_t value, uint64_t count)
+{
+	if( count == 0 ) {
+		return;
+	}
+
+	size_t index = bucketIndex(value);
+	if( index >= m_buckets.size() ) {
+		m_buckets.resize(index + 1, 0);
+	}
+	m_buckets[index] += count;
+
+	m_count += count;
+	m_sum += value * count;
+	m_min = std::min(m_min, value);
+	m_max = std::max(m_max, value);
+}
+
+void Histogram::merge(const Histogram& other)
+{
+	if( other.m_precisionBits != m_precisionBits ) {
+		// Different layouts, re-record every bucket at its representative value
+		for( size_t i = 0; i < other.m_buckets.size(); ++i ) {
+			record(std::min(other.bucketValue(i), other.m_max), other.m_buckets[i]);
+		}
+		return;
+	}
+
+	if( other.m_buckets.size() > m_buckets.size() ) {
+		m_buckets.resize(other.m_buckets.size(), 0);
+	}
+	for( size_t i = 0; i < other.m_buckets.size(); ++i ) {
+		m_buckets[i] += other.m_buckets[i];
+	}
+
+	m_count += other.m_count;
+	m_sum += other.m_sum;
+	m_min = std::min(m_min, other.m_min);
+	m_max = std::max(m_max, other.m_max);
+}
+
+void Histogram::reset()
+{
+	m_buckets.clear();
+	m_count = 0;
+	m_sum = 0;
+	m_min = std::numeric_limits<uint64_t>::max();
+	m_max = 0;
+}
+
+uint64_t Histogram::percentile(double percent) const
+{
+	if( m_count == 0 ) {
+		return 0;
+	}
+
+	percent = std::min(std::max(percent, 0.0), 100.0);
+	uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(percent / 100.0 * m_count)));
+
+	uint64_t seen = 0;
+	for( size_t i = 0; i < m_buckets.size(); ++i ) {
+		seen += m_buckets[i];
+		if( seen >= target ) {
+			return std::min(bucketValue(i), m_max);
+		}
+	}
+
+	return m_max;
+}
+
+void Histogram::writeJson(std::ostream& output) const
+{
+	output << "{\"count\":" << m_count << ",\"min\":" << min() << ",\"max\":" << m_max
+		<< ",\"mean\":" << mean();
+	for( size_t i = 0; i < sizeof(EXPORTED_PERCENTILES) / sizeof(EXPORTED_PERCENTILES[0]); ++i ) {
+		output << ",\"" << EXPORTED_NAMES[i] << "\":" << percentile(EXPORTED_PERCENTILES[i]);
+	}
+
+	output << ",\"buckets\":[";
+	bool first = true;
+	for( size_t i = 0; i < m_buckets.size(); ++i ) {
+		if( m_buckets[i] == 0 ) {
+			continue;
+		}
+		output << (first ? "" : ",") << "[" << bucketValue(i) << "," << m_buckets[i] << "]";
+		first = false;
+	}
+	output << "]}";
+}
+
+void Histogram::writePrometheus(std::ostream& output, const std::string& name, const std::string& help) const
+{
+	if( !help.empty() ) {
+		output << "# HELP " << name << " " << help << "\n";
+	}
+	output << "# TYPE " << name << " summary\n";
+	for( double percent : EXPORTED_PERCENTILES ) {
+		output << name << "{quantile=\"" << percent / 100.0 << "\"} " << percentile(percent) << "\n";
+	}
+	output << name << "_sum " << m_sum << "\n";
+	output << name << "_count " << m_count << "\n";
+}
+
+Histogram& Metrics::histogram(const std::string& name, const std::string& help)
+{
+	Entry& entry = m_entries[name];
+	if( entry.help.empty() ) {
+		entry.help = help;
+	}
+	return entry.histogram;
+}
+
+void Metrics::reset()
+{
+	for( auto& entry : m_entries ) {
+		entry.second.histogram.reset();
+	}
+}
+
+void Metrics::writeJson(std::ostream& output) const
+{
+	output << "{";
+	bool first = true;
+	for( const auto& entry : m_entries ) {
+		output << (first ? "" : ",") << "\"" << entry.first << "\":";
+		entry.second.histogram.writeJson(output);
+		first = false;
+	}
+	output << "}";
+}
+
+void Metrics::writePrometheus(std::ostream& output) const
+{
+	for( const auto& entry : m_entries ) {
+		entry.second.histogram.writePrometheus(output, entry.first, entry.second.help);
+	}
+}
+
+bool Metrics::writePrometheusFile(const std::string& path) const
+{
+	std::string temporaryPath = path + ".tmp";
+	{
+		std::ofstream file(temporaryPath);
+		writePrometheus(file);
+		if( !file ) {
+			return false;
+		}
+	}
+
+	return std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,163 @@
+#include <HotSet.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <thread>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define BOOST_LOG_DYN_LINK 1
+#include <boost/log/trivial.hpp>
+
+HotSet::WarmOptions::WarmOptions() :
+threads(std::max(1u, std::thread::hardware_concurrency())),
+hugePages(false),
+lockBytes(0)
+{
+}
+
+HotSet::HotSet(size_t limit) :
+m_limit(limit)
+{
+}
+
+bool HotSet::load(const std::string& manifest)
+{
+	m_paths.clear();
+	std::ifstream file(manifest.c_str());
+	if( !file ) {
+		return errno == ENOENT;
+	}
+
+	std::set<std::string> seen;
+	std::string line;
+	while( std::getline(file, line) && m_paths.size() < m_limit ) {
+		if( line.empty() || line[0] == '#' || !seen.insert(line).second ) {
+			continue;
+		}
+		m_paths.push_back(line);
+	}
+	return !file.bad();
+}
+
+void HotSet::record(const std::string& path)
+{
+	m_requests[path]++;
+}
+
+void HotSet::forget(const std::string& path)
+{
+	m_paths.erase(std::remove(m_paths.begin(), m_paths.end(), path), m_paths.end());
+	m_requests.erase(path);
+}
+
+bool HotSet::save(const std::string& manifest) const
+{
+	std::vector<std::pair<uint64_t, std::string> > requested;
+	for( const auto& entry : m_requests ) {
+		requested.push_back(std::make_pair(entry.second, entry.first));
+	}
+	std::stable_sort(requested.begin(), requested.end(),
+		[](const std::pair<uint64_t, std::string>& a, const std::pair<uint64_t, std::string>& b) {
+			return a.first > b.first;
+		});
+
+	std::vector<std::string> paths;
+	for( size_t i = 0; i < requested.size() && paths.size() < m_limit; ++i ) {
+		paths.push_back(requested[i].second);
+	}
+	for( size_t i = 0; i < m_paths.size() && paths.size() < m_limit; ++i ) {
+		if( m_requests.find(m_paths[i]) == m_requests.end() ) {
+			paths.push_back(m_paths[i]);
+		}
+	}
+
+	// Written aside and renamed, a crash keeps the old manifest
+	std::string temporary = manifest + ".tmp";
+	{
+		std::ofstream file(temporary.c_str(), std::ios::trunc);
+		for( const std::string& path : paths ) {
+			file << path << "\n";
+		}
+		if( !file.flush() ) {
+			return false;
+		}
+	}
+	return std::rename(temporary.c_str(), manifest.c_str()) == 0;
+}
+
+// Reads every page, the faults go to the page cache and map its pages
+static void touchPages(const uint8_t* data, size_t size, size_t pageSize)
+{
+	volatile uint8_t sink = 0;
+	for( size_t offset = 0; offset < size; offset += pageSize ) {
+		sink = sink + data[offset];
+	}
+}
+
+HotSet::WarmResult HotSet::warm(const std::vector<Region>& regions, const WarmOptions& options)
+{
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+
+	// The budget goes to the first regions, a region that does not fit is
+	// skipped for smaller ones after it
+	std::vector<bool> lock(regions.size(), false);
+	uint64_t budget = options.lockBytes;
+	for( size_t i = 0; i < regions.size(); ++i ) {
+		if( regions[i].size <= budget ) {
+			lock[i] = true;
+			budget -= regions[i].size;
+		}
+	}
+
+	std::atomic<size_t> nextRegion(0);
+	std::atomic<uint64_t> faultedBytes(0);
+	std::atomic<uint64_t> lockedBytes(0);
+	auto worker = [&]() {
+		for( size_t i = nextRegion++; i < regions.size(); i = nextRegion++ ) {
+			if( regions[i].size == 0 ) {
+				continue;
+			}
+
+			// Mappings start on a page, madvise needs that
+			uint8_t* start = reinterpret_cast<uint8_t*>(reinterpret_cast<uintptr_t>(regions[i].data) & ~(pageSize - 1));
+			size_t size = static_cast<const uint8_t*>(regions[i].data) + regions[i].size - start;
+			if( options.hugePages ) {
+				madvise(start, size, MADV_HUGEPAGE);
+			}
+			madvise(start, size, MADV_WILLNEED);
+
+			// mlock faults the pages in as well
+			if( lock[i] && mlock(start, size) == 0 ) {
+				lockedBytes += size;
+			} else {
+				if( lock[i] ) {
+					BOOST_LOG_TRIVIAL(warning) << "HotSet: Locking " << size << " bytes failed: " << strerror(errno);
+				}
+#ifdef MADV_POPULATE_READ
+				// The madvise form of MAP_POPULATE, since Linux 5.14
+				if( madvise(start, size, MADV_POPULATE_READ) != 0 )
+#endif
+				touchPages(start, size, pageSize);
+			}
+			faultedBytes += size;
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for( unsigned t = 1; t < std::min<size_t>(options.threads, regions.size()); ++t ) {
+		threads.push_back(std::thread(worker));
+	}
+	worker();
+	for( std::thread& thread : threads ) {
+		thread.join();
+	}
+
+	WarmResult result = {faultedBytes, lockedBytes};
+	return result;
+}
@@ -0,0 +1,98 @@
+#include <Impairment.h>
+
+#include <algorithm>
+
+using namespace std::chrono;
+
+Impairment::Config::Config() :
+loss(0),
+burstEnter(0),
+burstExit(1),
+burstLossGood(0),
+burstLossBad(1),
+duplicate(0),
+reorder(0),
+delayUs(0),
+jitterUs(0),
+rateBps(0),
+queueLimitUs(100000)
+{
+}
+
+Impairment::Impairment(const Config& config, uint64_t seed) :
+m_config(config),
+m_random(seed),
+m_burstState(false)
+{
+}
+
+bool Impairment::chance(double probability)
+{
+	return probability > 0 && std::uniform_real_distribution<double>()(m_random) < probability;
+}
+
+Impairment::Clock::time_point Impairment::transmit(Clock::time_point now, size_t size, bool& dropped)
+{
+	dropped = false;
+	if( m_config.rateBps == 0 ) {
+		return now;
+	}
+
+	// Datagrams queue behind each other on the bandwidth limited link
+	Clock::time_point start = std::max(now, m_linkFree);
+	if( start - now > microseconds(m_config.queueLimitUs) ) {
+		dropped = true;
+		return now;
+	}
+
+	m_linkFree = start + nanoseconds(size * 8 * 1000000000ULL / m_config.rateBps);
+	return m_linkFree;
+}
+
+void Impairment::schedule(Clock::time_point now, size_t size, std::vector<Clock::time_point>& departures)
+{
+	m_statistics.packets++;
+	m_statistics.bytes += size;
+
+	if( m_config.burstEnter > 0 ) {
+		m_burstState = m_burstState ? !chance(m_config.burstExit) : chance(m_config.burstEnter);
+		if( chance(m_burstState ? m_config.burstLossBad : m_config.burstLossGood) ) {
+			m_statistics.lost++;
+			return;
+		}
+	}
+
+	if( chance(m_config.loss) ) {
+		m_statistics.lost++;
+		return;
+	}
+
+	int copies = 1;
+	if( chance(m_config.duplicate) ) {
+		m_statistics.duplicated++;
+		copies = 2;
+	}
+
+	for( int i = 0; i < copies; ++i ) {
+		bool dropped;
+		Clock::time_point sent = transmit(now, size, dropped);
+		if( dropped ) {
+			m_statistics.queueDropped++;
+			continue;
+		}
+
+		if( chance(m_config.reorder) ) {
+			// Skip the propagation delay and overtake the datagrams in flight
+			m_statistics.reordered++;
+			departures.push_back(sent);
+			continue;
+		}
+
+		int64_t delay = m_config.delayUs;
+		if( m_config.jitterUs > 0 ) {
+			int64_t jitter = m_config.jitterUs;
+			delay += std::uniform_int_distribution<int64_t>(-jitter, jitter)(m_random);
+		}
+		departures.push_back(sent + microseconds(std::max<int64_t>(delay, 0)));
+	}
+}
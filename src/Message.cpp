@@ -6,10 +6,21 @@
 
 uint64_t Message::m_nextMessageId = 0;
 
+// Whether the buffer holds another size bytes
+static bool remaining(const uint8_t* data, const uint8_t* end, size_t size)
+{
+	return end - data >= static_cast<ptrdiff_t>(size);
+}
+
 
 Message::Message(Message::TYPE type) :
 m_type(type),
-m_version(REACH_VERSION)
+m_version(REACH_VERSION),
+m_priority(0),
+m_fileVersion(0),
+m_multicastSession(0),
+m_multicastAddress(0),
+m_multicastPort(0)
 {
 }
 
@@ -24,20 +35,32 @@ std::shared_ptr<Message> Message::createAlive()
 	return message;
 }
 
-std::shared_ptr<Message> Message::createReqFile(uint64_t ufid, const char* path)
+std::shared_ptr<Message> Message::createReqFile(uint64_t ufid, const char* path, uint8_t priority)
 {
 	std::shared_ptr<Message> message(new Message(REQ_FILE));
 	message->m_ufid = ufid;
 	strncpy(message->m_path, path, PATH_LENGTH);
+	message->m_priority = priority;
 	return message;
 }
 
-std::shared_ptr<Message> Message::createFileInfo(uint64_t ufid, uint64_t fileSize, uint64_t packetSize)
+std::shared_ptr<Message> Message::createFileInfo(uint64_t ufid, uint64_t fileSize, uint64_t packetSize, uint64_t fileVersion)
 {
 	std::shared_ptr<Message> message(new Message(FILE_INFO));
 	message->m_ufid = ufid;
 	message->m_fileSize = fileSize;
 	message->m_packetSize = packetSize;
+	message->m_fileVersion = fileVersion;
+	return message;
+}
+
+std::shared_ptr<Message> Message::createFileInfo(uint64_t ufid, uint64_t fileSize, uint64_t packetSize, uint64_t fileVersion,
+	uint64_t multicastSession, const boost::asio::ip::udp::endpoint& multicastGroup)
+{
+	std::shared_ptr<Message> message = createFileInfo(ufid, fileSize, packetSize, fileVersion);
+	message->m_multicastSession = multicastSession;
+	message->m_multicastAddress = multicastGroup.address().to_v4().to_ulong();
+	message->m_multicastPort = multicastGroup.port();
 	return message;
 }
 
@@ -64,40 +87,138 @@ std::shared_ptr<Message> Message::createFilePacket(uint64_t ufid, uint64_t packe
 	return createFilePacket(ufid, packetId, reinterpret_cast<const uint8_t*>(payloadData), payloadSize);
 }
 
-std::shared_ptr<Message> Message::fromBuffer(const uint8_t* data, size_t length)
+std::shared_ptr<Message> Message::createReqPeers(uint64_t ufid)
+{
+	std::shared_ptr<Message> message(new Message(REQ_PEERS));
+	message->m_ufid = ufid;
+	return message;
+}
+
+std::shared_ptr<Message> Message::createPeers(uint64_t ufid, const std::vector<boost::asio::ip::udp::endpoint>& peers)
+{
+	std::shared_ptr<Message> message(new Message(PEERS));
+	message->m_ufid = ufid;
+	message->m_peers = peers;
+
+	uint32_t count = peers.size();
+	std::vector<uint8_t>& buffer = message->m_peerBuffer;
+	buffer.resize(sizeof(count) + count * (sizeof(uint32_t) + sizeof(uint16_t)));
+	uint8_t* data = buffer.data();
+	memcpy(data, &count, sizeof(count));
+	data += sizeof(count);
+	for( const boost::asio::ip::udp::endpoint& peer : peers ) {
+		uint32_t address = peer.address().to_v4().to_ulong();
+		uint16_t port = peer.port();
+		memcpy(data, &address, sizeof(address));
+		memcpy(data + sizeof(address), &port, sizeof(port));
+		data += sizeof(address) + sizeof(port);
+	}
+	return message;
+}
+
+std::shared_ptr<Message> Message::createAvailability(uint64_t ufid, Range packets)
+{
+	std::shared_ptr<Message> message(new Message(AVAILABILITY));
+	message->m_ufid = ufid;
+	message->m_packets = packets;
+	return message;
+}
+
+std::shared_ptr<Message> Message::fromBuffer(const uint8_t* data, size_t length, uint64_t packetLimit)
 {
 	const uint8_t* bufferEnd = data + length;
+	std::shared_ptr<Message> truncated;
 
+	// Every fixed field has to be in the datagram, optional trailing fields
+	// of older versions are checked where they are read
+	if( !remaining(data, bufferEnd, sizeof(TYPE)) ) {
+		return truncated;
+	}
 	std::shared_ptr<Message> message(new Message(*reinterpret_cast<const TYPE*>(data)));
 	data += sizeof(TYPE);
 
 	if( message->m_type == ALIVE ) {
+		if( !remaining(data, bufferEnd, sizeof(uint64_t)) ) {
+			return truncated;
+		}
 		message->m_version = *reinterpret_cast<const uint64_t*>(data);
 		data += sizeof(uint64_t);
 	}
 
-	if( message->m_type == REQ_FILE || message->m_type == FILE_INFO || message->m_type == REQ_FILE_PACKETS || message->m_type == FILE_PACKET ) {
+	if( message->m_type == REQ_FILE || message->m_type == FILE_INFO || message->m_type == REQ_FILE_PACKETS || message->m_type == FILE_PACKET ||
+		message->m_type == REQ_PEERS || message->m_type == PEERS || message->m_type == AVAILABILITY ) {
+		if( !remaining(data, bufferEnd, sizeof(uint64_t)) ) {
+			return truncated;
+		}
 		message->m_ufid = *reinterpret_cast<const uint64_t*>(data);
 		data += sizeof(uint64_t);
 	}
 
 	if( message->m_type == REQ_FILE ) {
+		if( !remaining(data, bufferEnd, PATH_LENGTH) ) {
+			return truncated;
+		}
 		strncpy(message->m_path, reinterpret_cast<const char*>(data), PATH_LENGTH);
 		data += PATH_LENGTH;
+
+		// Clients before version 5 send no priority
+		if( bufferEnd - data >= static_cast<ptrdiff_t>(sizeof(uint8_t)) ) {
+			message->m_priority = *data;
+			data += sizeof(uint8_t);
+		}
 	}
 
 	if( message->m_type == FILE_INFO ) {
+		if( !remaining(data, bufferEnd, 2 * sizeof(uint64_t)) ) {
+			return truncated;
+		}
 		message->m_fileSize = *reinterpret_cast<const uint64_t*>(data);
 		data += sizeof(uint64_t);
 		message->m_packetSize = *reinterpret_cast<const uint64_t*>(data);
 		data += sizeof(uint64_t);
+
+		// Servers before version 3 send no file version, before version 4
+		// no multicast group, and without a group the fields are left out
+		if( bufferEnd - data >= static_cast<ptrdiff_t>(sizeof(uint64_t)) ) {
+			message->m_fileVersion = *reinterpret_cast<const uint64_t*>(data);
+			data += sizeof(uint64_t);
+		}
+		if( bufferEnd - data >= static_cast<ptrdiff_t>(sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint16_t)) ) {
+			message->m_multicastSession = *reinterpret_cast<const uint64_t*>(data);
+			data += sizeof(uint64_t);
+			message->m_multicastAddress = *reinterpret_cast<const uint32_t*>(data);
+			data += sizeof(uint32_t);
+			message->m_multicastPort = *reinterpret_cast<const uint16_t*>(data);
+			data += sizeof(uint16_t);
+		}
 	}
 
-	if( message->m_type == REQ_FILE_PACKETS ) {
-		message->m_packets = *Range::fromBuffer(data);
+	if( message->m_type == REQ_FILE_PACKETS || message->m_type == AVAILABILITY ) {
+		std::shared_ptr<Range> packets = Range::fromBuffer(data, bufferEnd - data, packetLimit);
+		if( !packets ) {
+			return std::shared_ptr<Message>();
+		}
+		message->m_packets = *packets;
+	}
+
+	if( message->m_type == PEERS && bufferEnd - data >= static_cast<ptrdiff_t>(sizeof(uint32_t)) ) {
+		uint32_t count;
+		memcpy(&count, data, sizeof(count));
+		data += sizeof(count);
+		for( uint32_t i = 0; i < count && bufferEnd - data >= static_cast<ptrdiff_t>(sizeof(uint32_t) + sizeof(uint16_t)); ++i ) {
+			uint32_t address;
+			uint16_t port;
+			memcpy(&address, data, sizeof(address));
+			memcpy(&port, data + sizeof(address), sizeof(port));
+			data += sizeof(address) + sizeof(port);
+			message->m_peers.push_back(boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4(address), port));
+		}
 	}
 
 	if( message->m_type == FILE_PACKET ) {
+		if( !remaining(data, bufferEnd, sizeof(uint64_t)) ) {
+			return truncated;
+		}
 		message->m_packetId = *reinterpret_cast<const uint64_t*>(data);
 		data += sizeof(uint64_t);
 		message->m_payloadData = data;
@@ -107,6 +228,23 @@ std::shared_ptr<Message> Message::fromBuffer(const uint8_t* data, size_t length)
 	return message;
 }
 
+boost::asio::ip::udp::endpoint Message::multicastGroup() const
+{
+	return boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4(m_multicastAddress), m_multicastPort);
+}
+
+void Message::encodeFilePacketHeader(uint8_t* header, uint64_t ufid, uint64_t packetId)
+{
+	header[0] = FILE_PACKET;
+	memcpy(header + sizeof(TYPE), &ufid, sizeof(ufid));
+	stampPacketId(header, packetId);
+}
+
+void Message::stampPacketId(uint8_t* header, uint64_t packetId)
+{
+	memcpy(header + sizeof(TYPE) + sizeof(uint64_t), &packetId, sizeof(packetId));
+}
+
 // Create a composite buffer for the Message
 std::vector<boost::asio::const_buffer> Message::asBuffer() const {
 
@@ -119,24 +257,36 @@ std::vector<boost::asio::const_buffer> Message::asBuffer() const {
 		composite_buffer.push_back(boost::asio::const_buffer(&m_version, sizeof(m_version)));
 	}
 
-	if( m_type == REQ_FILE || m_type == FILE_INFO || m_type == REQ_FILE_PACKETS || m_type == FILE_PACKET ) {
+	if( m_type == REQ_FILE || m_type == FILE_INFO || m_type == REQ_FILE_PACKETS || m_type == FILE_PACKET ||
+		m_type == REQ_PEERS || m_type == PEERS || m_type == AVAILABILITY ) {
 		composite_buffer.push_back(boost::asio::const_buffer(&m_ufid, sizeof(m_ufid)));
 	}
 
 	if( m_type == REQ_FILE ) {
 		composite_buffer.push_back(boost::asio::const_buffer(&m_path, sizeof(m_path)));
+		composite_buffer.push_back(boost::asio::const_buffer(&m_priority, sizeof(m_priority)));
 	}
 
 	if( m_type == FILE_INFO ) {
 		composite_buffer.push_back(boost::asio::const_buffer(&m_fileSize, sizeof(m_fileSize)));
 		composite_buffer.push_back(boost::asio::const_buffer(&m_packetSize, sizeof(m_packetSize)));
+		composite_buffer.push_back(boost::asio::const_buffer(&m_fileVersion, sizeof(m_fileVersion)));
+		if( m_multicastSession != 0 ) {
+			composite_buffer.push_back(boost::asio::const_buffer(&m_multicastSession, sizeof(m_multicastSession)));
+			composite_buffer.push_back(boost::asio::const_buffer(&m_multicastAddress, sizeof(m_multicastAddress)));
+			composite_buffer.push_back(boost::asio::const_buffer(&m_multicastPort, sizeof(m_multicastPort)));
+		}
 	}
 
-	if( m_type == REQ_FILE_PACKETS ) {
+	if( m_type == REQ_FILE_PACKETS || m_type == AVAILABILITY ) {
 		auto rangeBuffer = m_packets.asBuffer();
 		composite_buffer.insert(composite_buffer.end(), rangeBuffer.begin(), rangeBuffer.end());
 	}
 
+	if( m_type == PEERS ) {
+		composite_buffer.push_back(boost::asio::buffer(m_peerBuffer));
+	}
+
 	if( m_type == FILE_PACKET ) {
 		composite_buffer.push_back(boost::asio::const_buffer(&m_packetId, sizeof(m_packetId)));
 		composite_buffer.push_back(boost::asio::buffer(m_payloadData, m_payloadSize));
@@ -0,0 +1,254 @@
+#include <PacketRing.h>
+
+#include <cerrno>
+#include <cstring>
+#include <random>
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <Message.h>
+
+#define BOOST_LOG_DYN_LINK 1
+#include <boost/log/trivial.hpp>
+
+#ifndef TP_STATUS_CSUM_VALID
+#define TP_STATUS_CSUM_VALID (1 << 7)
+#endif
+
+using boost::asio::ip::udp;
+
+static bool attachFilter(int fd, sock_filter* program, unsigned short length)
+{
+	sock_fprog filter = {length, program};
+	return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) == 0;
+}
+
+// Ones' complement sum over the pseudo header and the UDP datagram, 0xffff
+// for a correct checksum
+static bool validChecksum(const uint8_t* ip, const uint8_t* datagram, size_t udpLength)
+{
+	uint32_t sum = IPPROTO_UDP + udpLength;
+	for( size_t i = 12; i < 20; i += 2 ) {
+		sum += (ip[i] << 8) | ip[i + 1];
+	}
+	for( size_t i = 0; i + 1 < udpLength; i += 2 ) {
+		sum += (datagram[i] << 8) | datagram[i + 1];
+	}
+	if( udpLength % 2 ) {
+		sum += datagram[udpLength - 1] << 8;
+	}
+	while( sum >> 16 ) {
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+	return sum == 0xffff;
+}
+
+PacketRing::PacketRing(boost::asio::io_service& io_service, size_t blockSize, size_t blockCount) :
+m_descriptor(io_service),
+m_blockSize(blockSize),
+m_blockCount(blockCount),
+m_ring(nullptr),
+m_nextBlock(0),
+m_packets(0),
+m_drops(0),
+m_checksumErrors(0)
+{
+}
+
+PacketRing::~PacketRing()
+{
+	close();
+}
+
+bool PacketRing::open(udp::socket& socket, Handler handler)
+{
+	int fd = ::socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+	if( fd < 0 ) {
+		BOOST_LOG_TRIVIAL(warning) << "PacketRing: " << strerror(errno);
+		return false;
+	}
+	m_descriptor.assign(fd);
+
+	// SOCK_DGRAM frames start at the IP header. Fragments are not expected
+	// after the reassembly, a fragment that gets here is dropped.
+	unsigned short port = socket.local_endpoint().port();
+	sock_filter ringProgram[] = {
+		{BPF_LD | BPF_B | BPF_ABS, 0, 0, 9},
+		{BPF_JMP | BPF_JEQ | BPF_K, 0, 8, IPPROTO_UDP},
+		{BPF_LD | BPF_H | BPF_ABS, 0, 0, 6},
+		{BPF_JMP | BPF_JSET | BPF_K, 6, 0, 0x3fff},
+		{BPF_LDX | BPF_B | BPF_MSH, 0, 0, 0},
+		{BPF_LD | BPF_H | BPF_IND, 0, 0, 2},
+		{BPF_JMP | BPF_JEQ | BPF_K, 0, 3, port},
+		{BPF_LD | BPF_B | BPF_IND, 0, 0, 8},
+		{BPF_JMP | BPF_JEQ | BPF_K, 0, 1, Message::FILE_PACKET},
+		{BPF_RET | BPF_K, 0, 0, UINT32_MAX},
+		{BPF_RET | BPF_K, 0, 0, 0},
+	};
+
+	int version = TPACKET_V3;
+	tpacket_req3 request;
+	memset(&request, 0, sizeof(request));
+	request.tp_block_size = m_blockSize;
+	request.tp_block_nr = m_blockCount;
+	request.tp_frame_size = TPACKET_ALIGNMENT << 7;
+	request.tp_frame_nr = m_blockSize / request.tp_frame_size * m_blockCount;
+	request.tp_retire_blk_tov = 1;
+
+	sockaddr_ll address;
+	memset(&address, 0, sizeof(address));
+	address.sll_family = AF_PACKET;
+	address.sll_protocol = htons(ETH_P_IP);
+
+	if( !attachFilter(fd, ringProgram, sizeof(ringProgram) / sizeof(ringProgram[0])) ||
+		setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0 ||
+		setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &request, sizeof(request)) != 0 ) {
+		BOOST_LOG_TRIVIAL(warning) << "PacketRing: " << strerror(errno);
+		close();
+		return false;
+	}
+
+	void* ring = mmap(nullptr, m_blockSize * m_blockCount, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if( ring == MAP_FAILED || bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ) {
+		BOOST_LOG_TRIVIAL(warning) << "PacketRing: " << strerror(errno);
+		if( ring != MAP_FAILED ) {
+			munmap(ring, m_blockSize * m_blockCount);
+		}
+		close();
+		return false;
+	}
+	m_ring = static_cast<uint8_t*>(ring);
+
+#ifdef PACKET_IGNORE_OUTGOING
+	// Loopback shows every packet outgoing as well, readFrame skips them
+	// on kernels without the option
+	int ignore = 1;
+	setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore, sizeof(ignore));
+#endif
+
+	// A fanout group of one is the only way to get reassembled datagrams,
+	// the group id is random as it has to be unique in the namespace
+	std::mt19937 random(std::random_device{}());
+	bool joined = false;
+	for( int attempt = 0; attempt < 8 && !joined; ++attempt ) {
+		int fanout = (random() & 0xffff) | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+		joined = setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) == 0;
+	}
+
+	// Only now the ring sees every FILE_PACKET the socket no longer gets
+	sock_filter socketProgram[] = {
+		{BPF_LD | BPF_B | BPF_ABS, 0, 0, sizeof(udphdr)},
+		{BPF_JMP | BPF_JEQ | BPF_K, 0, 1, Message::FILE_PACKET},
+		{BPF_RET | BPF_K, 0, 0, 0},
+		{BPF_RET | BPF_K, 0, 0, UINT32_MAX},
+	};
+	if( !joined || !attachFilter(socket.native_handle(), socketProgram, sizeof(socketProgram) / sizeof(socketProgram[0])) ) {
+		BOOST_LOG_TRIVIAL(warning) << "PacketRing: " << strerror(errno);
+		close();
+		return false;
+	}
+
+	m_handler = handler;
+	receive();
+	return true;
+}
+
+uint64_t PacketRing::drops()
+{
+	tpacket_stats_v3 statistics;
+	socklen_t length = sizeof(statistics);
+	if( m_descriptor.is_open() &&
+		getsockopt(m_descriptor.native_handle(), SOL_PACKET, PACKET_STATISTICS, &statistics, &length) == 0 ) {
+		// Reading the statistics resets them
+		m_drops += statistics.tp_drops;
+	}
+	return m_drops + m_checksumErrors;
+}
+
+void PacketRing::close()
+{
+	boost::system::error_code error;
+	m_descriptor.close(error);
+	if( m_ring ) {
+		munmap(m_ring, m_blockSize * m_blockCount);
+		m_ring = nullptr;
+	}
+}
+
+void PacketRing::receive()
+{
+	m_descriptor.async_wait(boost::asio::posix::stream_descriptor::wait_read,
+		[this](const boost::system::error_code& error) {
+			if( error == boost::asio::error::operation_aborted ) {
+				return;
+			}
+			readBlocks();
+			if( m_ring ) {
+				receive();
+			}
+		});
+}
+
+// Blocks are handed over in ring order, each one goes back to the kernel
+// once all its frames were handled
+void PacketRing::readBlocks()
+{
+	for(;;) {
+		tpacket_block_desc* block = reinterpret_cast<tpacket_block_desc*>(m_ring + m_nextBlock * m_blockSize);
+		if( !(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) ) {
+			return;
+		}
+
+		const uint8_t* frame = reinterpret_cast<const uint8_t*>(block) + block->hdr.bh1.offset_to_first_pkt;
+		for( uint32_t i = 0; i < block->hdr.bh1.num_pkts; ++i ) {
+			readFrame(frame);
+			frame += reinterpret_cast<const tpacket3_hdr*>(frame)->tp_next_offset;
+		}
+
+		__atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		m_nextBlock = (m_nextBlock + 1) % m_blockCount;
+	}
+}
+
+void PacketRing::readFrame(const uint8_t* frame)
+{
+	const tpacket3_hdr* header = reinterpret_cast<const tpacket3_hdr*>(frame);
+	const sockaddr_ll* link = reinterpret_cast<const sockaddr_ll*>(frame + TPACKET_ALIGN(sizeof(tpacket3_hdr)));
+	if( link->sll_pkttype == PACKET_OUTGOING || header->tp_snaplen != header->tp_len ) {
+		return;
+	}
+
+	const uint8_t* ip = frame + header->tp_net;
+	size_t ipHeaderSize = (ip[0] & 0x0f) * 4;
+	if( (ip[0] >> 4) != 4 || header->tp_snaplen < ipHeaderSize + sizeof(udphdr) ) {
+		return;
+	}
+
+	const uint8_t* datagram = ip + ipHeaderSize;
+	size_t udpLength = (datagram[4] << 8) | datagram[5];
+	if( udpLength < sizeof(udphdr) || udpLength > header->tp_snaplen - ipHeaderSize ) {
+		return;
+	}
+
+	// Loopback and checksum offload leave it unset
+	bool hasChecksum = datagram[6] != 0 || datagram[7] != 0;
+	if( hasChecksum && !(header->tp_status & (TP_STATUS_CSUM_VALID | TP_STATUS_CSUMNOTREADY)) &&
+		!validChecksum(ip, datagram, udpLength) ) {
+		m_checksumErrors++;
+		return;
+	}
+
+	uint32_t source;
+	memcpy(&source, ip + 12, sizeof(source));
+	udp::endpoint sender(boost::asio::ip::address_v4(ntohl(source)), (datagram[0] << 8) | datagram[1]);
+
+	m_packets++;
+	m_handler(datagram + sizeof(udphdr), udpLength - sizeof(udphdr), sender);
+}
@@ -1,171 +1,889 @@
 #include <Range.h>
 
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #define BOOST_LOG_DYN_LINK 1
 #include <boost/log/trivial.hpp>
 
-Range::Range(int64_t start, int64_t end)
+//////////////////////////////
+// Bitmap helpers
+//////////////////////////////
+
+static inline uint32_t popcount(uint64_t word) { return __builtin_popcountll(word); }
+static inline uint32_t trailingZeros(uint64_t word) { return __builtin_ctzll(word); }
+
+// dst |= src
+static void orWords(uint64_t* dst, const uint64_t* src)
 {
-	if( end > start ) {
-		m_intervals.push_back(Interval(start, end));
+#if defined(__AVX2__)
+	for( uint32_t i = 0; i < Range::CHUNK_WORDS; i += 4 ) {
+		__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+		__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_or_si256(a, b));
 	}
-	intervalCount();
+#elif defined(__SSE2__)
+	for( uint32_t i = 0; i < Range::CHUNK_WORDS; i += 2 ) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_or_si128(a, b));
+	}
+#else
+	for( uint32_t i = 0; i < Range::CHUNK_WORDS; ++i ) {
+		dst[i] |= src[i];
+	}
+#endif
 }
 
-Range::Range(int64_t number)
+// dst &= ~src
+static void andNotWords(uint64_t* dst, const uint64_t* src)
+{
+#if defined(__AVX2__)
+	for( uint32_t i = 0; i < Range::CHUNK_WORDS; i += 4 ) {
+		__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+		__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_andnot_si256(b, a));
+	}
+#elif defined(__SSE2__)
+	for( uint32_t i = 0; i < Range::CHUNK_WORDS; i += 2 ) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_andnot_si128(b, a));
+	}
+#else
+	for( uint32_t i = 0; i < Range::CHUNK_WORDS; ++i ) {
+		dst[i] &= ~src[i];
+	}
+#endif
+}
+
+static uint32_t popcountWords(const uint64_t* words)
 {
-	m_intervals.push_back(Interval(number, number + 1));
-	intervalCount();
+	uint32_t count = 0;
+	for( uint32_t i = 0; i < Range::CHUNK_WORDS; ++i ) {
+		count += popcount(words[i]);
+	}
+	return count;
 }
 
-void Range::add(uint64_t number)
+// Sets or clears the bits [start, end) and returns the number of changed bits
+static uint32_t fillWords(uint64_t* words, uint32_t start, uint32_t end, bool set)
 {
-	Interval addition(number, number+1);
-	m_intervals.insert( std::upper_bound( m_intervals.begin(), m_intervals.end(), addition), addition );
+	uint32_t changed = 0;
+	uint32_t firstWord = start >> 6;
+	uint32_t lastWord = (end - 1) >> 6;
+
+	for( uint32_t w = firstWord; w <= lastWord; ++w ) {
+		uint64_t mask = ~0ULL;
+		if( w == firstWord ) {
+			mask &= ~0ULL << (start & 63);
+		}
+		if( w == lastWord && (end & 63) != 0 ) {
+			mask &= ~0ULL >> (64 - (end & 63));
+		}
+
+		uint64_t before = words[w];
+		words[w] = set ? (before | mask) : (before & ~mask);
+		changed += popcount(before ^ words[w]);
+	}
 
-	mergeIntervals();
+	return changed;
 }
 
-void Range::add(int64_t start, int64_t end)
+//////////////////////////////
+// Chunk
+//////////////////////////////
+
+bool Range::Chunk::contains(uint32_t x) const
 {
-	if( end > start ) {
-		Interval addition(start, end);
-		m_intervals.insert( std::upper_bound( m_intervals.begin(), m_intervals.end(), addition), addition );
-		mergeIntervals();
+	if( isBitmap() ) {
+		return (bitmap[x >> 6] >> (x & 63)) & 1;
 	}
+
+	auto it = std::upper_bound(runs.begin(), runs.end(), x,
+		[](uint32_t v, const Run& r) { return v < r.first; });
+	return it != runs.begin() && x < (it - 1)->second;
 }
 
-void Range::add(const Range &other)
+bool Range::Chunk::next(uint32_t from, uint32_t& result) const
 {
-	for( Interval addition : other.m_intervals ) {
-		m_intervals.insert( std::upper_bound( m_intervals.begin(), m_intervals.end(), addition), addition );
+	if( isBitmap() ) {
+		uint32_t w = from >> 6;
+		uint64_t word = bitmap[w] & (~0ULL << (from & 63));
+		while( word == 0 ) {
+			if( ++w == CHUNK_WORDS ) {
+				return false;
+			}
+			word = bitmap[w];
+		}
+		result = (w << 6) + trailingZeros(word);
+		return true;
 	}
 
-	mergeIntervals();
+	auto it = std::lower_bound(runs.begin(), runs.end(), from,
+		[](const Run& r, uint32_t v) { return r.second <= v; });
+	if( it == runs.end() ) {
+		return false;
+	}
+	result = std::max(from, it->first);
+	return true;
 }
 
-bool Range::contains(uint64_t x)
+void Range::Chunk::add(uint32_t start, uint32_t end)
 {
-	for( Interval i : m_intervals ) {
-		if( i.first <= x && x < i.second )
-			return true;
+	if( isBitmap() ) {
+		cardinality += fillWords(&bitmap[0], start, end, true);
+		if( cardinality == CHUNK_SIZE ) {
+			toRuns();
+		}
+		return;
 	}
 
-	return false;
+	// Runs overlapping or touching [start, end)
+	auto first = std::lower_bound(runs.begin(), runs.end(), start,
+		[](const Run& r, uint32_t v) { return r.second < v; });
+	auto last = std::upper_bound(first, runs.end(), end,
+		[](uint32_t v, const Run& r) { return v < r.first; });
+
+	if( first == last ) {
+		runs.insert(first, Run(start, end));
+		cardinality += end - start;
+	} else {
+		uint32_t removed = 0;
+		for( auto it = first; it != last; ++it ) {
+			removed += it->second - it->first;
+		}
+
+		first->first = std::min(start, first->first);
+		first->second = std::max(end, (last - 1)->second);
+		cardinality += (first->second - first->first) - removed;
+		runs.erase(first + 1, last);
+	}
+
+	if( runs.size() > MAX_RUNS ) {
+		toBitmap();
+	}
 }
 
+void Range::Chunk::subtract(uint32_t start, uint32_t end)
+{
+	if( isBitmap() ) {
+		cardinality -= fillWords(&bitmap[0], start, end, false);
+		return;
+	}
 
-void Range::subtract(uint64_t number)
+	// Runs overlapping [start, end)
+	auto first = std::lower_bound(runs.begin(), runs.end(), start,
+		[](const Run& r, uint32_t v) { return r.second <= v; });
+	auto last = std::lower_bound(first, runs.end(), end,
+		[](const Run& r, uint32_t v) { return r.first < v; });
+
+	if( first == last ) {
+		return;
+	}
+
+	Run left(first->first, std::min(start, (last - 1)->second));
+	Run right(std::max(end, first->first), (last - 1)->second);
+
+	uint32_t removed = 0;
+	for( auto it = first; it != last; ++it ) {
+		removed += it->second - it->first;
+	}
+
+	auto pos = runs.erase(first, last);
+	if( right.first < right.second ) {
+		pos = runs.insert(pos, right);
+		removed -= right.second - right.first;
+	}
+	if( left.first < left.second ) {
+		runs.insert(pos, left);
+		removed -= left.second - left.first;
+	}
+	cardinality -= removed;
+
+	if( runs.size() > MAX_RUNS ) {
+		toBitmap();
+	}
+}
+
+void Range::Chunk::unite(const Chunk& other)
 {
-	for( auto it = m_intervals.begin(); it < m_intervals.end(); ++it ) {
-		if( it->first <= number && number < it->second ) {
-			if( it->first == number ) {
-				it->first++;
-			} else if ( it->second == number - 1) {
-				it->second--;
-			} else {
-				Interval split(it->first, number);
-				it->first = number + 1;
-				m_intervals.insert(it, split);
+	if( isBitmap() || other.isBitmap() ) {
+		toBitmap();
+		if( other.isBitmap() ) {
+			orWords(&bitmap[0], &other.bitmap[0]);
+			cardinality = popcountWords(&bitmap[0]);
+		} else {
+			for( const Run& r : other.runs ) {
+				cardinality += fillWords(&bitmap[0], r.first, r.second, true);
+			}
+		}
+		return;
+	}
+
+	// Merge two sorted run lists
+	std::vector<Run> merged;
+	merged.reserve(runs.size() + other.runs.size());
+	auto a = runs.begin();
+	auto b = other.runs.begin();
+	cardinality = 0;
+
+	while( a != runs.end() || b != other.runs.end() ) {
+		const Run& r = (b == other.runs.end() || (a != runs.end() && a->first <= b->first)) ? *a++ : *b++;
+		if( !merged.empty() && r.first <= merged.back().second ) {
+			if( r.second > merged.back().second ) {
+				cardinality += r.second - merged.back().second;
+				merged.back().second = r.second;
 			}
+		} else {
+			merged.push_back(r);
+			cardinality += r.second - r.first;
 		}
+	}
+
+	runs.swap(merged);
+	if( runs.size() > MAX_RUNS ) {
+		toBitmap();
+	}
+}
 
+void Range::Chunk::difference(const Chunk& other)
+{
+	if( other.isBitmap() ) {
+		toBitmap();
+		andNotWords(&bitmap[0], &other.bitmap[0]);
+		cardinality = popcountWords(&bitmap[0]);
 		return;
 	}
+
+	if( isBitmap() ) {
+		for( const Run& r : other.runs ) {
+			cardinality -= fillWords(&bitmap[0], r.first, r.second, false);
+		}
+		return;
+	}
+
+	// Subtract two sorted run lists
+	std::vector<Run> result;
+	result.reserve(runs.size() + other.runs.size());
+	auto b = other.runs.begin();
+	cardinality = 0;
+
+	for( Run r : runs ) {
+		while( b != other.runs.end() && b->second <= r.first ) {
+			++b;
+		}
+		for( auto it = b; it != other.runs.end() && it->first < r.second; ++it ) {
+			if( it->first > r.first ) {
+				result.push_back(Run(r.first, it->first));
+				cardinality += it->first - r.first;
+			}
+			r.first = std::max(r.first, it->second);
+		}
+		if( r.first < r.second ) {
+			result.push_back(r);
+			cardinality += r.second - r.first;
+		}
+	}
+
+	runs.swap(result);
+	if( runs.size() > MAX_RUNS ) {
+		toBitmap();
+	}
 }
 
-void Range::subtract(int64_t start, int64_t end)
+Range::Chunk Range::Chunk::firstN(uint32_t elements) const
 {
-	if( end <= start ) return;
+	Chunk result(key);
 
-	for( auto it = m_intervals.begin(); it < m_intervals.end(); ) {
-		if( it->first <= end && start < it->second ) {
-			if( start <= it->first && it->second <= end ) {
-				it = m_intervals.erase(it);
-			} else if (  start <= it->first && end < it->second) {
-				it->first = end;
-				it++;
-			} else if ( start > it->first && it->second < end ) {
-				it->second = start;
-				it++;
-			} else {
-				Interval split(it->first, start);
-				it->first = end;
-				it = m_intervals.insert(it, split);
-				it += 2;
+	forEachRun([&](uint32_t start, uint32_t end) {
+		uint32_t take = std::min(end - start, elements - result.cardinality);
+		result.runs.push_back(Run(start, start + take));
+		result.cardinality += take;
+		return result.cardinality < elements;
+	});
+
+	if( result.runs.size() > MAX_RUNS ) {
+		result.toBitmap();
+	}
+
+	return result;
+}
+
+size_t Range::Chunk::runCount() const
+{
+	if( !isBitmap() ) {
+		return runs.size();
+	}
+
+	// Count the first bit of every run
+	size_t count = 0;
+	uint64_t carry = 0;
+	for( uint32_t i = 0; i < CHUNK_WORDS; ++i ) {
+		uint64_t word = bitmap[i];
+		count += popcount(word & ~((word << 1) | carry));
+		carry = word >> 63;
+	}
+	return count;
+}
+
+// Calls f(start, end) for every run in order until f returns false
+template<typename F>
+void Range::Chunk::forEachRun(F f) const
+{
+	if( !isBitmap() ) {
+		for( const Run& r : runs ) {
+			if( !f(r.first, r.second) ) {
+				return;
 			}
+		}
+		return;
+	}
+
+	uint32_t w = 0;
+	uint64_t word = bitmap[0];
+	for(;;) {
+		// Next set bit
+		while( word == 0 ) {
+			if( ++w == CHUNK_WORDS ) {
+				return;
+			}
+			word = bitmap[w];
+		}
+		uint32_t start = (w << 6) + trailingZeros(word);
+
+		// Next clear bit
+		word = ~bitmap[w] & (~0ULL << (start & 63));
+		while( word == 0 ) {
+			if( ++w == CHUNK_WORDS ) {
+				f(start, CHUNK_SIZE);
+				return;
+			}
+			word = ~bitmap[w];
+		}
+		uint32_t end = (w << 6) + trailingZeros(word);
+
+		if( !f(start, end) ) {
+			return;
+		}
+
+		word = bitmap[w] & (~0ULL << (end & 63));
+	}
+}
+
+void Range::Chunk::toBitmap()
+{
+	if( isBitmap() ) {
+		return;
+	}
+
+	bitmap.assign(CHUNK_WORDS, 0);
+	for( const Run& r : runs ) {
+		fillWords(&bitmap[0], r.first, r.second, true);
+	}
+	std::vector<Run>().swap(runs);
+}
+
+void Range::Chunk::toRuns()
+{
+	if( !isBitmap() ) {
+		return;
+	}
+
+	std::vector<Run> result;
+	forEachRun([&](uint32_t start, uint32_t end) {
+		result.push_back(Run(start, end));
+		return true;
+	});
+
+	runs.swap(result);
+	std::vector<uint64_t>().swap(bitmap);
+}
+
+void Range::Chunk::optimize()
+{
+	// Convert back with some hysteresis to not flip between both forms
+	if( isBitmap() ) {
+		if( cardinality == CHUNK_SIZE || runCount() <= MAX_RUNS / 4 ) {
+			toRuns();
+		}
+	} else if( runs.size() > MAX_RUNS ) {
+		toBitmap();
+	}
+}
+
+//////////////////////////////
+// Range
+//////////////////////////////
+
+Range::Range(int64_t start, int64_t end)
+{
+	add(start, end);
+}
+
+Range::Range(int64_t number)
+{
+	add(number, number + 1);
+}
+
+std::vector<Range::Chunk>::iterator Range::findChunk(uint64_t key)
+{
+	return std::lower_bound(m_chunks.begin(), m_chunks.end(), key,
+		[](const Chunk& c, uint64_t k) { return c.key < k; });
+}
+
+std::vector<Range::Chunk>::const_iterator Range::findChunk(uint64_t key) const
+{
+	return std::lower_bound(m_chunks.begin(), m_chunks.end(), key,
+		[](const Chunk& c, uint64_t k) { return c.key < k; });
+}
+
+Range::Chunk& Range::chunk(uint64_t key)
+{
+	// Ranges are mostly built in ascending order
+	if( !m_chunks.empty() && m_chunks.back().key == key ) {
+		return m_chunks.back();
+	}
+
+	auto it = findChunk(key);
+	if( it == m_chunks.end() || it->key != key ) {
+		it = m_chunks.insert(it, Chunk(key));
+	}
+	return *it;
+}
+
+void Range::add(uint64_t number)
+{
+	chunk(number >> CHUNK_BITS).add(number & (CHUNK_SIZE - 1), (number & (CHUNK_SIZE - 1)) + 1);
+}
+
+void Range::add(int64_t start, int64_t end)
+{
+	start = std::max<int64_t>(start, 0);
+	if( end <= start ) return;
+
+	uint64_t firstKey = static_cast<uint64_t>(start) >> CHUNK_BITS;
+	uint64_t lastKey = static_cast<uint64_t>(end - 1) >> CHUNK_BITS;
+
+	for( uint64_t key = firstKey; key <= lastKey; ++key ) {
+		uint32_t localStart = key == firstKey ? start & (CHUNK_SIZE - 1) : 0;
+		uint32_t localEnd = key == lastKey ? ((end - 1) & (CHUNK_SIZE - 1)) + 1 : CHUNK_SIZE;
+		chunk(key).add(localStart, localEnd);
+	}
+}
+
+void Range::add(const Range &other)
+{
+	if( other.m_chunks.empty() ) {
+		return;
+	}
+
+	if( m_chunks.empty() ) {
+		m_chunks = other.m_chunks;
+		return;
+	}
+
+	std::vector<Chunk> merged;
+	merged.reserve(m_chunks.size() + other.m_chunks.size());
+
+	auto a = m_chunks.begin();
+	auto b = other.m_chunks.begin();
+	while( a != m_chunks.end() || b != other.m_chunks.end() ) {
+		if( b == other.m_chunks.end() || (a != m_chunks.end() && a->key < b->key) ) {
+			merged.push_back(std::move(*a++));
+		} else if( a == m_chunks.end() || b->key < a->key ) {
+			merged.push_back(*b++);
 		} else {
-			it++;
+			a->unite(*b++);
+			a->optimize();
+			merged.push_back(std::move(*a++));
 		}
 	}
 
+	m_chunks.swap(merged);
 }
 
-void Range::subtract(const Range &other)
+bool Range::contains(uint64_t x) const
+{
+	auto it = findChunk(x >> CHUNK_BITS);
+	return it != m_chunks.end() && it->key == (x >> CHUNK_BITS) && it->contains(x & (CHUNK_SIZE - 1));
+}
+
+uint64_t Range::first() const
 {
-	for( Interval sub: other.m_intervals) {
-		subtract(sub.first, sub.second);
+	const Chunk& c = m_chunks.front();
+	uint32_t local = 0;
+	c.next(0, local);
+	return (c.key << CHUNK_BITS) | local;
+}
+
+Range::Interval Range::firstInterval() const
+{
+	// Only the first run of a chunk can continue the interval, and only
+	// if the run before ended at the chunk border
+	uint64_t start = first();
+	Interval result(start, start);
+	for( const Chunk& c : m_chunks ) {
+		uint64_t base = c.key << CHUNK_BITS;
+		c.forEachRun([&](uint32_t runStart, uint32_t runEnd) {
+			if( base + runStart == result.second ) {
+				result.second = base + runEnd;
+			}
+			return false;
+		});
+		if( result.second != base + CHUNK_SIZE ) {
+			break;
+		}
 	}
+	return result;
 }
 
-void Range::mergeIntervals()
+
+void Range::subtract(uint64_t number)
 {
-	if( m_intervals.size() > 1 ) {
-		// Since the list of intervals is sorted, we can go greedy and consider only the
-		// next interval in the list for merging
-		auto it = m_intervals.begin() + 1;
-		while( it != m_intervals.end() )
-		{
-			if( (it-1)->first <= it->second && (it-1)->second >= it->first ) {
-				// BOOST_LOG_TRIVIAL(debug) << "Merge: " << (it-1)->first << ":" << (it-1)->second << " with " << it->first << ":" << it->second;
-				// Overlap -> Merge
-				(it-1)->second = std::max((it-1)->second, it->second);
+	auto it = findChunk(number >> CHUNK_BITS);
+	if( it == m_chunks.end() || it->key != (number >> CHUNK_BITS) ) {
+		return;
+	}
 
-				// BOOST_LOG_TRIVIAL(debug) << "-> Merged: " << (it-1)->first << ":" << (it-1)->second;
+	it->subtract(number & (CHUNK_SIZE - 1), (number & (CHUNK_SIZE - 1)) + 1);
+	if( it->cardinality == 0 ) {
+		m_chunks.erase(it);
+	}
+}
 
-				// Remove the merged interval
-				it = m_intervals.erase(it);
+void Range::subtract(int64_t start, int64_t end)
+{
+	start = std::max<int64_t>(start, 0);
+	if( end <= start ) return;
+
+	uint64_t firstKey = static_cast<uint64_t>(start) >> CHUNK_BITS;
+	uint64_t lastKey = static_cast<uint64_t>(end - 1) >> CHUNK_BITS;
+
+	for( auto it = findChunk(firstKey); it != m_chunks.end() && it->key <= lastKey; ) {
+		uint32_t localStart = it->key == firstKey ? start & (CHUNK_SIZE - 1) : 0;
+		uint32_t localEnd = it->key == lastKey ? ((end - 1) & (CHUNK_SIZE - 1)) + 1 : CHUNK_SIZE;
+		it->subtract(localStart, localEnd);
+
+		if( it->cardinality == 0 ) {
+			it = m_chunks.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+void Range::subtract(const Range &other)
+{
+	auto b = other.m_chunks.begin();
+	for( Chunk& c : m_chunks ) {
+		while( b != other.m_chunks.end() && b->key < c.key ) {
+			++b;
+		}
+		if( b == other.m_chunks.end() ) {
+			break;
+		}
+		if( b->key == c.key ) {
+			c.difference(*b);
+			c.optimize();
+		}
+	}
+
+	m_chunks.erase(std::remove_if(m_chunks.begin(), m_chunks.end(),
+		[](const Chunk& c) { return c.cardinality == 0; }), m_chunks.end());
+}
+
+std::vector<Range::Interval> Range::intervals() const
+{
+	std::vector<Interval> result;
+
+	for( const Chunk& c : m_chunks ) {
+		uint64_t base = c.key << CHUNK_BITS;
+		c.forEachRun([&](uint32_t start, uint32_t end) {
+			// Join intervals crossing a chunk border
+			if( !result.empty() && result.back().second == base + start ) {
+				result.back().second = base + end;
 			} else {
-				it++;
+				result.push_back(Interval(base + start, base + end));
 			}
-		}
+			return true;
+		});
 	}
 
-	intervalCount();
+	return result;
+}
+
+size_t Range::intervalCount() const
+{
+	return intervals().size();
 }
 
 std::string Range::toString() const {
 	std::stringstream output;
 
-	for( const Interval& v : m_intervals) {
+	for( const Interval& v : intervals()) {
 		output << v.first << ":" << v.second << ",";
 	}
 
 	return output.str();
 }
 
+//////////////////////////////
+// Wire encoding
+//////////////////////////////
 
-std::vector<boost::asio::const_buffer> Range::asBuffer() const {
+static size_t varintSize(uint64_t value)
+{
+	size_t size = 1;
+	while( value >= 0x80 ) {
+		value >>= 7;
+		size++;
+	}
+	return size;
+}
 
-	std::vector<boost::asio::const_buffer> composite_buffer;
+static void writeVarint(std::vector<uint8_t>& buffer, uint64_t value)
+{
+	while( value >= 0x80 ) {
+		buffer.push_back(static_cast<uint8_t>(value) | 0x80);
+		value >>= 7;
+	}
+	buffer.push_back(static_cast<uint8_t>(value));
+}
 
-	composite_buffer.push_back(boost::asio::const_buffer(&m_intervalCount, sizeof(m_intervalCount)));
-	for( const Interval& v : m_intervals) {
-		composite_buffer.push_back(boost::asio::const_buffer(&v, sizeof(Interval)));
+static bool readVarint(const uint8_t*& data, const uint8_t* end, uint64_t& value)
+{
+	value = 0;
+	for( uint32_t shift = 0; data < end && shift < 64; shift += 7 ) {
+		uint8_t byte = *data++;
+		value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+		if( !(byte & 0x80) ) {
+			return true;
+		}
 	}
+	return false;
+}
 
-	return composite_buffer;
+template<typename T>
+static void writeValue(std::vector<uint8_t>& buffer, T value)
+{
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+	buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+template<typename T>
+static bool readValue(const uint8_t*& data, const uint8_t* end, T& value)
+{
+	if( static_cast<size_t>(end - data) < sizeof(T) ) {
+		return false;
+	}
+	memcpy(&value, data, sizeof(T));
+	data += sizeof(T);
+	return true;
 }
 
-std::shared_ptr<Range> Range::fromBuffer(const uint8_t* data)
+static size_t encodedSize(const std::vector<Range::Interval>& intervals, Range::Encoding encoding)
 {
-	uint8_t intervalCount = *reinterpret_cast<const uint8_t*>(data);
-	data += sizeof(uint8_t);
+	const size_t header = sizeof(Range::Encoding);
 
+	switch( encoding ) {
+	case Range::INTERVALS:
+		return header + sizeof(uint32_t) + intervals.size() * sizeof(Range::Interval);
+
+	case Range::BITMAP: {
+		uint64_t span = intervals.empty() ? 0 : intervals.back().second - intervals.front().first;
+		if( span / 8 >= UINT32_MAX ) {
+			return SIZE_MAX;
+		}
+		return header + sizeof(uint64_t) + sizeof(uint32_t) + (span + 7) / 8;
+	}
+
+	case Range::RUNS: {
+		size_t size = header + sizeof(uint32_t);
+		uint64_t previousEnd = 0;
+		for( const Range::Interval& v : intervals ) {
+			size += varintSize(v.first - previousEnd) + varintSize(v.second - v.first);
+			previousEnd = v.second;
+		}
+		return size;
+	}
+	}
+
+	return SIZE_MAX;
+}
+
+static Range::Encoding smallestEncoding(const std::vector<Range::Interval>& intervals)
+{
+	Range::Encoding best = Range::INTERVALS;
+	for( Range::Encoding encoding : {Range::RUNS, Range::BITMAP} ) {
+		if( encodedSize(intervals, encoding) < encodedSize(intervals, best) ) {
+			best = encoding;
+		}
+	}
+	return best;
+}
+
+size_t Range::encodedSize(Encoding encoding) const
+{
+	return ::encodedSize(intervals(), encoding);
+}
+
+size_t Range::encodedSize() const
+{
+	auto v = intervals();
+	return ::encodedSize(v, ::smallestEncoding(v));
+}
+
+Range::Encoding Range::smallestEncoding() const
+{
+	return ::smallestEncoding(intervals());
+}
+
+std::vector<boost::asio::const_buffer> Range::asBuffer() const
+{
+	return asBuffer(smallestEncoding());
+}
+
+std::vector<boost::asio::const_buffer> Range::asBuffer(Encoding encoding) const
+{
+	auto v = intervals();
+
+	m_wireBuffer.clear();
+	m_wireBuffer.reserve(::encodedSize(v, encoding));
+	writeValue(m_wireBuffer, encoding);
+
+	switch( encoding ) {
+	case INTERVALS: {
+		writeValue(m_wireBuffer, static_cast<uint32_t>(v.size()));
+		for( const Interval& i : v ) {
+			writeValue(m_wireBuffer, i.first);
+			writeValue(m_wireBuffer, i.second);
+		}
+		break;
+	}
+
+	case BITMAP: {
+		uint64_t base = v.empty() ? 0 : v.front().first;
+		uint32_t byteCount = v.empty() ? 0 : static_cast<uint32_t>((v.back().second - base + 7) / 8);
+		writeValue(m_wireBuffer, base);
+		writeValue(m_wireBuffer, byteCount);
+
+		size_t offset = m_wireBuffer.size();
+		m_wireBuffer.resize(offset + byteCount, 0);
+		uint8_t* bits = &m_wireBuffer[offset];
+		for( const Interval& i : v ) {
+			for( uint64_t x = i.first - base; x < i.second - base; ++x ) {
+				bits[x >> 3] |= 1 << (x & 7);
+			}
+		}
+		break;
+	}
+
+	case RUNS: {
+		writeValue(m_wireBuffer, static_cast<uint32_t>(v.size()));
+		uint64_t previousEnd = 0;
+		for( const Interval& i : v ) {
+			writeVarint(m_wireBuffer, i.first - previousEnd);
+			writeVarint(m_wireBuffer, i.second - i.first);
+			previousEnd = i.second;
+		}
+		break;
+	}
+	}
+
+	std::vector<boost::asio::const_buffer> composite_buffer;
+	composite_buffer.push_back(boost::asio::const_buffer(m_wireBuffer.data(), m_wireBuffer.size()));
+	return composite_buffer;
+}
+
+std::shared_ptr<Range> Range::fromBuffer(const uint8_t* data, size_t length, uint64_t limit)
+{
+	const uint8_t* end = data + length;
 	std::shared_ptr<Range> range(new Range());
+	std::shared_ptr<Range> malformed;
+
+	Encoding encoding;
+	if( !readValue(data, end, encoding) ) {
+		return malformed;
+	}
+
+	// Every interval is checked before it is added, a sender can not make
+	// us build more chunks than the limit spans or wrap around 2^64
+	switch( encoding ) {
+	case INTERVALS: {
+		uint32_t count = 0;
+		if( !readValue(data, end, count) ) {
+			return malformed;
+		}
+		for( uint32_t i = 0; i < count; ++i ) {
+			uint64_t start, stop;
+			if( !readValue(data, end, start) || !readValue(data, end, stop) ) {
+				return malformed;
+			}
+			if( stop <= start || stop > limit ) {
+				return malformed;
+			}
+			range->add(start, stop);
+		}
+		break;
+	}
+
+	case BITMAP: {
+		uint64_t base = 0;
+		uint32_t byteCount = 0;
+		if( !readValue(data, end, base) || !readValue(data, end, byteCount) ) {
+			return malformed;
+		}
+		if( byteCount > static_cast<size_t>(end - data) || base > limit ) {
+			return malformed;
+		}
+
+		// Collect runs of set bits, the padding of the last byte is clear
+		uint64_t runStart = 0;
+		bool inRun = false;
+		for( uint64_t x = 0; x <= uint64_t(byteCount) * 8; ++x ) {
+			bool set = x < uint64_t(byteCount) * 8 && ((data[x >> 3] >> (x & 7)) & 1);
+			if( set && !inRun ) {
+				runStart = x;
+				inRun = true;
+			} else if( !set && inRun ) {
+				if( x > limit - base ) {
+					return malformed;
+				}
+				range->add(base + runStart, base + x);
+				inRun = false;
+			}
+		}
+		break;
+	}
+
+	case RUNS: {
+		uint32_t count = 0;
+		if( !readValue(data, end, count) ) {
+			return malformed;
+		}
+		uint64_t previousEnd = 0;
+		for( uint32_t i = 0; i < count; ++i ) {
+			uint64_t gap, runLength;
+			if( !readVarint(data, end, gap) || !readVarint(data, end, runLength) ) {
+				return malformed;
+			}
+			if( runLength == 0 || gap > limit - previousEnd || runLength > limit - previousEnd - gap ) {
+				return malformed;
+			}
+			range->add(previousEnd + gap, previousEnd + gap + runLength);
+			previousEnd += gap + runLength;
+		}
+		break;
+	}
 
-	const uint64_t* numbers = reinterpret_cast<const uint64_t*>(data);
-	for( int i = 0; i < intervalCount; ++i, numbers += 2) {
-		range->add(numbers[0], numbers[1]);
+	default:
+		return malformed;
 	}
 
 	return range;
@@ -175,20 +893,28 @@ std::shared_ptr<Range> Range::fromBuffer(const uint8_t* data)
 size_t Range::elementCount() const
 {
 	size_t elements = 0;
-	for( const Interval& v : m_intervals) {
-		elements += v.second - v.first;
+	for( const Chunk& c : m_chunks) {
+		elements += c.cardinality;
 	}
 
 	return elements;
 }
 
-Range Range::firstN(int64_t elements)
+Range Range::firstN(int64_t elements) const
 {
 	Range result;
 
-	for( const Interval& v : m_intervals) {
-		int64_t deltaElements = v.second - v.first;
-		result.add(v.first, v.first + std::min<int64_t>(elements - result.elementCount(), deltaElements));
+	for( const Chunk& c : m_chunks) {
+		if( elements <= 0 ) {
+			break;
+		}
+
+		if( c.cardinality <= elements ) {
+			result.m_chunks.push_back(c);
+		} else {
+			result.m_chunks.push_back(c.firstN(static_cast<uint32_t>(elements)));
+		}
+		elements -= c.cardinality;
 	}
 
 	return result;
@@ -197,6 +923,26 @@ Range Range::firstN(int64_t elements)
 Range Range::removeFirstN(int64_t elements)
 {
 	Range r = firstN(elements);
-	subtract(r);
+	if( r.m_chunks.empty() ) {
+		return r;
+	}
+
+	// All but the last chunk of r are complete chunks of this range
+	const Chunk& last = r.m_chunks.back();
+	size_t complete = r.m_chunks.size() - 1;
+	if( last.cardinality == m_chunks[complete].cardinality ) {
+		complete++;
+	} else {
+		Chunk& partial = m_chunks[complete];
+		if( last.isBitmap() ) {
+			partial.difference(last);
+		} else {
+			for( const Run& run : last.runs ) {
+				partial.subtract(run.first, run.second);
+			}
+		}
+	}
+
+	m_chunks.erase(m_chunks.begin(), m_chunks.begin() + complete);
 	return r;
 }
@@ -0,0 +1,221 @@
+#include <RequestScheduler.h>
+
+#include <algorithm>
+
+RequestScheduler::RequestScheduler(uint64_t quantum, uint64_t rateCap) :
+m_quantum(quantum),
+m_rateCap(rateCap),
+m_queuedPackets(0)
+{
+}
+
+void RequestScheduler::enqueue(const Client& client, uint8_t priority, uint64_t ufid, const Range& packets,
+	uint64_t packetBytes, Clock::time_point now, uint64_t content)
+{
+	QueueKey key(client, priority);
+	Queue& queue = m_queues[key];
+
+	// A client repeating a request that still waits would get the packets twice
+	Range fresh(packets);
+	for( const Request& request : queue.requests ) {
+		if( request.ufid == ufid ) {
+			fresh.subtract(request.packets);
+		}
+	}
+	if( fresh.elementCount() == 0 ) {
+		if( queue.requests.empty() ) {
+			m_queues.erase(key);
+		}
+		return;
+	}
+
+	if( queue.requests.empty() ) {
+		m_active[priority].push_back(key);
+		pruneBuckets(now);
+	}
+	Request request = {ufid, content, fresh, packetBytes, now};
+	queue.requests.push_back(request);
+	m_queuedPackets += fresh.elementCount();
+	if( content != 0 ) {
+		m_content[content][key]++;
+	}
+}
+
+bool RequestScheduler::next(Clock::time_point now, Packet& packet)
+{
+	for( auto activeIt = m_active.begin(); activeIt != m_active.end(); ) {
+		std::deque<QueueKey>& active = activeIt->second;
+
+		// Capped queues are passed over, when all of them were in a row a
+		// lower class gets the turn
+		size_t passed = 0;
+		while( passed < active.size() ) {
+			QueueKey key = active.front();
+			Queue& queue = m_queues[key];
+			Request& request = queue.requests.front();
+
+			// A capped queue keeps its turn and gets no quantum meanwhile
+			if( capped(key.first, request.packetBytes, now) ) {
+				active.pop_front();
+				active.push_back(key);
+				passed++;
+				continue;
+			}
+
+			if( !queue.turn ) {
+				queue.deficit += m_quantum;
+				queue.turn = true;
+			}
+			if( queue.deficit < static_cast<int64_t>(request.packetBytes) ) {
+				queue.turn = false;
+				active.pop_front();
+				active.push_back(key);
+				passed = 0;
+				continue;
+			}
+
+			queue.deficit -= request.packetBytes;
+			charge(key.first, request.packetBytes);
+			packet.client = key.first;
+			packet.ufid = request.ufid;
+			packet.packetId = request.packets.first();
+			request.packets.subtract(packet.packetId);
+			packet.content = request.content;
+			packet.last = request.packets.elementCount() == 0;
+			packet.queued = request.queued;
+			m_queuedPackets--;
+
+			if( packet.last ) {
+				// An idle queue does not save up deficit
+				removeRequest(key, queue.requests.begin());
+			}
+			return true;
+		}
+
+		if( active.empty() ) {
+			activeIt = m_active.erase(activeIt);
+		} else {
+			++activeIt;
+		}
+	}
+	return false;
+}
+
+void RequestScheduler::coalesce(const Packet& packet, Clock::time_point now, size_t limit, std::vector<Packet>& packets)
+{
+	auto contentIt = m_content.find(packet.content);
+	if( packet.content == 0 || contentIt == m_content.end() ) {
+		return;
+	}
+
+	// Requests may be removed while we go through the queues
+	std::vector<QueueKey> keys;
+	for( const auto& waiting : contentIt->second ) {
+		keys.push_back(waiting.first);
+	}
+
+	for( const QueueKey& key : keys ) {
+		if( limit == 0 ) {
+			return;
+		}
+
+		Queue& queue = m_queues[key];
+		for( auto requestIt = queue.requests.begin(); requestIt != queue.requests.end(); ++requestIt ) {
+			if( requestIt->content != packet.content || !requestIt->packets.contains(packet.packetId) ||
+				(key.first == packet.client && requestIt->ufid == packet.ufid) ) {
+				continue;
+			}
+			if( capped(key.first, requestIt->packetBytes, now) ) {
+				break;
+			}
+
+			requestIt->packets.subtract(packet.packetId);
+			queue.deficit -= requestIt->packetBytes;
+			charge(key.first, requestIt->packetBytes);
+			m_queuedPackets--;
+			limit--;
+
+			Packet match = {key.first, requestIt->ufid, packet.packetId, packet.content,
+				requestIt->packets.elementCount() == 0, requestIt->queued};
+			packets.push_back(match);
+			if( match.last ) {
+				removeRequest(key, requestIt);
+			}
+			break;
+		}
+	}
+}
+
+void RequestScheduler::charge(const Client& client, uint64_t bytes)
+{
+	if( m_rateCap > 0 ) {
+		m_buckets[client].tokens -= bytes;
+	}
+}
+
+// Drops a request without packets, and the queue once it is empty
+void RequestScheduler::removeRequest(const QueueKey& key, std::deque<Request>::iterator request)
+{
+	Queue& queue = m_queues[key];
+	if( request->content != 0 ) {
+		auto contentIt = m_content.find(request->content);
+		if( --contentIt->second[key] == 0 ) {
+			contentIt->second.erase(key);
+			if( contentIt->second.empty() ) {
+				m_content.erase(contentIt);
+			}
+		}
+	}
+	queue.requests.erase(request);
+	if( !queue.requests.empty() ) {
+		return;
+	}
+
+	std::deque<QueueKey>& active = m_active[key.second];
+	active.erase(std::find(active.begin(), active.end(), key));
+	if( active.empty() ) {
+		m_active.erase(key.second);
+	}
+	m_queues.erase(key);
+}
+
+// Refills the client's bucket, it holds at most 10 ms of the cap or one
+// quantum
+bool RequestScheduler::capped(const Client& client, uint64_t bytes, Clock::time_point now)
+{
+	if( m_rateCap == 0 ) {
+		return false;
+	}
+
+	double burst = std::max(m_rateCap / 100, static_cast<double>(m_quantum));
+	auto bucketIt = m_buckets.find(client);
+	if( bucketIt == m_buckets.end() ) {
+		Bucket bucket = {burst, now};
+		bucketIt = m_buckets.insert(std::make_pair(client, bucket)).first;
+	}
+
+	Bucket& bucket = bucketIt->second;
+	double seconds = std::chrono::duration_cast<std::chrono::duration<double> >(now - bucket.refilled).count();
+	bucket.tokens = std::min(burst, bucket.tokens + seconds * m_rateCap);
+	bucket.refilled = now;
+	return bucket.tokens < bytes;
+}
+
+// A bucket that refilled completely is the same as a new one, the buckets of
+// clients that are gone are dropped once there are many of them
+void RequestScheduler::pruneBuckets(Clock::time_point now)
+{
+	if( m_buckets.size() < 2 * m_queues.size() + 64 ) {
+		return;
+	}
+
+	double burst = std::max(m_rateCap / 100, static_cast<double>(m_quantum));
+	for( auto bucketIt = m_buckets.begin(); bucketIt != m_buckets.end(); ) {
+		double seconds = std::chrono::duration_cast<std::chrono::duration<double> >(now - bucketIt->second.refilled).count();
+		if( bucketIt->second.tokens + seconds * m_rateCap >= burst ) {
+			bucketIt = m_buckets.erase(bucketIt);
+		} else {
+			++bucketIt;
+		}
+	}
+}
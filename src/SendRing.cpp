@@ -0,0 +1,56 @@
+#include <SendRing.h>
+
+SendRing::SendRing(size_t slotCount) :
+m_slots(slotCount),
+m_next(0),
+m_inFlight(0)
+{
+	for( Slot& slot : m_slots ) {
+		slot.m_ufid = 0;
+		slot.m_packetId = 0;
+		slot.m_inUse = false;
+		Message::encodeFilePacketHeader(slot.m_header, slot.m_ufid, slot.m_packetId);
+	}
+}
+
+SendRing::Slot* SendRing::acquire(uint64_t ufid, uint64_t packetId,
+	const uint8_t* payloadData, size_t payloadSize,
+	std::shared_ptr<const void> payloadOwner)
+{
+	if( m_inFlight == m_slots.size() ) {
+		return nullptr;
+	}
+
+	// Sends usually complete in order, so the next slot is almost always free
+	Slot* slot = &m_slots[m_next];
+	while( slot->m_inUse ) {
+		m_next = (m_next + 1) % m_slots.size();
+		slot = &m_slots[m_next];
+	}
+	m_next = (m_next + 1) % m_slots.size();
+
+	if( slot->m_ufid != ufid ) {
+		slot->m_ufid = ufid;
+		Message::encodeFilePacketHeader(slot->m_header, ufid, packetId);
+	} else {
+		Message::stampPacketId(slot->m_header, packetId);
+	}
+
+	slot->m_packetId = packetId;
+	slot->m_inUse = true;
+	slot->m_payloadOwner = std::move(payloadOwner);
+	slot->m_buffers[0] = boost::asio::const_buffer(slot->m_header, sizeof(slot->m_header));
+	slot->m_buffers[1] = boost::asio::const_buffer(payloadData, payloadSize);
+
+	m_inFlight++;
+	return slot;
+}
+
+void SendRing::release(Slot* slot)
+{
+	if( slot->m_inUse ) {
+		slot->m_inUse = false;
+		slot->m_payloadOwner.reset();
+		m_inFlight--;
+	}
+}
@@ -0,0 +1,393 @@
+#include <Sink.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BOOST_LOG_DYN_LINK 1
+#include <boost/log/trivial.hpp>
+
+// Offsets, lengths and buffers of O_DIRECT I/O are multiples of this
+static const uint64_t DIRECT_ALIGNMENT = 4096;
+
+Range Sink::packets(uint64_t fileSize, uint64_t packetSize) const
+{
+	return Range(0, (fileSize + packetSize - 1) / packetSize);
+}
+
+MappedFileSink::MappedFileSink(const std::string& path) :
+m_path(path),
+m_kept(false)
+{
+}
+
+bool MappedFileSink::open(uint64_t fileSize)
+{
+	// A mapping can not be empty, a zero byte file is just created
+	if( fileSize == 0 ) {
+		FILE* file = fopen(m_path.c_str(), "wb");
+		if( file ) {
+			fclose(file);
+		}
+		return file != nullptr;
+	}
+
+	try {
+		boost::iostreams::mapped_file_params params;
+		params.path = m_path;
+		struct stat status;
+		m_kept = stat(m_path.c_str(), &status) == 0 && static_cast<uint64_t>(status.st_size) == fileSize;
+		if( !m_kept ) {
+			params.new_file_size = fileSize;
+		}
+		m_file.open(params);
+	} catch( std::exception& ) {
+		return false;
+	}
+
+	return m_file.is_open();
+}
+
+void MappedFileSink::write(uint64_t offset, const uint8_t* data, size_t size)
+{
+	if( offset + size <= m_file.size() ) {
+		memcpy(m_file.data() + offset, data, size);
+	}
+}
+
+void MappedFileSink::close()
+{
+	if( m_file.is_open() ) {
+		m_file.close();
+	}
+}
+
+DirectFileSink::DirectFileSink(const std::string& path, uint64_t dirtyLimit) :
+m_path(path),
+m_dirtyLimit(std::max<uint64_t>(dirtyLimit, DIRECT_EXTENT_SIZE)),
+m_fd(-1),
+m_direct(true),
+m_kept(false),
+m_fileSize(0)
+{
+}
+
+DirectFileSink::~DirectFileSink()
+{
+	// A failed transfer flushed for its checkpoint, the rest is dropped
+	for( auto& extent : m_extents ) {
+		free(extent.second.data);
+	}
+	for( uint8_t* data : m_free ) {
+		free(data);
+	}
+	if( m_fd >= 0 ) {
+		::close(m_fd);
+	}
+}
+
+bool DirectFileSink::open(uint64_t fileSize)
+{
+	m_fileSize = fileSize;
+	m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT | O_DIRECT, 0644);
+	if( m_fd < 0 && errno == EINVAL ) {
+		BOOST_LOG_TRIVIAL(warning) << "DirectFileSink: " << m_path << " does not support O_DIRECT, writing through the page cache";
+		m_direct = false;
+		m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT, 0644);
+	}
+	if( m_fd < 0 ) {
+		return false;
+	}
+
+	// An existing file of the right size is kept for resuming, the blocks
+	// are allocated up front so the extent writes do not fragment the file
+	struct stat status;
+	if( fstat(m_fd, &status) != 0 ) {
+		return false;
+	}
+	m_kept = static_cast<uint64_t>(status.st_size) == fileSize;
+	if( !m_kept && ftruncate(m_fd, fileSize) != 0 ) {
+		return false;
+	}
+	if( fileSize > 0 && fallocate(m_fd, 0, 0, fileSize) != 0 && errno != EOPNOTSUPP ) {
+		return false;
+	}
+	return true;
+}
+
+void DirectFileSink::write(uint64_t offset, const uint8_t* data, size_t size)
+{
+	size = std::min<uint64_t>(size, m_fileSize - std::min(offset, m_fileSize));
+	while( size > 0 ) {
+		uint64_t index = offset / DIRECT_EXTENT_SIZE;
+		uint64_t start = offset % DIRECT_EXTENT_SIZE;
+		size_t part = std::min<uint64_t>(size, DIRECT_EXTENT_SIZE - start);
+
+		Extent& target = extent(index);
+		memcpy(target.data + start, data, part);
+		target.filled.add(start, start + part);
+		if( target.filled.elementCount() == extentLength(index) ) {
+			writeExtent(index);
+		}
+
+		offset += part;
+		data += part;
+		size -= part;
+	}
+}
+
+void DirectFileSink::flush()
+{
+	while( !m_extents.empty() ) {
+		writeExtent(m_extents.begin()->first);
+	}
+}
+
+void DirectFileSink::close()
+{
+	if( m_fd < 0 ) {
+		return;
+	}
+
+	// The last extent was written rounded up to the alignment
+	flush();
+	if( ftruncate(m_fd, m_fileSize) != 0 || fdatasync(m_fd) != 0 ) {
+		BOOST_LOG_TRIVIAL(error) << "DirectFileSink: Closing " << m_path << " failed: " << strerror(errno);
+	}
+	::close(m_fd);
+	m_fd = -1;
+}
+
+uint64_t DirectFileSink::extentLength(uint64_t extent) const
+{
+	return std::min<uint64_t>(DIRECT_EXTENT_SIZE, m_fileSize - extent * DIRECT_EXTENT_SIZE);
+}
+
+DirectFileSink::Extent& DirectFileSink::extent(uint64_t index)
+{
+	auto extentIt = m_extents.find(index);
+	if( extentIt != m_extents.end() ) {
+		return extentIt->second;
+	}
+
+	// Over the limit the fullest extent goes first, it needs the least of
+	// the file merged in
+	if( dirtyBytes() + DIRECT_EXTENT_SIZE > m_dirtyLimit ) {
+		auto fullest = m_extents.begin();
+		for( auto it = m_extents.begin(); it != m_extents.end(); ++it ) {
+			if( it->second.filled.elementCount() > fullest->second.filled.elementCount() ) {
+				fullest = it;
+			}
+		}
+		writeExtent(fullest->first);
+	}
+
+	Extent& created = m_extents[index];
+	if( !m_free.empty() ) {
+		created.data = m_free.back();
+		m_free.pop_back();
+	} else if( posix_memalign(reinterpret_cast<void**>(&created.data), DIRECT_ALIGNMENT, DIRECT_EXTENT_SIZE) != 0 ) {
+		throw std::bad_alloc();
+	}
+	return created;
+}
+
+// A partly filled extent gets the bytes it is missing from the file first
+void DirectFileSink::writeExtent(uint64_t index)
+{
+	auto extentIt = m_extents.find(index);
+	Extent& extent = extentIt->second;
+	uint64_t offset = index * DIRECT_EXTENT_SIZE;
+	uint64_t length = extentLength(index);
+	uint64_t alignedLength = (length + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+
+	if( extent.filled.elementCount() < length ) {
+		uint8_t* merged = nullptr;
+		if( posix_memalign(reinterpret_cast<void**>(&merged), DIRECT_ALIGNMENT, DIRECT_EXTENT_SIZE) != 0 ) {
+			throw std::bad_alloc();
+		}
+		if( pread(m_fd, merged, alignedLength, offset) < 0 ) {
+			BOOST_LOG_TRIVIAL(error) << "DirectFileSink: Reading " << m_path << " failed: " << strerror(errno);
+		}
+		for( const Range::Interval& interval : extent.filled.intervals() ) {
+			memcpy(merged + interval.first, extent.data + interval.first, interval.second - interval.first);
+		}
+		std::swap(merged, extent.data);
+		free(merged);
+	}
+
+	if( pwrite(m_fd, extent.data, alignedLength, offset) != static_cast<ssize_t>(alignedLength) ) {
+		BOOST_LOG_TRIVIAL(error) << "DirectFileSink: Writing " << m_path << " failed: " << strerror(errno);
+	}
+
+	m_free.push_back(extent.data);
+	m_extents.erase(extentIt);
+}
+
+StreamSink::StreamSink(boost::asio::io_service& io_service, int fd, uint64_t window) :
+m_descriptor(io_service, fd),
+m_ring(std::max<uint64_t>(window, MAX_MESSAGE_SIZE)),
+m_fileSize(0),
+m_emitted(0),
+m_waiting(false),
+m_failed(false)
+{
+	m_descriptor.non_blocking(true);
+}
+
+StreamSink::~StreamSink()
+{
+	// The descriptor belongs to the caller
+	boost::system::error_code error;
+	m_descriptor.cancel(error);
+	m_descriptor.non_blocking(false, error);
+	m_descriptor.release();
+}
+
+bool StreamSink::open(uint64_t fileSize)
+{
+	m_fileSize = fileSize;
+	return true;
+}
+
+void StreamSink::write(uint64_t offset, const uint8_t* data, size_t size)
+{
+	// Bytes that were written out already or lie past the window are dropped
+	uint64_t start = std::max(offset, m_emitted);
+	uint64_t end = std::min<uint64_t>(offset + size, std::min(m_fileSize, windowEnd()));
+	if( start >= end ) {
+		return;
+	}
+	data += start - offset;
+
+	// The part of the payload up to the end of the ring, then the rest
+	uint64_t position = start % m_ring.size();
+	uint64_t first = std::min<uint64_t>(end - start, m_ring.size() - position);
+	memcpy(m_ring.data() + position, data, first);
+	memcpy(m_ring.data(), data + first, end - start - first);
+	m_filled.add(start, end);
+
+	if( start == m_emitted ) {
+		emit();
+	}
+}
+
+void StreamSink::close()
+{
+	// The consumer has to take the rest now
+	boost::system::error_code error;
+	m_descriptor.cancel(error);
+	m_descriptor.non_blocking(false, error);
+	m_waiting = false;
+	emit();
+}
+
+void StreamSink::emit()
+{
+	while( !m_failed && !m_waiting && !m_filled.empty() ) {
+		Range::Interval prefix = m_filled.firstInterval();
+		if( static_cast<uint64_t>(prefix.first) != m_emitted ) {
+			return;
+		}
+
+		uint64_t position = m_emitted % m_ring.size();
+		uint64_t length = std::min<uint64_t>(prefix.second - m_emitted, m_ring.size() - position);
+		boost::system::error_code error;
+		size_t written = m_descriptor.write_some(boost::asio::buffer(m_ring.data() + position, length), error);
+		if( error == boost::asio::error::would_block || error == boost::asio::error::try_again ) {
+			waitWritable();
+			return;
+		} else if( error ) {
+			BOOST_LOG_TRIVIAL(error) << "StreamSink: Writing failed: " << error.message();
+			m_failed = true;
+			return;
+		}
+
+		m_filled.subtract(m_emitted, m_emitted + written);
+		m_emitted += written;
+	}
+}
+
+void StreamSink::waitWritable()
+{
+	m_waiting = true;
+	m_descriptor.async_wait(boost::asio::posix::stream_descriptor::wait_write,
+		[this](const boost::system::error_code& error) {
+			if( error ) {
+				return;
+			}
+			m_waiting = false;
+			uint64_t windowEnd = this->windowEnd();
+			emit();
+			if( this->windowEnd() != windowEnd && m_listener ) {
+				m_listener();
+			}
+		});
+}
+
+bool MemorySink::open(uint64_t fileSize)
+{
+	try {
+		m_data.assign(fileSize, 0);
+	} catch( std::bad_alloc& ) {
+		return false;
+	}
+	return true;
+}
+
+void MemorySink::write(uint64_t offset, const uint8_t* data, size_t size)
+{
+	if( offset + size <= m_data.size() ) {
+		memcpy(m_data.data() + offset, data, size);
+	}
+}
+
+ScatterSink::ScatterSink(const std::vector<Buffer>& buffers) :
+m_buffers(buffers),
+m_maxLength(0)
+{
+	std::sort(m_buffers.begin(), m_buffers.end(), [](const Buffer& a, const Buffer& b) {
+		return a.offset < b.offset;
+	});
+	for( const Buffer& buffer : m_buffers ) {
+		m_maxLength = std::max(m_maxLength, buffer.length);
+	}
+}
+
+bool ScatterSink::open(uint64_t)
+{
+	return true;
+}
+
+void ScatterSink::write(uint64_t offset, const uint8_t* data, size_t size)
+{
+	// No buffer starting before offset - m_maxLength reaches the payload
+	Buffer first = {offset - std::min(offset, m_maxLength), 0, nullptr};
+	auto bufferIt = std::lower_bound(m_buffers.begin(), m_buffers.end(), first, [](const Buffer& a, const Buffer& b) {
+		return a.offset < b.offset;
+	});
+
+	for( ; bufferIt != m_buffers.end() && bufferIt->offset < offset + size; ++bufferIt ) {
+		uint64_t start = std::max(offset, bufferIt->offset);
+		uint64_t end = std::min(offset + size, bufferIt->offset + bufferIt->length);
+		if( start < end ) {
+			memcpy(bufferIt->data + (start - bufferIt->offset), data + (start - offset), end - start);
+		}
+	}
+}
+
+Range ScatterSink::packets(uint64_t fileSize, uint64_t packetSize) const
+{
+	Range packets;
+	for( const Buffer& buffer : m_buffers ) {
+		uint64_t end = std::min(buffer.offset + buffer.length, fileSize);
+		if( buffer.offset < end ) {
+			packets.add(buffer.offset / packetSize, (end + packetSize - 1) / packetSize);
+		}
+	}
+	return packets;
+}
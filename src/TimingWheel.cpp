@@ -0,0 +1,252 @@
+#include <TimingWheel.h>
+
+#include <algorithm>
+#include <boost/bind/bind.hpp>
+
+static const uint64_t SLOT_MASK = TimingWheel::SLOTS - 1;
+
+// Ticks the top level covers
+static const uint64_t MAX_DELTA = uint64_t(1) << (TimingWheel::SLOT_BITS * TimingWheel::LEVELS);
+
+void TimingWheel::Node::unlink()
+{
+	prev->next = next;
+	next->prev = prev;
+	prev = this;
+	next = this;
+}
+
+//////////////////////////////
+// Timer
+//////////////////////////////
+
+TimingWheel::Timer::Timer(TimingWheel& wheel) :
+m_wheel(&wheel),
+m_expiry(0),
+m_level(0)
+{
+}
+
+TimingWheel::Timer::~Timer()
+{
+	cancel();
+}
+
+void TimingWheel::Timer::expiresAt(Clock::time_point deadline, Handler handler)
+{
+	cancel();
+	m_handler.swap(handler);
+	m_expiry = m_wheel->tickOf(deadline);
+	m_wheel->link(*this);
+}
+
+void TimingWheel::Timer::expiresAfter(Clock::duration delay, Handler handler)
+{
+	expiresAt(Clock::now() + delay, std::move(handler));
+}
+
+void TimingWheel::Timer::cancel()
+{
+	if( linked() ) {
+		m_wheel->unlink(*this);
+		m_handler = Handler();
+	}
+}
+
+//////////////////////////////
+// TimingWheel
+//////////////////////////////
+
+TimingWheel::TimingWheel(boost::asio::io_service& io_service, std::chrono::microseconds tick) :
+m_tickTimer(io_service),
+m_tick(std::chrono::duration_cast<Clock::duration>(tick)),
+m_origin(Clock::now()),
+m_now(0),
+m_armed(0),
+m_wakeTick(0),
+m_wakeups(0),
+m_expired(0)
+{
+	std::fill(m_levelCount, m_levelCount + LEVELS, 0);
+}
+
+TimingWheel::~TimingWheel()
+{
+	// Timers that outlive the wheel are no longer armed
+	for( int level = 0; level < LEVELS; ++level ) {
+		for( size_t slot = 0; slot < SLOTS; ++slot ) {
+			while( m_slots[level][slot].linked() ) {
+				m_slots[level][slot].next->unlink();
+			}
+		}
+	}
+}
+
+uint64_t TimingWheel::tickOf(Clock::time_point time) const
+{
+	if( time <= m_origin ) {
+		return 0;
+	}
+	return ((time - m_origin).count() + m_tick.count() - 1) / m_tick.count();
+}
+
+uint64_t TimingWheel::currentTick() const
+{
+	return (Clock::now() - m_origin).count() / m_tick.count();
+}
+
+void TimingWheel::link(Timer& timer)
+{
+	// An idle wheel did not tick, it continues at the current time
+	if( m_armed == 0 ) {
+		m_now = std::max(m_now, currentTick());
+	}
+
+	place(timer);
+	m_armed++;
+
+	uint64_t wake = timer.m_level == 0 ? timer.m_expiry : (m_now / SLOTS + 1) * SLOTS;
+	if( m_wakeTick == 0 || wake < m_wakeTick ) {
+		wakeAt(wake);
+	}
+}
+
+void TimingWheel::unlink(Timer& timer)
+{
+	// The steady_timer keeps waiting, a wakeup without work is cheaper
+	// than cancelling it
+	timer.Node::unlink();
+	m_levelCount[timer.m_level]--;
+	m_armed--;
+}
+
+void TimingWheel::place(Timer& timer)
+{
+	// A deadline beyond the top level goes around it until it is in range
+	timer.m_expiry = std::max(timer.m_expiry, m_now + 1);
+	uint64_t expiry = std::min(timer.m_expiry, m_now + MAX_DELTA - 1);
+
+	uint64_t delta = expiry - m_now;
+	int level = 0;
+	while( delta >= uint64_t(1) << (SLOT_BITS * (level + 1)) ) {
+		level++;
+	}
+
+	Node& slot = m_slots[level][(expiry >> (SLOT_BITS * level)) & SLOT_MASK];
+	timer.prev = slot.prev;
+	timer.next = &slot;
+	slot.prev->next = &timer;
+	slot.prev = &timer;
+
+	timer.m_level = level;
+	m_levelCount[level]++;
+}
+
+void TimingWheel::advance(uint64_t now)
+{
+	while( m_now < now ) {
+		if( m_armed == 0 ) {
+			m_now = now;
+			break;
+		}
+
+		m_now++;
+		size_t slot = m_now & SLOT_MASK;
+		if( slot == 0 ) {
+			cascade(1);
+		}
+		expireSlot(slot);
+	}
+}
+
+void TimingWheel::cascade(int level)
+{
+	Node& slot = m_slots[level][(m_now >> (SLOT_BITS * level)) & SLOT_MASK];
+
+	// The timers of the slot expire within the next span of the level below
+	Node pending;
+	if( slot.linked() ) {
+		pending.next = slot.next;
+		pending.prev = slot.prev;
+		pending.next->prev = &pending;
+		pending.prev->next = &pending;
+		slot.next = &slot;
+		slot.prev = &slot;
+	}
+	while( pending.linked() ) {
+		Timer& timer = static_cast<Timer&>(*pending.next);
+		timer.Node::unlink();
+		m_levelCount[level]--;
+		place(timer);
+	}
+
+	if( ((m_now >> (SLOT_BITS * level)) & SLOT_MASK) == 0 && level + 1 < LEVELS ) {
+		cascade(level + 1);
+	}
+}
+
+void TimingWheel::expireSlot(size_t slot)
+{
+	// Handlers re-arm at m_now + 1 or later, which is never this slot
+	Node& head = m_slots[0][slot];
+	while( head.linked() ) {
+		Timer& timer = static_cast<Timer&>(*head.next);
+		if( timer.m_expiry > m_now ) {
+			timer.Node::unlink();
+			m_levelCount[0]--;
+			place(timer);
+			continue;
+		}
+
+		unlink(timer);
+		m_expired++;
+
+		Handler handler;
+		handler.swap(timer.m_handler);
+		handler();
+	}
+}
+
+uint64_t TimingWheel::nextWake() const
+{
+	// The cascade may move timers into the slots before the next one in use
+	uint64_t wake = UINT64_MAX;
+	if( m_armed > m_levelCount[0] ) {
+		wake = (m_now / SLOTS + 1) * SLOTS;
+	}
+
+	if( m_levelCount[0] > 0 ) {
+		for( uint64_t tick = m_now + 1; tick < m_now + SLOTS && tick < wake; ++tick ) {
+			if( m_slots[0][tick & SLOT_MASK].linked() ) {
+				return tick;
+			}
+		}
+	}
+	return wake;
+}
+
+void TimingWheel::wakeAt(uint64_t tick)
+{
+	m_wakeTick = tick;
+	m_tickTimer.expires_at(m_origin + m_tick * static_cast<Clock::rep>(tick));
+	m_tickTimer.async_wait(boost::bind(&TimingWheel::onTick, this, boost::asio::placeholders::error));
+}
+
+void TimingWheel::onTick(const boost::system::error_code& error)
+{
+	// Replaced by an earlier wakeup or the wheel is gone
+	if( error ) {
+		return;
+	}
+
+	m_wakeTick = 0;
+	m_wakeups++;
+	advance(currentTick());
+
+	if( m_armed > 0 ) {
+		uint64_t wake = nextWake();
+		if( m_wakeTick == 0 || wake < m_wakeTick ) {
+			wakeAt(wake);
+		}
+	}
+}
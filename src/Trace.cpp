@@ -0,0 +1,110 @@
+#include <Trace.h>
+#include <Config.h>
+
+#include <mutex>
+
+using namespace std::chrono;
+
+thread_local Trace::Buffer* Trace::s_threadBuffer = nullptr;
+std::vector<Trace::Buffer*> Trace::s_buffers;
+
+namespace {
+	std::mutex s_registryMutex;
+
+	// Reference point to convert timestamps to microseconds
+	uint64_t s_epochTimestamp;
+	steady_clock::time_point s_epochTime;
+}
+
+static_assert((TRACE_BUFFER_EVENTS & (TRACE_BUFFER_EVENTS - 1)) == 0, "TRACE_BUFFER_EVENTS has to be a power of two");
+
+Trace::Buffer* Trace::registerThread()
+{
+	Buffer* buffer = new Buffer();
+	buffer->head.store(0);
+	buffer->events.resize(TRACE_BUFFER_EVENTS);
+
+	std::lock_guard<std::mutex> lock(s_registryMutex);
+	if( s_buffers.empty() ) {
+		s_epochTimestamp = timestamp();
+		s_epochTime = steady_clock::now();
+	}
+	s_buffers.push_back(buffer);
+
+	s_threadBuffer = buffer;
+	return buffer;
+}
+
+std::vector<std::vector<Trace::Event> > Trace::snapshot()
+{
+	std::lock_guard<std::mutex> lock(s_registryMutex);
+
+	std::vector<std::vector<Event> > threads;
+	for( Buffer* buffer : s_buffers ) {
+		uint64_t head = buffer->head.load(std::memory_order_acquire);
+		uint64_t size = buffer->events.size();
+		uint64_t first = head > size ? head - size : 0;
+
+		threads.push_back(std::vector<Event>());
+		threads.back().reserve(head - first);
+		for( uint64_t i = first; i < head; ++i ) {
+			threads.back().push_back(buffer->events[i & (size - 1)]);
+		}
+	}
+
+	return threads;
+}
+
+void Trace::clear()
+{
+	std::lock_guard<std::mutex> lock(s_registryMutex);
+	for( Buffer* buffer : s_buffers ) {
+		buffer->head.store(0, std::memory_order_release);
+	}
+}
+
+const char* Trace::name(Type type)
+{
+	switch( type ) {
+		case REQUEST_SENT: return "request sent";
+		case REQUEST_RECEIVED: return "request received";
+		case PACKET_SENT: return "packet sent";
+		case PACKET_RECEIVED: return "packet received";
+		case TIMEOUT: return "timeout";
+		case RETRANSMIT: return "retransmit";
+	}
+	return "unknown";
+}
+
+void Trace::writeChromeJson(std::ostream& output)
+{
+	std::vector<std::vector<Event> > threads = snapshot();
+
+	// Calibrate the timestamp frequency against the steady clock over the
+	// whole recording period
+	uint64_t epochTimestamp;
+	double ticksPerUs;
+	{
+		std::lock_guard<std::mutex> lock(s_registryMutex);
+		epochTimestamp = s_epochTimestamp;
+		double elapsedUs = duration_cast<duration<double, std::micro> >(steady_clock::now() - s_epochTime).count();
+		uint64_t elapsedTicks = timestamp() - s_epochTimestamp;
+		ticksPerUs = elapsedUs > 0 && elapsedTicks > 0 ? elapsedTicks / elapsedUs : 1;
+	}
+
+	output << "{\"traceEvents\":[";
+	bool first = true;
+	for( size_t thread = 0; thread < threads.size(); ++thread ) {
+		output << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread
+			<< ",\"args\":{\"name\":\"thread " << thread << "\"}}";
+		first = false;
+
+		for( const Event& event : threads[thread] ) {
+			double ts = static_cast<int64_t>(event.timestamp - epochTimestamp) / ticksPerUs;
+			output << ",\n{\"name\":\"" << name(event.type) << "\",\"cat\":\"reach\",\"ph\":\"i\",\"s\":\"t\""
+				<< ",\"pid\":1,\"tid\":" << thread << ",\"ts\":" << std::fixed << ts << std::defaultfloat
+				<< ",\"args\":{\"ufid\":" << event.ufid << ",\"value\":" << event.value << "}}";
+		}
+	}
+	output << "\n]}" << std::endl;
+}
@@ -0,0 +1,144 @@
+#include <ZeroCopy.h>
+
+#include <cerrno>
+#include <cstring>
+#include <linux/errqueue.h>
+#include <sys/socket.h>
+
+#define BOOST_LOG_DYN_LINK 1
+#include <boost/log/trivial.hpp>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+using boost::asio::ip::udp;
+
+bool ZeroCopySender::enable(udp::socket& socket)
+{
+	int one = 1;
+	return setsockopt(socket.native_handle(), SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+}
+
+ZeroCopySender::ZeroCopySender(udp::socket& socket, SendRing& ring) :
+m_socket(socket),
+m_ring(ring),
+m_firstSequence(0),
+m_waiting(false),
+m_zeroCopySends(0),
+m_copiedSends(0)
+{
+	// The sends below must not block the io_service
+	m_socket.non_blocking(true);
+}
+
+void ZeroCopySender::send(SendRing::Slot* slot, const udp::endpoint& destination)
+{
+	const SendRing::Slot::Buffers& buffers = slot->buffers();
+	if( boost::asio::buffer_size(buffers[1]) < ZEROCOPY_MIN_PAYLOAD ) {
+		sendCopy(slot, destination);
+		return;
+	}
+
+	iovec iov[2];
+	for( size_t i = 0; i < 2; ++i ) {
+		iov[i].iov_base = const_cast<void*>(boost::asio::buffer_cast<const void*>(buffers[i]));
+		iov[i].iov_len = boost::asio::buffer_size(buffers[i]);
+	}
+	msghdr header;
+	memset(&header, 0, sizeof(header));
+	header.msg_name = const_cast<sockaddr*>(destination.data());
+	header.msg_namelen = destination.size();
+	header.msg_iov = iov;
+	header.msg_iovlen = 2;
+
+	// Only a send that was accepted takes a sequence number
+	if( sendmsg(m_socket.native_handle(), &header, MSG_ZEROCOPY) < 0 ) {
+		if( errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS ) {
+			sendCopy(slot, destination);
+		} else {
+			BOOST_LOG_TRIVIAL(error) << "Sending packet " << slot->packetId() << " failed: " << strerror(errno);
+			m_ring.release(slot);
+		}
+		return;
+	}
+
+	m_pending.push_back(slot);
+	m_zeroCopySends++;
+	waitForCompletions();
+}
+
+void ZeroCopySender::sendCopy(SendRing::Slot* slot, const udp::endpoint& destination)
+{
+	m_socket.async_send_to(slot->buffers(), destination,
+		[this, slot](const boost::system::error_code& error, std::size_t) {
+			if( error ) {
+				BOOST_LOG_TRIVIAL(error) << "Sending packet " << slot->packetId() << " failed: " << error.message();
+			}
+			m_ring.release(slot);
+		});
+}
+
+void ZeroCopySender::waitForCompletions()
+{
+	if( m_waiting || m_pending.empty() ) {
+		return;
+	}
+
+	// The error queue makes the socket report an error condition
+	m_waiting = true;
+	m_socket.async_wait(udp::socket::wait_error, [this](const boost::system::error_code& error) {
+		m_waiting = false;
+		if( !error ) {
+			readCompletions();
+		}
+		waitForCompletions();
+	});
+}
+
+void ZeroCopySender::readCompletions()
+{
+	for(;;) {
+		char control[CMSG_SPACE(sizeof(sock_extended_err)) + 64];
+		msghdr header;
+		memset(&header, 0, sizeof(header));
+		header.msg_control = control;
+		header.msg_controllen = sizeof(control);
+
+		if( recvmsg(m_socket.native_handle(), &header, MSG_ERRQUEUE | MSG_DONTWAIT) < 0 ) {
+			return;
+		}
+
+		for( cmsghdr* message = CMSG_FIRSTHDR(&header); message; message = CMSG_NXTHDR(&header, message) ) {
+			const sock_extended_err* extended = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(message));
+			if( extended->ee_errno != 0 || extended->ee_origin != SO_EE_ORIGIN_ZEROCOPY ) {
+				continue;
+			}
+			if( extended->ee_code & SO_EE_CODE_ZEROCOPY_COPIED ) {
+				m_copiedSends += extended->ee_data - extended->ee_info + 1;
+			}
+			complete(extended->ee_info, extended->ee_data);
+		}
+	}
+}
+
+// Completions usually arrive in order, slots of a later range are released
+// right away and the queue catches up once the gap closed
+void ZeroCopySender::complete(uint32_t first, uint32_t last)
+{
+	for( uint32_t sequence = first; sequence != last + 1; ++sequence ) {
+		uint32_t index = sequence - m_firstSequence;
+		if( index < m_pending.size() && m_pending[index] ) {
+			m_ring.release(m_pending[index]);
+			m_pending[index] = nullptr;
+		}
+	}
+
+	while( !m_pending.empty() && !m_pending.front() ) {
+		m_pending.pop_front();
+		m_firstSequence++;
+	}
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdlib>
+#include <string>
+#include <stdlib.h>
+
+/////////////////////////////////////
+// Directory that is removed at the end of the test, also if a
+// BOOST_REQUIRE fails
+/////////////////////////////////////
+
+struct TempDirectory {
+	TempDirectory()
+	{
+		char name[] = "/tmp/reach_test_XXXXXX";
+		path = mkdtemp(name);
+	}
+
+	~TempDirectory()
+	{
+		std::system(("rm -rf " + path).c_str());
+	}
+
+	std::string path;
+};
@@ -0,0 +1,185 @@
+//Link to Boost
+#define BOOST_TEST_DYN_LINK
+
+//Define our Module name (prints at testing)
+#define BOOST_TEST_MODULE "BlockCache"
+
+//VERY IMPORTANT - include this last
+#include <boost/test/unit_test.hpp>
+
+#include <BlockCache.h>
+
+#include "TempDirectory.h"
+
+#include <fstream>
+#include <vector>
+
+static std::vector<uint8_t> packet(uint64_t packetId, size_t size = 1024)
+{
+	return std::vector<uint8_t>(size, static_cast<uint8_t>(packetId + 1));
+}
+
+static void writePackets(BlockCache::Entry& entry, std::initializer_list<uint64_t> packetIds)
+{
+	for( uint64_t packetId : packetIds ) {
+		std::vector<uint8_t> data = packet(packetId);
+		entry.write(packetId, data.data(), data.size());
+	}
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( persistAcrossRestart )
+{
+	TempDirectory directory;
+	{
+		auto cache = std::make_shared<BlockCache>(directory.path, 1024 * 1024);
+		BOOST_REQUIRE(cache->isOpen());
+
+		auto entry = cache->open("server", "file", 10000, 1024, 7);
+		BOOST_REQUIRE(entry);
+		writePackets(*entry, {0, 1, 9});
+		BOOST_CHECK_EQUAL(cache->cachedBytes(), 3 * 1024);
+	}
+
+	auto cache = std::make_shared<BlockCache>(directory.path, 1024 * 1024);
+	BOOST_CHECK_EQUAL(cache->cachedBytes(), 3 * 1024);
+
+	auto entry = cache->open("server", "file", 10000, 1024, 7);
+	BOOST_REQUIRE(entry);
+	Range cached = entry->cached(Range(0, 10));
+	BOOST_CHECK_EQUAL(cached.toString(), "0:2,9:10,");
+
+	// The last packet of the file is short
+	BOOST_CHECK_EQUAL(entry->size(9), 10000 - 9 * 1024);
+	BOOST_CHECK_EQUAL(entry->data(1)[1023], 2);
+	BOOST_CHECK_EQUAL(entry->data(9)[0], 10);
+
+	// Unversioned files are not cached
+	BOOST_CHECK(!cache->open("server", "other", 10000, 1024, 0));
+
+	// Lookup without knowing the version
+	auto found = cache->find("server", "file");
+	BOOST_REQUIRE(found);
+	BOOST_CHECK_EQUAL(found->version(), 7);
+	BOOST_CHECK_EQUAL(found->packetCount(), 10);
+	BOOST_CHECK(!cache->find("server", "other"));
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( versionChangeDropsPackets )
+{
+	TempDirectory directory;
+	auto cache = std::make_shared<BlockCache>(directory.path, 1024 * 1024);
+
+	writePackets(*cache->open("server", "file", 10000, 1024, 7), {0, 1, 2});
+	BOOST_CHECK_EQUAL(cache->open("server", "file", 10000, 1024, 7)->cached(Range(0, 10)).elementCount(), 3);
+
+	// Same version on another server is another file
+	BOOST_CHECK_EQUAL(cache->open("other", "file", 10000, 1024, 7)->cached(Range(0, 10)).elementCount(), 0);
+
+	BOOST_CHECK_EQUAL(cache->open("server", "file", 10000, 1024, 8)->cached(Range(0, 10)).elementCount(), 0);
+	BOOST_CHECK_EQUAL(cache->open("server", "file", 20000, 1024, 8)->cached(Range(0, 20)).elementCount(), 0);
+	BOOST_CHECK_EQUAL(cache->cachedBytes(), 0);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( leastRecentlyUsedEviction )
+{
+	TempDirectory directory;
+	auto cache = std::make_shared<BlockCache>(directory.path, 4 * 1024);
+
+	writePackets(*cache->open("server", "a", 10000, 1024, 1), {0, 1});
+	writePackets(*cache->open("server", "b", 10000, 1024, 1), {0, 1});
+
+	// Touch a, so b is the least recently used file
+	cache->open("server", "a", 10000, 1024, 1);
+	writePackets(*cache->open("server", "c", 10000, 1024, 1), {0, 1});
+
+	BOOST_CHECK_EQUAL(cache->cachedBytes(), 4 * 1024);
+	BOOST_CHECK_EQUAL(cache->open("server", "a", 10000, 1024, 1)->cached(Range(0, 10)).elementCount(), 2);
+	BOOST_CHECK_EQUAL(cache->open("server", "b", 10000, 1024, 1)->cached(Range(0, 10)).elementCount(), 0);
+	BOOST_CHECK_EQUAL(cache->open("server", "c", 10000, 1024, 1)->cached(Range(0, 10)).elementCount(), 2);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( openEntriesAreKept )
+{
+	TempDirectory directory;
+	auto cache = std::make_shared<BlockCache>(directory.path, 2 * 1024);
+
+	auto a = cache->open("server", "a", 10000, 1024, 1);
+	writePackets(*a, {0, 1});
+
+	// The budget is used by a, which is still open
+	auto b = cache->open("server", "b", 10000, 1024, 1);
+	writePackets(*b, {0});
+	BOOST_CHECK_EQUAL(b->cached(Range(0, 10)).elementCount(), 0);
+	BOOST_CHECK_EQUAL(a->cached(Range(0, 10)).elementCount(), 2);
+
+	a.reset();
+	writePackets(*b, {0});
+	BOOST_CHECK_EQUAL(b->cached(Range(0, 10)).elementCount(), 1);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( slotsAreRecycled )
+{
+	TempDirectory directory;
+	auto cache = std::make_shared<BlockCache>(directory.path, 1024 * 1024, 2);
+
+	writePackets(*cache->open("server", "a", 10000, 1024, 1), {0});
+	writePackets(*cache->open("server", "b", 10000, 1024, 1), {0});
+	writePackets(*cache->open("server", "c", 10000, 1024, 1), {0});
+
+	BOOST_CHECK_EQUAL(cache->cachedBytes(), 2 * 1024);
+	BOOST_CHECK_EQUAL(cache->open("server", "c", 10000, 1024, 1)->cached(Range(0, 10)).elementCount(), 1);
+
+	// Every slot in use
+	auto b = cache->open("server", "b", 10000, 1024, 1);
+	auto c = cache->open("server", "c", 10000, 1024, 1);
+	BOOST_CHECK(!cache->open("server", "d", 10000, 1024, 1));
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( uncleanShutdownEmptiesCache )
+{
+	TempDirectory directory;
+	{
+		auto cache = std::make_shared<BlockCache>(directory.path, 1024 * 1024);
+		writePackets(*cache->open("server", "file", 10000, 1024, 7), {0, 1});
+
+		// A second owner is refused while the cache is open
+		BlockCache second(directory.path, 1024 * 1024);
+		BOOST_CHECK(!second.isOpen());
+	}
+
+	// Clear the clean flag as if the process had crashed
+	{
+		std::fstream index((directory.path + "/index").c_str(), std::ios::in | std::ios::out | std::ios::binary);
+		uint64_t clean = 0;
+		index.seekp(3 * sizeof(uint64_t));
+		index.write(reinterpret_cast<const char*>(&clean), sizeof(clean));
+	}
+
+	auto cache = std::make_shared<BlockCache>(directory.path, 1024 * 1024);
+	BOOST_CHECK_EQUAL(cache->cachedBytes(), 0);
+	BOOST_CHECK_EQUAL(cache->open("server", "file", 10000, 1024, 7)->cached(Range(0, 10)).elementCount(), 0);
+}
@@ -0,0 +1,83 @@
+//Link to Boost
+#define BOOST_TEST_DYN_LINK
+
+//Define our Module name (prints at testing)
+#define BOOST_TEST_MODULE "BusyPoll"
+
+//VERY IMPORTANT - include this last
+#include <boost/test/unit_test.hpp>
+
+#include <BusyPoll.h>
+
+#include <boost/asio/steady_timer.hpp>
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( spinsWhileBusy )
+{
+	boost::asio::io_service io_service;
+	boost::asio::steady_timer timer(io_service);
+	bool fired = false;
+	timer.expires_from_now(std::chrono::milliseconds(20));
+	timer.async_wait([&](const boost::system::error_code& error) {
+		fired = !error;
+		io_service.stop();
+	});
+
+	// The timer fires within the idle time, the loop never blocks
+	BusyPoll busyPoll(io_service, std::chrono::seconds(1));
+	busyPoll.run();
+	BOOST_CHECK(fired);
+	BOOST_CHECK_GT(busyPoll.emptyPolls(), 0);
+	BOOST_CHECK_EQUAL(busyPoll.blockingWaits(), 0);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( blocksWhenIdle )
+{
+	boost::asio::io_service io_service;
+	boost::asio::steady_timer timer(io_service);
+	int fired = 0;
+	std::function<void(const boost::system::error_code&)> wait = [&](const boost::system::error_code&) {
+		if( ++fired == 3 ) {
+			return;
+		}
+		timer.expires_from_now(std::chrono::milliseconds(20));
+		timer.async_wait(wait);
+	};
+	timer.expires_from_now(std::chrono::milliseconds(20));
+	timer.async_wait(wait);
+
+	// Every gap between the timers is longer than the idle time, the loop
+	// ends once it is out of work
+	BusyPoll busyPoll(io_service, std::chrono::milliseconds(1));
+	busyPoll.run();
+	BOOST_CHECK_EQUAL(fired, 3);
+	BOOST_CHECK_EQUAL(busyPoll.blockingWaits(), 3);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( pinToAllowedCpu )
+{
+	cpu_set_t allowed;
+	BOOST_REQUIRE_EQUAL(pthread_getaffinity_np(pthread_self(), sizeof(allowed), &allowed), 0);
+	int cpu = 0;
+	while( !CPU_ISSET(cpu, &allowed) ) {
+		cpu++;
+	}
+
+	BOOST_CHECK(BusyPoll::pinThread(cpu));
+	BOOST_CHECK(!BusyPoll::pinThread(-1));
+	BOOST_CHECK_EQUAL(sched_getcpu(), cpu);
+
+	// Restore for the other tests of the process
+	pthread_setaffinity_np(pthread_self(), sizeof(allowed), &allowed);
+}
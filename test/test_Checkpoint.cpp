@@ -0,0 +1,82 @@
+//Link to Boost
+#define BOOST_TEST_DYN_LINK
+
+//Define our Module name (prints at testing)
+#define BOOST_TEST_MODULE "Checkpoint"
+
+//VERY IMPORTANT - include this last
+#include <boost/test/unit_test.hpp>
+
+#include <Checkpoint.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
+
+static std::string checkpointFile()
+{
+	char name[] = "/tmp/reach_checkpoint_XXXXXX";
+	close(mkstemp(name));
+	return name;
+}
+
+static Checkpoint testCheckpoint()
+{
+	Checkpoint checkpoint;
+	checkpoint.path = "/data/file.bin";
+	checkpoint.fileSize = 5000000000;
+	checkpoint.packetSize = 8192;
+	checkpoint.fileVersion = 1500000000123456789;
+	checkpoint.missing.add(17, 1000);
+	checkpoint.missing.add(5000, 5001);
+	checkpoint.missing.add(610000, 610352);
+	return checkpoint;
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( saveAndLoad )
+{
+	std::string file = checkpointFile();
+	Checkpoint saved = testCheckpoint();
+	BOOST_REQUIRE(saved.save(file));
+
+	Checkpoint loaded;
+	BOOST_REQUIRE(loaded.load(file));
+	BOOST_CHECK(loaded.sameFile(saved));
+	BOOST_CHECK_EQUAL(loaded.path, saved.path);
+	BOOST_CHECK_EQUAL(loaded.missing.toString(), saved.missing.toString());
+
+	// A new version of the file is another file
+	loaded.fileVersion++;
+	BOOST_CHECK(!loaded.sameFile(saved));
+
+	std::remove(file.c_str());
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( rejectBrokenFiles )
+{
+	std::string file = checkpointFile();
+	Checkpoint checkpoint;
+	BOOST_CHECK(!checkpoint.load(file));
+	BOOST_CHECK(!checkpoint.load(file + ".missing"));
+
+	BOOST_REQUIRE(testCheckpoint().save(file));
+	std::ifstream input(file, std::ios::binary);
+	std::string content((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+	// Every truncation is detected
+	for( size_t size = 0; size < content.size(); ++size ) {
+		std::ofstream(file, std::ios::binary).write(content.data(), size);
+		BOOST_CHECK(!checkpoint.load(file));
+	}
+
+	std::remove(file.c_str());
+}
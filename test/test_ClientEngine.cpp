@@ -0,0 +1,803 @@
+//Link to Boost
+#define BOOST_TEST_DYN_LINK
+
+//Define our Module name (prints at testing)
+#define BOOST_TEST_MODULE "ClientEngine"
+
+//VERY IMPORTANT - include this last
+#include <boost/test/unit_test.hpp>
+#include <boost/asio.hpp>
+
+#include <ClientEngine.h>
+
+#include "TempDirectory.h"
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <thread>
+#include <unistd.h>
+
+using boost::asio::ip::udp;
+
+/////////////////////////////////////
+// In-process server on the loopback interface. The path is the decimal
+// file size, byte i of every file is (i * 7) & 0xff. Drops the given
+// fraction of the FILE_PACKETs and stops sending them at the packet limit.
+// With a multicast group it sends every file once to the group shortly
+// after the given number of receivers asked for it. As tracker it lists
+// every earlier client as peer. With malformed packets every FILE_PACKET
+// follows a truncated and an oversized copy of it.
+/////////////////////////////////////
+
+static uint8_t fileByte(uint64_t offset)
+{
+	return static_cast<uint8_t>(offset * 7);
+}
+
+class LoopbackServer {
+public:
+	LoopbackServer(boost::asio::io_service& io_service, double loss, uint64_t packetSize = 1024)
+	: m_socket(io_service, udp::endpoint(boost::asio::ip::address_v4::loopback(), 0)),
+	  m_loss(loss),
+	  m_packetSize(packetSize),
+	  m_fileVersion(1),
+	  m_random(1),
+	  m_requests(0),
+	  m_packetLimit(UINT64_MAX),
+	  m_tracker(false),
+	  m_malformed(false),
+	  m_receivers(0),
+	  m_multicastTimer(io_service),
+	  m_unicastPackets(0),
+	  m_multicastPackets(0)
+	{
+		// All transfers start at once, their REQ_FILEs arrive in one burst
+		m_socket.set_option(boost::asio::socket_base::receive_buffer_size(4 * 1024 * 1024));
+		receive();
+	}
+
+	udp::endpoint endpoint() const { return m_socket.local_endpoint(); }
+	uint64_t requests() const { return m_requests; }
+	void setFileVersion(uint64_t fileVersion) { m_fileVersion = fileVersion; }
+	void setPacketLimit(uint64_t packetLimit) { m_packetLimit = packetLimit; }
+	void setTracker() { m_tracker = true; }
+	void setMalformed() { m_malformed = true; }
+	uint64_t unicastPackets() const { return m_unicastPackets; }
+	uint64_t multicastPackets() const { return m_multicastPackets; }
+	const std::vector<udp::endpoint>& peers() const { return m_peers; }
+
+	void setMulticastGroup(const udp::endpoint& group, size_t receivers)
+	{
+		m_socket.set_option(boost::asio::ip::multicast::outbound_interface(boost::asio::ip::address_v4::loopback()));
+		m_group = group;
+		m_receivers = receivers;
+	}
+
+private:
+	void receive()
+	{
+		m_socket.async_receive_from(boost::asio::buffer(m_buffer), m_client,
+			[this](const boost::system::error_code& error, std::size_t size) {
+				if( !error ) {
+					handle(*Message::fromBuffer(m_buffer.data(), size));
+					receive();
+				}
+			});
+	}
+
+	void handle(const Message& message)
+	{
+		m_requests++;
+		if( message.type() == Message::REQ_FILE ) {
+			uint64_t fileSize = std::stoull(message.path());
+			m_fileSize[message.ufid()] = fileSize;
+			if( m_receivers == 0 ) {
+				m_socket.send_to(Message::createFileInfo(message.ufid(), fileSize, m_packetSize, m_fileVersion)->asBuffer(), m_client);
+				sendPeers(message.ufid());
+				return;
+			}
+
+			// The session is the file size
+			m_socket.send_to(Message::createFileInfo(message.ufid(), fileSize, m_packetSize, m_fileVersion, fileSize, m_group)->asBuffer(), m_client);
+			if( ++m_joined[fileSize] == m_receivers ) {
+				m_multicastTimer.expires_from_now(std::chrono::milliseconds(50));
+				m_multicastTimer.async_wait([this, fileSize](const boost::system::error_code& error) {
+					if( !error ) {
+						sendPackets(fileSize, fileSize, Range(0, (fileSize + m_packetSize - 1) / m_packetSize), m_group);
+					}
+				});
+			}
+		} else if( message.type() == Message::REQ_FILE_PACKETS ) {
+			sendPackets(message.ufid(), m_fileSize[message.ufid()], message.packets(), m_client);
+		} else if( message.type() == Message::REQ_PEERS ) {
+			sendPeers(message.ufid());
+		}
+	}
+
+	void sendPeers(uint64_t ufid)
+	{
+		if( !m_tracker ) {
+			return;
+		}
+		if( std::find(m_peers.begin(), m_peers.end(), m_client) == m_peers.end() ) {
+			m_peers.push_back(m_client);
+		}
+
+		std::vector<udp::endpoint> others(m_peers);
+		others.erase(std::find(others.begin(), others.end(), m_client));
+		m_socket.send_to(Message::createPeers(ufid, others)->asBuffer(), m_client);
+	}
+
+	void sendPackets(uint64_t ufid, uint64_t fileSize, const Range& packets, const udp::endpoint& destination)
+	{
+		std::vector<uint8_t> payload(m_packetSize);
+		for( uint64_t packetId : packets ) {
+			if( std::uniform_real_distribution<double>()(m_random) < m_loss || m_packetLimit == 0 ) {
+				continue;
+			}
+			m_packetLimit--;
+
+			uint64_t offset = packetId * m_packetSize;
+			size_t size = std::min<uint64_t>(m_packetSize, fileSize - offset);
+			for( size_t i = 0; i < size; ++i ) {
+				payload[i] = fileByte(offset + i);
+			}
+			if( m_malformed ) {
+				uint8_t header[Message::FILE_PACKET_HEADER_SIZE];
+				Message::encodeFilePacketHeader(header, ufid, packetId);
+				m_socket.send_to(boost::asio::buffer(header, sizeof(header) - 5), destination);
+				std::vector<uint8_t> oversized(size + 100, 0xee);
+				m_socket.send_to(Message::createFilePacket(ufid, packetId, oversized.data(), oversized.size())->asBuffer(), destination);
+			}
+			m_socket.send_to(Message::createFilePacket(ufid, packetId, payload.data(), size)->asBuffer(), destination);
+			(destination == m_group ? m_multicastPackets : m_unicastPackets)++;
+		}
+	}
+
+	udp::socket m_socket;
+	udp::endpoint m_client;
+	boost::array<uint8_t, MAX_MESSAGE_SIZE> m_buffer;
+	double m_loss;
+	uint64_t m_packetSize;
+	uint64_t m_fileVersion;
+	std::mt19937_64 m_random;
+	std::map<uint64_t, uint64_t> m_fileSize;
+	uint64_t m_requests;
+	uint64_t m_packetLimit;
+	bool m_tracker;
+	std::vector<udp::endpoint> m_peers;
+	bool m_malformed;
+
+	udp::endpoint m_group;
+	size_t m_receivers;
+	std::map<uint64_t, size_t> m_joined;
+	boost::asio::steady_timer m_multicastTimer;
+	uint64_t m_unicastPackets;
+	uint64_t m_multicastPackets;
+};
+
+static bool verify(const MemorySink& sink, uint64_t fileSize)
+{
+	if( sink.data().size() != fileSize ) {
+		return false;
+	}
+	for( uint64_t i = 0; i < fileSize; ++i ) {
+		if( sink.data()[i] != fileByte(i) ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static ClientEngine::Options testOptions()
+{
+	ClientEngine::Options options;
+	options.window = 64;
+	options.fileInfoTimeoutMs = 200;
+	options.requestTimeoutMs = 20;
+	options.stallTimeoutMs = 2000;
+	return options;
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( singleTransfer )
+{
+	boost::asio::io_service io_service;
+	LoopbackServer server(io_service, 0);
+	ClientEngine engine(io_service, server.endpoint(), testOptions());
+
+	std::shared_ptr<MemorySink> sink(new MemorySink());
+	boost::system::error_code result = boost::asio::error::would_block;
+	engine.copy("100000", sink, [&](const boost::system::error_code& error, const CopyFile::Result& transfer) {
+		result = error;
+		BOOST_CHECK_EQUAL(transfer.fileSize, 100000);
+		BOOST_CHECK_EQUAL(transfer.packets, 98);
+		io_service.stop();
+	});
+	io_service.run();
+
+	BOOST_CHECK(!result);
+	BOOST_CHECK(verify(*sink, 100000));
+	BOOST_CHECK_EQUAL(engine.activeTransfers(), 0);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( malformedPacketsAreDropped )
+{
+	boost::asio::io_service io_service;
+	LoopbackServer server(io_service, 0);
+	server.setMalformed();
+	ClientEngine engine(io_service, server.endpoint(), testOptions());
+
+	// The truncated and oversized copies arrive first and are not written
+	std::shared_ptr<MemorySink> sink(new MemorySink());
+	boost::system::error_code result = boost::asio::error::would_block;
+	engine.copy("100000", sink, [&](const boost::system::error_code& error, const CopyFile::Result& transfer) {
+		result = error;
+		BOOST_CHECK_EQUAL(transfer.receivedPackets, 98);
+		BOOST_CHECK_EQUAL(transfer.bytes, 100000);
+		io_service.stop();
+	});
+	io_service.run();
+
+	BOOST_CHECK(!result);
+	BOOST_CHECK(verify(*sink, 100000));
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( concurrentLossyTransfers )
+{
+	boost::asio::io_service io_service;
+	LoopbackServer server(io_service, 0.05);
+	ClientEngine engine(io_service, server.endpoint(), testOptions());
+
+	const int transfers = 200;
+	std::vector<std::shared_ptr<MemorySink> > sinks;
+	int completed = 0;
+	for( int i = 0; i < transfers; ++i ) {
+		sinks.push_back(std::shared_ptr<MemorySink>(new MemorySink()));
+		uint64_t fileSize = 20000 + i * 37;
+		engine.copy(std::to_string(fileSize), sinks.back(), [&, i, fileSize](const boost::system::error_code& error, const CopyFile::Result&) {
+			BOOST_CHECK_MESSAGE(!error, error.message());
+			BOOST_CHECK(verify(*sinks[i], fileSize));
+			if( ++completed == transfers ) {
+				io_service.stop();
+			}
+		});
+	}
+	io_service.run();
+
+	BOOST_CHECK_EQUAL(completed, transfers);
+	BOOST_CHECK_GT(engine.metrics().histogram("reach_client_loss_burst_packets").count(), 0);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( noServer )
+{
+	boost::asio::io_service io_service;
+	udp::endpoint nowhere;
+	{
+		// Reserve a port nobody answers on
+		LoopbackServer unused(io_service, 0);
+		nowhere = unused.endpoint();
+	}
+	io_service.reset();
+
+	ClientEngine engine(io_service, nowhere, testOptions());
+	boost::system::error_code result;
+	engine.copy("1000", std::shared_ptr<Sink>(new NullSink()), [&](const boost::system::error_code& error, const CopyFile::Result&) {
+		result = error;
+		io_service.stop();
+	});
+	io_service.run();
+
+	BOOST_CHECK(result == boost::asio::error::timed_out);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( cancelAndFuture )
+{
+	boost::asio::io_service io_service;
+	LoopbackServer server(io_service, 0);
+	ClientEngine engine(io_service, server.endpoint(), testOptions());
+
+	std::shared_ptr<MemorySink> sink(new MemorySink());
+	std::future<CopyFile::Result> done = engine.copy("50000", sink);
+	std::future<CopyFile::Result> cancelled = engine.copy("50000", std::shared_ptr<Sink>(new NullSink()));
+	engine.cancel(2);
+
+	while( done.wait_for(std::chrono::seconds(0)) != std::future_status::ready ||
+		cancelled.wait_for(std::chrono::seconds(0)) != std::future_status::ready ) {
+		io_service.run_one();
+	}
+
+	BOOST_CHECK_EQUAL(done.get().fileSize, 50000);
+	BOOST_CHECK(verify(*sink, 50000));
+	try {
+		cancelled.get();
+		BOOST_ERROR("cancelled transfer completed");
+	} catch( boost::system::system_error& e ) {
+		BOOST_CHECK(e.code() == boost::asio::error::operation_aborted);
+	}
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( rangeRead )
+{
+	boost::asio::io_service io_service;
+	LoopbackServer server(io_service, 0);
+	ClientEngine engine(io_service, server.endpoint(), testOptions());
+
+	// Bytes 5000 to 9096 lie in packets 4 to 8 of a 1 MB file
+	std::vector<uint8_t> data(4096);
+	std::future<CopyFile::Result> done = engine.read("1000000", 5000, data.size(), data.data());
+	while( done.wait_for(std::chrono::seconds(0)) != std::future_status::ready ) {
+		io_service.run_one();
+	}
+
+	CopyFile::Result result = done.get();
+	BOOST_CHECK_EQUAL(result.fileSize, 1000000);
+	BOOST_CHECK_EQUAL(result.packets, 5);
+	BOOST_CHECK_EQUAL(result.requestedPackets, 5);
+	for( size_t i = 0; i < data.size(); ++i ) {
+		BOOST_REQUIRE_EQUAL(data[i], fileByte(5000 + i));
+	}
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( vectoredRead )
+{
+	boost::asio::io_service io_service;
+	LoopbackServer server(io_service, 0.05);
+	ClientEngine engine(io_service, server.endpoint(), testOptions());
+
+	// Scattered, overlapping and one range past the end of the file
+	const uint64_t fileSize = 3000000;
+	std::vector<std::pair<uint64_t, uint64_t> > ranges = {
+		{0, 1}, {1023, 2}, {100000, 50000}, {120000, 100}, {2999000, 2000}, {777777, 4096}};
+	std::vector<std::vector<uint8_t> > data;
+	std::vector<ScatterSink::Buffer> buffers;
+	for( const auto& range : ranges ) {
+		data.push_back(std::vector<uint8_t>(range.second, 0xee));
+	}
+	for( size_t i = 0; i < ranges.size(); ++i ) {
+		ScatterSink::Buffer buffer = {ranges[i].first, ranges[i].second, data[i].data()};
+		buffers.push_back(buffer);
+	}
+
+	boost::system::error_code result = boost::asio::error::would_block;
+	engine.read(std::to_string(fileSize), buffers, [&](const boost::system::error_code& error, const CopyFile::Result& transfer) {
+		result = error;
+		BOOST_CHECK_LT(transfer.packets, 80);
+		io_service.stop();
+	});
+	io_service.run();
+
+	BOOST_CHECK(!result);
+	for( size_t i = 0; i < ranges.size(); ++i ) {
+		for( uint64_t j = 0; j < ranges[i].second; ++j ) {
+			uint64_t offset = ranges[i].first + j;
+			BOOST_REQUIRE_EQUAL(data[i][j], offset < fileSize ? fileByte(offset) : 0xee);
+		}
+	}
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( warmReadFromCache )
+{
+	TempDirectory cacheDirectory;
+	ClientEngine::Options options = testOptions();
+	options.cacheDirectory = cacheDirectory.path;
+
+	boost::asio::io_service io_service;
+	LoopbackServer server(io_service, 0.05);
+	std::vector<CopyFile::Result> results;
+	{
+		ClientEngine engine(io_service, server.endpoint(), options);
+
+		auto copy = [&]() {
+			std::shared_ptr<MemorySink> sink(new MemorySink());
+			std::future<CopyFile::Result> done = engine.copy("100000", sink);
+			while( done.wait_for(std::chrono::seconds(0)) != std::future_status::ready ) {
+				io_service.run_one();
+			}
+			results.push_back(done.get());
+			BOOST_CHECK(verify(*sink, 100000));
+		};
+
+		copy();
+		copy();
+
+		// A new version of the file is fetched again
+		server.setFileVersion(2);
+		copy();
+	}
+
+	// A new engine finds the cache on disk
+	ClientEngine engine(io_service, server.endpoint(), options);
+	std::vector<uint8_t> data(5000);
+	std::future<CopyFile::Result> done = engine.read("100000", 30000, data.size(), data.data());
+	while( done.wait_for(std::chrono::seconds(0)) != std::future_status::ready ) {
+		io_service.run_one();
+	}
+	results.push_back(done.get());
+	for( size_t i = 0; i < data.size(); ++i ) {
+		BOOST_REQUIRE_EQUAL(data[i], fileByte(30000 + i));
+	}
+
+	BOOST_CHECK_EQUAL(results[0].cachedPackets, 0);
+	BOOST_CHECK_EQUAL(results[1].cachedPackets, 98);
+	BOOST_CHECK_EQUAL(results[1].requests, 0);
+	BOOST_CHECK_EQUAL(results[2].cachedPackets, 0);
+	BOOST_CHECK_EQUAL(results[3].cachedPackets, 6);
+	BOOST_CHECK_EQUAL(results[3].requests, 0);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+static CopyFile::Result copyToFile(boost::asio::io_service& io_service, ClientEngine& engine, const std::string& output, boost::system::error_code& error)
+{
+	CopyFile::Result result;
+	bool done = false;
+	engine.copy("100000", std::shared_ptr<Sink>(new MappedFileSink(output)), [&](const boost::system::error_code& transferError, const CopyFile::Result& transfer) {
+		error = transferError;
+		result = transfer;
+		done = true;
+	});
+	while( !done ) {
+		io_service.run_one();
+	}
+	return result;
+}
+
+static bool verifyFile(const std::string& path, uint64_t fileSize)
+{
+	std::ifstream input(path, std::ios::binary);
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+	MemorySink sink;
+	sink.open(data.size());
+	sink.write(0, data.data(), data.size());
+	return verify(sink, fileSize);
+}
+
+BOOST_AUTO_TEST_CASE( resumeFromCheckpoint )
+{
+	TempDirectory directory;
+	std::string output = directory.path + "/output.bin";
+
+	boost::asio::io_service io_service;
+	LoopbackServer server(io_service, 0);
+	ClientEngine::Options options = testOptions();
+	options.stallTimeoutMs = 200;
+	boost::system::error_code error;
+
+	// A server that drops everything interrupts the transfer
+	LoopbackServer silent(io_service, 1.0);
+	{
+		ClientEngine engine(io_service, silent.endpoint(), options);
+		copyToFile(io_service, engine, output, error);
+		BOOST_CHECK(error == boost::asio::error::timed_out);
+	}
+	Checkpoint checkpoint;
+	BOOST_REQUIRE(checkpoint.load(output + ".reach"));
+	BOOST_CHECK_EQUAL(checkpoint.missing.elementCount(), 98);
+
+	// Pretend the first run got all but a few packets
+	{
+		MappedFileSink sink(output);
+		sink.open(100000);
+		for( uint64_t offset = 0; offset < 100000; ++offset ) {
+			uint8_t byte = fileByte(offset);
+			sink.write(offset, &byte, 1);
+		}
+		uint8_t wrong[1024] = {0};
+		sink.write(5 * 1024, wrong, sizeof(wrong));
+		sink.write(97 * 1024, wrong, 100000 - 97 * 1024);
+	}
+	checkpoint.missing = Range(5);
+	checkpoint.missing.add(97);
+	checkpoint.save(output + ".reach");
+
+	ClientEngine engine(io_service, server.endpoint(), options);
+	CopyFile::Result result = copyToFile(io_service, engine, output, error);
+	BOOST_CHECK(!error);
+	BOOST_CHECK_EQUAL(result.resumedPackets, 96);
+	BOOST_CHECK_EQUAL(result.requestedPackets, 2);
+	BOOST_CHECK(verifyFile(output, 100000));
+	BOOST_CHECK(!checkpoint.load(output + ".reach"));
+
+	// A checkpoint of another file version is ignored
+	checkpoint.fileVersion = 2;
+	checkpoint.save(output + ".reach");
+	result = copyToFile(io_service, engine, output, error);
+	BOOST_CHECK_EQUAL(result.resumedPackets, 0);
+	BOOST_CHECK_EQUAL(result.requestedPackets, 98);
+
+	// A checkpoint whose output file is gone describes a new, empty file
+	checkpoint.fileVersion = 1;
+	checkpoint.save(output + ".reach");
+	std::remove(output.c_str());
+	result = copyToFile(io_service, engine, output, error);
+	BOOST_CHECK(!error);
+	BOOST_CHECK_EQUAL(result.resumedPackets, 0);
+	BOOST_CHECK_EQUAL(result.requestedPackets, 98);
+	BOOST_CHECK(verifyFile(output, 100000));
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+static CopyFile::Result copyFromReplicas(boost::asio::io_service& io_service,
+	const std::vector<udp::endpoint>& servers, uint64_t fileSize)
+{
+	ClientEngine engine(io_service, servers, testOptions());
+
+	std::shared_ptr<MemorySink> sink(new MemorySink());
+	std::future<CopyFile::Result> done = engine.copy(std::to_string(fileSize), sink);
+	while( done.wait_for(std::chrono::seconds(0)) != std::future_status::ready ) {
+		io_service.run_one();
+	}
+
+	CopyFile::Result result = done.get();
+	BOOST_CHECK(verify(*sink, fileSize));
+	return result;
+}
+
+BOOST_AUTO_TEST_CASE( stripedAcrossReplicas )
+{
+	boost::asio::io_service io_service;
+	LoopbackServer first(io_service, 0);
+	LoopbackServer second(io_service, 0);
+
+	CopyFile::Result result = copyFromReplicas(io_service, {first.endpoint(), second.endpoint()}, 1000000);
+
+	BOOST_REQUIRE_EQUAL(result.serverPackets.size(), 2);
+	BOOST_CHECK_GT(result.serverPackets[0], 0);
+	BOOST_CHECK_GT(result.serverPackets[1], 0);
+	BOOST_CHECK_EQUAL(result.serverPackets[0] + result.serverPackets[1], result.receivedPackets);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( lossyReplicaGetsLess )
+{
+	boost::asio::io_service io_service;
+	LoopbackServer lossy(io_service, 0.3);
+	LoopbackServer clean(io_service, 0);
+
+	CopyFile::Result result = copyFromReplicas(io_service, {lossy.endpoint(), clean.endpoint()}, 4000000);
+
+	BOOST_CHECK_LT(result.serverPackets[0], result.serverPackets[1]);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( replicasFailMidTransfer )
+{
+	boost::asio::io_service io_service;
+
+	// Never answers, stops after 100 packets and a working one
+	udp::socket dead(io_service, udp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+	LoopbackServer failing(io_service, 0);
+	failing.setPacketLimit(100);
+	LoopbackServer working(io_service, 0);
+
+	CopyFile::Result result = copyFromReplicas(io_service,
+		{dead.local_endpoint(), failing.endpoint(), working.endpoint()}, 1000000);
+
+	BOOST_CHECK_EQUAL(result.serverPackets[0], 0);
+	BOOST_CHECK_LE(result.serverPackets[1], 100);
+	BOOST_CHECK_GE(result.serverPackets[2], result.packets - 100);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( multicastToSeveralReceivers )
+{
+	boost::asio::io_service io_service;
+
+	// The group loses packets as well, receivers request them by unicast
+	LoopbackServer server(io_service, 0.1);
+	uint16_t port = udp::socket(io_service, udp::endpoint(udp::v4(), 0)).local_endpoint().port();
+	server.setMulticastGroup(udp::endpoint(boost::asio::ip::address_v4::from_string("239.255.82.1"), port), 3);
+
+	ClientEngine::Options options = testOptions();
+	options.multicastInterface = "127.0.0.1";
+
+	std::vector<std::unique_ptr<ClientEngine> > engines;
+	std::vector<std::shared_ptr<MemorySink> > sinks;
+	std::vector<std::future<CopyFile::Result> > done;
+	for( int i = 0; i < 3; ++i ) {
+		engines.emplace_back(new ClientEngine(io_service, server.endpoint(), options));
+		sinks.emplace_back(new MemorySink());
+		done.push_back(engines.back()->copy("1000000", sinks.back()));
+	}
+
+	for( std::future<CopyFile::Result>& transfer : done ) {
+		while( transfer.wait_for(std::chrono::seconds(0)) != std::future_status::ready ) {
+			io_service.run_one();
+		}
+	}
+
+	for( int i = 0; i < 3; ++i ) {
+		CopyFile::Result result = done[i].get();
+		BOOST_CHECK(verify(*sinks[i], 1000000));
+		BOOST_CHECK_GT(result.multicastPackets, result.packets / 2);
+	}
+
+	// The file went to the group once, unicast only repaired the losses and
+	// is less than one more copy for all receivers together
+	BOOST_CHECK_LE(server.multicastPackets(), 977);
+	BOOST_CHECK_LT(server.unicastPackets(), 977);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( fetchFromSeedingPeer )
+{
+	TempDirectory seedDirectory;
+	TempDirectory peerDirectory;
+	ClientEngine::Options seedOptions = testOptions();
+	seedOptions.cacheDirectory = seedDirectory.path;
+	ClientEngine::Options peerOptions = testOptions();
+	peerOptions.cacheDirectory = peerDirectory.path;
+
+	boost::asio::io_service io_service;
+	LoopbackServer server(io_service, 0);
+	server.setTracker();
+	{
+		ClientEngine seed(io_service, server.endpoint(), seedOptions);
+		ClientEngine peer(io_service, server.endpoint(), peerOptions);
+
+		auto copy = [&](ClientEngine& engine) {
+			std::shared_ptr<MemorySink> sink(new MemorySink());
+			std::future<CopyFile::Result> done = engine.copy("1000000", sink);
+			while( done.wait_for(std::chrono::seconds(0)) != std::future_status::ready ) {
+				io_service.run_one();
+			}
+			BOOST_CHECK(verify(*sink, 1000000));
+			return done.get();
+		};
+
+		CopyFile::Result seeded = copy(seed);
+		BOOST_CHECK_EQUAL(seeded.peerPackets, 0);
+
+		// The server stops sending, every packet has to come from the seed
+		server.setPacketLimit(0);
+		CopyFile::Result fetched = copy(peer);
+		BOOST_CHECK_EQUAL(fetched.peerPackets, fetched.packets);
+		BOOST_CHECK_EQUAL(fetched.serverPackets[0], 0);
+
+		// A request for the whole file gets requestSize packets, paced
+		udp::socket probe(io_service, udp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+		auto reqFile = Message::createReqFile(77, "1000000");
+		probe.send_to(reqFile->asBuffer(), server.peers().front());
+		auto reqPackets = Message::createRequestFilePackets(77, Range(0, 977));
+		probe.send_to(reqPackets->asBuffer(), server.peers().front());
+
+		boost::array<uint8_t, MAX_MESSAGE_SIZE> buffer;
+		size_t filePackets = 0;
+		std::function<void()> receive = [&]() {
+			probe.async_receive(boost::asio::buffer(buffer), [&](const boost::system::error_code& error, std::size_t size) {
+				std::shared_ptr<Message> message = Message::fromBuffer(buffer.data(), size);
+				if( !error && message && message->type() == Message::FILE_PACKET ) {
+					filePackets++;
+				}
+				if( !error ) {
+					receive();
+				}
+			});
+		};
+		receive();
+		io_service.run_for(std::chrono::milliseconds(300));
+		BOOST_CHECK_EQUAL(filePackets, seedOptions.requestSize);
+		probe.close();
+		io_service.restart();
+		io_service.poll();
+	}
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( streamToSlowConsumer )
+{
+	int pipeFds[2];
+	BOOST_REQUIRE_EQUAL(pipe(pipeFds), 0);
+
+	// Reads in small pieces with pauses, the transfer has to wait for it
+	std::vector<uint8_t> received;
+	std::thread consumer([&]() {
+		std::vector<uint8_t> buffer(16 * 1024);
+		ssize_t size;
+		while( (size = read(pipeFds[0], buffer.data(), buffer.size())) > 0 ) {
+			received.insert(received.end(), buffer.begin(), buffer.begin() + size);
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+	});
+
+	boost::asio::io_service io_service;
+	LoopbackServer server(io_service, 0.05);
+	ClientEngine engine(io_service, server.endpoint(), testOptions());
+	std::shared_ptr<StreamSink> sink(new StreamSink(io_service, pipeFds[1], 64 * 1024));
+
+	std::future<CopyFile::Result> done = engine.copy("2000000", sink);
+	while( done.wait_for(std::chrono::seconds(0)) != std::future_status::ready ) {
+		io_service.run_one();
+	}
+	CopyFile::Result result = done.get();
+	close(pipeFds[1]);
+	consumer.join();
+	close(pipeFds[0]);
+
+	BOOST_CHECK_EQUAL(result.fileSize, 2000000);
+	BOOST_REQUIRE_EQUAL(received.size(), 2000000);
+	for( size_t i = 0; i < received.size(); ++i ) {
+		BOOST_REQUIRE_EQUAL(received[i], fileByte(i));
+	}
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( receiveFromPacketRing )
+{
+	boost::asio::io_service io_service;
+	LoopbackServer server(io_service, 0.1, 8192);
+	ClientEngine::Options options = testOptions();
+	options.packetRing = true;
+	ClientEngine engine(io_service, server.endpoint(), options);
+	if( !engine.packetRing() ) {
+		BOOST_TEST_MESSAGE("Skipped, AF_PACKET needs CAP_NET_RAW");
+		return;
+	}
+
+	std::shared_ptr<MemorySink> sink(new MemorySink());
+	std::future<CopyFile::Result> result = engine.copy("1000000", sink);
+	while( result.wait_for(std::chrono::seconds(0)) != std::future_status::ready ) {
+		io_service.run_one();
+	}
+
+	BOOST_CHECK_EQUAL(result.get().fileSize, 1000000);
+	BOOST_CHECK(verify(*sink, 1000000));
+	BOOST_CHECK_GE(engine.packetRing()->packets(), 123);
+	BOOST_CHECK_EQUAL(engine.packetRing()->checksumErrors(), 0);
+}
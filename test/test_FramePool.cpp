@@ -0,0 +1,118 @@
+//Link to Boost
+#define BOOST_TEST_DYN_LINK
+
+//Define our Module name (prints at testing)
+#define BOOST_TEST_MODULE "FramePool"
+
+//VERY IMPORTANT - include this last
+#include <boost/test/unit_test.hpp>
+
+#include <FramePool.h>
+
+#include <chrono>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+struct Frame {
+	Frame() : value(0) {}
+
+	int value;
+	std::vector<int> buffer;
+};
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( framesAreRecycled )
+{
+	int created = 0;
+	FramePool<Frame> pool([&]() { created++; return new Frame(); });
+	BOOST_CHECK_EQUAL(pool.size(), 0);
+
+	Frame* a = pool.acquire();
+	Frame* b = pool.acquire();
+	BOOST_CHECK(a != b);
+	BOOST_CHECK_EQUAL(pool.inUse(), 2);
+
+	// Released frames keep their state, the most recent comes back first
+	a->buffer.assign(100, 1);
+	pool.release(b);
+	pool.release(a);
+	BOOST_CHECK_EQUAL(pool.inUse(), 0);
+
+	Frame* c = pool.acquire();
+	BOOST_CHECK(c == a);
+	BOOST_CHECK_EQUAL(c->buffer.size(), 100);
+	BOOST_CHECK(pool.acquire() == b);
+	BOOST_CHECK_EQUAL(created, 2);
+	BOOST_CHECK_EQUAL(pool.size(), 2);
+
+	pool.acquire();
+	BOOST_CHECK_EQUAL(created, 3);
+	BOOST_CHECK_EQUAL(pool.inUse(), 3);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( reserveCreatesFrames )
+{
+	int created = 0;
+	FramePool<Frame> pool([&]() { created++; return new Frame(); }, 8);
+	BOOST_CHECK_EQUAL(created, 8);
+	BOOST_CHECK_EQUAL(pool.size(), 8);
+	BOOST_CHECK_EQUAL(pool.inUse(), 0);
+
+	for( int i = 0; i < 8; ++i ) {
+		pool.acquire();
+	}
+	BOOST_CHECK_EQUAL(created, 8);
+	pool.acquire();
+	BOOST_CHECK_EQUAL(created, 9);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+struct TimerFrame {
+	explicit TimerFrame(boost::asio::io_service& io_service) : timer(io_service), steps(0) {}
+
+	boost::asio::steady_timer timer;
+	int steps;
+};
+
+BOOST_AUTO_TEST_CASE( stateMachinesShareFrames )
+{
+	boost::asio::io_service io_service;
+	FramePool<TimerFrame> pool([&]() { return new TimerFrame(io_service); });
+
+	// Two rounds of operations, the second reuses the frames of the first
+	int completed = 0;
+	std::function<void(TimerFrame*)> step = [&](TimerFrame* frame) {
+		if( ++frame->steps == 4 ) {
+			completed++;
+			pool.release(frame);
+			return;
+		}
+		frame->timer.expires_from_now(std::chrono::microseconds(10));
+		frame->timer.async_wait([&step, frame](const boost::system::error_code&) { step(frame); });
+	};
+
+	for( int round = 0; round < 2; ++round ) {
+		for( int i = 0; i < 100; ++i ) {
+			TimerFrame* frame = pool.acquire();
+			frame->steps = 0;
+			step(frame);
+		}
+		io_service.run();
+		io_service.reset();
+	}
+
+	BOOST_CHECK_EQUAL(completed, 200);
+	BOOST_CHECK_EQUAL(pool.size(), 100);
+	BOOST_CHECK_EQUAL(pool.inUse(), 0);
+}
@@ -0,0 +1,118 @@
+//Link to Boost
+#define BOOST_TEST_DYN_LINK
+
+//Define our Module name (prints at testing)
+#define BOOST_TEST_MODULE "Histogram"
+
+//VERY IMPORTANT - include this last
+#include <boost/test/unit_test.hpp>
+
+#include <Histogram.h>
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( exactSmallValues )
+{
+	Histogram histogram(7);
+	for( uint64_t value = 0; value < 100; ++value ) {
+		histogram.record(value);
+	}
+
+	BOOST_CHECK_EQUAL(histogram.count(), 100);
+	BOOST_CHECK_EQUAL(histogram.min(), 0);
+	BOOST_CHECK_EQUAL(histogram.max(), 99);
+	BOOST_CHECK_EQUAL(histogram.sum(), 4950);
+	BOOST_CHECK_EQUAL(histogram.percentile(50), 49);
+	BOOST_CHECK_EQUAL(histogram.percentile(99), 98);
+	BOOST_CHECK_EQUAL(histogram.percentile(100), 99);
+	BOOST_CHECK_EQUAL(histogram.percentile(0), 0);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( relativeError )
+{
+	Histogram histogram(7);
+	std::mt19937_64 random(1);
+	std::vector<uint64_t> reference;
+
+	// Log-uniform values between 1 us and ~17 min
+	for( int i = 0; i < 100000; ++i ) {
+		uint64_t value = static_cast<uint64_t>(std::exp2(std::uniform_real_distribution<double>(0, 30)(random)));
+		histogram.record(value);
+		reference.push_back(value);
+	}
+	std::sort(reference.begin(), reference.end());
+
+	for( double percent : {1.0, 25.0, 50.0, 90.0, 99.0, 99.9} ) {
+		uint64_t expected = reference[static_cast<size_t>(std::ceil(percent / 100 * reference.size())) - 1];
+		uint64_t reported = histogram.percentile(percent);
+		BOOST_CHECK_GE(reported, expected);
+		BOOST_CHECK_LE(reported - expected, expected / 128);
+	}
+	BOOST_CHECK_EQUAL(histogram.max(), reference.back());
+	BOOST_CHECK_EQUAL(histogram.min(), reference.front());
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( merge )
+{
+	Histogram a, b, c(3);
+	for( uint64_t value = 1; value <= 1000; ++value ) {
+		(value % 2 ? a : b).record(value * 1000);
+	}
+	c.record(5, 10);
+
+	Histogram merged;
+	merged.merge(a);
+	merged.merge(b);
+	BOOST_CHECK_EQUAL(merged.count(), 1000);
+	BOOST_CHECK_EQUAL(merged.min(), 1000);
+	BOOST_CHECK_EQUAL(merged.max(), 1000000);
+	BOOST_CHECK_CLOSE(static_cast<double>(merged.percentile(50)), 500000.0, 1);
+
+	merged.merge(c);
+	BOOST_CHECK_EQUAL(merged.count(), 1010);
+	BOOST_CHECK_EQUAL(merged.min(), 5);
+
+	merged.reset();
+	BOOST_CHECK_EQUAL(merged.count(), 0);
+	BOOST_CHECK_EQUAL(merged.percentile(99), 0);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( textExport )
+{
+	Metrics metrics;
+	metrics.histogram("reach_test_us", "Test latency").record(42, 3);
+	metrics.histogram("reach_empty");
+
+	std::stringstream json;
+	metrics.writeJson(json);
+	BOOST_CHECK_EQUAL(json.str(),
+		"{\"reach_empty\":{\"count\":0,\"min\":0,\"max\":0,\"mean\":0,\"p50\":0,\"p90\":0,\"p99\":0,\"p999\":0,\"buckets\":[]},"
+		"\"reach_test_us\":{\"count\":3,\"min\":42,\"max\":42,\"mean\":42,\"p50\":42,\"p90\":42,\"p99\":42,\"p999\":42,\"buckets\":[[42,3]]}}");
+
+	std::stringstream prometheus;
+	metrics.writePrometheus(prometheus);
+	std::string text = prometheus.str();
+	BOOST_CHECK(text.find("# HELP reach_test_us Test latency\n") != std::string::npos);
+	BOOST_CHECK(text.find("# TYPE reach_test_us summary\n") != std::string::npos);
+	BOOST_CHECK(text.find("reach_test_us{quantile=\"0.99\"} 42\n") != std::string::npos);
+	BOOST_CHECK(text.find("reach_test_us_sum 126\n") != std::string::npos);
+	BOOST_CHECK(text.find("reach_test_us_count 3\n") != std::string::npos);
+}
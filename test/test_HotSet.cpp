@@ -0,0 +1,102 @@
+//Link to Boost
+#define BOOST_TEST_DYN_LINK
+
+//Define our Module name (prints at testing)
+#define BOOST_TEST_MODULE "HotSet"
+
+//VERY IMPORTANT - include this last
+#include <boost/test/unit_test.hpp>
+
+#include <HotSet.h>
+
+#include "TempDirectory.h"
+
+#include <fstream>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static std::vector<std::string> readLines(const std::string& path)
+{
+	std::vector<std::string> lines;
+	std::ifstream file(path.c_str());
+	std::string line;
+	while( std::getline(file, line) ) {
+		lines.push_back(line);
+	}
+	return lines;
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( recordedManifest )
+{
+	TempDirectory directory;
+	std::string manifest = directory.path + "/hot";
+
+	// A missing manifest is an empty hot set
+	HotSet hotSet(3);
+	BOOST_CHECK(hotSet.load(manifest));
+	BOOST_CHECK(hotSet.paths().empty());
+
+	{
+		std::ofstream file(manifest.c_str());
+		file << "# written by hand\n/a\n\n/b\n/a\n/c\n/d\n";
+	}
+	BOOST_REQUIRE(hotSet.load(manifest));
+	BOOST_REQUIRE_EQUAL(hotSet.paths().size(), 3);
+	BOOST_CHECK_EQUAL(hotSet.paths()[1], "/b");
+	BOOST_CHECK_EQUAL(hotSet.paths()[2], "/c");
+
+	// The most requested files first, then the rest of the old manifest
+	hotSet.record("/x");
+	hotSet.record("/b");
+	hotSet.record("/x");
+	hotSet.forget("/a");
+	BOOST_REQUIRE(hotSet.save(manifest));
+	std::vector<std::string> expected = {"/x", "/b", "/c"};
+	BOOST_CHECK(readLines(manifest) == expected);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( warmedPagesAreResident )
+{
+	TempDirectory directory;
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	std::vector<boost::iostreams::mapped_file_source> files(4);
+	std::vector<HotSet::Region> regions;
+	for( size_t i = 0; i < files.size(); ++i ) {
+		std::string path = directory.path + "/file" + std::to_string(i);
+		{
+			std::ofstream file(path.c_str(), std::ios::binary);
+			std::vector<char> data((i + 1) * 16 * pageSize + 100, static_cast<char>(i));
+			file.write(data.data(), data.size());
+		}
+		files[i].open(path);
+		HotSet::Region region = {files[i].data(), files[i].size()};
+		regions.push_back(region);
+	}
+
+	// The budget covers the first two files only, locking fails with a low
+	// RLIMIT_MEMLOCK
+	HotSet::WarmOptions options;
+	options.threads = 2;
+	options.lockBytes = 48 * pageSize + 200;
+	HotSet::WarmResult result = HotSet::warm(regions, options);
+	BOOST_CHECK_EQUAL(result.faultedBytes, (1 + 2 + 3 + 4) * 16 * pageSize + 4 * 100);
+	BOOST_CHECK(result.lockedBytes == 0 || result.lockedBytes == 48 * pageSize + 200);
+
+	for( const HotSet::Region& region : regions ) {
+		size_t pages = (region.size + pageSize - 1) / pageSize;
+		std::vector<unsigned char> resident(pages);
+		BOOST_REQUIRE_EQUAL(mincore(const_cast<void*>(region.data), region.size, resident.data()), 0);
+		for( size_t page = 0; page < pages; ++page ) {
+			BOOST_CHECK(resident[page] & 1);
+		}
+	}
+}
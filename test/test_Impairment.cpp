@@ -0,0 +1,137 @@
+//Link to Boost
+#define BOOST_TEST_DYN_LINK
+
+//Define our Module name (prints at testing)
+#define BOOST_TEST_MODULE "Impairment"
+
+//VERY IMPORTANT - include this last
+#include <boost/test/unit_test.hpp>
+
+#include <Impairment.h>
+
+using namespace std::chrono;
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( perfectLink )
+{
+	Impairment link(Impairment::Config(), 1);
+	std::vector<Impairment::Clock::time_point> departures;
+	auto now = Impairment::Clock::now();
+
+	for( int i = 0; i < 100; ++i ) {
+		link.schedule(now, 1000, departures);
+	}
+
+	BOOST_CHECK_EQUAL(departures.size(), 100);
+	for( auto departure : departures ) {
+		BOOST_CHECK(departure == now);
+	}
+	BOOST_CHECK_EQUAL(link.statistics().packets, 100);
+	BOOST_CHECK_EQUAL(link.statistics().bytes, 100000);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( randomLoss )
+{
+	Impairment::Config config;
+	config.loss = 0.1;
+	config.duplicate = 0.05;
+	Impairment link(config, 2);
+
+	std::vector<Impairment::Clock::time_point> departures;
+	auto now = Impairment::Clock::now();
+	for( int i = 0; i < 100000; ++i ) {
+		link.schedule(now, 100, departures);
+	}
+
+	const Impairment::Statistics& s = link.statistics();
+	BOOST_CHECK_CLOSE(static_cast<double>(s.lost), 10000.0, 5);
+	BOOST_CHECK_CLOSE(static_cast<double>(s.duplicated), 0.05 * 90000, 5);
+	BOOST_CHECK_EQUAL(departures.size(), 100000 - s.lost + s.duplicated);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( burstLoss )
+{
+	// Mean burst length of 1 / burstExit = 8 packets
+	Impairment::Config config;
+	config.burstEnter = 0.01;
+	config.burstExit = 0.125;
+	Impairment link(config, 3);
+
+	std::vector<Impairment::Clock::time_point> departures;
+	auto now = Impairment::Clock::now();
+	uint64_t bursts = 0;
+	bool lastLost = false;
+	for( int i = 0; i < 200000; ++i ) {
+		uint64_t lostBefore = link.statistics().lost;
+		link.schedule(now, 100, departures);
+		bool lost = link.statistics().lost > lostBefore;
+		bursts += lost && !lastLost;
+		lastLost = lost;
+	}
+
+	double meanBurst = static_cast<double>(link.statistics().lost) / bursts;
+	BOOST_CHECK_CLOSE(meanBurst, 8.0, 10);
+
+	// Stationary loss rate p / (p + r)
+	BOOST_CHECK_CLOSE(link.statistics().lost / 200000.0, 0.01 / 0.135, 10);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( delayAndJitter )
+{
+	Impairment::Config config;
+	config.delayUs = 5000;
+	config.jitterUs = 1000;
+	Impairment link(config, 4);
+
+	std::vector<Impairment::Clock::time_point> departures;
+	auto now = Impairment::Clock::now();
+	for( int i = 0; i < 1000; ++i ) {
+		link.schedule(now, 100, departures);
+	}
+
+	for( auto departure : departures ) {
+		BOOST_CHECK(departure >= now + microseconds(4000));
+		BOOST_CHECK(departure <= now + microseconds(6000));
+	}
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( bandwidthCap )
+{
+	// 8 Mbit/s -> 1000 byte take 1 ms on the wire
+	Impairment::Config config;
+	config.rateBps = 8000000;
+	config.queueLimitUs = 10000;
+	Impairment link(config, 5);
+
+	std::vector<Impairment::Clock::time_point> departures;
+	auto now = Impairment::Clock::now();
+	for( int i = 0; i < 20; ++i ) {
+		link.schedule(now, 1000, departures);
+	}
+
+	// The queue holds 10 ms worth of datagrams, the rest is tail dropped
+	BOOST_CHECK_EQUAL(departures.size(), 11);
+	BOOST_CHECK_EQUAL(link.statistics().queueDropped, 9);
+	for( size_t i = 0; i < departures.size(); ++i ) {
+		BOOST_CHECK(departures[i] == now + milliseconds(i + 1));
+	}
+}
@@ -84,13 +84,14 @@ BOOST_AUTO_TEST_CASE( reqFileMessage )
 		uint8_t type;
 		uint64_t ufid;
 		char path[PATH_LENGTH];
+		uint8_t priority;
 	} messageData;
 	#pragma pack(pop)
 
 	// Create
 	const char* testPath = "/some/random/file";
 	uint64_t testUfid = 3456;
-	auto message = Message::createReqFile(testUfid, testPath);
+	auto message = Message::createReqFile(testUfid, testPath, 2);
 
 	// Data Layer
 	auto messageBuffer = message->asBuffer();
@@ -101,12 +102,18 @@ BOOST_AUTO_TEST_CASE( reqFileMessage )
 	BOOST_CHECK_EQUAL(messageData.type, Message::REQ_FILE);
 	BOOST_CHECK_EQUAL(messageData.ufid, message->ufid());
 	BOOST_CHECK_EQUAL(messageData.path, testPath);
+	BOOST_CHECK_EQUAL(messageData.priority, 2);
 
 	// Parse
 	auto parsedMessage = Message::fromBuffer(reinterpret_cast<uint8_t*>(&messageData), sizeof(messageData));
 	BOOST_CHECK_EQUAL(parsedMessage->type(), Message::REQ_FILE);
 	BOOST_CHECK_EQUAL(parsedMessage->ufid(), message->ufid());
 	BOOST_CHECK_EQUAL(parsedMessage->path(), testPath);
+	BOOST_CHECK_EQUAL(parsedMessage->priority(), 2);
+
+	// Older clients send no priority
+	parsedMessage = Message::fromBuffer(reinterpret_cast<uint8_t*>(&messageData), sizeof(messageData) - 1);
+	BOOST_CHECK_EQUAL(parsedMessage->priority(), 0);
 }
 
 
@@ -123,6 +130,7 @@ BOOST_AUTO_TEST_CASE( fileInfoMessage )
 		uint64_t ufid;
 		uint64_t fileSize;
 		uint64_t packetSize;
+		uint64_t fileVersion;
 	} messageData;
 	#pragma pack(pop)
 
@@ -130,7 +138,8 @@ BOOST_AUTO_TEST_CASE( fileInfoMessage )
 	uint64_t testUfid = 1234567;
 	uint64_t testfileSize = 75234;
 	uint64_t testPacketSize = 1024;
-	auto message = Message::createFileInfo(testUfid, testfileSize, testPacketSize);
+	uint64_t testFileVersion = 1500000000123456789;
+	auto message = Message::createFileInfo(testUfid, testfileSize, testPacketSize, testFileVersion);
 
 	// Data Layer
 	auto messageBuffer = message->asBuffer();
@@ -142,6 +151,7 @@ BOOST_AUTO_TEST_CASE( fileInfoMessage )
 	BOOST_CHECK_EQUAL(messageData.ufid, testUfid);
 	BOOST_CHECK_EQUAL(messageData.fileSize, testfileSize);
 	BOOST_CHECK_EQUAL(messageData.packetSize, testPacketSize);
+	BOOST_CHECK_EQUAL(messageData.fileVersion, testFileVersion);
 
 	// Parse
 	auto parsedMessage = Message::fromBuffer(reinterpret_cast<uint8_t*>(&messageData), sizeof(messageData));
@@ -149,6 +159,47 @@ BOOST_AUTO_TEST_CASE( fileInfoMessage )
 	BOOST_CHECK_EQUAL(parsedMessage->ufid(), testUfid);
 	BOOST_CHECK_EQUAL(parsedMessage->fileSize(), testfileSize);
 	BOOST_CHECK_EQUAL(parsedMessage->packetSize(), testPacketSize);
+	BOOST_CHECK_EQUAL(parsedMessage->fileVersion(), testFileVersion);
+
+	// Older servers end the message after the packet size
+	auto legacyMessage = Message::fromBuffer(reinterpret_cast<uint8_t*>(&messageData), sizeof(messageData) - sizeof(uint64_t));
+	BOOST_CHECK_EQUAL(legacyMessage->packetSize(), testPacketSize);
+	BOOST_CHECK_EQUAL(legacyMessage->fileVersion(), 0);
+	BOOST_CHECK_EQUAL(parsedMessage->multicastSession(), 0);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( fileInfoMulticastMessage )
+{
+	// UDP Packet as Struct
+	#pragma pack(push, 1)
+	struct {
+		uint8_t type;
+		uint64_t ufid;
+		uint64_t fileSize;
+		uint64_t packetSize;
+		uint64_t fileVersion;
+		uint64_t multicastSession;
+		uint32_t multicastAddress;
+		uint16_t multicastPort;
+	} messageData;
+	#pragma pack(pop)
+
+	boost::asio::ip::udp::endpoint group(boost::asio::ip::address_v4::from_string("239.255.0.1"), 52124);
+	auto message = Message::createFileInfo(1234567, 75234, 1024, 7, 0x1122334455667788ULL, group);
+
+	auto messageBuffer = message->asBuffer();
+	BOOST_CHECK_EQUAL(sizeof(messageData), boost::asio::buffer_size(messageBuffer));
+	boost::asio::buffer_copy(boost::asio::buffer(&messageData, sizeof(messageData)), messageBuffer);
+
+	auto parsedMessage = Message::fromBuffer(reinterpret_cast<uint8_t*>(&messageData), sizeof(messageData));
+	BOOST_CHECK_EQUAL(parsedMessage->fileSize(), 75234);
+	BOOST_CHECK_EQUAL(parsedMessage->fileVersion(), 7);
+	BOOST_CHECK_EQUAL(parsedMessage->multicastSession(), 0x1122334455667788ULL);
+	BOOST_CHECK(parsedMessage->multicastGroup() == group);
 }
 
 /////////////////////////////////////
@@ -162,9 +213,10 @@ BOOST_AUTO_TEST_CASE( requestfilePacketsMessage )
 	struct {
 		uint8_t type;
 		uint64_t ufid;
-		uint8_t numberIntervals;
-		uint64_t a0;
-		uint64_t b0;
+		uint8_t encoding;
+		uint32_t numberRuns;
+		uint8_t gap0;
+		uint8_t length0;
 	} messageData;
 	#pragma pack(pop)
 
@@ -181,9 +233,10 @@ BOOST_AUTO_TEST_CASE( requestfilePacketsMessage )
 	
 	BOOST_CHECK_EQUAL(messageData.type, Message::REQ_FILE_PACKETS);
 	BOOST_CHECK_EQUAL(messageData.ufid, testUfid);
-	BOOST_CHECK_EQUAL(messageData.numberIntervals, 1);
-	BOOST_CHECK_EQUAL(messageData.a0, 2);
-	BOOST_CHECK_EQUAL(messageData.b0, 19);
+	BOOST_CHECK_EQUAL(messageData.encoding, Range::RUNS);
+	BOOST_CHECK_EQUAL(messageData.numberRuns, 1);
+	BOOST_CHECK_EQUAL(messageData.gap0, 2);
+	BOOST_CHECK_EQUAL(messageData.length0, 17);
 
 	// Parse
 	auto parsedMessage = Message::fromBuffer(reinterpret_cast<uint8_t*>(&messageData), sizeof(messageData));
@@ -250,3 +303,125 @@ BOOST_AUTO_TEST_CASE( filePacketMessage )
 		BOOST_CHECK_EQUAL(messageData.payloadData[i], parsedPayloadData[i]);
 	}
 }
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( peersMessage )
+{
+	std::vector<boost::asio::ip::udp::endpoint> peers;
+	peers.push_back(boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4::from_string("10.0.0.1"), 40000));
+	peers.push_back(boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4::from_string("10.0.0.2"), 40001));
+	auto message = Message::createPeers(3456, peers);
+
+	// type, ufid, count and 6 bytes per peer
+	std::vector<uint8_t> data(boost::asio::buffer_size(message->asBuffer()));
+	BOOST_CHECK_EQUAL(data.size(), 1 + 8 + 4 + 2 * 6);
+	boost::asio::buffer_copy(boost::asio::buffer(data), message->asBuffer());
+
+	auto parsedMessage = Message::fromBuffer(data.data(), data.size());
+	BOOST_CHECK_EQUAL(parsedMessage->type(), Message::PEERS);
+	BOOST_CHECK_EQUAL(parsedMessage->ufid(), 3456);
+	BOOST_REQUIRE_EQUAL(parsedMessage->peers().size(), 2);
+	BOOST_CHECK(parsedMessage->peers()[0] == peers[0]);
+	BOOST_CHECK(parsedMessage->peers()[1] == peers[1]);
+
+	// A truncated list keeps the complete entries
+	parsedMessage = Message::fromBuffer(data.data(), data.size() - 1);
+	BOOST_CHECK_EQUAL(parsedMessage->peers().size(), 1);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( availabilityMessage )
+{
+	Range held(0, 10);
+	held.add(20, 30);
+	auto message = Message::createAvailability(3456, held);
+
+	std::vector<uint8_t> data(boost::asio::buffer_size(message->asBuffer()));
+	boost::asio::buffer_copy(boost::asio::buffer(data), message->asBuffer());
+
+	auto parsedMessage = Message::fromBuffer(data.data(), data.size());
+	BOOST_CHECK_EQUAL(parsedMessage->type(), Message::AVAILABILITY);
+	BOOST_CHECK_EQUAL(parsedMessage->ufid(), 3456);
+	BOOST_CHECK_EQUAL(parsedMessage->packets().toString(), held.toString());
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( truncatedMessagesAreRejected )
+{
+	uint8_t payload[100] = {};
+	auto message = Message::createFilePacket(7, 3, payload, sizeof(payload));
+	auto messageBuffer = message->asBuffer();
+	std::vector<uint8_t> data(boost::asio::buffer_size(messageBuffer));
+	boost::asio::buffer_copy(boost::asio::buffer(data), messageBuffer);
+
+	// Every cut into the header, the payload may be empty
+	for( size_t length = 0; length < Message::FILE_PACKET_HEADER_SIZE; ++length ) {
+		BOOST_CHECK(!Message::fromBuffer(data.data(), length));
+	}
+	auto parsedMessage = Message::fromBuffer(data.data(), Message::FILE_PACKET_HEADER_SIZE);
+	BOOST_REQUIRE(parsedMessage);
+	BOOST_CHECK_EQUAL(parsedMessage->packetId(), 3);
+	BOOST_CHECK_EQUAL(parsedMessage->payloadSize(), 0);
+
+	// Fixed fields of the other types
+	auto fileInfoMessage = Message::createFileInfo(7, 1000, 100);
+	auto fileInfoBuffer = fileInfoMessage->asBuffer();
+	std::vector<uint8_t> fileInfo(boost::asio::buffer_size(fileInfoBuffer));
+	boost::asio::buffer_copy(boost::asio::buffer(fileInfo), fileInfoBuffer);
+	BOOST_CHECK(!Message::fromBuffer(fileInfo.data(), sizeof(uint8_t) + 2 * sizeof(uint64_t)));
+	BOOST_CHECK(Message::fromBuffer(fileInfo.data(), sizeof(uint8_t) + 3 * sizeof(uint64_t)));
+
+	auto reqFileMessage = Message::createReqFile(7, "file");
+	auto reqFileBuffer = reqFileMessage->asBuffer();
+	std::vector<uint8_t> reqFile(boost::asio::buffer_size(reqFileBuffer));
+	boost::asio::buffer_copy(boost::asio::buffer(reqFile), reqFileBuffer);
+	BOOST_CHECK(!Message::fromBuffer(reqFile.data(), reqFile.size() - 2));
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( hugeIntervalIsRejected )
+{
+	// UDP Packet as Struct
+	#pragma pack(push, 1)
+	struct {
+		uint8_t type;
+		uint64_t ufid;
+		uint8_t encoding;
+		uint32_t count;
+		uint64_t start;
+		uint64_t end;
+	} messageData;
+	#pragma pack(pop)
+
+	messageData.type = Message::REQ_FILE_PACKETS;
+	messageData.ufid = 3456;
+	messageData.encoding = Range::INTERVALS;
+	messageData.count = 1;
+	messageData.start = 0;
+	messageData.end = 1ULL << 62;
+
+	// Decoding it would build 2^46 chunks
+	BOOST_CHECK(!Message::fromBuffer(reinterpret_cast<uint8_t*>(&messageData), sizeof(messageData)));
+
+	// Ids up to the limit are accepted
+	messageData.start = MAX_PACKET_ID - 10;
+	messageData.end = MAX_PACKET_ID;
+	auto parsedMessage = Message::fromBuffer(reinterpret_cast<uint8_t*>(&messageData), sizeof(messageData));
+	BOOST_REQUIRE(parsedMessage);
+	BOOST_CHECK_EQUAL(parsedMessage->packets().elementCount(), 10);
+
+	// A tighter limit from the caller
+	BOOST_CHECK(!Message::fromBuffer(reinterpret_cast<uint8_t*>(&messageData), sizeof(messageData), MAX_PACKET_ID - 1));
+}
@@ -7,6 +7,8 @@
 //VERY IMPORTANT - include this last
 #include <boost/test/unit_test.hpp>
 #include <boost/asio.hpp>
+#include <random>
+#include <set>
 
 #include <Range.h>
 #include <Config.h>
@@ -243,7 +245,8 @@ BOOST_AUTO_TEST_CASE( serizalization )
 	// UDP Packet as Struct
 	#pragma pack(push, 1)
 	struct {
-		uint8_t numberIntervals;
+		uint8_t encoding;
+		uint32_t numberIntervals;
 		uint64_t a0;
 		uint64_t b0;
 		uint64_t a1;
@@ -256,11 +259,12 @@ BOOST_AUTO_TEST_CASE( serizalization )
 	range.add(8,10);
 
 	// Data Layer
-	auto rangeBuffer = range.asBuffer();
+	auto rangeBuffer = range.asBuffer(Range::INTERVALS);
 	BOOST_CHECK_EQUAL(sizeof(rangeData), boost::asio::buffer_size(rangeBuffer));
 
 	boost::asio::buffer_copy(boost::asio::buffer(&rangeData, sizeof(rangeData)), rangeBuffer); 
 	
+	BOOST_CHECK_EQUAL(rangeData.encoding, Range::INTERVALS);
 	BOOST_CHECK_EQUAL(rangeData.numberIntervals, 2);
 	BOOST_CHECK_EQUAL(rangeData.a0, 3);
 	BOOST_CHECK_EQUAL(rangeData.b0, 5);
@@ -268,7 +272,7 @@ BOOST_AUTO_TEST_CASE( serizalization )
 	BOOST_CHECK_EQUAL(rangeData.b1, 10);
 
 	// Parse
-	auto parsedRange = Range::fromBuffer(reinterpret_cast<uint8_t*>(&rangeData));
+	auto parsedRange = Range::fromBuffer(reinterpret_cast<uint8_t*>(&rangeData), sizeof(rangeData));
 	BOOST_CHECK_EQUAL(parsedRange->intervalCount(), 2);
 	{
 		auto it = parsedRange->begin();
@@ -288,6 +292,227 @@ BOOST_AUTO_TEST_CASE( serizalization )
 /////////////////////////////////////
 /////////////////////////////////////
 
+BOOST_AUTO_TEST_CASE( serizalizationRuns )
+{
+	// UDP Packet as Struct
+	#pragma pack(push, 1)
+	struct {
+		uint8_t encoding;
+		uint32_t numberRuns;
+		uint8_t gap0;
+		uint8_t length0;
+		uint8_t gap1;
+		uint8_t length1;
+	} rangeData;
+	#pragma pack(pop)
+
+	// Create
+	auto range = Range(3,5);
+	range.add(8,10);
+
+	// Data Layer
+	BOOST_CHECK_EQUAL(range.smallestEncoding(), Range::RUNS);
+	auto rangeBuffer = range.asBuffer();
+	BOOST_CHECK_EQUAL(sizeof(rangeData), boost::asio::buffer_size(rangeBuffer));
+	BOOST_CHECK_EQUAL(sizeof(rangeData), range.encodedSize());
+
+	boost::asio::buffer_copy(boost::asio::buffer(&rangeData, sizeof(rangeData)), rangeBuffer);
+
+	BOOST_CHECK_EQUAL(rangeData.encoding, Range::RUNS);
+	BOOST_CHECK_EQUAL(rangeData.numberRuns, 2);
+	BOOST_CHECK_EQUAL(rangeData.gap0, 3);
+	BOOST_CHECK_EQUAL(rangeData.length0, 2);
+	BOOST_CHECK_EQUAL(rangeData.gap1, 3);
+	BOOST_CHECK_EQUAL(rangeData.length1, 2);
+
+	// Parse
+	auto parsedRange = Range::fromBuffer(reinterpret_cast<uint8_t*>(&rangeData), sizeof(rangeData));
+	BOOST_CHECK_EQUAL(parsedRange->toString(), range.toString());
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+static Range roundTrip(const Range& range, Range::Encoding encoding)
+{
+	auto rangeBuffer = range.asBuffer(encoding);
+	std::vector<uint8_t> data(boost::asio::buffer_size(rangeBuffer));
+	boost::asio::buffer_copy(boost::asio::buffer(data), rangeBuffer);
+	BOOST_CHECK_EQUAL(data.size(), range.encodedSize(encoding));
+	auto parsedRange = Range::fromBuffer(data.data(), data.size());
+	BOOST_REQUIRE(parsedRange);
+	return *parsedRange;
+}
+
+BOOST_AUTO_TEST_CASE( sparseEncoding )
+{
+	std::mt19937_64 random(11);
+
+	// Random 2% loss on a large file leaves thousands of scattered packets
+	const uint64_t base = 5 * Range::CHUNK_SIZE + 17;
+	Range missing;
+	Range dense;
+	for( uint64_t i = 0; i < 200000; ++i ) {
+		uint64_t r = random() % 100;
+		if( r < 2 ) {
+			missing.add(base + i);
+		}
+		if( r < 30 ) {
+			dense.add(base + i);
+		}
+	}
+	BOOST_CHECK_GT(missing.intervalCount(), 3000);
+
+	// Small gaps encode in a single varint byte and fit into one datagram
+	BOOST_CHECK_EQUAL(missing.smallestEncoding(), Range::RUNS);
+	BOOST_CHECK_LT(missing.encodedSize(), 10000);
+	BOOST_CHECK_LT(missing.encodedSize(), missing.encodedSize(Range::INTERVALS));
+	BOOST_CHECK_LT(missing.encodedSize(), missing.encodedSize(Range::BITMAP));
+
+	// At higher loss one bit per packet beats a run per lost packet
+	BOOST_CHECK_EQUAL(dense.smallestEncoding(), Range::BITMAP);
+	BOOST_CHECK_LT(dense.encodedSize(), 65000);
+	BOOST_CHECK_LT(dense.encodedSize(), dense.encodedSize(Range::RUNS));
+
+	for( Range::Encoding encoding : {Range::INTERVALS, Range::BITMAP, Range::RUNS} ) {
+		BOOST_CHECK_EQUAL(roundTrip(missing, encoding).toString(), missing.toString());
+		BOOST_CHECK_EQUAL(roundTrip(dense, encoding).toString(), dense.toString());
+	}
+
+	// Few long runs far apart are cheapest as run lengths
+	Range bursts;
+	bursts.add(1000, 3000);
+	bursts.add(1 << 29, (1 << 29) + 500);
+	BOOST_CHECK_EQUAL(bursts.smallestEncoding(), Range::RUNS);
+	for( Range::Encoding encoding : {Range::INTERVALS, Range::RUNS} ) {
+		BOOST_CHECK_EQUAL(roundTrip(bursts, encoding).toString(), bursts.toString());
+	}
+
+	// Empty range
+	Range empty;
+	for( Range::Encoding encoding : {Range::INTERVALS, Range::BITMAP, Range::RUNS} ) {
+		BOOST_CHECK_EQUAL(roundTrip(empty, encoding).elementCount(), 0);
+	}
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( truncatedBuffer )
+{
+	Range range;
+	for( uint64_t i = 0; i < 1000; i += 3 ) {
+		range.add(i);
+	}
+
+	for( Range::Encoding encoding : {Range::INTERVALS, Range::BITMAP, Range::RUNS} ) {
+		auto rangeBuffer = range.asBuffer(encoding);
+		std::vector<uint8_t> data(boost::asio::buffer_size(rangeBuffer));
+		boost::asio::buffer_copy(boost::asio::buffer(data), rangeBuffer);
+
+		// Never reads past the end and fails instead of returning a part
+		for( size_t length = 0; length < data.size(); length += 7 ) {
+			BOOST_CHECK(!Range::fromBuffer(data.data(), length));
+		}
+		BOOST_REQUIRE(Range::fromBuffer(data.data(), data.size()));
+		BOOST_CHECK_EQUAL(Range::fromBuffer(data.data(), data.size())->toString(), range.toString());
+	}
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( malformedIntervalsAreRejected )
+{
+	#pragma pack(push, 1)
+	struct {
+		uint8_t encoding;
+		uint32_t numberIntervals;
+		uint64_t start;
+		uint64_t stop;
+	} intervalData = {Range::INTERVALS, 1, 10, 5};
+	#pragma pack(pop)
+
+	// Reversed and empty intervals
+	BOOST_CHECK(!Range::fromBuffer(reinterpret_cast<uint8_t*>(&intervalData), sizeof(intervalData)));
+	intervalData.stop = intervalData.start;
+	BOOST_CHECK(!Range::fromBuffer(reinterpret_cast<uint8_t*>(&intervalData), sizeof(intervalData)));
+	intervalData.stop = 20;
+	BOOST_CHECK(Range::fromBuffer(reinterpret_cast<uint8_t*>(&intervalData), sizeof(intervalData)));
+
+	// Runs that wrap around 2^64 or are empty
+	std::vector<uint8_t> runData = {Range::RUNS, 2, 0, 0, 0};
+	for( int i = 0; i < 2; ++i ) {
+		for( int byte = 0; byte < 9; ++byte ) {
+			runData.push_back(0xff);
+		}
+		runData.push_back(0x01);
+		runData.push_back(0x01);
+	}
+	BOOST_CHECK(!Range::fromBuffer(runData.data(), runData.size(), UINT64_MAX));
+	std::vector<uint8_t> emptyRunData = {Range::RUNS, 1, 0, 0, 0, 5, 0};
+	BOOST_CHECK(!Range::fromBuffer(emptyRunData.data(), emptyRunData.size()));
+
+	// A bitmap longer than the buffer and an unknown encoding
+	#pragma pack(push, 1)
+	struct {
+		uint8_t encoding;
+		uint64_t base;
+		uint32_t byteCount;
+		uint8_t bits;
+	} bitmapData = {Range::BITMAP, 100, 2, 0xff};
+	#pragma pack(pop)
+	BOOST_CHECK(!Range::fromBuffer(reinterpret_cast<uint8_t*>(&bitmapData), sizeof(bitmapData)));
+	bitmapData.byteCount = 1;
+	BOOST_CHECK_EQUAL(Range::fromBuffer(reinterpret_cast<uint8_t*>(&bitmapData), sizeof(bitmapData))->toString(), Range(100, 108).toString());
+	bitmapData.encoding = 7;
+	BOOST_CHECK(!Range::fromBuffer(reinterpret_cast<uint8_t*>(&bitmapData), sizeof(bitmapData)));
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( firstElement )
+{
+	Range range(70000, 70010);
+	range.add(5);
+	BOOST_CHECK_EQUAL(range.first(), 5);
+	range.subtract(range.first());
+	BOOST_CHECK_EQUAL(range.first(), 70000);
+
+	// Bitmap chunk
+	Range sparse;
+	for( uint64_t i = 3 * Range::CHUNK_SIZE + 9; i < 4 * Range::CHUNK_SIZE; i += 2 ) {
+		sparse.add(i);
+	}
+	BOOST_CHECK_EQUAL(sparse.first(), 3 * Range::CHUNK_SIZE + 9);
+	sparse.subtract(sparse.first());
+	BOOST_CHECK_EQUAL(sparse.first(), 3 * Range::CHUNK_SIZE + 11);
+	BOOST_CHECK_EQUAL(sparse.firstInterval().second, 3 * Range::CHUNK_SIZE + 12);
+
+	// The first interval continues across chunk borders
+	Range prefix(10, 3 * Range::CHUNK_SIZE + 5);
+	prefix.add(3 * Range::CHUNK_SIZE + 7);
+	BOOST_CHECK(prefix.firstInterval() == Range::Interval(10, 3 * Range::CHUNK_SIZE + 5));
+	prefix.subtract(0, Range::CHUNK_SIZE);
+	BOOST_CHECK(prefix.firstInterval() == Range::Interval(1 * Range::CHUNK_SIZE, 3 * Range::CHUNK_SIZE + 5));
+	prefix.subtract(0, 3 * Range::CHUNK_SIZE);
+	BOOST_CHECK(prefix.firstInterval() == Range::Interval(3 * Range::CHUNK_SIZE, 3 * Range::CHUNK_SIZE + 5));
+	prefix.subtract(0, 3 * Range::CHUNK_SIZE + 6);
+	BOOST_CHECK(prefix.firstInterval() == Range::Interval(3 * Range::CHUNK_SIZE + 7, 3 * Range::CHUNK_SIZE + 8));
+	BOOST_CHECK(!prefix.empty());
+	prefix.subtract(prefix.first());
+	BOOST_CHECK(prefix.empty());
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
 
 BOOST_AUTO_TEST_CASE( firstN )
 {
@@ -327,3 +552,177 @@ BOOST_AUTO_TEST_CASE( contains )
 		BOOST_CHECK(!testRange.contains(-1));				
 	}
 }
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( chunkBorders )
+{
+	uint64_t border = Range::CHUNK_SIZE;
+
+	Range testRange(border - 2, border + 2);
+	BOOST_CHECK_EQUAL(testRange.intervalCount(), 1);
+	BOOST_CHECK_EQUAL(testRange.elementCount(), 4);
+	BOOST_CHECK(testRange.contains(border - 1));
+	BOOST_CHECK(testRange.contains(border));
+	BOOST_CHECK(!testRange.contains(border + 2));
+
+	{
+		auto it = testRange.begin();
+		for( uint64_t i = border - 2; i < border + 2; i++, it++)
+		{
+			BOOST_CHECK_EQUAL(*it, i);
+		}
+		BOOST_CHECK(it == testRange.end());
+	}
+
+	testRange.subtract(border);
+	BOOST_CHECK_EQUAL(testRange.intervalCount(), 2);
+	BOOST_CHECK_EQUAL(testRange.toString(), "65534:65536,65537:65538,");
+
+	Range removed = testRange.removeFirstN(3);
+	BOOST_CHECK_EQUAL(removed.toString(), "65534:65536,65537:65538,");
+	BOOST_CHECK_EQUAL(testRange.elementCount(), 0);
+	BOOST_CHECK(testRange.begin() == testRange.end());
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+static void checkEqual(const Range& range, const std::set<uint64_t>& reference)
+{
+	BOOST_REQUIRE_EQUAL(range.elementCount(), reference.size());
+
+	auto it = range.begin();
+	for( uint64_t x : reference ) {
+		BOOST_REQUIRE(it != range.end());
+		BOOST_REQUIRE_EQUAL(*it, x);
+		++it;
+	}
+	BOOST_CHECK(it == range.end());
+
+	size_t elements = 0;
+	for( const Range::Interval& i : range.intervals() ) {
+		elements += i.second - i.first;
+		BOOST_CHECK(reference.count(i.first) && reference.count(i.second - 1));
+		BOOST_CHECK(!reference.count(i.second));
+	}
+	BOOST_CHECK_EQUAL(elements, reference.size());
+}
+
+BOOST_AUTO_TEST_CASE( fragmentedAgainstReference )
+{
+	std::mt19937_64 random(42);
+	const uint64_t packetCount = 3 * Range::CHUNK_SIZE + 100;
+
+	// Heavy random loss fragments the set far beyond MAX_RUNS
+	Range outstanding(0, packetCount);
+	std::set<uint64_t> reference;
+	for( uint64_t i = 0; i < packetCount; ++i ) {
+		reference.insert(i);
+	}
+
+	for( uint64_t i = 0; i < packetCount; ++i ) {
+		if( random() % 3 != 0 ) {
+			outstanding.subtract(i);
+			reference.erase(i);
+		}
+	}
+	checkEqual(outstanding, reference);
+
+	for( int i = 0; i < 2000; ++i ) {
+		uint64_t x = random() % packetCount;
+		BOOST_CHECK_EQUAL(outstanding.contains(x), reference.count(x) == 1);
+	}
+
+	// Union and difference with another fragmented set
+	Range other;
+	std::set<uint64_t> otherReference;
+	for( int i = 0; i < 20000; ++i ) {
+		uint64_t start = random() % packetCount;
+		uint64_t end = start + random() % 8;
+		other.add(start, end);
+		for( uint64_t x = start; x < end; ++x ) {
+			otherReference.insert(x);
+		}
+	}
+	checkEqual(other, otherReference);
+
+	Range united = outstanding;
+	united.add(other);
+	std::set<uint64_t> unitedReference = reference;
+	unitedReference.insert(otherReference.begin(), otherReference.end());
+	checkEqual(united, unitedReference);
+
+	united.subtract(other);
+	std::set<uint64_t> differenceReference;
+	std::set_difference(unitedReference.begin(), unitedReference.end(),
+		otherReference.begin(), otherReference.end(),
+		std::inserter(differenceReference, differenceReference.end()));
+	checkEqual(united, differenceReference);
+
+	// Drain through firstN / removeFirstN
+	while( outstanding.elementCount() > 0 ) {
+		Range first = outstanding.firstN(1000);
+		Range removed = outstanding.removeFirstN(1000);
+		BOOST_CHECK_EQUAL(first.toString(), removed.toString());
+
+		for( uint64_t x : removed ) {
+			BOOST_REQUIRE_EQUAL(x, *reference.begin());
+			reference.erase(reference.begin());
+		}
+		checkEqual(outstanding, reference);
+	}
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( subtractIntervalRandom )
+{
+	std::mt19937_64 random(7);
+	const uint64_t packetCount = 2 * Range::CHUNK_SIZE;
+
+	Range testRange;
+	std::set<uint64_t> reference;
+	for( int i = 0; i < 5000; ++i ) {
+		int64_t start = random() % packetCount;
+		int64_t end = start + random() % 200;
+		if( random() % 2 ) {
+			testRange.add(start, end);
+			for( int64_t x = start; x < end; ++x ) {
+				reference.insert(x);
+			}
+		} else {
+			testRange.subtract(start, end);
+			for( int64_t x = start; x < end; ++x ) {
+				reference.erase(x);
+			}
+		}
+	}
+	checkEqual(testRange, reference);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( idsPastLimitAreRejected )
+{
+	Range range(1000, 1010);
+	range.add(2000);
+
+	for( Range::Encoding encoding : {Range::INTERVALS, Range::BITMAP, Range::RUNS} ) {
+		auto rangeBuffer = range.asBuffer(encoding);
+		std::vector<uint8_t> data(boost::asio::buffer_size(rangeBuffer));
+		boost::asio::buffer_copy(boost::asio::buffer(data), rangeBuffer);
+
+		auto parsedRange = Range::fromBuffer(data.data(), data.size(), 2001);
+		BOOST_REQUIRE(parsedRange);
+		BOOST_CHECK_EQUAL(parsedRange->toString(), range.toString());
+		BOOST_CHECK(!Range::fromBuffer(data.data(), data.size(), 2000));
+	}
+}
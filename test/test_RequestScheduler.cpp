@@ -0,0 +1,191 @@
+//Link to Boost
+#define BOOST_TEST_DYN_LINK
+
+//Define our Module name (prints at testing)
+#define BOOST_TEST_MODULE "RequestScheduler"
+
+//VERY IMPORTANT - include this last
+#include <boost/test/unit_test.hpp>
+
+#include <RequestScheduler.h>
+
+#include <vector>
+
+typedef RequestScheduler::Clock Clock;
+
+static RequestScheduler::Client client(unsigned short port)
+{
+	return RequestScheduler::Client(boost::asio::ip::address_v4::loopback(), port);
+}
+
+// Packets in the order they are sent, at most limit of them
+static std::vector<RequestScheduler::Packet> drain(RequestScheduler& scheduler, Clock::time_point now, size_t limit = SIZE_MAX)
+{
+	std::vector<RequestScheduler::Packet> packets;
+	RequestScheduler::Packet packet;
+	while( packets.size() < limit && scheduler.next(now, packet) ) {
+		packets.push_back(packet);
+	}
+	return packets;
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( smallRequestPassesBulk )
+{
+	RequestScheduler scheduler(16 * 1024);
+	Clock::time_point now = Clock::now();
+
+	scheduler.enqueue(client(1), 0, 1, Range(0, 10000), 8 * 1024, now);
+	scheduler.enqueue(client(2), 0, 2, Range(0, 4), 8 * 1024, now);
+	BOOST_CHECK_EQUAL(scheduler.queuedPackets(), 10004);
+
+	// The queues take turns of two packets each
+	std::vector<RequestScheduler::Packet> packets = drain(scheduler, now, 8);
+	BOOST_REQUIRE_EQUAL(packets.size(), 8);
+	uint64_t expectedUfid[] = {1, 1, 2, 2, 1, 1, 2, 2};
+	for( size_t i = 0; i < packets.size(); ++i ) {
+		BOOST_CHECK_EQUAL(packets[i].ufid, expectedUfid[i]);
+	}
+	BOOST_CHECK_EQUAL(packets[2].packetId, 0);
+	BOOST_CHECK_EQUAL(packets[7].packetId, 3);
+	BOOST_CHECK(!packets[6].last);
+	BOOST_CHECK(packets[7].last);
+	BOOST_CHECK(packets[7].client == client(2));
+
+	// The bulk client gets everything once the other one is done
+	packets = drain(scheduler, now);
+	BOOST_CHECK_EQUAL(packets.size(), 10000 - 4);
+	BOOST_CHECK_EQUAL(packets.back().packetId, 9999);
+	BOOST_CHECK(scheduler.empty());
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( higherPriorityFirst )
+{
+	RequestScheduler scheduler(8 * 1024);
+	Clock::time_point now = Clock::now();
+
+	scheduler.enqueue(client(1), 0, 1, Range(0, 100), 8 * 1024, now);
+	drain(scheduler, now, 10);
+	scheduler.enqueue(client(2), 5, 2, Range(0, 20), 8 * 1024, now);
+
+	std::vector<RequestScheduler::Packet> packets = drain(scheduler, now, 20);
+	for( const RequestScheduler::Packet& packet : packets ) {
+		BOOST_CHECK_EQUAL(packet.ufid, 2);
+	}
+	BOOST_CHECK(packets.back().last);
+
+	packets = drain(scheduler, now);
+	BOOST_REQUIRE_EQUAL(packets.size(), 90);
+	BOOST_CHECK_EQUAL(packets.front().packetId, 10);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( rateCapPerClient )
+{
+	// 512 KB/s, the bucket holds one quantum
+	RequestScheduler scheduler(8 * 1024, 512 * 1024);
+	Clock::time_point now = Clock::now();
+
+	scheduler.enqueue(client(1), 0, 1, Range(0, 1000), 1024, now);
+	BOOST_CHECK_EQUAL(drain(scheduler, now).size(), 8);
+
+	// A capped client does not block another one
+	scheduler.enqueue(client(2), 0, 2, Range(0, 4), 1024, now);
+	BOOST_CHECK_EQUAL(drain(scheduler, now).size(), 4);
+
+	// 100 ms refill 50 KB, of which the bucket keeps 8 KB
+	BOOST_CHECK_EQUAL(drain(scheduler, now + std::chrono::milliseconds(100)).size(), 8);
+	BOOST_CHECK_EQUAL(drain(scheduler, now + std::chrono::milliseconds(101)).size(), 0);
+	BOOST_CHECK_EQUAL(drain(scheduler, now + std::chrono::milliseconds(102)).size(), 1);
+	BOOST_CHECK_EQUAL(scheduler.queuedPackets(), 1000 - 17);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( repeatedRequestIsMerged )
+{
+	RequestScheduler scheduler;
+	Clock::time_point now = Clock::now();
+
+	scheduler.enqueue(client(1), 0, 1, Range(0, 10), 1024, now);
+	scheduler.enqueue(client(1), 0, 1, Range(5, 15), 1024, now);
+	scheduler.enqueue(client(1), 0, 1, Range(0, 15), 1024, now);
+
+	// Another transfer of the same client is not merged
+	scheduler.enqueue(client(1), 0, 2, Range(0, 10), 1024, now);
+	BOOST_CHECK_EQUAL(scheduler.queuedPackets(), 25);
+
+	std::vector<RequestScheduler::Packet> packets = drain(scheduler, now);
+	BOOST_REQUIRE_EQUAL(packets.size(), 25);
+	BOOST_CHECK_EQUAL(packets[9].packetId, 9);
+	BOOST_CHECK(packets[9].last);
+	BOOST_CHECK_EQUAL(packets[14].packetId, 14);
+	BOOST_CHECK_EQUAL(packets[15].ufid, 2);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( coalesceSameContent )
+{
+	RequestScheduler scheduler(8 * 1024);
+	Clock::time_point now = Clock::now();
+
+	// Three transfers of content 7 and one of another content
+	scheduler.enqueue(client(1), 0, 1, Range(0, 4), 1024, now, 7);
+	scheduler.enqueue(client(2), 0, 2, Range(2, 4), 1024, now, 7);
+	scheduler.enqueue(client(3), 0, 3, Range(0, 4), 1024, now, 7);
+	scheduler.enqueue(client(4), 0, 4, Range(0, 4), 1024, now, 8);
+
+	std::vector<RequestScheduler::Packet> packets;
+	RequestScheduler::Packet packet;
+	BOOST_REQUIRE(scheduler.next(now, packet));
+	BOOST_CHECK_EQUAL(packet.content, 7);
+	BOOST_CHECK_EQUAL(packet.packetId, 0);
+
+	// Client 2 does not wait for packet 0
+	scheduler.coalesce(packet, now, 10, packets);
+	BOOST_REQUIRE_EQUAL(packets.size(), 1);
+	BOOST_CHECK(packets[0].client == client(3));
+	BOOST_CHECK_EQUAL(packets[0].ufid, 3);
+	BOOST_CHECK_EQUAL(scheduler.queuedPackets(), 14 - 2);
+
+	// The limit stops it, client 2 gets its own turn later
+	packets.clear();
+	scheduler.enqueue(client(1), 0, 5, Range(2, 3), 1024, now, 7);
+	packet.packetId = 2;
+	scheduler.coalesce(packet, now, 1, packets);
+	BOOST_CHECK_EQUAL(packets.size(), 1);
+
+	// Packets taken by coalescing are not sent again
+	size_t sent = packets.size() + 2;
+	while( scheduler.next(now, packet) ) {
+		sent++;
+	}
+	BOOST_CHECK_EQUAL(sent, 4 + 2 + 4 + 4 + 1);
+	BOOST_CHECK(scheduler.empty());
+
+	// Coalescing the last packet of a request completes it
+	scheduler.enqueue(client(1), 0, 1, Range(0, 1), 1024, now, 7);
+	scheduler.enqueue(client(2), 0, 2, Range(0, 1), 1024, now, 7);
+	BOOST_REQUIRE(scheduler.next(now, packet));
+	packets.clear();
+	scheduler.coalesce(packet, now, 10, packets);
+	BOOST_REQUIRE_EQUAL(packets.size(), 1);
+	BOOST_CHECK(packets[0].last);
+	BOOST_CHECK(scheduler.empty());
+	BOOST_CHECK(!scheduler.next(now, packet));
+}
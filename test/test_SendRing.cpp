@@ -0,0 +1,98 @@
+//Link to Boost
+#define BOOST_TEST_DYN_LINK
+
+//Define our Module name (prints at testing)
+#define BOOST_TEST_MODULE "SendRing"
+
+//VERY IMPORTANT - include this last
+#include <boost/test/unit_test.hpp>
+#include <boost/asio.hpp>
+
+#include <SendRing.h>
+#include <Message.h>
+#include <Config.h>
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( matchesFilePacketMessage )
+{
+	std::vector<uint8_t> testPayload(16);
+	for( size_t i = 0; i < testPayload.size(); ++i ) {
+		testPayload[i] = static_cast<uint8_t>(i * 7);
+	}
+
+	SendRing ring(4);
+
+	for( uint64_t packetId = 0; packetId < 10; ++packetId ) {
+		uint64_t testUfid = 1234567 + packetId / 3;
+		auto message = Message::createFilePacket(testUfid, packetId, &testPayload[0], testPayload.size());
+		auto messageBuffer = message->asBuffer();
+
+		SendRing::Slot* slot = ring.acquire(testUfid, packetId, &testPayload[0], testPayload.size());
+		BOOST_REQUIRE(slot != nullptr);
+		BOOST_CHECK_EQUAL(boost::asio::buffer_size(slot->buffers()), boost::asio::buffer_size(messageBuffer));
+
+		std::vector<uint8_t> expected(boost::asio::buffer_size(messageBuffer));
+		std::vector<uint8_t> stamped(boost::asio::buffer_size(slot->buffers()));
+		boost::asio::buffer_copy(boost::asio::buffer(expected), messageBuffer);
+		boost::asio::buffer_copy(boost::asio::buffer(stamped), slot->buffers());
+		BOOST_CHECK(expected == stamped);
+
+		// Parse
+		auto parsedMessage = Message::fromBuffer(&stamped[0], stamped.size());
+		BOOST_CHECK_EQUAL(parsedMessage->type(), Message::FILE_PACKET);
+		BOOST_CHECK_EQUAL(parsedMessage->ufid(), testUfid);
+		BOOST_CHECK_EQUAL(parsedMessage->packetId(), packetId);
+		BOOST_CHECK_EQUAL(parsedMessage->payloadSize(), testPayload.size());
+
+		ring.release(slot);
+	}
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( recycling )
+{
+	uint8_t payload[8] = {0};
+	SendRing ring(3);
+
+	auto a = ring.acquire(1, 0, payload, sizeof(payload));
+	auto b = ring.acquire(1, 1, payload, sizeof(payload));
+	auto c = ring.acquire(1, 2, payload, sizeof(payload));
+	BOOST_CHECK(a && b && c);
+	BOOST_CHECK_EQUAL(ring.inFlight(), 3);
+
+	// Ring is exhausted until a send completes
+	BOOST_CHECK(ring.acquire(1, 3, payload, sizeof(payload)) == nullptr);
+
+	// Out of order completion frees the middle slot
+	ring.release(b);
+	auto d = ring.acquire(1, 3, payload, sizeof(payload));
+	BOOST_CHECK(d == b);
+	BOOST_CHECK_EQUAL(d->packetId(), 3);
+
+	ring.release(a);
+	ring.release(c);
+	ring.release(d);
+	BOOST_CHECK_EQUAL(ring.inFlight(), 0);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( payloadOwner )
+{
+	std::shared_ptr<std::vector<uint8_t> > payload(new std::vector<uint8_t>(32));
+	SendRing ring(2);
+
+	auto slot = ring.acquire(1, 0, payload->data(), payload->size(), payload);
+	BOOST_CHECK_EQUAL(payload.use_count(), 2);
+
+	ring.release(slot);
+	BOOST_CHECK_EQUAL(payload.use_count(), 1);
+}
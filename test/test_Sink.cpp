@@ -0,0 +1,211 @@
+//Link to Boost
+#define BOOST_TEST_DYN_LINK
+
+//Define our Module name (prints at testing)
+#define BOOST_TEST_MODULE "Sink"
+
+//VERY IMPORTANT - include this last
+#include <boost/test/unit_test.hpp>
+
+#include <Sink.h>
+
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+/////////////////////////////////////
+// Output file next to the test binary, removed at the end of the test
+/////////////////////////////////////
+
+struct TempFile {
+	TempFile() : path("test_sink_output.bin")
+	{
+		std::remove(path.c_str());
+	}
+
+	~TempFile()
+	{
+		std::remove(path.c_str());
+	}
+
+	std::vector<uint8_t> read() const
+	{
+		std::ifstream input(path, std::ios::binary);
+		return std::vector<uint8_t>((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+	}
+
+	std::string path;
+};
+
+static std::vector<uint8_t> pattern(uint64_t size)
+{
+	std::vector<uint8_t> data(size);
+	for( uint64_t i = 0; i < size; ++i ) {
+		data[i] = static_cast<uint8_t>(i * 7 + i / 251);
+	}
+	return data;
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( directOutOfOrder )
+{
+	TempFile file;
+
+	// Packets do not divide the extents and the last one is short
+	const uint64_t fileSize = 3 * DIRECT_EXTENT_SIZE + 12345;
+	const uint64_t packetSize = 1000;
+	std::vector<uint8_t> data = pattern(fileSize);
+
+	DirectFileSink sink(file.path);
+	BOOST_REQUIRE(sink.open(fileSize));
+	uint64_t packetCount = (fileSize + packetSize - 1) / packetSize;
+	for( uint64_t packetId = packetCount; packetId-- > 0; ) {
+		uint64_t offset = packetId * packetSize;
+		sink.write(offset, data.data() + offset, std::min(packetSize, fileSize - offset));
+	}
+
+	// Complete extents were written as soon as they were
+	BOOST_CHECK_EQUAL(sink.dirtyBytes(), 0);
+	sink.close();
+	BOOST_CHECK(file.read() == data);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( directDirtyLimit )
+{
+	TempFile file;
+	const uint64_t fileSize = 8 * DIRECT_EXTENT_SIZE;
+	const uint64_t packetSize = 4096;
+	std::vector<uint8_t> data = pattern(fileSize);
+
+	// Every extent gets every other packet first, the limit forces partly
+	// filled extents out and the second half is merged with them
+	DirectFileSink sink(file.path, 2 * DIRECT_EXTENT_SIZE);
+	BOOST_REQUIRE(sink.open(fileSize));
+	for( uint64_t start : {0, 1} ) {
+		for( uint64_t offset = start * packetSize; offset < fileSize; offset += 2 * packetSize ) {
+			sink.write(offset, data.data() + offset, packetSize);
+			BOOST_REQUIRE_LE(sink.dirtyBytes(), 2 * DIRECT_EXTENT_SIZE);
+		}
+	}
+	sink.close();
+	BOOST_CHECK(file.read() == data);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( directFlushKeepsFile )
+{
+	TempFile file;
+	const uint64_t fileSize = 2 * DIRECT_EXTENT_SIZE;
+	std::vector<uint8_t> data = pattern(fileSize);
+	{
+		// An interrupted transfer flushed for its checkpoint
+		DirectFileSink sink(file.path);
+		BOOST_REQUIRE(sink.open(fileSize));
+		sink.write(0, data.data(), 1000);
+		sink.write(DIRECT_EXTENT_SIZE + 5000, data.data() + DIRECT_EXTENT_SIZE + 5000, 1000);
+		sink.flush();
+		BOOST_CHECK_EQUAL(sink.dirtyBytes(), 0);
+	}
+
+	// The next run writes the rest into the same file
+	DirectFileSink sink(file.path);
+	BOOST_REQUIRE(sink.open(fileSize));
+	sink.write(1000, data.data() + 1000, DIRECT_EXTENT_SIZE + 4000);
+	sink.write(DIRECT_EXTENT_SIZE + 6000, data.data() + DIRECT_EXTENT_SIZE + 6000, DIRECT_EXTENT_SIZE - 6000);
+	sink.close();
+	BOOST_CHECK(file.read() == data);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+static std::vector<uint8_t> readAvailable(int fd)
+{
+	std::vector<uint8_t> data(1024 * 1024);
+	ssize_t size = read(fd, data.data(), data.size());
+	data.resize(size > 0 ? size : 0);
+	return data;
+}
+
+BOOST_AUTO_TEST_CASE( streamInOrderWithBackpressure )
+{
+	int pipeFds[2];
+	BOOST_REQUIRE_EQUAL(pipe2(pipeFds, O_NONBLOCK), 0);
+
+	const uint64_t window = 256 * 1024;
+	const uint64_t fileSize = 4 * window;
+	std::vector<uint8_t> data = pattern(fileSize);
+
+	boost::asio::io_service io_service;
+	int windowMoves = 0;
+	StreamSink sink(io_service, pipeFds[1], window);
+	sink.setWindowListener([&]() { windowMoves++; });
+	BOOST_REQUIRE(sink.open(fileSize));
+
+	// A gap holds back everything after it
+	sink.write(1000, data.data() + 1000, 2000);
+	BOOST_CHECK_EQUAL(sink.emittedBytes(), 0);
+	sink.write(0, data.data(), 1000);
+	BOOST_CHECK_EQUAL(sink.emittedBytes(), 3000);
+
+	// The consumer does not read, the pipe fills and the window stops
+	std::vector<uint8_t> received = readAvailable(pipeFds[0]);
+	BOOST_CHECK_EQUAL(received.size(), 3000);
+	uint64_t offset = 3000;
+	while( offset < sink.windowEnd() ) {
+		uint64_t size = std::min<uint64_t>(1000, sink.windowEnd() - offset);
+		sink.write(offset, data.data() + offset, size);
+		offset += size;
+	}
+	BOOST_CHECK_LT(sink.emittedBytes(), offset);
+	BOOST_CHECK_EQUAL(sink.windowEnd(), sink.emittedBytes() + window);
+
+	// Reading moves the window
+	while( received.size() < offset ) {
+		std::vector<uint8_t> part = readAvailable(pipeFds[0]);
+		received.insert(received.end(), part.begin(), part.end());
+		io_service.poll();
+		io_service.reset();
+	}
+	BOOST_CHECK_GT(windowMoves, 0);
+
+	// The rest is written by close
+	std::thread reader([&]() {
+		int flags = fcntl(pipeFds[0], F_GETFL);
+		fcntl(pipeFds[0], F_SETFL, flags & ~O_NONBLOCK);
+		std::vector<uint8_t> part;
+		while( !(part = readAvailable(pipeFds[0])).empty() ) {
+			received.insert(received.end(), part.begin(), part.end());
+		}
+	});
+	while( offset < fileSize ) {
+		uint64_t size = std::min<uint64_t>(1000, std::min(fileSize, sink.windowEnd()) - offset);
+		if( size == 0 ) {
+			io_service.run_one();
+			continue;
+		}
+		sink.write(offset, data.data() + offset, size);
+		offset += size;
+	}
+	sink.close();
+	close(pipeFds[1]);
+	reader.join();
+	close(pipeFds[0]);
+
+	BOOST_CHECK(received == data);
+}
@@ -0,0 +1,158 @@
+//Link to Boost
+#define BOOST_TEST_DYN_LINK
+
+//Define our Module name (prints at testing)
+#define BOOST_TEST_MODULE "TimingWheel"
+
+//VERY IMPORTANT - include this last
+#include <boost/test/unit_test.hpp>
+
+#include <TimingWheel.h>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <boost/asio.hpp>
+
+typedef TimingWheel::Clock Clock;
+
+static int64_t elapsedUs(Clock::time_point start)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( firesInOrderAndNeverEarly )
+{
+	boost::asio::io_service io_service;
+	TimingWheel wheel(io_service);
+	Clock::time_point start = Clock::now();
+
+	// Level 0, level 1 and level 2 of a 1 ms wheel
+	std::vector<int> delaysMs = {150, 5, 70, 20};
+	std::vector<int> fired;
+	std::vector<int64_t> firedUs;
+	std::vector<std::unique_ptr<TimingWheel::Timer> > timers;
+	for( int delayMs : delaysMs ) {
+		timers.emplace_back(new TimingWheel::Timer(wheel));
+		timers.back()->expiresAt(start + std::chrono::milliseconds(delayMs), [&, delayMs]() {
+			fired.push_back(delayMs);
+			firedUs.push_back(elapsedUs(start));
+		});
+	}
+	BOOST_CHECK_EQUAL(wheel.armed(), 4);
+	io_service.run();
+
+	BOOST_REQUIRE_EQUAL(fired.size(), 4);
+	BOOST_CHECK_EQUAL(fired[0], 5);
+	BOOST_CHECK_EQUAL(fired[1], 20);
+	BOOST_CHECK_EQUAL(fired[2], 70);
+	BOOST_CHECK_EQUAL(fired[3], 150);
+	for( size_t i = 0; i < fired.size(); ++i ) {
+		BOOST_CHECK_GE(firedUs[i], fired[i] * 1000);
+	}
+	BOOST_CHECK_EQUAL(wheel.armed(), 0);
+	BOOST_CHECK_EQUAL(wheel.expired(), 4);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( cancelAndRearm )
+{
+	boost::asio::io_service io_service;
+	TimingWheel wheel(io_service);
+
+	int cancelled = 0;
+	int rearmed = 0;
+	int periodic = 0;
+	TimingWheel::Timer a(wheel);
+	TimingWheel::Timer b(wheel);
+	TimingWheel::Timer c(wheel);
+	a.expiresAfter(std::chrono::milliseconds(5), [&]() { cancelled++; });
+	a.cancel();
+	BOOST_CHECK(!a.armed());
+
+	// The second deadline replaces the first
+	b.expiresAfter(std::chrono::milliseconds(2), [&]() { rearmed += 100; });
+	b.expiresAfter(std::chrono::milliseconds(10), [&]() { rearmed++; });
+
+	// A handler arms its own timer again
+	std::function<void()> tick = [&]() {
+		if( ++periodic < 5 ) {
+			c.expiresAfter(std::chrono::milliseconds(3), tick);
+		}
+	};
+	c.expiresAfter(std::chrono::milliseconds(3), tick);
+
+	{
+		// Destroying an armed timer cancels it
+		TimingWheel::Timer d(wheel);
+		d.expiresAfter(std::chrono::milliseconds(1), [&]() { cancelled++; });
+	}
+	io_service.run();
+
+	BOOST_CHECK_EQUAL(cancelled, 0);
+	BOOST_CHECK_EQUAL(rearmed, 1);
+	BOOST_CHECK_EQUAL(periodic, 5);
+	BOOST_CHECK_EQUAL(wheel.armed(), 0);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( cascadesThroughEveryLevel )
+{
+	boost::asio::io_service io_service;
+
+	// With 10 us ticks 200 ms are on the top level
+	TimingWheel wheel(io_service, std::chrono::microseconds(10));
+	Clock::time_point start = Clock::now();
+
+	std::vector<int64_t> delaysUs = {200000, 30, 700, 45000};
+	std::vector<int64_t> fired;
+	std::vector<std::unique_ptr<TimingWheel::Timer> > timers;
+	for( int64_t delayUs : delaysUs ) {
+		timers.emplace_back(new TimingWheel::Timer(wheel));
+		timers.back()->expiresAt(start + std::chrono::microseconds(delayUs), [&, delayUs]() {
+			BOOST_CHECK_GE(elapsedUs(start), delayUs);
+			fired.push_back(delayUs);
+		});
+	}
+	io_service.run();
+
+	BOOST_REQUIRE_EQUAL(fired.size(), 4);
+	BOOST_CHECK_EQUAL(fired[0], 30);
+	BOOST_CHECK_EQUAL(fired[1], 700);
+	BOOST_CHECK_EQUAL(fired[2], 45000);
+	BOOST_CHECK_EQUAL(fired[3], 200000);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( expiresInBatches )
+{
+	boost::asio::io_service io_service;
+	TimingWheel wheel(io_service);
+
+	// Timers of the same tick share one wakeup
+	Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(20);
+	int fired = 0;
+	std::vector<std::unique_ptr<TimingWheel::Timer> > timers;
+	for( int i = 0; i < 1000; ++i ) {
+		timers.emplace_back(new TimingWheel::Timer(wheel));
+		timers.back()->expiresAt(deadline, [&]() { fired++; });
+	}
+	io_service.run();
+
+	BOOST_CHECK_EQUAL(fired, 1000);
+	BOOST_CHECK_EQUAL(wheel.expired(), 1000);
+	BOOST_CHECK_LE(wheel.wakeups(), 2);
+}
@@ -0,0 +1,102 @@
+//Link to Boost
+#define BOOST_TEST_DYN_LINK
+
+//Define our Module name (prints at testing)
+#define BOOST_TEST_MODULE "Trace"
+
+//VERY IMPORTANT - include this last
+#include <boost/test/unit_test.hpp>
+
+#include <Trace.h>
+#include <Config.h>
+
+#include <sstream>
+#include <thread>
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( recordAndSnapshot )
+{
+	Trace::clear();
+	Trace::record(Trace::REQUEST_SENT, 7, 32);
+	Trace::record(Trace::PACKET_RECEIVED, 7, 3);
+	Trace::record(Trace::TIMEOUT, 7, 29);
+
+	auto threads = Trace::snapshot();
+	BOOST_REQUIRE_EQUAL(threads.size(), 1);
+	BOOST_REQUIRE_EQUAL(threads[0].size(), 3);
+	BOOST_CHECK_EQUAL(threads[0][0].type, Trace::REQUEST_SENT);
+	BOOST_CHECK_EQUAL(threads[0][1].value, 3);
+	BOOST_CHECK_EQUAL(threads[0][2].ufid, 7);
+	BOOST_CHECK(threads[0][0].timestamp <= threads[0][2].timestamp);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( ringKeepsNewest )
+{
+	Trace::clear();
+	for( uint64_t i = 0; i < TRACE_BUFFER_EVENTS + 10; ++i ) {
+		Trace::record(Trace::PACKET_SENT, 1, i);
+	}
+
+	auto threads = Trace::snapshot();
+	BOOST_REQUIRE_EQUAL(threads[0].size(), TRACE_BUFFER_EVENTS);
+	BOOST_CHECK_EQUAL(threads[0].front().value, 10);
+	BOOST_CHECK_EQUAL(threads[0].back().value, TRACE_BUFFER_EVENTS + 9);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( perThreadBuffers )
+{
+	Trace::clear();
+	std::vector<std::thread> workers;
+	for( uint64_t t = 0; t < 4; ++t ) {
+		workers.push_back(std::thread([t]() {
+			for( uint64_t i = 0; i < 1000; ++i ) {
+				Trace::record(Trace::PACKET_RECEIVED, t, i);
+			}
+		}));
+	}
+	for( std::thread& worker : workers ) {
+		worker.join();
+	}
+
+	// Buffers of exited threads are kept
+	auto threads = Trace::snapshot();
+	BOOST_REQUIRE_EQUAL(threads.size(), 5);
+	uint64_t total = 0;
+	for( const auto& events : threads ) {
+		total += events.size();
+		for( size_t i = 0; i < events.size(); ++i ) {
+			BOOST_CHECK_EQUAL(events[i].value, i);
+			BOOST_CHECK_EQUAL(events[i].ufid, events[0].ufid);
+		}
+	}
+	BOOST_CHECK_EQUAL(total, 4000);
+}
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( chromeJson )
+{
+	Trace::clear();
+	Trace::record(Trace::RETRANSMIT, 12345, 17);
+
+	std::stringstream json;
+	Trace::writeChromeJson(json);
+	std::string text = json.str();
+	BOOST_CHECK_EQUAL(text.find("{\"traceEvents\":["), 0);
+	BOOST_CHECK(text.find("\"name\":\"retransmit\"") != std::string::npos);
+	BOOST_CHECK(text.find("\"args\":{\"ufid\":12345,\"value\":17}") != std::string::npos);
+	BOOST_CHECK(text.find("\"ph\":\"M\"") != std::string::npos);
+}
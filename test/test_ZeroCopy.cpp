@@ -0,0 +1,72 @@
+//Link to Boost
+#define BOOST_TEST_DYN_LINK
+
+//Define our Module name (prints at testing)
+#define BOOST_TEST_MODULE "ZeroCopy"
+
+//VERY IMPORTANT - include this last
+#include <boost/test/unit_test.hpp>
+#include <boost/asio.hpp>
+
+#include <ZeroCopy.h>
+#include <Message.h>
+#include <Config.h>
+
+#include <memory>
+#include <vector>
+
+using boost::asio::ip::udp;
+
+/////////////////////////////////////
+/////////////////////////////////////
+/////////////////////////////////////
+
+BOOST_AUTO_TEST_CASE( slotsWaitForCompletion )
+{
+	boost::asio::io_service io_service;
+	udp::socket receiver(io_service, udp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+	receiver.set_option(boost::asio::socket_base::receive_buffer_size(4 * 1024 * 1024));
+	udp::socket sender(io_service, udp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+	if( !ZeroCopySender::enable(sender) ) {
+		BOOST_TEST_MESSAGE("MSG_ZEROCOPY is not supported");
+		return;
+	}
+
+	// The payload owner has to outlive every send
+	std::shared_ptr<std::vector<uint8_t> > payload(new std::vector<uint8_t>(8 * 1024));
+	for( size_t i = 0; i < payload->size(); ++i ) {
+		(*payload)[i] = static_cast<uint8_t>(i * 7);
+	}
+	std::weak_ptr<std::vector<uint8_t> > watch(payload);
+
+	SendRing ring(8);
+	ZeroCopySender zeroCopy(sender, ring);
+	for( uint64_t packetId = 0; packetId < 8; ++packetId ) {
+		// The last one is too small and copied
+		size_t size = packetId == 7 ? 100 : payload->size();
+		SendRing::Slot* slot = ring.acquire(42, packetId, payload->data(), size, payload);
+		BOOST_REQUIRE(slot);
+		zeroCopy.send(slot, receiver.local_endpoint());
+	}
+	payload.reset();
+	BOOST_CHECK_EQUAL(zeroCopy.zeroCopySends(), 7);
+	BOOST_CHECK(!watch.expired());
+
+	while( ring.inFlight() > 0 ) {
+		io_service.run_one();
+	}
+	BOOST_CHECK(watch.expired());
+	BOOST_CHECK_EQUAL(zeroCopy.pending(), 0);
+
+	std::vector<uint8_t> buffer(MAX_MESSAGE_SIZE);
+	for( uint64_t packetId = 0; packetId < 8; ++packetId ) {
+		size_t size = receiver.receive(boost::asio::buffer(buffer));
+		auto message = Message::fromBuffer(buffer.data(), size);
+		BOOST_CHECK_EQUAL(message->ufid(), 42);
+		BOOST_CHECK_EQUAL(message->packetId(), packetId);
+		BOOST_REQUIRE_EQUAL(message->payloadSize(), packetId == 7 ? 100 : 8 * 1024);
+		for( size_t i = 0; i < message->payloadSize(); ++i ) {
+			BOOST_REQUIRE_EQUAL(message->payloadData()[i], static_cast<uint8_t>(i * 7));
+		}
+	}
+}